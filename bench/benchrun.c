@@ -0,0 +1,335 @@
+/*
+    benchrun.c - time a command over a tree, for benchmarks
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Usage: benchrun [-c] [-s] [-n runs] [-e entries] [-t title] command ...
+           benchrun -H
+           benchrun -p
+
+    Runs the command, output thrown away, the given number of times (5)
+    and prints one line: the median wall clock time, entries per second
+    for the given number of entries, system calls per entry and the peak
+    resident set size of any run.
+
+    -c	drop the file system caches before each run, for cold cache times
+    -s	count system calls, in one more run under ptrace (Linux only)
+    -H	print the column headings
+    -p	exit 0 if the caches can be dropped, which takes root
+
+    A run that fails stops everything, exit status EX_SOFTWARE, so a
+    broken build isn't timed as a fast one.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sysexits.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+
+#define		PROGRAM_STRING		"benchrun"
+#define		OPT_STRING			"+csn:e:t:Hp"
+#define		MAX_RUNS			100
+
+static double   TimeRun (char **command, long *maxRSS);
+static long     CountSyscalls (char **command);
+static int      DropCaches (void);
+static pid_t    Spawn (char **command, int traced);
+static void     CheckStatus (int status, char **command);
+static double   Now (void);
+static int      CompareDoubles (const void *a, const void *b);
+static void     PrintHeadings (void);
+static void     PrintHelp (void);
+
+int main (int argc, char **argv)
+{
+	int		optch;
+	int		cold = 0, syscalls = 0;
+	int		runs = 5;
+	double	entries = 0;
+	char	*title = NULL;
+	double	times[MAX_RUNS];
+	double	median;
+	long	peakRSS = 0, maxRSS;
+	long	calls = -1;
+	int		i;
+
+	while ((optch = getopt(argc, argv, OPT_STRING)) != -1)
+	{
+		switch (optch)
+		{
+			case 'c':	cold = 1;					break;
+			case 's':	syscalls = 1;				break;
+			case 'n':	runs = atoi(optarg);		break;
+			case 'e':	entries = atof(optarg);		break;
+			case 't':	title = optarg;				break;
+			case 'H':
+				PrintHeadings();
+				return EX_OK;
+			case 'p':
+				return DropCaches() ? EX_NOPERM : EX_OK;
+			default:
+				PrintHelp();
+				return EX_USAGE;
+		}
+	}
+	if (optind >= argc || runs < 1 || runs > MAX_RUNS)
+	{
+		PrintHelp();
+		return EX_USAGE;
+	}
+	argv += optind;
+
+	for (i = 0; i < runs; i++)
+	{
+		if (cold && DropCaches())
+		{
+			fprintf(stderr, "%s: can't drop the caches: %s\n", PROGRAM_STRING, strerror(errno));
+			return EX_NOPERM;
+		}
+		times[i] = TimeRun(argv, &maxRSS);
+		if (maxRSS > peakRSS)
+			peakRSS = maxRSS;
+	}
+	qsort(times, runs, sizeof(double), CompareDoubles);
+	median = (runs & 1) ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+
+	if (syscalls)
+		calls = CountSyscalls(argv);
+
+	printf("%-32.32s %-5s %4d %10.4f ", title ? title : argv[0], cold ? "cold" : "warm", runs, median);
+	if (entries > 0 && median > 0)
+		printf("%12.0f ", entries / median);
+	else
+		printf("%12s ", "-");
+	if (entries > 0 && calls >= 0)
+		printf("%10.2f ", calls / entries);
+	else
+		printf("%10s ", "-");
+	printf("%10ld\n", peakRSS);
+	return EX_OK;
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// One run; seconds taken, and its peak
+// resident set size in kilobytes
+/////////////////////////////////////*/
+static double TimeRun (char **command, long *maxRSS)
+{
+	struct rusage	usage;
+	double			start;
+	pid_t			pid;
+	int				status;
+
+	start = Now();
+	pid = Spawn(command, 0);
+	if (wait4(pid, &status, 0, &usage) == -1)
+	{
+		perror(PROGRAM_STRING ": wait4");
+		exit(EX_OSERR);
+	}
+	start = Now() - start;
+	CheckStatus(status, command);
+
+#ifdef __APPLE__
+	*maxRSS = usage.ru_maxrss / 1024;		/* bytes here */
+#else
+	*maxRSS = usage.ru_maxrss;
+#endif
+	return start;
+}
+
+/*//////////////////////////////////////
+// System calls made by the command and
+// every thread and child of it, or -1
+// where they can't be counted
+/////////////////////////////////////*/
+static long CountSyscalls (char **command)
+{
+#ifdef __linux__
+	long	stops = 0;
+	long	entries = 0;
+	pid_t	pid, w;
+	int		status, sig, mainStatus = 0;
+
+	pid = Spawn(command, 1);
+	if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status))
+		return -1;
+	if (ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE |
+			   PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL) == -1)
+	{
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		return -1;
+	}
+	ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+	while ((w = waitpid(-1, &status, __WALL)) != -1)
+	{
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+		{
+			if (w == pid)
+				mainStatus = status;
+			continue;
+		}
+		if (!WIFSTOPPED(status))
+			continue;
+
+		sig = WSTOPSIG(status);
+		if (sig == (SIGTRAP | 0x80))
+		{
+			/* each call stops on the way in and out; where the
+			   kernel can say which, count the ins, else halve */
+#ifdef PTRACE_GET_SYSCALL_INFO
+			struct __ptrace_syscall_info	info;
+
+			if (ptrace(PTRACE_GET_SYSCALL_INFO, w, sizeof(info), &info) > 0)
+			{
+				if (info.op == PTRACE_SYSCALL_INFO_ENTRY)
+					entries++;
+			}
+			else
+#endif
+				stops++;
+			sig = 0;
+		}
+		else if (sig == SIGTRAP || sig == SIGSTOP)
+			sig = 0;				/* clone and fork events, new threads' first stop */
+		ptrace(PTRACE_SYSCALL, w, 0, sig);
+	}
+	CheckStatus(mainStatus, command);
+	return entries + (stops + 1) / 2;
+#else
+	(void)command;
+	return -1;
+#endif
+}
+
+static int DropCaches (void)
+{
+#if defined(__linux__)
+	int		fd;
+
+	sync();
+	if ((fd = open("/proc/sys/vm/drop_caches", O_WRONLY)) == -1)
+		return -1;
+	if (write(fd, "3\n", 2) != 2)
+	{
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+#elif defined(__APPLE__)
+	if (geteuid() != 0)
+	{
+		errno = EPERM;
+		return -1;
+	}
+	return system("/usr/sbin/purge") ? -1 : 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+#pragma mark -
+
+/* output goes to /dev/null, errors still to stderr */
+static pid_t Spawn (char **command, int traced)
+{
+	pid_t	pid;
+	int		fd;
+
+	fflush(NULL);
+	if ((pid = fork()) == -1)
+	{
+		perror(PROGRAM_STRING ": fork");
+		exit(EX_OSERR);
+	}
+	if (pid)
+		return pid;
+
+	if ((fd = open("/dev/null", O_WRONLY)) != -1)
+	{
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+#ifdef __linux__
+	if (traced && ptrace(PTRACE_TRACEME, 0, 0, 0) == -1)
+		_exit(127);
+#else
+	(void)traced;
+#endif
+	execvp(command[0], command);
+	fprintf(stderr, "%s: %s: %s\n", PROGRAM_STRING, command[0], strerror(errno));
+	_exit(127);
+}
+
+static void CheckStatus (int status, char **command)
+{
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		return;
+	if (WIFSIGNALED(status))
+		fprintf(stderr, "%s: %s: killed by signal %d\n", PROGRAM_STRING, command[0], WTERMSIG(status));
+	else
+		fprintf(stderr, "%s: %s: exit status %d\n", PROGRAM_STRING, command[0], WEXITSTATUS(status));
+	exit(EX_SOFTWARE);
+}
+
+static double Now (void)
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int CompareDoubles (const void *a, const void *b)
+{
+	double	x = *(const double *)a;
+	double	y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void PrintHeadings (void)
+{
+	printf("%-32s %-5s %4s %10s %12s %10s %10s\n",
+		   "benchmark", "cache", "runs", "median s", "entries/s", "calls/ent", "peak KB");
+}
+
+static void PrintHelp (void)
+{
+	fprintf(stderr, "usage: %s [-cs] [-n runs] [-e entries] [-t title] command ...\n"
+					"       %s -H | -p\n", PROGRAM_STRING, PROGRAM_STRING);
+}
@@ -0,0 +1,444 @@
+/*
+    mktree.c - make a synthetic tree of files with Mac meta-data, for benchmarks
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Usage: mktree [options] directory
+
+    -f n	folders in each folder (8)
+    -d n	levels of folders below the top one (3)
+    -n n	files in each folder (20)
+    -z n	mean data fork size in bytes (4096)
+    -i pct	files and folders with a FinderInfo record (50)
+    -r pct	files with a resource fork (10)
+    -c pct	files and folders with a Finder comment (5)
+    -l pct	entries that are symbolic links (5)
+    -a pct	entries that are alias files (2)
+    -s n	random seed (1)
+    -p		print the parameters line .mktree would get, and make nothing
+
+    The directory must not exist yet.  The same options and seed always
+    make the same tree.  Meta-data goes where the tools look for it: in
+    the com.apple.* extended attributes, which off the Mac live in the
+    user namespace.  Alias files are made the way the Finder makes them,
+    an empty data fork, the kIsAlias flag and an 'alis' resource.
+    Resource forks are kept under 3K, since ext4 holds all of a file's
+    extended attributes in one 4K block.
+
+    When the tree is done, its parameters and entry counts go in the file
+    .mktree at the top, which bench(1) reads to decide whether a tree can
+    be reused; the counts include that file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sysexits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#define		PROGRAM_STRING		"mktree"
+#define		OPT_STRING			"f:d:n:z:i:r:c:l:a:s:p"
+#define		STAMP_NAME			".mktree"
+
+#ifdef __APPLE__
+#define		XATTR_PREFIX		""
+#else
+#define		XATTR_PREFIX		"user."
+#endif
+
+#define		FINDERINFO_XATTR	XATTR_PREFIX "com.apple.FinderInfo"
+#define		RESOURCEFORK_XATTR	XATTR_PREFIX "com.apple.ResourceFork"
+#define		COMMENT_XATTR		XATTR_PREFIX "com.apple.metadata:kMDItemFinderComment"
+
+/* Finder flags */
+#define		kIsAlias			0x8000
+#define		kIsInvisible		0x4000
+#define		kHasCustomIcon		0x0400
+#define		kColor				0x000E
+
+typedef struct CodePair
+{
+	char	type[5];
+	char	creator[5];
+} CodePair;
+
+static const CodePair gCodes[] =
+{
+	{ "TEXT", "ttxt" }, { "TEXT", "R*ch" }, { "PDF ", "prvw" }, { "JPEG", "8BIM" },
+	{ "PNGf", "prvw" }, { "MooV", "TVOD" }, { "APPL", "????" }, { "W8BN", "MSWD" },
+	{ "XLS8", "XCEL" }, { "SIT!", "SITx" }, { "clpt", "MACS" }, { "AIFF", "hook" }
+};
+
+static void   MakeFolder (const char *path, int level);
+static void   MakeFile (const char *path, int index);
+static void   MakeAlias (const char *path);
+static void   MakeLink (const char *path, int index);
+static void   SetFinderInfo (const char *path, int isFolder);
+static void   SetComment (const char *path);
+static void   SetResourceFork (const char *path, const char *type, size_t dataLen);
+static void   SetXattr (const char *path, const char *name, const void *value, size_t len);
+static void   WriteStamp (const char *top);
+static void   PrintParameters (FILE *f);
+static int    Chance (int pct);
+static uint32_t Random (void);
+static void   PutBig (unsigned char *p, uint32_t value, int bytes);
+static void   Fail (const char *what, const char *path);
+static void   PrintHelp (void);
+
+static int			gFanout = 8;
+static int			gDepth = 3;
+static int			gFiles = 20;
+static long			gMeanSize = 4096;
+static int			gInfoPct = 50;
+static int			gRsrcPct = 10;
+static int			gCommentPct = 5;
+static int			gLinkPct = 5;
+static int			gAliasPct = 2;
+static unsigned long	gSeed = 1;
+
+static uint64_t		gState;
+static uint64_t		gEntries;
+static uint64_t		gFileCount;
+static char			gZeros[65536];
+
+int main (int argc, char **argv)
+{
+	int		optch;
+	int		parametersOnly = 0;
+
+	while ((optch = getopt(argc, argv, OPT_STRING)) != -1)
+	{
+		switch (optch)
+		{
+			case 'f':	gFanout = atoi(optarg);			break;
+			case 'd':	gDepth = atoi(optarg);			break;
+			case 'n':	gFiles = atoi(optarg);			break;
+			case 'z':	gMeanSize = atol(optarg);		break;
+			case 'i':	gInfoPct = atoi(optarg);		break;
+			case 'r':	gRsrcPct = atoi(optarg);		break;
+			case 'c':	gCommentPct = atoi(optarg);		break;
+			case 'l':	gLinkPct = atoi(optarg);		break;
+			case 'a':	gAliasPct = atoi(optarg);		break;
+			case 's':	gSeed = strtoul(optarg, NULL, 10);	break;
+			case 'p':	parametersOnly = 1;				break;
+			default:
+				PrintHelp();
+				return EX_USAGE;
+		}
+	}
+	if (parametersOnly)
+	{
+		PrintParameters(stdout);
+		return EX_OK;
+	}
+	if (optind != argc - 1 || gFanout < 0 || gDepth < 0 || gFiles < 0 || gMeanSize < 0)
+	{
+		PrintHelp();
+		return EX_USAGE;
+	}
+
+	gState = gSeed * 0x9E3779B97F4A7C15ull + 1;
+
+	if (mkdir(argv[optind], 0755) == -1)
+		Fail("mkdir", argv[optind]);
+	MakeFolder(argv[optind], 0);
+	WriteStamp(argv[optind]);
+
+	printf("%llu entries, %llu files\n", (unsigned long long)gEntries, (unsigned long long)gFileCount);
+	return EX_OK;
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Fill the folder at path, which exists,
+// and make its sub-folders
+/////////////////////////////////////*/
+static void MakeFolder (const char *path, int level)
+{
+	char	child[4096];
+	int		i;
+
+	for (i = 0; i < gFiles; i++)
+	{
+		if (Chance(gLinkPct))
+		{
+			snprintf(child, sizeof(child), "%s/link %d", path, i);
+			MakeLink(child, i);
+		}
+		else if (Chance(gAliasPct))
+		{
+			snprintf(child, sizeof(child), "%s/alias %d", path, i);
+			MakeAlias(child);
+		}
+		else
+		{
+			snprintf(child, sizeof(child), "%s/file %d.dat", path, i);
+			MakeFile(child, i);
+		}
+		gEntries++;
+	}
+
+	if (level >= gDepth)
+		return;
+
+	for (i = 0; i < gFanout; i++)
+	{
+		snprintf(child, sizeof(child), "%s/folder %d", path, i);
+		if (mkdir(child, 0755) == -1)
+			Fail("mkdir", child);
+		gEntries++;
+		if (Chance(gInfoPct))
+			SetFinderInfo(child, 1);
+		if (Chance(gCommentPct))
+			SetComment(child);
+		MakeFolder(child, level + 1);
+	}
+}
+
+/* sizes spread evenly up to twice the mean */
+static void MakeFile (const char *path, int index)
+{
+	long	size = gMeanSize ? (long)(Random() % (2 * gMeanSize + 1)) : 0;
+	long	n;
+	int		fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1)
+		Fail("open", path);
+	for (; size > 0; size -= n)
+	{
+		n = (size < (long)sizeof(gZeros)) ? size : (long)sizeof(gZeros);
+		if (write(fd, gZeros, n) != n)
+			Fail("write", path);
+	}
+	close(fd);
+	gFileCount++;
+
+	if (Chance(gInfoPct))
+		SetFinderInfo(path, 0);
+	if (Chance(gRsrcPct))
+		SetResourceFork(path, (index & 1) ? "icns" : "STR ", 256 + Random() % 2048);
+	if (Chance(gCommentPct))
+		SetComment(path);
+}
+
+static void MakeAlias (const char *path)
+{
+	unsigned char	info[32];
+	int				fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1)
+		Fail("open", path);
+	close(fd);
+	gFileCount++;
+
+	memset(info, 0, sizeof(info));
+	memcpy(info, "fdrp", 4);
+	memcpy(info + 4, "MACS", 4);
+	PutBig(info + 8, kIsAlias, 2);
+	SetXattr(path, FINDERINFO_XATTR, info, sizeof(info));
+	SetResourceFork(path, "alis", 300 + Random() % 200);
+}
+
+/* to one of the earlier files in the folder,
+   which may have come out a link or an alias
+   instead, so some links dangle, as in life */
+static void MakeLink (const char *path, int index)
+{
+	char	target[64];
+
+	snprintf(target, sizeof(target), "file %d.dat", index ? (int)(Random() % index) : 0);
+	if (symlink(target, path) == -1)
+		Fail("symlink", path);
+}
+
+#pragma mark -
+
+static void SetFinderInfo (const char *path, int isFolder)
+{
+	unsigned char	info[32];
+	const CodePair	*code = &gCodes[Random() % (sizeof(gCodes) / sizeof(gCodes[0]))];
+	uint32_t		flags = (Random() << 1) & kColor;
+
+	if (Chance(5))
+		flags |= kIsInvisible;
+	if (Chance(5))
+		flags |= kHasCustomIcon;
+
+	memset(info, 0, sizeof(info));
+	if (!isFolder)
+	{
+		memcpy(info, code->type, 4);
+		memcpy(info + 4, code->creator, 4);
+	}
+	PutBig(info + 8, flags, 2);
+	PutBig(info + 10, Random() % 1024, 2);		/* location, v */
+	PutBig(info + 12, Random() % 1024, 2);		/* location, h */
+	SetXattr(path, FINDERINFO_XATTR, info, sizeof(info));
+}
+
+/*//////////////////////////////////////
+// The comment as the Finder stores it,
+// a binary property list of one string
+/////////////////////////////////////*/
+static void SetComment (const char *path)
+{
+	unsigned char	plist[128];
+	char			text[64];
+	size_t			len, pos;
+
+	len = snprintf(text, sizeof(text), "Synthetic comment %u", Random() % 100000);
+
+	memcpy(plist, "bplist00", 8);
+	pos = 8;
+	plist[pos++] = 0x5F;						/* ASCII string, length follows */
+	plist[pos++] = 0x10;						/* one byte integer */
+	plist[pos++] = len;
+	memcpy(plist + pos, text, len);
+	pos += len;
+	plist[pos] = 8;								/* offset table: object 0 at 8 */
+	memset(plist + pos + 1, 0, 32);				/* trailer */
+	plist[pos + 1 + 6] = 1;						/* offset size */
+	plist[pos + 1 + 7] = 1;						/* object reference size */
+	PutBig(plist + pos + 1 + 12, 1, 4);			/* number of objects */
+	PutBig(plist + pos + 1 + 28, pos, 4);		/* offset table offset */
+	SetXattr(path, COMMENT_XATTR, plist, pos + 1 + 32);
+}
+
+/*//////////////////////////////////////
+// A well formed resource fork holding one
+// resource of the given type, ID 128, with
+// dataLen bytes of data
+/////////////////////////////////////*/
+static void SetResourceFork (const char *path, const char *type, size_t dataLen)
+{
+	unsigned char	*fork;
+	size_t			dataOffset = 256;
+	size_t			mapOffset = dataOffset + 4 + dataLen;
+	size_t			mapLen = 28 + 2 + 8 + 12;
+	size_t			len = mapOffset + mapLen;
+	unsigned char	*map;
+
+	if (!(fork = calloc(1, len)))
+		Fail("calloc", path);
+
+	PutBig(fork, dataOffset, 4);
+	PutBig(fork + 4, mapOffset, 4);
+	PutBig(fork + 8, 4 + dataLen, 4);
+	PutBig(fork + 12, mapLen, 4);
+
+	PutBig(fork + dataOffset, dataLen, 4);
+
+	map = fork + mapOffset;
+	memcpy(map, fork, 16);
+	PutBig(map + 24, 28, 2);					/* type list */
+	PutBig(map + 26, mapLen, 2);				/* name list, empty */
+	PutBig(map + 28, 0, 2);						/* one type */
+	memcpy(map + 30, type, 4);
+	PutBig(map + 34, 0, 2);						/* one resource */
+	PutBig(map + 36, 10, 2);					/* its reference, from the type list */
+	PutBig(map + 38, 128, 2);					/* ID */
+	PutBig(map + 40, 0xFFFF, 2);				/* no name */
+	PutBig(map + 42, 0, 4);						/* attributes and data offset */
+
+	SetXattr(path, RESOURCEFORK_XATTR, fork, len);
+	free(fork);
+}
+
+static void SetXattr (const char *path, const char *name, const void *value, size_t len)
+{
+	int		err;
+
+#ifdef __APPLE__
+	err = setxattr(path, name, value, len, 0, XATTR_NOFOLLOW);
+#else
+	err = lsetxattr(path, name, value, len, 0);
+#endif
+	if (err == -1)
+		Fail(name, path);
+}
+
+static void WriteStamp (const char *top)
+{
+	char	path[4096];
+	FILE	*f;
+
+	snprintf(path, sizeof(path), "%s/%s", top, STAMP_NAME);
+	if (!(f = fopen(path, "w")))
+		Fail("fopen", path);
+	gEntries++;
+	gFileCount++;
+	PrintParameters(f);
+	fprintf(f, "entries %llu\nfiles %llu\n",
+			(unsigned long long)gEntries, (unsigned long long)gFileCount);
+	if (fclose(f) == EOF)
+		Fail("fclose", path);
+}
+
+static void PrintParameters (FILE *f)
+{
+	fprintf(f, "-f %d -d %d -n %d -z %ld -i %d -r %d -c %d -l %d -a %d -s %lu\n",
+			gFanout, gDepth, gFiles, gMeanSize, gInfoPct, gRsrcPct, gCommentPct,
+			gLinkPct, gAliasPct, gSeed);
+}
+
+#pragma mark -
+
+static int Chance (int pct)
+{
+	return (int)(Random() % 100) < pct;
+}
+
+/* xorshift64*, so a seed makes the same tree everywhere */
+static uint32_t Random (void)
+{
+	gState ^= gState >> 12;
+	gState ^= gState << 25;
+	gState ^= gState >> 27;
+	return (uint32_t)((gState * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static void PutBig (unsigned char *p, uint32_t value, int bytes)
+{
+	while (bytes-- > 0)
+	{
+		p[bytes] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+static void Fail (const char *what, const char *path)
+{
+	fprintf(stderr, "%s: %s: %s: %s\n", PROGRAM_STRING, what, path, strerror(errno));
+	if (errno == ENOTSUP)
+		fprintf(stderr, "%s: the file system needs extended attributes\n", PROGRAM_STRING);
+	exit(EX_CANTCREAT);
+}
+
+static void PrintHelp (void)
+{
+	fprintf(stderr, "usage: %s [-f folders] [-d depth] [-n files] [-z size] [-i pct] [-r pct]\n"
+					"       [-c pct] [-l pct] [-a pct] [-s seed] directory\n"
+					"       %s [options] -p\n", PROGRAM_STRING, PROGRAM_STRING);
+}
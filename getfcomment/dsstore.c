@@ -0,0 +1,439 @@
+/*
+    dsstore.c - read Finder comments from a folder's .DS_Store
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "dsstore.h"
+#include "fcomment.h"
+
+#define		DS_ALIGN_LENGTH			4			/* before "Bud1"; offsets count from after it */
+#define		DS_HEADER_LENGTH		32
+#define		DS_ADDRESS_PADDING		256			/* block addresses come in runs of */
+#define		DS_MAX_LEVELS			32
+#define		DS_MAX_STORE			(1 << 30)	/* far past any real one */
+
+#define		FOUR_CC(a, b, c, d)		(((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+/* a comment record, where it lies in the mapped file */
+typedef struct Record
+{
+	const unsigned char	*name;
+	const unsigned char	*comment;
+	uint32_t			nameLength;		/* in UTF-16 characters */
+	uint32_t			commentLength;
+} Record;
+
+/* a comment, converted */
+typedef struct Entry
+{
+	const char		*name;
+	const char		*comment;
+	uint32_t		hash;
+} Entry;
+
+struct DSStore
+{
+	Entry			*entries;
+	long			numEntries;
+	int32_t			*table;			/* index into entries plus one, 0 for empty */
+	uint32_t		tableMask;
+	char			*strings;		/* every name and comment */
+};
+
+/* the file as it's walked */
+typedef struct Walk
+{
+	const unsigned char	*base;		/* past the alignment bytes */
+	size_t				size;
+	const unsigned char	*addresses;
+	uint32_t			numBlocks;
+	uint32_t			nodesLeft;	/* so a loop in the tree can't go on forever */
+	Record				*records;
+	long				numRecords;
+	long				maxRecords;
+} Walk;
+
+static int      ReadTree (Walk *walk);
+static int      GetBlock (Walk *walk, uint32_t number, const unsigned char **block, size_t *size);
+static int      WalkNode (Walk *walk, uint32_t number, int depth);
+static int      ReadRecord (Walk *walk, const unsigned char *node, size_t size, size_t *pos);
+static DSStore *MakeStore (Walk *walk);
+static uint32_t Hash (const char *s);
+static uint32_t Get32 (const unsigned char *p);
+static int      Malformed (void);
+
+/*//////////////////////////////////////
+// Read every comment in the .DS_Store of
+// the folder at dir.  Returns NULL and
+// errno on error, ENOENT if there's no
+// .DS_Store and EINVAL if it's malformed
+/////////////////////////////////////*/
+DSStore *DSOpen (const char *dir)
+{
+	char			path[PATH_MAX];
+	struct stat		sb;
+	unsigned char	*map;
+	Walk			walk = { 0 };
+	DSStore			*store = NULL;
+	int				fd, err;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, DS_STORE_NAME) >= (int)sizeof(path))
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &sb) == -1)
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	if (!S_ISREG(sb.st_mode) || sb.st_size < DS_ALIGN_LENGTH + DS_HEADER_LENGTH || sb.st_size > DS_MAX_STORE)
+	{
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	err = errno;
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		errno = err;
+		return NULL;
+	}
+
+	walk.base = map + DS_ALIGN_LENGTH;
+	walk.size = sb.st_size - DS_ALIGN_LENGTH;
+	if (ReadTree(&walk) == 0)
+		store = MakeStore(&walk);
+
+	err = errno;
+	free(walk.records);
+	munmap(map, sb.st_size);
+	errno = err;
+	return store;
+}
+
+/*//////////////////////////////////////
+// The comment of the file called name, or
+// NULL if it has none
+/////////////////////////////////////*/
+const char *DSGetComment (const DSStore *store, const char *name)
+{
+	uint32_t	hash = Hash(name);
+	uint32_t	i;
+	int32_t		index;
+
+	for (i = hash & store->tableMask; (index = store->table[i]); i = (i + 1) & store->tableMask)
+	{
+		if (store->entries[index - 1].hash == hash && !strcmp(store->entries[index - 1].name, name))
+			return store->entries[index - 1].comment;
+	}
+	return NULL;
+}
+
+void DSClose (DSStore *store)
+{
+	if (!store)
+		return;
+	free(store->entries);
+	free(store->table);
+	free(store->strings);
+	free(store);
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Find the B-tree from the header and
+// the root block, and collect its
+// comment records
+/////////////////////////////////////*/
+static int ReadTree (Walk *walk)
+{
+	const unsigned char	*root, *p, *end, *dsdb;
+	uint32_t			rootOffset, rootSize, numDirs, rootNode, levels;
+	size_t				tableSize, dsdbSize;
+	int					len;
+
+	if (memcmp(walk->base, "Bud1", 4))
+		return Malformed();
+	rootOffset = Get32(walk->base + 4);
+	rootSize = Get32(walk->base + 8);
+	if (Get32(walk->base + 12) != rootOffset || rootOffset > walk->size || rootSize > walk->size - rootOffset)
+		return Malformed();
+	root = walk->base + rootOffset;
+	end = root + rootSize;
+
+	/* the block addresses, and past them the count of named blocks */
+	if (rootSize < 12)
+		return Malformed();
+	walk->numBlocks = Get32(root);
+	tableSize = ((walk->numBlocks + DS_ADDRESS_PADDING - 1) / DS_ADDRESS_PADDING) * DS_ADDRESS_PADDING * 4;
+	if (walk->numBlocks > rootSize || tableSize > rootSize - 12)
+		return Malformed();
+	walk->addresses = root + 8;
+	walk->nodesLeft = walk->numBlocks;
+
+	/* the named blocks, for the one holding the tree */
+	p = walk->addresses + tableSize;
+	numDirs = Get32(p);
+	p += 4;
+	for (; numDirs; numDirs--)
+	{
+		if (p >= end || end - p < 1 + *p + 4)
+			return Malformed();
+		len = *p++;
+		if (len == 4 && !memcmp(p, "DSDB", 4))
+			break;
+		p += len + 4;
+	}
+	if (!numDirs)
+		return Malformed();
+
+	if (GetBlock(walk, Get32(p + 4), &dsdb, &dsdbSize) == -1 || dsdbSize < 8)
+		return Malformed();
+	rootNode = Get32(dsdb);
+	levels = Get32(dsdb + 4);
+	if (levels > DS_MAX_LEVELS)
+		return Malformed();
+
+	return WalkNode(walk, rootNode, 0);
+}
+
+/* a block by number, from its address */
+static int GetBlock (Walk *walk, uint32_t number, const unsigned char **block, size_t *size)
+{
+	uint32_t	address;
+	size_t		offset;
+	int			shift;
+
+	if (number >= walk->numBlocks)
+		return Malformed();
+	address = Get32(walk->addresses + 4 * number);
+	offset = address & ~0x1FU;
+	shift = address & 0x1F;
+	*size = (size_t)1 << shift;
+	if (offset > walk->size || *size > walk->size - offset)
+		return Malformed();
+	*block = walk->base + offset;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Collect the comment records of a node
+// and all the nodes below it
+/////////////////////////////////////*/
+static int WalkNode (Walk *walk, uint32_t number, int depth)
+{
+	const unsigned char	*node;
+	size_t				size, pos;
+	uint32_t			next, count;
+
+	if (depth > DS_MAX_LEVELS || !walk->nodesLeft--)
+		return Malformed();
+	if (GetBlock(walk, number, &node, &size) == -1 || size < 8)
+		return Malformed();
+
+	next = Get32(node);
+	count = Get32(node + 4);
+	pos = 8;
+	for (; count; count--)
+	{
+		if (next)
+		{
+			if (size - pos < 4 || WalkNode(walk, Get32(node + pos), depth + 1) == -1)
+				return Malformed();
+			pos += 4;
+		}
+		if (ReadRecord(walk, node, size, &pos) == -1)
+			return -1;
+	}
+	return next ? WalkNode(walk, next, depth + 1) : 0;
+}
+
+/*//////////////////////////////////////
+// Step over the record at pos, keeping it
+// if it's a comment
+/////////////////////////////////////*/
+static int ReadRecord (Walk *walk, const unsigned char *node, size_t size, size_t *pos)
+{
+	const unsigned char	*p = node + *pos;
+	const unsigned char	*name;
+	uint32_t			nameLength, kind, type;
+	size_t				left = size - *pos, valueSize;
+	Record				*records;
+
+	if (left < 4)
+		return Malformed();
+	nameLength = Get32(p);
+	if ((left - 4) / 2 < nameLength || left - 4 - 2 * (size_t)nameLength < 8)
+		return Malformed();
+	name = p + 4;
+	p = name + 2 * (size_t)nameLength;
+	kind = Get32(p);
+	type = Get32(p + 4);
+	p += 8;
+	left = size - (p - node);
+
+	switch (type)
+	{
+		case FOUR_CC('b','o','o','l'):
+			valueSize = 1;
+			break;
+		case FOUR_CC('l','o','n','g'):
+		case FOUR_CC('s','h','o','r'):
+		case FOUR_CC('t','y','p','e'):
+			valueSize = 4;
+			break;
+		case FOUR_CC('c','o','m','p'):
+		case FOUR_CC('d','u','t','c'):
+			valueSize = 8;
+			break;
+		case FOUR_CC('b','l','o','b'):
+			if (left < 4)
+				return Malformed();
+			valueSize = 4 + (size_t)Get32(p);
+			break;
+		case FOUR_CC('u','s','t','r'):
+			if (left < 4)
+				return Malformed();
+			valueSize = 4 + 2 * (size_t)Get32(p);
+			break;
+		default:
+			return Malformed();
+	}
+	if (valueSize > left)
+		return Malformed();
+
+	if (kind == FOUR_CC('c','m','m','t') && type == FOUR_CC('u','s','t','r'))
+	{
+		if (walk->numRecords == walk->maxRecords)
+		{
+			walk->maxRecords = walk->maxRecords ? 2 * walk->maxRecords : 64;
+			records = realloc(walk->records, walk->maxRecords * sizeof(Record));
+			if (!records)
+				return -1;
+			walk->records = records;
+		}
+		walk->records[walk->numRecords].name = name;
+		walk->records[walk->numRecords].nameLength = nameLength;
+		walk->records[walk->numRecords].comment = p + 4;
+		walk->records[walk->numRecords].commentLength = Get32(p);
+		walk->numRecords++;
+	}
+
+	*pos = (p - node) + valueSize;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Convert the comments to UTF-8, all in
+// one buffer, and hash them by name
+/////////////////////////////////////*/
+static DSStore *MakeStore (Walk *walk)
+{
+	DSStore		*store;
+	Record		*record;
+	Entry		*entry;
+	size_t		stringsSize = 0, used = 0, n;
+	uint32_t	tableSize, i;
+	long		r;
+
+	store = calloc(1, sizeof(DSStore));
+	if (!store)
+		return NULL;
+
+	/* a UTF-16 character takes at most 3 bytes of UTF-8, a pair 4 */
+	for (r = 0; r < walk->numRecords; r++)
+		stringsSize += 3 * ((size_t)walk->records[r].nameLength + walk->records[r].commentLength) + 2;
+
+	for (tableSize = 16; tableSize < 2 * (uint32_t)walk->numRecords; tableSize *= 2)
+		;
+	store->tableMask = tableSize - 1;
+	store->table = calloc(tableSize, sizeof(int32_t));
+	store->entries = malloc((walk->numRecords ? walk->numRecords : 1) * sizeof(Entry));
+	store->strings = malloc(stringsSize ? stringsSize : 1);
+	if (!store->table || !store->entries || !store->strings)
+	{
+		DSClose(store);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for (r = 0; r < walk->numRecords; r++)
+	{
+		record = &walk->records[r];
+		entry = &store->entries[store->numEntries];
+
+		entry->name = store->strings + used;
+		n = 3 * (size_t)record->nameLength + 1;
+		used += FCUTF16ToUTF8(record->name, 2 * (size_t)record->nameLength, store->strings + used, n) + 1;
+		entry->comment = store->strings + used;
+		n = 3 * (size_t)record->commentLength + 1;
+		used += FCUTF16ToUTF8(record->comment, 2 * (size_t)record->commentLength, store->strings + used, n) + 1;
+		entry->hash = Hash(entry->name);
+
+		/* a name is in the tree once; if not, the first one wins */
+		if (DSGetComment(store, entry->name))
+			continue;
+		for (i = entry->hash & store->tableMask; store->table[i]; i = (i + 1) & store->tableMask)
+			;
+		store->table[i] = ++store->numEntries;
+	}
+	return store;
+}
+
+#pragma mark -
+
+/* FNV-1a */
+static uint32_t Hash (const char *s)
+{
+	uint32_t	h = 2166136261U;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+static uint32_t Get32 (const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int Malformed (void)
+{
+	errno = EINVAL;
+	return -1;
+}
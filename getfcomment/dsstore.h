@@ -0,0 +1,57 @@
+/*
+    dsstore.h - read Finder comments from a folder's .DS_Store
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Before the kMDItemFinderComment attribute, and still for the Finder's
+    own Get Info window, a folder's comments are "cmmt" records in its
+    .DS_Store, a B-tree kept in a buddy allocator.  All numbers are
+    big-endian, and offsets count from byte 4 of the file:
+
+        0       00 00 00 01, "Bud1", then the root block's offset and
+                size, and the offset again
+        root    the number of blocks and their addresses, an offset
+                with log2 of the size in the low 5 bits, padded to a
+                multiple of 256; then named blocks, "DSDB" among them
+        DSDB    the B-tree's root node and its number of levels
+        node    P, then a count of records; in a leaf (P = 0) just the
+                records, else each record after the child holding the
+                ones before it, and P the child past the last
+        record  the file name (UTF-16 characters, then the UTF-16),
+                a four character code for what it is, "cmmt" for the
+                comment, and a typed value; "ustr" is a UTF-16 string
+
+    DSOpen maps the file, walks the whole tree once and keeps every
+    comment, as UTF-8, in a hash table by name, so DSGetComment is a
+    lookup however many files of the folder are asked about.  Names are
+    compared as stored, so they must be in the same Unicode form as the
+    Finder wrote them, which on HFS+ is decomposed.
+*/
+
+#ifndef DSSTORE_H
+#define DSSTORE_H
+
+#define		DS_STORE_NAME		".DS_Store"
+
+typedef struct DSStore DSStore;
+
+DSStore    *DSOpen (const char *dir);
+const char *DSGetComment (const DSStore *store, const char *name);
+void        DSClose (DSStore *store);
+
+#endif /* DSSTORE_H */
@@ -0,0 +1,502 @@
+/*
+    fcomment.c - read Mac OS X Finder comments from extended attributes
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#include "fcomment.h"
+
+#ifndef ENOATTR
+#define		ENOATTR		ENODATA
+#endif
+
+#define		BPLIST_HEADER_LENGTH	8
+#define		BPLIST_TRAILER_LENGTH	32
+
+#define		BPLIST_INT				0x1
+#define		BPLIST_ASCII_STRING		0x5
+#define		BPLIST_UTF16_STRING		0x6
+
+static ssize_t  GetXattr (const char *path, void *buf, size_t size);
+static int      SetXattr (int fd, const void *buf, size_t size);
+static uint64_t GetBig (const unsigned char *p, int n);
+static void     PutBig (unsigned char *p, uint64_t v, int n);
+static long     UTF8ToUTF16 (const char *in, unsigned char *out);
+static int      Malformed (void);
+
+/*//////////////////////////////////////
+// Find the string a comment's property
+// list holds, in place.  Returns 0, or -1
+// and EINVAL if it isn't a binary property
+// list with a string at the top
+/////////////////////////////////////*/
+int FCParseComment (const unsigned char *plist, size_t len, FCString *str)
+{
+	const unsigned char	*trailer, *obj, *end;
+	uint64_t			numObjects, top, tableOffset, offset, count;
+	int					offsetSize, marker, n;
+
+	if (len < BPLIST_HEADER_LENGTH + 1 + BPLIST_TRAILER_LENGTH || memcmp(plist, "bplist00", BPLIST_HEADER_LENGTH))
+		return Malformed();
+
+	trailer = plist + len - BPLIST_TRAILER_LENGTH;
+	offsetSize = trailer[6];
+	numObjects = GetBig(trailer + 8, 8);
+	top = GetBig(trailer + 16, 8);
+	tableOffset = GetBig(trailer + 24, 8);
+
+	/* the top object's entry has to lie within the offset table */
+	if (offsetSize < 1 || offsetSize > 8 || top >= numObjects ||
+		tableOffset < BPLIST_HEADER_LENGTH || tableOffset > len - BPLIST_TRAILER_LENGTH ||
+		(len - BPLIST_TRAILER_LENGTH - tableOffset) / offsetSize <= top)
+		return Malformed();
+
+	/* and the object between the header and the table */
+	offset = GetBig(plist + tableOffset + top * offsetSize, offsetSize);
+	if (offset < BPLIST_HEADER_LENGTH || offset >= tableOffset)
+		return Malformed();
+	obj = plist + offset;
+	end = plist + tableOffset;
+
+	marker = *obj >> 4;
+	count = *obj++ & 0x0F;
+	if (marker != BPLIST_ASCII_STRING && marker != BPLIST_UTF16_STRING)
+		return Malformed();
+
+	/* 15 characters or more: the length is an int object of its own */
+	if (count == 0x0F)
+	{
+		if (obj >= end || (*obj >> 4) != BPLIST_INT)
+			return Malformed();
+		n = 1 << (*obj++ & 0x0F);
+		if (n > 8 || end - obj < n)
+			return Malformed();
+		count = GetBig(obj, n);
+		obj += n;
+	}
+
+	if (marker == BPLIST_UTF16_STRING)
+	{
+		if (count > (uint64_t)(end - obj) / 2)
+			return Malformed();
+		count *= 2;
+	}
+	else if (count > (uint64_t)(end - obj))
+		return Malformed();
+
+	str->bytes = obj;
+	str->length = (size_t)count;
+	str->isUTF16 = (marker == BPLIST_UTF16_STRING);
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Get the Finder comment of the file at
+// path, following symlinks, as a UTF-8 C
+// string cut short to fit in size bytes.
+// Returns its length, 0 if the file has no
+// comment, or -1 and errno on error
+/////////////////////////////////////*/
+ssize_t FCGetComment (const char *path, char *buf, size_t size)
+{
+	unsigned char	stackBuf[FC_BUFFER_SIZE];
+	unsigned char	*plist = stackBuf;
+	ssize_t			len;
+	size_t			n;
+	FCString		str;
+	int				err;
+
+	buf[0] = '\0';
+
+	len = GetXattr(path, stackBuf, sizeof(stackBuf));
+	if (len == -1 && errno == ERANGE)
+	{
+		/* a long one; size it, and read it again */
+		len = GetXattr(path, NULL, 0);
+		if (len > 0)
+		{
+			plist = malloc(len);
+			if (!plist)
+				return -1;
+			len = GetXattr(path, plist, len);
+		}
+	}
+	if (len == -1)
+	{
+		err = errno;
+		if (plist != stackBuf)
+			free(plist);
+		/* no comment, or a filesystem without xattrs */
+		if (err == ENOATTR || err == ENOTSUP)
+			return 0;
+		errno = err;
+		return -1;
+	}
+
+	if (FCParseComment(plist, len, &str) == -1)
+	{
+		if (plist != stackBuf)
+			free(plist);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (str.isUTF16)
+		n = FCUTF16ToUTF8(str.bytes, str.length, buf, size);
+	else
+	{
+		n = (str.length < size - 1) ? str.length : size - 1;
+		memcpy(buf, str.bytes, n);
+		buf[n] = '\0';
+	}
+
+	if (plist != stackBuf)
+		free(plist);
+	return (ssize_t)n;
+}
+
+/*//////////////////////////////////////
+// The most bytes FCEncodeComment can take
+// for a comment: each byte of UTF-8 makes
+// at most one UTF-16 code unit
+/////////////////////////////////////*/
+size_t FCEncodedSize (const char *comment)
+{
+	return BPLIST_HEADER_LENGTH + 1 + 9 + 2 * strlen(comment) + 1 + BPLIST_TRAILER_LENGTH;
+}
+
+/*//////////////////////////////////////
+// A UTF-8 comment as a binary property
+// list of one string, into plist.  Returns
+// its length, or -1 and EINVAL if comment
+// isn't UTF-8, ERANGE if it doesn't fit
+/////////////////////////////////////*/
+ssize_t FCEncodeComment (const char *comment, unsigned char *plist, size_t size)
+{
+	const unsigned char	*c;
+	long				units;
+	size_t				count, pos, charBytes;
+	int					marker = BPLIST_ASCII_STRING;
+
+	for (c = (const unsigned char *)comment; *c; c++)
+		if (*c >= 0x80)
+			marker = BPLIST_UTF16_STRING;
+
+	/* the length in characters, ASCII ones or UTF-16 code units */
+	if (marker == BPLIST_ASCII_STRING)
+	{
+		count = strlen(comment);
+		charBytes = count;
+	}
+	else
+	{
+		units = UTF8ToUTF16(comment, NULL);
+		if (units == -1)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		count = (size_t)units;
+		charBytes = 2 * count;
+	}
+
+	if (size < BPLIST_HEADER_LENGTH + 1 + 9 + charBytes + 1 + BPLIST_TRAILER_LENGTH)
+	{
+		errno = ERANGE;
+		return -1;
+	}
+
+	memcpy(plist, "bplist00", BPLIST_HEADER_LENGTH);
+	pos = BPLIST_HEADER_LENGTH;
+
+	/* the string's marker, and past 14 characters its length as an int object */
+	if (count < 0x0F)
+		plist[pos++] = (marker << 4) | count;
+	else
+	{
+		plist[pos++] = (marker << 4) | 0x0F;
+		if (count < 0x100)
+		{
+			plist[pos++] = BPLIST_INT << 4;
+			plist[pos++] = count;
+		}
+		else if (count < 0x10000)
+		{
+			plist[pos++] = (BPLIST_INT << 4) | 1;
+			PutBig(plist + pos, count, 2);
+			pos += 2;
+		}
+		else
+		{
+			plist[pos++] = (BPLIST_INT << 4) | 2;
+			PutBig(plist + pos, count, 4);
+			pos += 4;
+		}
+	}
+
+	if (marker == BPLIST_ASCII_STRING)
+		memcpy(plist + pos, comment, count);
+	else
+		UTF8ToUTF16(comment, plist + pos);
+	pos += charBytes;
+
+	/* an offset table of one, the string at 8, and the trailer */
+	plist[pos] = BPLIST_HEADER_LENGTH;
+	memset(plist + pos + 1, 0, BPLIST_TRAILER_LENGTH);
+	plist[pos + 1 + 6] = 1;						/* offset size */
+	plist[pos + 1 + 7] = 1;						/* object reference size */
+	PutBig(plist + pos + 1 + 8, 1, 8);			/* number of objects */
+	PutBig(plist + pos + 1 + 24, pos, 8);		/* offset table offset */
+
+	return pos + 1 + BPLIST_TRAILER_LENGTH;
+}
+
+/*//////////////////////////////////////
+// Set the Finder comment of an open file,
+// or remove it if comment is empty.
+// Returns 0, or -1 and errno on error
+/////////////////////////////////////*/
+int FCSetComment (int fd, const char *comment)
+{
+	unsigned char	stackBuf[FC_BUFFER_SIZE];
+	unsigned char	*plist = stackBuf;
+	size_t			size;
+	ssize_t			len;
+	int				rc, err;
+
+	if (!*comment)
+	{
+#if defined(__APPLE__)
+		rc = fremovexattr(fd, COMMENT_XATTR_NAME, 0);
+#elif defined(__linux__)
+		rc = fremovexattr(fd, COMMENT_XATTR_NAME);
+#else
+		errno = ENOTSUP;
+		rc = -1;
+#endif
+		return (rc == -1 && errno == ENOATTR) ? 0 : rc;
+	}
+
+	size = FCEncodedSize(comment);
+	if (size > sizeof(stackBuf))
+	{
+		plist = malloc(size);
+		if (!plist)
+			return -1;
+	}
+
+	len = FCEncodeComment(comment, plist, size);
+	rc = (len == -1) ? -1 : SetXattr(fd, plist, len);
+
+	err = errno;
+	if (plist != stackBuf)
+		free(plist);
+	errno = err;
+	return rc;
+}
+
+/*//////////////////////////////////////
+// Big-endian UTF-16 to a UTF-8 C string in
+// out, never splitting a character; an
+// unpaired surrogate becomes U+FFFD.
+// Returns the length
+/////////////////////////////////////*/
+size_t FCUTF16ToUTF8 (const unsigned char *in, size_t len, char *out, size_t size)
+{
+	const unsigned char	*end = in + len;
+	unsigned char		*o = (unsigned char *)out;
+	uint32_t			c, lo;
+	size_t				used = 0, need;
+
+	while (end - in >= 2)
+	{
+		c = (in[0] << 8) | in[1];
+		in += 2;
+
+		if (c >= 0xD800 && c < 0xDC00 && end - in >= 2)
+		{
+			lo = (in[0] << 8) | in[1];
+			if (lo >= 0xDC00 && lo < 0xE000)
+			{
+				c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+				in += 2;
+			}
+		}
+		if (c >= 0xD800 && c < 0xE000)
+			c = 0xFFFD;
+
+		need = (c < 0x80) ? 1 : (c < 0x800) ? 2 : (c < 0x10000) ? 3 : 4;
+		if (used + need >= size)
+			break;
+
+		switch (need)
+		{
+			case 1:
+				o[used++] = c;
+				break;
+			case 2:
+				o[used++] = 0xC0 | (c >> 6);
+				o[used++] = 0x80 | (c & 0x3F);
+				break;
+			case 3:
+				o[used++] = 0xE0 | (c >> 12);
+				o[used++] = 0x80 | ((c >> 6) & 0x3F);
+				o[used++] = 0x80 | (c & 0x3F);
+				break;
+			default:
+				o[used++] = 0xF0 | (c >> 18);
+				o[used++] = 0x80 | ((c >> 12) & 0x3F);
+				o[used++] = 0x80 | ((c >> 6) & 0x3F);
+				o[used++] = 0x80 | (c & 0x3F);
+				break;
+		}
+	}
+	o[used] = '\0';
+	return used;
+}
+
+#pragma mark -
+
+static ssize_t GetXattr (const char *path, void *buf, size_t size)
+{
+#if defined(__APPLE__)
+	return getxattr(path, COMMENT_XATTR_NAME, buf, size, 0, 0);
+#elif defined(__linux__)
+	return getxattr(path, COMMENT_XATTR_NAME, buf, size);
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+static int SetXattr (int fd, const void *buf, size_t size)
+{
+#if defined(__APPLE__)
+	return fsetxattr(fd, COMMENT_XATTR_NAME, buf, size, 0, 0);
+#elif defined(__linux__)
+	return fsetxattr(fd, COMMENT_XATTR_NAME, buf, size, 0);
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+static uint64_t GetBig (const unsigned char *p, int n)
+{
+	uint64_t	v = 0;
+
+	while (n--)
+		v = (v << 8) | *p++;
+	return v;
+}
+
+static void PutBig (unsigned char *p, uint64_t v, int n)
+{
+	while (n--)
+	{
+		p[n] = v & 0xFF;
+		v >>= 8;
+	}
+}
+
+/*//////////////////////////////////////
+// A UTF-8 C string to big-endian UTF-16 in
+// out, or just counted if out is NULL.
+// Returns the number of code units, or -1
+// if in isn't well formed UTF-8
+/////////////////////////////////////*/
+static long UTF8ToUTF16 (const char *in, unsigned char *out)
+{
+	const unsigned char	*p = (const unsigned char *)in;
+	uint32_t			c;
+	long				units = 0;
+	int					n, i;
+
+	while (*p)
+	{
+		if (*p < 0x80)
+		{
+			c = *p;
+			n = 0;
+		}
+		else if ((*p & 0xE0) == 0xC0)
+		{
+			c = *p & 0x1F;
+			n = 1;
+		}
+		else if ((*p & 0xF0) == 0xE0)
+		{
+			c = *p & 0x0F;
+			n = 2;
+		}
+		else if ((*p & 0xF8) == 0xF0)
+		{
+			c = *p & 0x07;
+			n = 3;
+		}
+		else
+			return -1;
+		p++;
+
+		for (i = 0; i < n; i++, p++)
+		{
+			if ((*p & 0xC0) != 0x80)
+				return -1;
+			c = (c << 6) | (*p & 0x3F);
+		}
+
+		/* overlong forms, surrogates and past U+10FFFF aren't UTF-8 */
+		if ((n == 1 && c < 0x80) || (n == 2 && c < 0x800) || (n == 3 && c < 0x10000) ||
+			(c >= 0xD800 && c < 0xE000) || c > 0x10FFFF)
+			return -1;
+
+		if (c >= 0x10000)
+		{
+			c -= 0x10000;
+			if (out)
+			{
+				PutBig(out, 0xD800 | (c >> 10), 2);
+				PutBig(out + 2, 0xDC00 | (c & 0x3FF), 2);
+				out += 4;
+			}
+			units += 2;
+		}
+		else
+		{
+			if (out)
+			{
+				PutBig(out, c, 2);
+				out += 2;
+			}
+			units++;
+		}
+	}
+	return units;
+}
+
+static int Malformed (void)
+{
+	errno = EINVAL;
+	return -1;
+}
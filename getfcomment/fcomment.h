@@ -0,0 +1,75 @@
+/*
+    fcomment.h - read Mac OS X Finder comments from extended attributes
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    The Finder keeps a file's comment in the
+    com.apple.metadata:kMDItemFinderComment extended attribute, which
+    mirrors off a Mac keep under "user." as they do the Finder info.
+    It holds a binary property list whose top object is the string:
+
+        0       "bplist00"
+        8       objects; a string is a marker byte, 0x5n for ASCII or
+                0x6n for UTF-16BE with n the length in characters, or
+                n = 0xF and the length in an int object after it
+                (0x1n, 2^n bytes, big-endian)
+        ...     offset table, the offset of each object
+        end-32  trailer: offset size at 6, object reference size at 7,
+                then big-endian 64 bit object count, top object and
+                offset table offset
+
+    FCParseComment finds the string in place without copying it, and
+    FCGetComment reads the attribute with a single getxattr and hands
+    back the comment as UTF-8.  FCEncodeComment goes the other way, an
+    ASCII string where it can be and UTF-16BE where it can't, as the
+    Finder writes them, and FCSetComment stores it with one fsetxattr.
+    None of them needs the Finder, or a Mac.  FCUTF16ToUTF8 is theirs,
+    shared with dsstore.c and lsmac's hfsimage.c.
+*/
+
+#ifndef FCOMMENT_H
+#define FCOMMENT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __APPLE__
+#define		COMMENT_XATTR_NAME		"com.apple.metadata:kMDItemFinderComment"
+#else
+#define		COMMENT_XATTR_NAME		"user.com.apple.metadata:kMDItemFinderComment"
+#endif
+
+#define		FC_BUFFER_SIZE			1024		/* tried first; longer comments are read into the heap */
+#define		FC_MAX_COMMENT			16384		/* bytes of UTF-8 the tools print at most */
+
+/* a string in a property list, where it lies */
+typedef struct FCString
+{
+	const unsigned char	*bytes;
+	size_t				length;		/* in bytes */
+	int					isUTF16;	/* big-endian, else ASCII */
+} FCString;
+
+int     FCParseComment (const unsigned char *plist, size_t len, FCString *str);
+ssize_t FCGetComment (const char *path, char *buf, size_t size);
+size_t  FCEncodedSize (const char *comment);
+ssize_t FCEncodeComment (const char *comment, unsigned char *plist, size_t size);
+int     FCSetComment (int fd, const char *comment);
+size_t  FCUTF16ToUTF8 (const unsigned char *in, size_t len, char *out, size_t size);
+
+#endif /* FCOMMENT_H */
@@ -21,62 +21,81 @@
   
 /*  CHANGES
     
+	0.5 - -D reads comments from the folder's .DS_Store, once for all its files
+	0.4 - Mac OS X comments read from the kMDItemFinderComment extended attribute,
+	      so the Finder needn't be running, and on other systems too; -F asks
+	      the Finder as before
 	0.3 - exit constants used from sysexits.h, manpage updated
 	0.2 - Apple Events querying Finder for comment -- now compatible with Mac OS X comments
     0.1 - First release of getfcomment.  It only supports Mac OS 9 Desktop Database comments at the moment
 
 */
 
-/*  TODO
-        
-    * Mac OS X comments
-
-*/
-
-
 /*
     Command line options
 
     v - version
     h - help - usage
-	c - get Mac OS 9 Desktop Database comment instead of querying the Finder via Apple Events
+	p - print the file name before each comment
+	c - get Mac OS 9 Desktop Database comment instead of the Mac OS X one
+	F - ask the Finder via Apple Events instead of reading the extended attribute
+	D - read the comment from the .DS_Store of the file's folder
     
 */
 
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
+#ifdef __APPLE__
 #include <Carbon/Carbon.h>
+#endif
 #include <string.h>
 #include <sysexits.h>
 
+#include "fcomment.h"
+#include "dsstore.h"
 
+#ifdef __APPLE__
 // Some MoreAppleEvents stuff
             #define MoreAssert(x) (true)
             #define MoreAssertQ(x)
+#else
+#define		true		1
+#define		false		0
+#endif
 
 ///////////////  Definitions    //////////////
 
 #define		MAX_COMMENT_LENGTH	255
 #define		PROGRAM_STRING  	"getfcomment"
-#define		VERSION_STRING		"0.3"
+#define		VERSION_STRING		"0.5"
 #define		AUTHOR_STRING 		"Sveinbjorn Thordarson"
 
 //globals
 
 short	printFileName = false;
 short	os9comment = false;
+short	askFinder = false;
+short	useDSStore = false;
 
+#ifdef __APPLE__
 static const OSType gFinderSignature = 'MACS';
+#endif
 
 // prototypes
 
 	static void PrintOSXComment (char *path);
-	static void PrintFileComment (char *path);
+	static void PrintDSStoreComment (char *path);
+	static void PrintComment (char *path, const char *comment);
     static void PrintVersion (void);
     static void PrintHelp (void);
 	
+#ifdef __APPLE__
+	static void PrintFinderComment (char *path);
+	static void PrintFileComment (char *path);
+	
 	//AE functions from MoreAppleEvents.c, Apple's sample code
     pascal OSErr MoreFEGetComment(const FSRef *pFSRefPtr, const FSSpecPtr pFSSpecPtr,Str255 pCommentStr,const AEIdleUPP pIdleProcUPP);
 	pascal void MoreAEDisposeDesc(AEDesc* desc);
@@ -89,6 +108,7 @@ static const OSType gFinderSignature = 'MACS';
 	pascal OSStatus MoreAESendEventReturnData(const AEIdleUPP    pIdleProcUPP,const AppleEvent  *pAppleEvent,DescType      pDesiredType,DescType*      pActualType,void*         pDataPtr,Size        pMaximumSize,Size         *pActualSize);
 	pascal OSErr MoreAEGetCFStringFromDescriptor(const AEDesc* pAEDesc, CFStringRef* pCFStringRef);
 	Boolean MyAEIdleCallback (EventRecord * theEvent,SInt32 * sleepTime,RgnHandle * mouseRgn);
+#endif
 
 
 
@@ -96,9 +116,12 @@ static const OSType gFinderSignature = 'MACS';
 
 int main (int argc, const char * argv[]) 
 {
-	int			rc;
     int			optch;
-    static char	optstring[] = "vhpc";
+#ifdef __APPLE__
+    static char	optstring[] = "vhpcFD";
+#else
+    static char	optstring[] = "vhpD";
+#endif
 
     while ( (optch = getopt(argc, (char * const *)argv, optstring)) != -1)
     {
@@ -115,13 +138,20 @@ int main (int argc, const char * argv[])
 			case 'p':
 				printFileName = true;
 				break;
-#if !__LP64__
+			case 'D':
+				useDSStore = true;
+				break;
+#if defined(__APPLE__) && !__LP64__
 			case 'c':
 				os9comment = true;
 				break;
+#endif
+#ifdef __APPLE__
+			case 'F':
+				askFinder = true;
+				break;
 #endif
             default: // '?'
-                rc = 1;
                 PrintHelp();
                 return EX_USAGE;
         }
@@ -130,15 +160,120 @@ int main (int argc, const char * argv[])
     //all remaining arguments should be files
     for (; optind < argc; ++optind)
     {    
+#ifdef __APPLE__
 		if (os9comment)
 			PrintFileComment((char *)argv[optind]);
+		else if (askFinder)
+			PrintFinderComment((char *)argv[optind]);
+		else
+#endif
+		if (useDSStore)
+			PrintDSStoreComment((char *)argv[optind]);
 		else
 			PrintOSXComment((char *)argv[optind]);
 	}
     return EX_OK;
 }
 
+////////////////////////////////////////
+// Print the comment the Finder keeps in
+// the file's extended attributes; a single
+// getxattr, no Finder needed
+///////////////////////////////////////
+
 static void PrintOSXComment (char *path)
+{
+	char	comment[FC_MAX_COMMENT];
+	ssize_t	len;
+
+	len = FCGetComment(path, comment, sizeof(comment));
+	if (len == -1)
+	{
+		if (errno == EINVAL)
+			fprintf(stderr, "%s: Finder comment isn't a binary property list string\n", path);
+		else
+			perror(path);
+		return;
+	}
+	//if there is no comment, we don't print out anything
+	if (len == 0)
+		return;
+	
+	PrintComment(path, comment);
+}
+
+////////////////////////////////////////
+// Print the comment the Finder keeps for
+// the file in its folder's .DS_Store.  The
+// store is read once and kept for the
+// files after it in the same folder
+///////////////////////////////////////
+
+static void PrintDSStoreComment (char *path)
+{
+	static DSStore	*store = NULL;
+	static char		storeDir[PATH_MAX] = "";
+	char			dir[PATH_MAX];
+	char			name[PATH_MAX];
+	char			*slash;
+	const char		*comment;
+	size_t			len;
+
+	// the folder and the name in it, trailing slashes aside
+	len = strlen(path);
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+	if (len >= sizeof(dir))
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(ENAMETOOLONG));
+		return;
+	}
+	memcpy(dir, path, len);
+	dir[len] = '\0';
+	slash = strrchr(dir, '/');
+	strcpy(name, slash ? slash + 1 : dir);
+	if (!slash)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+
+	if (!*storeDir || strcmp(dir, storeDir))
+	{
+		DSClose(store);
+		store = DSOpen(dir);
+		strcpy(storeDir, dir);
+		
+		//a folder without a .DS_Store has no comments
+		if (!store && errno == EINVAL)
+			fprintf(stderr, "%s/%s: Not a readable .DS_Store\n", dir, DS_STORE_NAME);
+		else if (!store && errno != ENOENT)
+			fprintf(stderr, "%s/%s: %s\n", dir, DS_STORE_NAME, strerror(errno));
+	}
+	if (!store)
+		return;
+
+	comment = DSGetComment(store, name);
+	if (comment && *comment)
+		PrintComment(path, comment);
+}
+
+static void PrintComment (char *path, const char *comment)
+{
+	if (!printFileName)
+		printf("%s\n", comment);
+	else
+		printf("Comment for '%s':\n%s\n", path, comment);
+}
+
+#ifdef __APPLE__
+
+////////////////////////////////////////
+// Same, asking the Finder with Apple Events
+///////////////////////////////////////
+
+static void PrintFinderComment (char *path)
 {
 	OSErr	err = noErr;
     FSRef	fileRef;
@@ -192,10 +327,7 @@ static void PrintOSXComment (char *path)
 		return;
 	
 	//print out the comment
-	if (!printFileName)
-			printf("%s\n", (char *)&cStrCmt);
-		else
-			printf("Comment for '%s':\n%s\n", path, (char *)&cStrCmt);
+	PrintComment(path, (char *)&cStrCmt);
 }
 
 
@@ -254,15 +386,14 @@ static void PrintFileComment (char *path)
 	if (dt.ioDTActCount != 0) //if zero, that means no comment
 	{
 		strncpy((char *)&comment, (char *)&buf, dt.ioDTActCount);
-		if (!printFileName)
-			printf("%s\n", (char *)&comment);
-		else
-			printf("Comment for '%s':\n%s\n", path, (char *)&comment);
+		PrintComment(path, (char *)&comment);
 	}
 	return;
 #endif
 }
 
+#endif /* __APPLE__ */
+
 
 ////////////////////////////////////////
 // Print version and author to stdout
@@ -279,10 +410,16 @@ static void PrintVersion (void)
 
 static void PrintHelp (void)
 {
-    printf("usage: %s [-vhp] [file ...]\n", PROGRAM_STRING);
+#ifdef __APPLE__
+    printf("usage: %s [-vhpcFD] [file ...]\n", PROGRAM_STRING);
+#else
+    printf("usage: %s [-vhpD] [file ...]\n", PROGRAM_STRING);
+#endif
 }
 
 
+#ifdef __APPLE__
+
 #pragma mark -
 
 Boolean MyAEIdleCallback (
@@ -650,3 +787,5 @@ pascal OSErr MoreAEGetCFStringFromDescriptor(const AEDesc* pAEDesc, CFStringRef*
   }
   return (anErr);
 }//end MoreAEGetCFStringFromDescriptor
+
+#endif /* __APPLE__ */
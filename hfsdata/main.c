@@ -20,6 +20,22 @@
 
 /*  CHANGES
     
+    0.6 - --stats: the paths looked up and the calls and time of each phase
+          (path to FSRef, catalog lookup, alias, writing out), on stderr
+
+    0.5 - --image: the file is a path on the HFS+ volume in an image file or
+          device, looked up in its catalog without mounting it; only what the
+          catalog holds can be printed, so not -x, -A, -k, -o, -O or -e
+
+    0.4 - -o reads the comment from the kMDItemFinderComment extended attribute
+          instead of asking the Finder, which needn't be running
+
+    0.3 - --stdin0: NUL separated paths on stdin, looked up by a pool of threads
+          and printed a line each in the order they came
+
+    0.2 - Any number of flags at once, printed on one line separated by tabs
+          in the order given; the catalog is read once for all of them
+
     0.1 - First release of hfsdata
 
 */
@@ -60,6 +76,9 @@
 	-O	Mac OS 9 Finder comment						DONE
 	
 	-e	Show file pointed to by alias				DONE
+	
+	--stdin0	NUL separated paths on stdin instead of a file argument
+	--image		the paths are on the HFS+ volume in this image file or device
     
 */
 
@@ -84,44 +103,43 @@
 #define	kMacOSXComment				17
 #define	kMacOS9Comment				18
 #define	kAliasOriginal				19
+#define	kNumTypes					20
 
 /////////////// Includes /////////////////
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <Carbon/Carbon.h>
 #include <string.h>
 
+#include "../getfcomment/fcomment.h"
+#include "../lsmac/hfsimage.h"
+#include "../lsmac/stats.h"
+
 ////////////// Prototypes ////////////////
 
 	static OSErr PrintIsExtensionHidden (FSRef *fileRef);
 	static OSErr PrintAliasSource (FSRef *fileRef);
-	static OSErr PrintResourceForkLogicalSize (FSRef *fileRef);
-	static OSErr PrintResourceForkPhysicalSize (FSRef *fileRef);
-	static OSErr PrintDataForkLogicalSize (FSRef *fileRef);
-	static OSErr PrintDataForkPhysicalSize (FSRef *fileRef);
-	static OSErr PrintBothForksLogicalSize (FSRef *fileRef);
-	static OSErr PrintBothForksPhysicalSize (FSRef *fileRef);
-	static OSErr PrintDateCreated (FSRef *fileRef);
-	static OSErr PrintDateContentModified (FSRef *fileRef);
-	static OSErr PrintDateLastAccessed (FSRef *fileRef);
-	static OSErr PrintDateAttributeModified (FSRef *fileRef);
-	static OSErr PrintFileType (FSRef *fileRef);
-	static OSErr PrintCreatorCode (FSRef *fileRef);
+	static OSErr PrintAttributes (const char *path);
+	static OSErr PrintImageAttributes (const char *path);
+	static int RunBatch (void);
+	static void *BatchWorker (void *arg);
+	static FSCatalogInfoBitmap CatalogInfoNeeded (int type);
+	static OSErr PrintCatalogInfo (int type, const FSCatalogInfo *cinfo);
+	static OSErr PrintDate (const UTCDateTime *utcDateTime);
 	static OSErr PrintKind (FSRef *fileRef);
 	static OSErr PrintAppWhichOpensFile (FSRef *fileRef);
-	static OSErr PrintLabelName (FSRef *fileRef);
-	static OSErr PrintLabelNumber (FSRef *fileRef);
 	
 	static void OSTypeToStr(OSType aType, char *aStr);
 	static int UnixIsFolder (char *path);
 	static Boolean IsFolder (FSRef *fileRef);
 	static void HFSUniPStrToCString (HFSUniStr255 *uniStr, char *cstr);
 	static OSStatus FSMakePath(FSRef fileRef, UInt8 *path, UInt32 maxPathSize);
-	static OSErr FSGetDInfo(const FSRef* ref, DInfo *dInfo);
-	static OSErr FSGetFInfo(const FSRef* ref, FInfo *fInfo);
 	static short GetLabelNumber (short flags);
 	static OSErr GetDateTimeStringFromUTCDateTime (UTCDateTime *utcDateTime, char *dateTimeString);
 	
@@ -129,45 +147,64 @@
 	static void PrintVersion (void);
 	static void PrintHelp (void);
 	
-	static OSErr PrintOSXComment (FSRef	*fileRef);
+	static OSErr PrintOSXComment (const char *path);
 #if !__LP64__
 	static OSErr PrintOS9Comment (FSRef *fileRef);
 #endif
-	//AE functions from MoreAppleEvents.c, Apple's sample code
-	pascal OSErr MoreFEGetComment(const FSRef *pFSRefPtr, const FSSpecPtr pFSSpecPtr,Str255 pCommentStr,const AEIdleUPP pIdleProcUPP);
-	pascal void MoreAEDisposeDesc(AEDesc* desc);
-	pascal void MoreAENullDesc(AEDesc* desc);
-	pascal OSStatus MoreAEOCreateObjSpecifierFromFSRef(const FSRefPtr pFSRefPtr,AEDesc *pObjSpecifier);
-	pascal OSStatus MoreAEOCreateObjSpecifierFromCFURLRef(const CFURLRef pCFURLRef,AEDesc *pObjSpecifier);
-	pascal OSStatus MoreAESendEventReturnAEDesc(const AEIdleUPP    pIdleProcUPP, const AppleEvent  *pAppleEvent,const DescType    pDescType, AEDesc        *pAEDesc);
-	pascal OSStatus MoreAESendEventReturnPString(const AEIdleUPP pIdleProcUPP,const AppleEvent* pAppleEvent,Str255 pStr255);
-	pascal  OSStatus  MoreAEGetHandlerError(const AppleEvent* pAEReply);
-	pascal OSStatus MoreAESendEventReturnData(const AEIdleUPP    pIdleProcUPP,const AppleEvent  *pAppleEvent,DescType      pDesiredType,DescType*      pActualType,void*         pDataPtr,Size        pMaximumSize,Size         *pActualSize);
-	pascal OSErr MoreAEGetCFStringFromDescriptor(const AEDesc* pAEDesc, CFStringRef* pCFStringRef);
-	Boolean MyAEIdleCallback (EventRecord * theEvent,SInt32 * sleepTime,RgnHandle * mouseRgn);
-
-
-// Some MoreAppleEvents stuff I don't understand and don't want to
-            #define MoreAssert(x) (true)
-            #define MoreAssertQ(x)
-
-
 
 
 ///////////////  Definitions    //////////////
 
 #define		MAX_COMMENT_LENGTH	255
+#define		BATCH_WINDOW		4096	// paths read ahead of the output, --stdin0
+#define		BATCH_SIZE			256		// paths read at a time
+#define		OPT_STDIN0			256		// long options only
+#define		OPT_IMAGE			257
+#define		OPT_STATS			258
 #define		PROGRAM_STRING  	"hfsdata"
-#define		VERSION_STRING		"0.1"
+#define		VERSION_STRING		"0.6"
 #define		AUTHOR_STRING 		"Sveinbjorn Thordarson"
 #if __LP64__
-#define     USAGE_STRING        "hfsdata [-x|A|c|m|a|t|r|R|s|S|d|D|T|C|k|l|L|o|e] file\nor\nhfsdata [-hv]\n"
+#define     USAGE_STRING        "hfsdata [-xAcmatrRsSdDTCklLoe] [--image image] [--stats[=json]] file\nor\nhfsdata [-xAcmatrRsSdDTCklLoe] [--image image] [--stats[=json]] --stdin0\nor\nhfsdata [-hv]\n"
 #else
-#define     USAGE_STRING        "hfsdata [-x|A|c|m|a|t|r|R|s|S|d|D|T|C|k|l|L|o|O|e] file\nor\nhfsdata [-hv]\n"
+#define     USAGE_STRING        "hfsdata [-xAcmatrRsSdDTCklLoOe] [--image image] [--stats[=json]] file\nor\nhfsdata [-xAcmatrRsSdDTCklLoOe] [--image image] [--stats[=json]] --stdin0\nor\nhfsdata [-hv]\n"
 #endif
 
-// The Mac Four-Character Application Signature for the Finder
-static const OSType gFinderSignature = 'MACS';
+// the attributes asked for, in order
+static int			types[kNumTypes];
+static int			numTypes = 0;
+
+// where this thread prints them; stdout, or a worker's buffer
+static __thread FILE	*out;
+
+// --image: the volume the paths are on, read by every thread
+static HFSImage		*image = NULL;
+
+static struct option	longOptions[] =
+{
+	{ "stdin0",	no_argument,	NULL,	OPT_STDIN0 },
+	{ "image",	required_argument,	NULL,	OPT_IMAGE },
+	{ "stats",	optional_argument,	NULL,	OPT_STATS },
+	{ NULL,		0,				NULL,	0 }
+};
+
+/* --stdin0: a window of paths, each printed once its line is made up
+   and every line before it printed */
+typedef struct BatchSlot
+{
+	char		*path;
+	char		*line;			// from open_memstream
+	size_t		lineLen;
+	OSErr		err;
+	int			done;
+} BatchSlot;
+
+static BatchSlot		batch[BATCH_WINDOW];
+static unsigned long	batchRead, batchWork, batchPrint;	// paths read, taken by a worker, printed
+static int				batchEOF = false;
+static pthread_mutex_t	batchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	batchWorkCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	batchDoneCond = PTHREAD_COND_INITIALIZER;
 
 int main (int argc, const char * argv[]) 
 {
@@ -175,14 +212,37 @@ int main (int argc, const char * argv[])
     int			rc;
     int			optch;
 	char		*path;
-	FSRef		fileRef;
 	int			type;
+	int			i;
+	int			useStdin = false;
     static char	optstring[] = "vhxAcmatrRsSdDTCklLoOe";
 
-    while ( (optch = getopt(argc, (char * const *)argv, optstring)) != -1)
+    while ( (optch = getopt_long(argc, (char * const *)argv, optstring, longOptions, NULL)) != -1)
     {
         switch(optch)
         {
+            case OPT_STDIN0:
+                useStdin = true;
+                continue;
+            case OPT_IMAGE:
+                image = HFSImageOpen(optarg);
+                if (!image)
+                {
+                    fprintf(stderr, "%s: %s\n", optarg, (errno == EINVAL) ? "No HFS+ volume, or a damaged one" : strerror(errno));
+                    exit(1);
+                }
+                continue;
+            case OPT_STATS:
+                if (!optarg || !strcmp(optarg, "text"))
+                    StatsInit(STATS_TEXT);
+                else if (!strcmp(optarg, "json"))
+                    StatsInit(STATS_JSON);
+                else
+                {
+                    fprintf(stderr, "Illegal parameter: %s\nYou must specify one of the following: text, json\n", optarg);
+                    exit(1);
+                }
+                continue;
             case 'v':
                 PrintVersion();
                 return 0;
@@ -258,11 +318,36 @@ int main (int argc, const char * argv[])
                 PrintUsage();
                 return 0;
         }
+
+		// each attribute once, in the order asked for
+		for (i = 0; i < numTypes && types[i] != type; i++)
+			;
+		if (i == numTypes)
+			types[numTypes++] = type;
     }
 	
 	
     
-	//path to file passed as argument
+	if (numTypes == 0)
+	{
+		PrintHelp();
+		exit(0);
+	}
+	
+	// --stats goes out however we exit
+	atexit(StatsPrint);
+	
+	// paths on stdin, or the one file passed as argument
+	if (useStdin)
+	{
+		if (optind != argc)
+		{
+			PrintUsage();
+			exit(1);
+		}
+		exit(RunBatch());
+	}
+	
 	path = (char *)argv[optind];
 	if (path == NULL)
 	{
@@ -270,93 +355,323 @@ int main (int argc, const char * argv[])
 		exit(0);
 	}
 	
+	out = stdout;
+	err = PrintAttributes(path);
+	
+	exit(err);
+
+	return err;
+}
+
+/*//////////////////////////////////////
+// Print the attributes asked for of the
+// file at path on one line, separated by
+// tabs.  On an error the line ends early,
+// so that with --stdin0 there's still a
+// line for each path
+/////////////////////////////////////*/
+static OSErr PrintAttributes (const char *path)
+{
+	OSErr		err = noErr;
+	FSRef		fileRef;
+	int			i;
+	FSCatalogInfoBitmap	cinfoMap = 0;
+	FSCatalogInfo		cinfo;
+	uint64_t			start;
+
+	StatsItem();
+	if (image)
+		return PrintImageAttributes(path);
+
 	if (access(path, R_OK|F_OK) == -1)
 	{
 		perror(path);
-		exit(1);
+		putc('\n', out);
+		return 1;
 	}
 	
 	// Get file ref to the file or folder pointed to by the path
+	start = StatsBegin();
     err = FSPathMakeRef((unsigned char *)path, &fileRef, NULL);
+	StatsEnd(STATS_MAKEREF, start);
 	if (err != noErr) 
     {
         fprintf(stderr, "FSPathMakeRef(): Error %d returned when getting file reference for %s\n", err, path);
-		exit(1);
+		putc('\n', out);
+		return 1;
     }
 	
-	switch(type)
+	// one catalog lookup covers every attribute that comes from the catalog
+	for (i = 0; i < numTypes; i++)
+		cinfoMap |= CatalogInfoNeeded(types[i]);
+	if (cinfoMap)
 	{
-		case kSuffixHidden:
-			err = PrintIsExtensionHidden(&fileRef);
-			break;
-		case kAppForFile:
-			err = PrintAppWhichOpensFile(&fileRef);
-			break;
-		case kDateCreated:
-			err = PrintDateCreated(&fileRef);
-			break;
-		case kDateModified:
-			err = PrintDateContentModified(&fileRef);
-			break;
-		case kDateAccessed:
-			err = PrintDateLastAccessed(&fileRef);
-			break;
-		case kDateAttrMod:
-			err = PrintDateAttributeModified(&fileRef);
-			break;
-		case kLogicalResourceForkSize:
-			err = PrintResourceForkLogicalSize(&fileRef);
-			break;
-		case kPhysicalResourceForkSize:
-			err = PrintResourceForkPhysicalSize(&fileRef);
-			break;
-		case kLogicalTotalForkSize:
-			err = PrintBothForksLogicalSize(&fileRef);
-			break;
-		case kPhysicalTotalForkSize:
-			err = PrintBothForksPhysicalSize(&fileRef);
-			break;
-		case kLogicalDataForkSize:
-			err = PrintDataForkLogicalSize(&fileRef);
-			break;
-		case kPhysicalDataForkSize:
-			err = PrintDataForkPhysicalSize(&fileRef);
-			break;
-		case kFileTypeCode:
-			err = PrintFileType(&fileRef);
-			break;
-		case kCreatorTypeCode:
-			err = PrintCreatorCode(&fileRef);
-			break;
-		case kFileKind:
-			err = PrintKind(&fileRef);
-			break;
-		case kLabelNumeric:
-			err = PrintLabelNumber(&fileRef);
-			break;
-		case kLabelName:
-			err = PrintLabelName(&fileRef);
-			break;
-		case kMacOSXComment:
-			err = PrintOSXComment(&fileRef);
-			break;
+		start = StatsBegin();
+		err = FSGetCatalogInfo(&fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
+		StatsEnd(STATS_STAT, start);
+		if (err != noErr)
+		{
+			fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information for %s\n", err, path);
+			putc('\n', out);
+			return 1;
+		}
+	}
+	
+	// and the attributes are printed on one line, separated by tabs
+	for (i = 0; i < numTypes && err == noErr; i++)
+	{
+		if (i)
+			putc('\t', out);
+		
+		switch(types[i])
+		{
+			case kSuffixHidden:
+				err = PrintIsExtensionHidden(&fileRef);
+				break;
+			case kAppForFile:
+				err = PrintAppWhichOpensFile(&fileRef);
+				break;
+			case kFileKind:
+				err = PrintKind(&fileRef);
+				break;
+			case kMacOSXComment:
+				err = PrintOSXComment(path);
+				break;
 #if !__LP64__
-		case kMacOS9Comment:
-			err = PrintOS9Comment(&fileRef);
-			break;
+			case kMacOS9Comment:
+				err = PrintOS9Comment(&fileRef);
+				break;
 #endif
-		case kAliasOriginal:
-			err = PrintAliasSource(&fileRef);
-			break;
+			case kAliasOriginal:
+				start = StatsBegin();
+				err = PrintAliasSource(&fileRef);
+				StatsEnd(STATS_ALIAS, start);
+				break;
+			default:
+				err = PrintCatalogInfo(types[i], &cinfo);
+				break;
+		}
 	}
+	putc('\n', out);
 	
-	exit(err);
+	return err;
+}
 
+/*//////////////////////////////////////
+// --image: PrintAttributes for a path on
+// the image's volume, with the catalog
+// information made up from its record.
+// Attributes that need the File Manager
+// or Launch Services can't be printed
+/////////////////////////////////////*/
+static OSErr PrintImageAttributes (const char *path)
+{
+	OSErr			err = noErr;
+	HFSImageItem	item;
+	FSCatalogInfo	cinfo;
+	FInfo			*finderInfo = (FInfo *)cinfo.finderInfo;
+	int				i;
+	uint64_t		start = StatsBegin();
+	int				rc;
+
+	rc = HFSImageLookup(image, path, &item);
+	StatsEnd(STATS_STAT, start);
+	if (rc == -1)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		putc('\n', out);
+		return 1;
+	}
+
+	// a folder's frFlags are where a file's fdFlags are
+	memset(&cinfo, 0, sizeof(cinfo));
+	cinfo.nodeFlags = item.isFolder ? kFSNodeIsDirectoryMask : 0;
+	finderInfo->fdType = item.type;
+	finderInfo->fdCreator = item.creator;
+	finderInfo->fdFlags = item.flags;
+	cinfo.createDate.lowSeconds = item.createDate;
+	cinfo.contentModDate.lowSeconds = item.contentModDate;
+	cinfo.attributeModDate.lowSeconds = item.attributeModDate;
+	cinfo.accessDate.lowSeconds = item.accessDate;
+	cinfo.dataLogicalSize = item.dataLogical;
+	cinfo.dataPhysicalSize = item.dataPhysical;
+	cinfo.rsrcLogicalSize = item.rsrcLogical;
+	cinfo.rsrcPhysicalSize = item.rsrcPhysical;
+
+	for (i = 0; i < numTypes && err == noErr; i++)
+	{
+		if (i)
+			putc('\t', out);
+		
+		if (CatalogInfoNeeded(types[i]))
+			err = PrintCatalogInfo(types[i], &cinfo);
+		else
+		{
+			fprintf(stderr, "%s: Only catalog information can be read from an image\n", path);
+			err = 1;
+		}
+	}
+	putc('\n', out);
+	
 	return err;
 }
 
 #pragma mark -
 
+/*//////////////////////////////////////
+// --stdin0: read NUL separated paths from
+// stdin a batch at a time, hand them to a
+// thread per processor and print their
+// lines in the order the paths came.
+// Returns the exit status, 1 if any path
+// failed
+/////////////////////////////////////*/
+static int RunBatch (void)
+{
+	pthread_t	*threads;
+	long		numThreads, i, n;
+	BatchSlot	*slot;
+	char		*buf = NULL;
+	size_t		bufSize = 0;
+	uint64_t	start;
+	int			eof = false;
+	int			status = 0;
+
+	numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads < 1)
+		numThreads = 1;
+	
+	// Mac OS 9 comments come from the Desktop Database one at a time
+	for (i = 0; i < numTypes; i++)
+		if (types[i] == kMacOS9Comment)
+			numThreads = 1;
+	
+	threads = malloc(numThreads * sizeof(pthread_t));
+	if (!threads)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < numThreads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, BatchWorker, NULL) != 0)
+		{
+			fprintf(stderr, "pthread_create(): Error creating worker thread\n");
+			exit(1);
+		}
+	}
+
+	while (!eof || batchPrint < batchRead)
+	{
+		// fill the free slots with the next batch of paths; only this
+		// thread changes batchRead and batchPrint, and no worker looks
+		// at a slot past batchRead
+		for (n = 0; !eof && n < BATCH_SIZE && batchRead + n - batchPrint < BATCH_WINDOW; n++)
+		{
+			if (getdelim(&buf, &bufSize, '\0', stdin) == -1)
+			{
+				eof = true;
+				break;
+			}
+			slot = &batch[(batchRead + n) % BATCH_WINDOW];
+			slot->path = strdup(buf);
+			if (!slot->path)
+			{
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+			slot->line = NULL;
+			slot->done = false;
+		}
+
+		pthread_mutex_lock(&batchLock);
+		batchRead += n;
+		batchEOF = eof;
+		pthread_cond_broadcast(&batchWorkCond);
+
+		// print the lines that are next in order, and wait for more
+		// unless there's room to read ahead
+		for (;;)
+		{
+			while (batchPrint < batchRead && batch[batchPrint % BATCH_WINDOW].done)
+			{
+				slot = &batch[batchPrint % BATCH_WINDOW];
+				pthread_mutex_unlock(&batchLock);
+				
+				start = StatsBegin();
+				fwrite(slot->line, 1, slot->lineLen, stdout);
+				StatsEnd(STATS_WRITE, start);
+				if (slot->err != noErr)
+					status = 1;
+				free(slot->line);
+				free(slot->path);
+				
+				pthread_mutex_lock(&batchLock);
+				batchPrint++;
+			}
+			if (batchPrint == batchRead && eof)
+				break;
+			if (!eof && batchRead - batchPrint < BATCH_WINDOW)
+				break;
+			pthread_cond_wait(&batchDoneCond, &batchLock);
+		}
+		pthread_mutex_unlock(&batchLock);
+	}
+
+	for (i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(buf);
+	
+	if (fflush(stdout) == EOF)
+	{
+		perror("stdout");
+		return 1;
+	}
+	return status;
+}
+
+/*//////////////////////////////////////
+// Make up the line of each path taken from
+// the window into a buffer of its own,
+// until stdin runs dry
+/////////////////////////////////////*/
+static void *BatchWorker (void *arg)
+{
+	BatchSlot		*slot;
+	unsigned long	seq;
+
+	pthread_mutex_lock(&batchLock);
+	for (;;)
+	{
+		while (batchWork == batchRead && !batchEOF)
+			pthread_cond_wait(&batchWorkCond, &batchLock);
+		if (batchWork == batchRead)
+			break;
+		seq = batchWork++;
+		slot = &batch[seq % BATCH_WINDOW];
+		pthread_mutex_unlock(&batchLock);
+
+		out = open_memstream(&slot->line, &slot->lineLen);
+		if (!out)
+		{
+			perror("open_memstream");
+			exit(1);
+		}
+		slot->err = PrintAttributes(slot->path);
+		fclose(out);
+
+		pthread_mutex_lock(&batchLock);
+		slot->done = true;
+		if (seq == batchPrint)
+			pthread_cond_signal(&batchDoneCond);
+	}
+	pthread_mutex_unlock(&batchLock);
+	return NULL;
+}
+
+#pragma mark -
+
 ////////////////////////////////////////
 // Print whether the file is set to show
 // its suffix in the filename
@@ -374,9 +689,9 @@ static OSErr PrintIsExtensionHidden (FSRef *fileRef)
 	}
 			
 	if (infoRecord.flags & kLSItemInfoExtensionIsHidden)
-		printf("Yes\n");
+		fprintf(out, "Yes");
 	else
-		printf("No\n");
+		fprintf(out, "No");
 	
 	return err;
 }
@@ -389,7 +704,7 @@ static OSErr PrintIsExtensionHidden (FSRef *fileRef)
 static OSErr PrintAliasSource (FSRef *fileRef)
 {
     OSErr	err = noErr;
-    static char	srcPath[2048];
+    char	srcPath[2048];
     Boolean	isAlias, isFolder;
 	FSRef	aliasRef;
     
@@ -406,316 +721,150 @@ static OSErr PrintAliasSource (FSRef *fileRef)
         return TRUE;
     }
     
-    //resolve alias --> get file reference to file
-    err = FSResolveAliasFile (fileRef, TRUE, &isFolder, &isAlias);
+    //resolve alias --> get file reference to file, leaving the alias's own for the other flags
+    aliasRef = *fileRef;
+    err = FSResolveAliasFile (&aliasRef, TRUE, &isFolder, &isAlias);
     if (err != noErr)
     {
         fprintf(stderr, "Error resolving alias.\n");
         return err;
     }
-    
-    //get path to file that alias points to
-    err = FSMakePath(*fileRef, (char *)&srcPath, strlen(srcPath));
-    if (err != noErr)
-	{
-		fprintf(stderr, "Error getting path from file reference\n");
-		return err;
-    }
-	printf("%s\n", &srcPath);
-}
-
-
-
-
-
-
-#pragma mark -
-
-static OSErr PrintResourceForkLogicalSize (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoRsrcSizes;
-	FSCatalogInfo		cinfo;
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	printf("%llu\n", cinfo.rsrcLogicalSize);
-	return err;
-}
-
-static OSErr PrintResourceForkPhysicalSize (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoRsrcSizes;
-	FSCatalogInfo		cinfo;
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	printf("%llu\n", cinfo.rsrcPhysicalSize);
-	return err;
-}
-
-
-static OSErr PrintDataForkLogicalSize (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoDataSizes;
-	FSCatalogInfo		cinfo;
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	printf("%llu\n", cinfo.dataLogicalSize);
-	return err;
-}
-
-
-static OSErr PrintDataForkPhysicalSize (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoDataSizes;
-	FSCatalogInfo		cinfo;
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	printf("%llu\n", cinfo.dataPhysicalSize);
-	return err;
-}
-
-static OSErr PrintBothForksLogicalSize (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoDataSizes+kFSCatInfoRsrcSizes;
-	FSCatalogInfo		cinfo;
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	printf("%llu\n", cinfo.rsrcLogicalSize + cinfo.dataLogicalSize);
-	return err;
-}
-
-static OSErr PrintBothForksPhysicalSize (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoDataSizes+kFSCatInfoRsrcSizes;
-	FSCatalogInfo		cinfo;
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	printf("%llu\n", cinfo.dataPhysicalSize + cinfo.rsrcPhysicalSize);
-	return err;
-}
-
-#pragma mark -
-
-static OSErr PrintDateCreated (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoCreateDate;
-	FSCatalogInfo		cinfo;
-	char				dateCreatedString[255];
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	err = GetDateTimeStringFromUTCDateTime(&cinfo.createDate, (char *)&dateCreatedString);
-	if (err != noErr)
-	{
-		fprintf(stderr, "GetDateTimeStringFromUTCDateTime(): Error %d generating date string\n", err);
-        return err;
-	}
-	printf("%s\n", &dateCreatedString);
-	
-	return err;
-}
-
-static OSErr PrintDateContentModified (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoContentMod;
-	FSCatalogInfo		cinfo;
-	char				dateString[255];
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	err = GetDateTimeStringFromUTCDateTime(&cinfo.contentModDate, (char *)&dateString);
-	if (err != noErr)
-	{
-		fprintf(stderr, "GetDateTimeStringFromUTCDateTime(): Error %d generating date string\n", err);
-        return err;
-	}
-	printf("%s\n", &dateString);
-	
-	return err;
-}
-
-static OSErr PrintDateLastAccessed (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoAccessDate;
-	FSCatalogInfo		cinfo;
-	char				dateString[255];
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	err = GetDateTimeStringFromUTCDateTime(&cinfo.accessDate, (char *)&dateString);
-	if (err != noErr)
-	{
-		fprintf(stderr, "GetDateTimeStringFromUTCDateTime(): Error %d generating date string\n", err);
-        return err;
-	}
-	printf("%s\n", &dateString);
-	
-	return err;
-}
-
-static OSErr PrintDateAttributeModified (FSRef *fileRef)
-{
-	OSErr				err = noErr;
-	FSCatalogInfoBitmap cinfoMap = kFSCatInfoAttrMod;
-	FSCatalogInfo		cinfo;
-	char				dateString[255];
-	
-	err = FSGetCatalogInfo (fileRef, cinfoMap, &cinfo, NULL, NULL, NULL);
-	if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d returned when retrieving catalog information\n", err);
-        return err;
-    }
-	
-	err = GetDateTimeStringFromUTCDateTime(&cinfo.attributeModDate, (char *)&dateString);
-	if (err != noErr)
+    
+    //get path to file that alias points to
+    err = FSMakePath(aliasRef, (char *)&srcPath, sizeof(srcPath));
+    if (err != noErr)
 	{
-		fprintf(stderr, "GetDateTimeStringFromUTCDateTime(): Error %d generating date string\n", err);
-        return err;
-	}
-	printf("%s\n", &dateString);
-	
-	return err;
+		fprintf(stderr, "Error getting path from file reference\n");
+		return err;
+    }
+	fprintf(out, "%s", srcPath);
+	return noErr;
 }
 
+
+
+
+
+
 #pragma mark -
 
-static OSErr PrintFileType (FSRef *fileRef)
+/*//////////////////////////////////////
+// The catalog information an attribute
+// is printed from, 0 if it isn't
+/////////////////////////////////////*/
+static FSCatalogInfoBitmap CatalogInfoNeeded (int type)
 {
-	FSSpec		fileSpec;
-    FInfo 		finderInfo;
-	OSErr		err = noErr;
-	char		fileType[5] = "\0";
-
-	//if it's a folder
-	if (IsFolder(fileRef))
+	switch(type)
 	{
-		printf("fold\n");
-		return 0;
+		case kDateCreated:
+			return kFSCatInfoCreateDate;
+		case kDateModified:
+			return kFSCatInfoContentMod;
+		case kDateAccessed:
+			return kFSCatInfoAccessDate;
+		case kDateAttrMod:
+			return kFSCatInfoAttrMod;
+		case kLogicalResourceForkSize:
+		case kPhysicalResourceForkSize:
+			return kFSCatInfoRsrcSizes;
+		case kLogicalDataForkSize:
+		case kPhysicalDataForkSize:
+			return kFSCatInfoDataSizes;
+		case kLogicalTotalForkSize:
+		case kPhysicalTotalForkSize:
+			return kFSCatInfoDataSizes | kFSCatInfoRsrcSizes;
+		case kFileTypeCode:
+		case kCreatorTypeCode:
+		case kLabelNumeric:
+		case kLabelName:
+			return kFSCatInfoNodeFlags | kFSCatInfoFinderInfo;
 	}
+	return 0;
+}
 
-	// retrieve filespec from file ref
-    err = FSGetCatalogInfo (fileRef, NULL, NULL, NULL, &fileSpec, NULL);
-    if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d getting file spec from file reference\n", err);
-        return err;
-    }
-	// get Finder File Info
-	err = FSGetFInfo (fileRef, &finderInfo);
-	if (err != noErr)
+/*//////////////////////////////////////
+// Print an attribute from the catalog
+// information CatalogInfoNeeded() asked
+// for.  A folder's type and creator are
+// always 'fold' and 'MACS'
+/////////////////////////////////////*/
+static OSErr PrintCatalogInfo (int type, const FSCatalogInfo *cinfo)
+{
+	static char	labelNames[8][8] = { "None", "Red", "Orange", "Yellow", "Green", "Blue", "Purple", "Gray" };
+	const FInfo	*finderInfo = (const FInfo *)cinfo->finderInfo;
+	const DInfo	*dInfo = (const DInfo *)cinfo->finderInfo;
+	Boolean		isFolder = (cinfo->nodeFlags & kFSNodeIsDirectoryMask) == kFSNodeIsDirectoryMask;
+	char		typeStr[5];
+	int			labelNum;
+
+	switch(type)
 	{
-		fprintf(stderr, "FSpGetFInfo(): Error %d getting file Finder File Info from file spec\n", err);
-		return err;
+		case kDateCreated:
+			return PrintDate(&cinfo->createDate);
+		case kDateModified:
+			return PrintDate(&cinfo->contentModDate);
+		case kDateAccessed:
+			return PrintDate(&cinfo->accessDate);
+		case kDateAttrMod:
+			return PrintDate(&cinfo->attributeModDate);
+		
+		case kLogicalResourceForkSize:
+			fprintf(out, "%llu", cinfo->rsrcLogicalSize);
+			break;
+		case kPhysicalResourceForkSize:
+			fprintf(out, "%llu", cinfo->rsrcPhysicalSize);
+			break;
+		case kLogicalDataForkSize:
+			fprintf(out, "%llu", cinfo->dataLogicalSize);
+			break;
+		case kPhysicalDataForkSize:
+			fprintf(out, "%llu", cinfo->dataPhysicalSize);
+			break;
+		case kLogicalTotalForkSize:
+			fprintf(out, "%llu", cinfo->rsrcLogicalSize + cinfo->dataLogicalSize);
+			break;
+		case kPhysicalTotalForkSize:
+			fprintf(out, "%llu", cinfo->dataPhysicalSize + cinfo->rsrcPhysicalSize);
+			break;
+		
+		case kFileTypeCode:
+		case kCreatorTypeCode:
+			if (isFolder)
+			{
+				fprintf(out, "%s", type == kFileTypeCode ? "fold" : "MACS");
+				break;
+			}
+			OSTypeToStr(type == kFileTypeCode ? finderInfo->fdType : finderInfo->fdCreator, typeStr);
+			fprintf(out, "%s", typeStr);
+			break;
+		
+		case kLabelNumeric:
+		case kLabelName:
+			labelNum = GetLabelNumber(isFolder ? dInfo->frFlags : finderInfo->fdFlags);
+			if (type == kLabelNumeric)
+				fprintf(out, "%d", labelNum);
+			else
+				fprintf(out, "%s", (char *)&labelNames[labelNum]);
+			break;
 	}
-	
-	/* get creator type string */
-	OSTypeToStr(finderInfo.fdType, fileType);
-	
-	//print it
-	if (strlen(fileType) != 0)
-		printf("%s\n", fileType);
-	
-	return 0;
+	return noErr;
 }
 
-
-static OSErr PrintCreatorCode (FSRef *fileRef)
+static OSErr PrintDate (const UTCDateTime *utcDateTime)
 {
-	FSSpec		fileSpec;
-    FInfo 		finderInfo;
 	OSErr		err = noErr;
-	char		creatorType[5] = "\0";
+	UTCDateTime	date = *utcDateTime;
+	char		dateString[255];
 	
-	//if it's a folder
-	if (IsFolder(fileRef))
-	{
-		printf("MACS\n");
-		return 0;
-	}
-
-	// retrieve filespec from file ref
-    err = FSGetCatalogInfo (fileRef, NULL, NULL, NULL, &fileSpec, NULL);
-    if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d getting file spec from file reference\n", err);
-        return err;
-    }
-	// get Finder File Info
-	err = FSGetFInfo (fileRef, &finderInfo);
+	err = GetDateTimeStringFromUTCDateTime(&date, (char *)&dateString);
 	if (err != noErr)
 	{
-		fprintf(stderr, "FSpGetFInfo(): Error %d getting file Finder File Info from file spec\n", err);
-		return err;
+		fprintf(stderr, "GetDateTimeStringFromUTCDateTime(): Error %d generating date string\n", err);
+        return err;
 	}
+	fprintf(out, "%s", dateString);
 	
-	/* get creator type string */
-	OSTypeToStr(finderInfo.fdCreator, creatorType);
-	
-	//print it
-	if (strlen(creatorType) != 0)
-		printf("%s\n", creatorType);
-
-	return 0;
+	return err;
 }
 
 #pragma mark -
@@ -732,7 +881,7 @@ static OSErr PrintKind (FSRef *fileRef)
 	
 	CFStringGetCString(kindString, (char *)&cKindStr, 1024, CFStringGetSystemEncoding());
 	
-	printf("%s\n", cKindStr);
+	fprintf(out, "%s", cKindStr);
 	return 0;
 }
 
@@ -754,7 +903,7 @@ static OSErr PrintAppWhichOpensFile (FSRef *fileRef)
 	err = LSGetApplicationForItem (fileRef, roleMask, &appRef,NULL);
 	if (err == kLSApplicationNotFoundErr)
 	{
-		printf("This file has no preferred application set.\n", err);
+		fprintf(out, "This file has no preferred application set.");
 		return 0;
 	}
 	if (err != noErr)
@@ -772,94 +921,7 @@ static OSErr PrintAppWhichOpensFile (FSRef *fileRef)
 	}
 
 	//print out path to application which will open file
-	printf("%s\n", appPath);
-	return noErr;
-}
-
-#pragma mark -
-
-static OSErr PrintLabelName (FSRef *fileRef)
-{
-	static char	labelNames[8][8] = { "None", "Red", "Orange", "Yellow", "Green", "Blue", "Purple", "Gray" };
-	FSSpec		fileSpec;
-    FInfo 		finderInfo;
-	DInfo       dInfo;
-	OSErr		err = noErr;
-	int			labelNum = 0;
-
-	/* retrieve filespec from file ref */
-    err = FSGetCatalogInfo (fileRef, NULL, NULL, NULL, &fileSpec, NULL);
-    if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d getting file spec from file reference\n", err);
-        return err;
-    }
-	
-	if (IsFolder(fileRef))
-	{
-		err = FSGetDInfo (fileRef, &dInfo);
-		if (err != noErr)
-		{
-			fprintf(stderr, "FSpGetFInfo(): Error %d getting file Finder Directory Info from file spec\n", err);
-			return err;
-		}
-		labelNum = GetLabelNumber(dInfo.frFlags);
-	}
-	else
-	{
-		err = FSGetFInfo (fileRef, &finderInfo);
-		if (err != noErr)
-		{
-			fprintf(stderr, "FSpGetFInfo(): Error %d getting file Finder File Info from file spec\n", err);
-			return err;
-		}
-		labelNum = GetLabelNumber(finderInfo.fdFlags);
-	}
-	
-	printf("%s\n", (char *)&labelNames[labelNum]);
-	
-	return noErr;
-}
-
-static OSErr PrintLabelNumber (FSRef *fileRef)
-{
-	FSSpec		fileSpec;
-    FInfo 		finderInfo;
-	DInfo       dInfo;
-	OSErr		err = noErr;
-	int			labelNum = 0;
-
-	/* retrieve filespec from file ref */
-    err = FSGetCatalogInfo (fileRef, NULL, NULL, NULL, &fileSpec, NULL);
-    if (err != noErr) 
-    {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d getting file spec from file reference\n", err);
-        return err;
-    }
-	
-	if (IsFolder(fileRef))
-	{
-		err = FSGetDInfo (fileRef, &dInfo);
-		if (err != noErr)
-		{
-			fprintf(stderr, "FSpGetFInfo(): Error %d getting file Finder Directory Info from file spec\n", err);
-			return err;
-		}
-		labelNum = GetLabelNumber(dInfo.frFlags);
-	}
-	else
-	{
-		err = FSGetFInfo (fileRef, &finderInfo);
-		if (err != noErr)
-		{
-			fprintf(stderr, "FSpGetFInfo(): Error %d getting file Finder File Info from file spec\n", err);
-			return err;
-		}
-		labelNum = GetLabelNumber(finderInfo.fdFlags);
-	}
-	
-	printf("%d\n", labelNum);
-	
+	fprintf(out, "%s", appPath);
 	return noErr;
 }
 
@@ -938,29 +1000,6 @@ static OSStatus FSMakePath(FSRef fileRef, UInt8 *path, UInt32 maxPathSize)
     return ( result );
 }
 
-/*//////////////////////////////////////
-// Returns directory info structure of 
-// file spec
-/////////////////////////////////////*/
-static OSErr FSGetDInfo(const FSRef* ref, DInfo *dInfo)
-{
-    FSCatalogInfo cinfo;
-    OSErr err = FSGetCatalogInfo(ref, kFSCatInfoFinderInfo, &cinfo, NULL, NULL, NULL);
-    if (err != noErr)
-        return err;
-    *dInfo = *(DInfo*)cinfo.finderInfo;
-	return err;
-}
-static OSErr FSGetFInfo(const FSRef* ref, FInfo *fInfo)
-{
-    FSCatalogInfo cinfo;
-    OSErr err = FSGetCatalogInfo(ref, kFSCatInfoFinderInfo, &cinfo, NULL, NULL, NULL);
-    if (err != noErr)
-        return err;
-    *fInfo = *(FInfo*)cinfo.finderInfo;
-	return err;
-}
-
 /*//////////////////////////////////////
 // Checks bits 1-3 of fdFlags and frFlags
 // values in FInfo and DInfo structs
@@ -1046,7 +1085,8 @@ static void PrintHelp (void)
 {
 	puts("hfsdata - retrieve Mac meta-data for a file or folder");
 	puts("");
-	puts("Supported flags:");
+	puts("Supported flags, any number of them; the values are printed on one");
+	puts("line, separated by tabs, in the order the flags are given:");
 	puts("");
 	puts("\t-e  Prints the path of the file pointed to by a given alias");
 	puts("\t-x  Prints whether file's suffix is hidden by the Finder or not");
@@ -1077,45 +1117,40 @@ static void PrintHelp (void)
 	puts("\t-O  Prints the file's Mac OS 9 Desktop Database comment");
 #endif
 	puts("");
+	puts("\t--stdin0  Reads NUL separated paths from stdin, as find -print0 writes");
+	puts("\t          them, instead of a file argument; prints a line for each");
+	puts("\t--image image  The paths are on the HFS+ volume in an image file or");
+	puts("\t          device, read without mounting it; catalog flags only");
+	puts("\t--stats[=json]  When done, prints on stderr how many paths were looked");
+	puts("\t          up and the calls and time of each phase of it");
+	puts("");
 	
 }
 
 #pragma mark -
 
-static OSErr PrintOSXComment (FSRef	*fileRef)
+/*//////////////////////////////////////
+// The Finder comment, from the extended
+// attribute the Finder keeps it in
+/////////////////////////////////////*/
+static OSErr PrintOSXComment (const char *path)
 {
-	OSErr	err = noErr;
-    FSSpec	fileSpec;
-	Str255	comment = "\p";
-	char	cStrCmt[255] = "\0";
-	AEIdleUPP inIdleProc = NewAEIdleUPP(&MyAEIdleCallback);
-        
-            //retrieve filespec from file ref
-            err = FSGetCatalogInfo (fileRef, NULL, NULL, NULL, &fileSpec, NULL);
-            if (err != noErr)
-            {
-				fprintf(stderr, "FSGetCatalogInfo(): Error %d getting file spec for %s\n", err);
-                return err;
-            }
-    
-    ///////////// oK, now we can go about getting the comment /////////////
+	char	comment[FC_MAX_COMMENT];
+	ssize_t	len;
 
-	// call the apple event routine. I'm not going to pretend I understand what's going on
-	// in all those horribly kludgy functions, but at least it works.
-	err = MoreFEGetComment(fileRef, &fileSpec, comment, inIdleProc);
-	if (err)
+	len = FCGetComment(path, comment, sizeof(comment));
+	if (len == -1)
 	{
-		fprintf(stderr, "Error %d getting comment\n", err);
-		if (err == -600)
-			fprintf(stderr, "Finder is not running\n", err);//requires Finder to be running
-		return err;
+		if (errno == EINVAL)
+			fprintf(stderr, "%s: Finder comment isn't a binary property list string\n", path);
+		else
+			perror(path);
+		return ioErr;
 	}
-	//convert pascal string to c string
-	strncpy((char *)&cStrCmt, (unsigned char *)&comment+1, comment[0]);
 	
 	//if there is a comment, we print it
-	if (strlen((char *)&cStrCmt))
-		printf("%s\n", (char *)&cStrCmt);
+	if (len)
+		fprintf(out, "%s", comment);
 		
 	return noErr;
 }
@@ -1159,377 +1194,8 @@ static OSErr PrintOS9Comment (FSRef *fileRef)
 	if (dt.ioDTActCount != 0) //if zero, that means no comment
 	{
 		strncpy((char *)&comment, (char *)&buf, dt.ioDTActCount);
-		printf("%s\n", (char *)&comment);
+		fprintf(out, "%s", (char *)&comment);
 	}
 	return noErr;
 }
 #endif
-
-
-
-#pragma mark -
-
-Boolean MyAEIdleCallback (
-   EventRecord * theEvent,
-   SInt32 * sleepTime,
-   RgnHandle * mouseRgn)
-{
-
-	return 0;
-}
-
-pascal OSErr MoreFEGetComment(const FSRef *pFSRefPtr, const FSSpecPtr pFSSpecPtr,Str255 pCommentStr,const AEIdleUPP pIdleProcUPP)
-{
-  AppleEvent tAppleEvent = {typeNull,NULL};  //  If you always init AEDescs, it's always safe to dispose of them.
-  AEDesc tAEDesc = {typeNull,NULL};
-  OSErr anErr = noErr;
-
-  if (NULL == pIdleProcUPP)  // the idle proc is required
-  {
-	fprintf(stderr, "No proc pointer\n");
-    return paramErr;
-  }
-  anErr = MoreAEOCreateObjSpecifierFromFSRef(pFSRefPtr,&tAEDesc);
-  if (anErr)
-  {
-	fprintf(stderr, "Error creating objspecifier from fsspec\n");
-    return paramErr;
-  }
-  if (noErr == anErr)
-  {
-    AEBuildError  tAEBuildError;
-
-    anErr = AEBuildAppleEvent(
-              kAECoreSuite,kAEGetData,
-          typeApplSignature,&gFinderSignature,sizeof(OSType),
-              kAutoGenerateReturnID,kAnyTransactionID,
-              &tAppleEvent,&tAEBuildError,
-              "'----':obj {form:prop,want:type(prop),seld:type(comt),from:(@)}",&tAEDesc);
-
-        // always dispose of AEDescs when you are finished with them
-        (void) MoreAEDisposeDesc(&tAEDesc);
-
-    if (noErr == anErr)
-    {  
-      //  Send the event.
-      anErr = MoreAESendEventReturnPString(pIdleProcUPP,&tAppleEvent,pCommentStr);
-	  if (anErr)
-	  {
-		fprintf(stderr, "Error sending event to get pascal string\n");
-	  }
-      // always dispose of AEDescs when you are finished with them
-      (void) MoreAEDisposeDesc(&tAppleEvent);
-    }
-	else
-	{
-		fprintf(stderr, "Error building Apple Event\n");
-	}
-  }
-  return anErr;
-}  // end MoreFEGetComment
-
-/********************************************************************************
-  Send an Apple event to the Finder to get the finder comment of the item 
-  specified by the FSRefPtr.
-
-  pFSRefPtr    ==>    The item to get the file kind of.
-  pCommentStr    ==>    A string into which the finder comment will be returned.
-  pIdleProcUPP  ==>    A UPP for an idle function (required)
-  
-  See note about idle functions above.
-*/
-#if TARGET_API_MAC_CARBON
-pascal OSErr MoreFEGetCommentCFString(const FSRefPtr pFSRefPtr, CFStringRef* pCommentStr,const AEIdleUPP pIdleProcUPP)
-{
-  AppleEvent tAppleEvent = {typeNull,NULL};  //  If you always init AEDescs, it's always safe to dispose of them.
-  AEDesc tAEDesc = {typeNull,NULL};
-  OSErr anErr = noErr;
-
-  if (NULL == pIdleProcUPP)  // the idle proc is required
-    return paramErr;
-
-
-  anErr = MoreAEOCreateObjSpecifierFromFSRef(pFSRefPtr,&tAEDesc);
-
-  if (noErr == anErr)
-  {
-    AEBuildError  tAEBuildError;
-
-    anErr = AEBuildAppleEvent(
-              kAECoreSuite,kAEGetData,
-          typeApplSignature,&gFinderSignature,sizeof(OSType),
-              kAutoGenerateReturnID,kAnyTransactionID,
-              &tAppleEvent,&tAEBuildError,
-              "'----':obj {form:prop,want:type(prop),seld:type(comt),from:(@)}",&tAEDesc);
-
-        // always dispose of AEDescs when you are finished with them
-        (void) MoreAEDisposeDesc(&tAEDesc);
-
-    if (noErr == anErr)
-    {  
-#if 0  // Set this true to printf the Apple Event before you send it.
-      Handle strHdl;
-      anErr = AEPrintDescToHandle(&tAppleEvent,&strHdl);
-      if (noErr == anErr)
-      {
-        char  nul  = '\0';
-        PtrAndHand(&nul,strHdl,1);
-        printf("\n-MoreFEGetCommentCFString: tAppleEvent=%s.",*strHdl); fflush(stdout);
-        DisposeHandle(strHdl);
-      }
-#endif
-      //  Send the event.
-      anErr = MoreAESendEventReturnAEDesc(pIdleProcUPP,&tAppleEvent,typeUnicodeText,&tAEDesc);
-      // always dispose of AEDescs when you are finished with them
-      (void) MoreAEDisposeDesc(&tAppleEvent);
-      if (noErr == anErr)
-      {
-        anErr = MoreAEGetCFStringFromDescriptor(&tAEDesc,pCommentStr);
-        // always dispose of AEDescs when you are finished with them
-        (void) MoreAEDisposeDesc(&tAEDesc);
-      }
-    }
-  }
-  return anErr;
-}  // end MoreFEGetCommentCFString
-#endif
-
-
-//*******************************************************************************
-// Disposes of desc and initialises it to the null descriptor.
-pascal void MoreAEDisposeDesc(AEDesc* desc)
-{
-	OSStatus junk;
-
-	MoreAssertQ(desc != nil);
-	
-	junk = AEDisposeDesc(desc);
-	MoreAssertQ(junk == noErr);
-
-	MoreAENullDesc(desc);
-}//end MoreAEDisposeDesc
-
-//*******************************************************************************
-// Initialises desc to the null descriptor (typeNull, nil).
-pascal void MoreAENullDesc(AEDesc* desc)
-{
-	MoreAssertQ(desc != nil);
-
-	desc->descriptorType = typeNull;
-	desc->dataHandle     = nil;
-}//end MoreAENullDesc
-
-//********************************************************************************
-// A simple wrapper around CreateObjSpecifier which creates
-// an object specifier from a FSRef and using formName.
-pascal OSStatus MoreAEOCreateObjSpecifierFromFSRef(const FSRefPtr pFSRefPtr,AEDesc *pObjSpecifier)
-{
-	OSErr 		anErr = paramErr;
-
-	if (nil != pFSRefPtr)
-	{
-		CFURLRef tCFURLRef = CFURLCreateFromFSRef(kCFAllocatorDefault,pFSRefPtr);
-
-		if (nil != tCFURLRef)
-		{
-			anErr = MoreAEOCreateObjSpecifierFromCFURLRef(tCFURLRef,pObjSpecifier);
-			CFRelease(tCFURLRef);
-		}
-		else
-			anErr = coreFoundationUnknownErr;
-	}
-	return anErr;
-}
-
-
-
-//********************************************************************************
-// A simple wrapper around CreateObjSpecifier which creates
-// an object specifier from a CFURLRef and using formName.
-
-pascal OSStatus MoreAEOCreateObjSpecifierFromCFURLRef(const CFURLRef pCFURLRef,AEDesc *pObjSpecifier)
-{
-	OSErr 		anErr = paramErr;
-
-	if (nil != pCFURLRef)
-	{
-		Boolean 		isDirectory = CFURLHasDirectoryPath(pCFURLRef);
-		CFStringRef		tCFStringRef = CFURLCopyFileSystemPath(pCFURLRef, kCFURLHFSPathStyle);
-		AEDesc 			containerDesc = {typeNull, NULL};
-		AEDesc 			nameDesc = {typeNull, NULL};
-		UniCharPtr		buf = nil;
-
-		if (nil != tCFStringRef)
-		{
-			Size	bufSize = (CFStringGetLength(tCFStringRef) + (isDirectory ? 1 : 0)) * sizeof(UniChar);
-
-			buf = (UniCharPtr) NewPtr(bufSize);
-
-			if ((anErr = MemError()) == noErr)
-			{
-				CFStringGetCharacters(tCFStringRef, CFRangeMake(0,bufSize/2), buf);
-				if (isDirectory) (buf)[(bufSize-1)/2] = (UniChar) 0x003A;				
-			}
-		} else
-			anErr = coreFoundationUnknownErr;
-		
-		if (anErr == noErr)
-			anErr = AECreateDesc(typeUnicodeText, buf, GetPtrSize((Ptr) buf), &nameDesc);
-		if (anErr == noErr)
-			anErr = CreateObjSpecifier(isDirectory ? cFolder : cFile,&containerDesc,formName,&nameDesc,false,pObjSpecifier);
-
-		MoreAEDisposeDesc(&nameDesc);
-
-		if (buf)
-			DisposePtr((Ptr)buf);
-	}
-	return anErr;
-}//end MoreAEOCreateObjSpecifierFromCFURLRef
-
-pascal OSStatus MoreAESendEventReturnAEDesc(
-            const AEIdleUPP    pIdleProcUPP,
-            const AppleEvent  *pAppleEvent,
-            const DescType    pDescType,
-            AEDesc        *pAEDesc)
-{
-  OSStatus anError = noErr;
-
-  //  No idle function is an error, since we are expected to return a value
-  if (pIdleProcUPP == NULL)
-    anError = paramErr;
-  else
-  {
-    AppleEvent theReply = {typeNull,NULL};
-    AESendMode sendMode = kAEWaitReply;
-
-    anError = AESend(pAppleEvent, &theReply, sendMode, kAENormalPriority, kNoTimeOut, pIdleProcUPP, NULL);
-    //  [ Don't dispose of the event, it's not ours ]
-    if (noErr == anError)
-    {
-      anError = MoreAEGetHandlerError(&theReply);
-
-      if (!anError && theReply.descriptorType != typeNull)
-      {
-        anError = AEGetParamDesc(&theReply, keyDirectObject, pDescType, pAEDesc);
-      }
-      MoreAEDisposeDesc(&theReply);
-    }
-  }
-  return anError;
-}  // MoreAESendEventReturnAEDesc
-
-pascal OSStatus MoreAESendEventReturnPString(
-            const AEIdleUPP pIdleProcUPP,
-            const AppleEvent* pAppleEvent,
-            Str255 pStr255)
-{
-  DescType      actualType;
-  Size         actualSize;
-  OSStatus      anError;
-
-  anError = MoreAESendEventReturnData(pIdleProcUPP,pAppleEvent,typePString,
-        &actualType,pStr255,sizeof(Str255),&actualSize);
-
-  if (errAECoercionFail == anError)
-  {
-    anError =  MoreAESendEventReturnData(pIdleProcUPP,pAppleEvent,typeChar,
-      &actualType,(Ptr) &pStr255[1],sizeof(Str255),&actualSize);
-    if (actualSize < 256)
-      pStr255[0] = (UInt8) actualSize;
-    else
-      anError = errAECoercionFail;
-  }
-  return anError;
-}  // MoreAESendEventReturnPString
-
-
-pascal  OSStatus  MoreAEGetHandlerError(const AppleEvent* pAEReply)
-{
-  OSStatus  anError = noErr;
-  OSErr    handlerErr;
-  
-  DescType  actualType;
-  long    actualSize;
-  
-  if ( pAEReply->descriptorType != typeNull )  // there's a reply, so there may be an error
-  {
-    OSErr  getErrErr = noErr;
-    
-    getErrErr = AEGetParamPtr( pAEReply, keyErrorNumber, typeSInt16, &actualType,
-                  &handlerErr, sizeof( OSErr ), &actualSize );
-    
-    if ( getErrErr != errAEDescNotFound )  // found an errorNumber parameter
-    {
-      anError = handlerErr;          // so return it's value
-    }
-  }
-  return anError;
-}//end MoreAEGetHandlerError
-
-pascal OSStatus MoreAESendEventReturnData(
-            const AEIdleUPP    pIdleProcUPP,
-            const AppleEvent  *pAppleEvent,
-            DescType      pDesiredType,
-            DescType*      pActualType,
-            void*         pDataPtr,
-            Size        pMaximumSize,
-            Size         *pActualSize)
-{
-  OSStatus anError = noErr;
-
-  //  No idle function is an error, since we are expected to return a value
-  if (pIdleProcUPP == NULL)
-    anError = paramErr;
-  else
-  {
-    AppleEvent theReply = {typeNull,NULL};
-    AESendMode sendMode = kAEWaitReply;
-
-    anError = AESend(pAppleEvent, &theReply, sendMode, kAENormalPriority, kNoTimeOut, pIdleProcUPP, NULL);
-    //  [ Don't dispose of the event, it's not ours ]
-    if (noErr == anError)
-    {
-      anError = MoreAEGetHandlerError(&theReply);
-
-      if (!anError && theReply.descriptorType != typeNull)
-      {
-        anError = AEGetParamPtr(&theReply, keyDirectObject, pDesiredType,
-              pActualType, pDataPtr, pMaximumSize, pActualSize);
-      }
-      MoreAEDisposeDesc(&theReply);
-    }
-  }
-  return anError;
-}  // MoreAESendEventReturnData
-
-
-pascal OSErr MoreAEGetCFStringFromDescriptor(const AEDesc* pAEDesc, CFStringRef* pCFStringRef)
-{
-  AEDesc    uniAEDesc = {typeNull, NULL};
-  OSErr    anErr;
-
-  if (NULL == pCFStringRef)
-    return paramErr;
-
-  anErr = AECoerceDesc(pAEDesc, typeUnicodeText, &uniAEDesc);
-  if (noErr == anErr)
-  {
-    if (typeUnicodeText == uniAEDesc.descriptorType)
-    {
-          Size bufSize = AEGetDescDataSize(&uniAEDesc);
-          Ptr buf = NewPtr(bufSize);
-
-          if ((noErr == (anErr = MemError())) && (NULL != buf))
-          {
-              anErr = AEGetDescData(&uniAEDesc, buf, bufSize);
-              if (noErr == anErr)
-                  *pCFStringRef = CFStringCreateWithCharacters(kCFAllocatorDefault, (UniChar*) buf, bufSize / (Size) sizeof(UniChar));
-
-              DisposePtr(buf);
-          }
-    }
-    MoreAEDisposeDesc(&uniAEDesc);
-  }
-  return (anErr);
-}//end MoreAEGetCFStringFromDescriptor
-
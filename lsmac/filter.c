@@ -0,0 +1,553 @@
+/*
+    filter.c - --where expressions for lsmac
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <sysexits.h>
+
+#ifdef __APPLE__
+#include <Carbon/Carbon.h>
+#else
+#include "finderinfo.h"
+#endif
+
+#include "filter.h"
+
+#define		FILTER_MAX_OPS		256			/* also the deepest the stack can get */
+#define		MAX_WORD_LENGTH		1024
+
+/* program codes */
+#define		OP_FLAGS			0			/* (flags & mask) cmp value */
+#define		OP_TYPE				1
+#define		OP_CREATOR			2
+#define		OP_SIZE				3
+#define		OP_NAME				4
+#define		OP_AND				5
+#define		OP_OR				6
+#define		OP_NOT				7
+
+/* comparisons */
+#define		CMP_EQ				0
+#define		CMP_NE				1
+#define		CMP_LT				2
+#define		CMP_LE				3
+#define		CMP_GT				4
+#define		CMP_GE				5
+
+/* tokens */
+#define		TOK_END				0
+#define		TOK_WORD			1
+#define		TOK_CMP				2
+#define		TOK_LPAREN			3
+#define		TOK_RPAREN			4
+#define		TOK_AND				5
+#define		TOK_OR				6
+#define		TOK_NOT				7
+#define		TOK_ERROR			8
+
+typedef struct FilterOp
+{
+	int			code;
+	int			cmp;
+	uint16_t	mask;
+	uint32_t	value;
+	uint64_t	size;
+	char		*pattern;
+} FilterOp;
+
+struct Filter
+{
+	FilterOp	ops[FILTER_MAX_OPS];
+	int			numOps;
+	int			uses;		/* FILTER_KNOW_ bits */
+};
+
+/* the expression being compiled */
+typedef struct Parser
+{
+	const char	*p;
+	int			token;
+	int			cmp;
+	char		word[MAX_WORD_LENGTH];
+	Filter		*filter;
+	char		*errBuf;
+	size_t		errLen;
+	int			failed;
+} Parser;
+
+static const struct { const char *name; uint16_t flag; } flagNames[] =
+{
+	{ "invisible", kIsInvisible }, { "customicon", kHasCustomIcon }, { "locked", kNameLocked },
+	{ "bundle", kHasBundle }, { "alias", kIsAlias }, { "stationery", kIsStationery }
+};
+
+/* by label number, as lsmac -L numbers them; the color bits of the Finder flags */
+static const char		*labelNames[8] = { "none", "red", "orange", "yellow", "green", "blue", "purple", "gray" };
+static const uint16_t	labelBits[8] = { 0x0, 0xC, 0xE, 0xA, 0x4, 0x8, 0x6, 0x2 };
+
+static void     NextToken (Parser *ps);
+static void     ParseOr (Parser *ps);
+static void     ParseAnd (Parser *ps);
+static void     ParseUnary (Parser *ps);
+static void     ParseTerm (Parser *ps);
+static int      ParseOSType (Parser *ps, uint32_t *type);
+static int      ParseSize (Parser *ps, uint64_t *size);
+static void     Emit (Parser *ps, int code, int cmp, uint16_t mask, uint32_t value, uint64_t size, const char *pattern);
+static void     Fail (Parser *ps, const char *format, const char *arg);
+static int      Compare (uint64_t a, int cmp, uint64_t b);
+
+/*//////////////////////////////////////
+// Compile an expression.  On error returns
+// NULL with a message in errBuf
+/////////////////////////////////////*/
+Filter *FilterCompile (const char *expr, char *errBuf, size_t errLen)
+{
+	Parser		ps;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p = expr;
+	ps.errBuf = errBuf;
+	ps.errLen = errLen;
+	ps.filter = calloc(1, sizeof(Filter));
+	if (!ps.filter)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+
+	NextToken(&ps);
+	ParseOr(&ps);
+	if (!ps.failed && ps.token != TOK_END)
+		Fail(&ps, "unexpected '%s'", ps.word);
+
+	if (ps.failed)
+	{
+		FilterDispose(ps.filter);
+		return NULL;
+	}
+	return ps.filter;
+}
+
+/*//////////////////////////////////////
+// What the expression needs to know
+// beyond the name, FILTER_KNOW_ bits
+/////////////////////////////////////*/
+int FilterUses (const Filter *filter)
+{
+	return filter->uses;
+}
+
+/*//////////////////////////////////////
+// Run the program on what is known of an
+// entry.  Returns FILTER_YES, FILTER_NO,
+// or FILTER_MAYBE if that depends on
+// something not known yet.  Safe to call
+// from any thread.
+/////////////////////////////////////*/
+int FilterMatch (const Filter *filter, const FilterFacts *facts)
+{
+	unsigned char	stack[FILTER_MAX_OPS];
+	const FilterOp	*op;
+	int				sp = 0;
+	int				a, b;
+	int				i;
+
+	for (i = 0; i < filter->numOps; i++)
+	{
+		op = &filter->ops[i];
+		switch (op->code)
+		{
+			case OP_FLAGS:
+				if (!(facts->known & FILTER_KNOW_FINDERINFO))
+					stack[sp++] = FILTER_MAYBE;
+				else
+					stack[sp++] = Compare(facts->flags & op->mask, op->cmp, op->value);
+				break;
+			case OP_TYPE:
+			case OP_CREATOR:
+				if (!(facts->known & FILTER_KNOW_FINDERINFO))
+					stack[sp++] = FILTER_MAYBE;
+				else
+					stack[sp++] = Compare(op->code == OP_TYPE ? facts->type : facts->creator, op->cmp, op->value);
+				break;
+			case OP_SIZE:
+				if (!(facts->known & FILTER_KNOW_SIZE))
+					stack[sp++] = FILTER_MAYBE;
+				else if (facts->size == FILTER_NO_SIZE)
+					stack[sp++] = FILTER_NO;
+				else
+					stack[sp++] = Compare(facts->size, op->cmp, op->size);
+				break;
+			case OP_NAME:
+				stack[sp++] = (fnmatch(op->pattern, facts->name, 0) == 0) ^ (op->cmp == CMP_NE);
+				break;
+			case OP_NOT:
+				if (stack[sp - 1] != FILTER_MAYBE)
+					stack[sp - 1] = !stack[sp - 1];
+				break;
+			case OP_AND:
+				b = stack[--sp];
+				a = stack[sp - 1];
+				if (a == FILTER_NO || b == FILTER_NO)
+					stack[sp - 1] = FILTER_NO;
+				else if (a == FILTER_YES && b == FILTER_YES)
+					stack[sp - 1] = FILTER_YES;
+				else
+					stack[sp - 1] = FILTER_MAYBE;
+				break;
+			case OP_OR:
+				b = stack[--sp];
+				a = stack[sp - 1];
+				if (a == FILTER_YES || b == FILTER_YES)
+					stack[sp - 1] = FILTER_YES;
+				else if (a == FILTER_NO && b == FILTER_NO)
+					stack[sp - 1] = FILTER_NO;
+				else
+					stack[sp - 1] = FILTER_MAYBE;
+				break;
+		}
+	}
+
+	return stack[0];
+}
+
+void FilterDispose (Filter *filter)
+{
+	int		i;
+
+	if (!filter)
+		return;
+	for (i = 0; i < filter->numOps; i++)
+		free(filter->ops[i].pattern);
+	free(filter);
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Read the next token into ps->token, and
+// its text into ps->word
+/////////////////////////////////////*/
+static void NextToken (Parser *ps)
+{
+	const char	*p = ps->p;
+	char		quote;
+	size_t		len = 0;
+
+	while (isspace((unsigned char)*p))
+		p++;
+
+	ps->word[0] = '\0';
+	if (!*p)
+	{
+		ps->token = TOK_END;
+		strcpy(ps->word, "end");
+		ps->p = p;
+		return;
+	}
+
+	/* punctuation */
+	ps->token = TOK_CMP;
+	if (p[0] == '=' && p[1] == '=')			{ ps->cmp = CMP_EQ; len = 2; }
+	else if (p[0] == '!' && p[1] == '=')	{ ps->cmp = CMP_NE; len = 2; }
+	else if (p[0] == '<' && p[1] == '=')	{ ps->cmp = CMP_LE; len = 2; }
+	else if (p[0] == '>' && p[1] == '=')	{ ps->cmp = CMP_GE; len = 2; }
+	else if (p[0] == '=')					{ ps->cmp = CMP_EQ; len = 1; }
+	else if (p[0] == '<')					{ ps->cmp = CMP_LT; len = 1; }
+	else if (p[0] == '>')					{ ps->cmp = CMP_GT; len = 1; }
+	else if (p[0] == '&' && p[1] == '&')	{ ps->token = TOK_AND; len = 2; }
+	else if (p[0] == '|' && p[1] == '|')	{ ps->token = TOK_OR; len = 2; }
+	else if (p[0] == '!')					{ ps->token = TOK_NOT; len = 1; }
+	else if (p[0] == '(')					{ ps->token = TOK_LPAREN; len = 1; }
+	else if (p[0] == ')')					{ ps->token = TOK_RPAREN; len = 1; }
+
+	if (len)
+	{
+		memcpy(ps->word, p, len);
+		ps->word[len] = '\0';
+		ps->p = p + len;
+		return;
+	}
+
+	/* a quoted word is never a keyword */
+	ps->token = TOK_WORD;
+	if (*p == '\'' || *p == '"')
+	{
+		quote = *p++;
+		while (*p && *p != quote && len < MAX_WORD_LENGTH - 1)
+			ps->word[len++] = *p++;
+		ps->word[len] = '\0';
+		if (*p != quote)
+		{
+			ps->token = TOK_ERROR;
+			Fail(ps, "unterminated %s", "quote");
+			return;
+		}
+		ps->p = p + 1;
+		return;
+	}
+
+	while (*p && !isspace((unsigned char)*p) && !strchr("()!=<>&|'\"", *p) && len < MAX_WORD_LENGTH - 1)
+		ps->word[len++] = *p++;
+	ps->word[len] = '\0';
+	ps->p = p;
+
+	if (!strcasecmp(ps->word, "and"))
+		ps->token = TOK_AND;
+	else if (!strcasecmp(ps->word, "or"))
+		ps->token = TOK_OR;
+	else if (!strcasecmp(ps->word, "not"))
+		ps->token = TOK_NOT;
+}
+
+/* or binds loosest, then and, then not */
+static void ParseOr (Parser *ps)
+{
+	ParseAnd(ps);
+	while (!ps->failed && ps->token == TOK_OR)
+	{
+		NextToken(ps);
+		ParseAnd(ps);
+		Emit(ps, OP_OR, 0, 0, 0, 0, NULL);
+	}
+}
+
+static void ParseAnd (Parser *ps)
+{
+	ParseUnary(ps);
+	while (!ps->failed && ps->token == TOK_AND)
+	{
+		NextToken(ps);
+		ParseUnary(ps);
+		Emit(ps, OP_AND, 0, 0, 0, 0, NULL);
+	}
+}
+
+static void ParseUnary (Parser *ps)
+{
+	if (ps->failed)
+		return;
+
+	if (ps->token == TOK_NOT)
+	{
+		NextToken(ps);
+		ParseUnary(ps);
+		Emit(ps, OP_NOT, 0, 0, 0, 0, NULL);
+	}
+	else if (ps->token == TOK_LPAREN)
+	{
+		NextToken(ps);
+		ParseOr(ps);
+		if (!ps->failed && ps->token != TOK_RPAREN)
+			Fail(ps, "expected ')' instead of '%s'", ps->word);
+		if (!ps->failed)
+			NextToken(ps);
+	}
+	else if (ps->token == TOK_WORD)
+		ParseTerm(ps);
+	else
+		Fail(ps, "unexpected '%s'", ps->word);
+}
+
+/*//////////////////////////////////////
+// A flag name, or field op value
+/////////////////////////////////////*/
+static void ParseTerm (Parser *ps)
+{
+	char		field[MAX_WORD_LENGTH];
+	uint32_t	type;
+	uint64_t	size;
+	int			cmp;
+	int			i;
+
+	for (i = 0; i < (int)(sizeof(flagNames) / sizeof(flagNames[0])); i++)
+	{
+		if (!strcasecmp(ps->word, flagNames[i].name))
+		{
+			Emit(ps, OP_FLAGS, CMP_EQ, flagNames[i].flag, flagNames[i].flag, 0, NULL);
+			ps->filter->uses |= FILTER_KNOW_FINDERINFO;
+			NextToken(ps);
+			return;
+		}
+	}
+
+	strcpy(field, ps->word);
+	NextToken(ps);
+	if (ps->token != TOK_CMP)
+	{
+		Fail(ps, "expected a comparison after '%s'", field);
+		return;
+	}
+	cmp = ps->cmp;
+	NextToken(ps);
+	if (ps->token != TOK_WORD)
+	{
+		Fail(ps, "expected a value instead of '%s'", ps->word);
+		return;
+	}
+
+	if (strcasecmp(field, "label") && strcasecmp(field, "type") && strcasecmp(field, "creator") &&
+		strcasecmp(field, "size") && strcasecmp(field, "name"))
+	{
+		Fail(ps, "unknown field '%s'", field);
+		return;
+	}
+	if (strcasecmp(field, "size") && cmp != CMP_EQ && cmp != CMP_NE)
+	{
+		Fail(ps, "%s can only be compared with = or !=", field);
+		return;
+	}
+
+	if (!strcasecmp(field, "label"))
+	{
+		for (i = 0; i < 8; i++)
+			if (!strcasecmp(ps->word, labelNames[i]) || (ps->word[0] == '0' + i && !ps->word[1]))
+				break;
+		if (i == 8)
+		{
+			Fail(ps, "unknown label '%s'", ps->word);
+			return;
+		}
+		Emit(ps, OP_FLAGS, cmp, kColor, labelBits[i], 0, NULL);
+		ps->filter->uses |= FILTER_KNOW_FINDERINFO;
+	}
+	else if (!strcasecmp(field, "type") || !strcasecmp(field, "creator"))
+	{
+		if (ParseOSType(ps, &type) == -1)
+			return;
+		Emit(ps, strcasecmp(field, "type") ? OP_CREATOR : OP_TYPE, cmp, 0, type, 0, NULL);
+		ps->filter->uses |= FILTER_KNOW_FINDERINFO;
+	}
+	else if (!strcasecmp(field, "size"))
+	{
+		if (ParseSize(ps, &size) == -1)
+			return;
+		Emit(ps, OP_SIZE, cmp, 0, 0, size, NULL);
+		ps->filter->uses |= FILTER_KNOW_SIZE;
+	}
+	else
+		Emit(ps, OP_NAME, cmp, 0, 0, 0, ps->word);
+
+	NextToken(ps);
+}
+
+/* up to four characters, padded with spaces as the Finder does; '' is none */
+static int ParseOSType (Parser *ps, uint32_t *type)
+{
+	size_t	len = strlen(ps->word);
+	size_t	i;
+
+	if (len > 4)
+	{
+		Fail(ps, "'%s' is longer than four characters", ps->word);
+		return -1;
+	}
+
+	*type = 0;
+	if (len == 0)
+		return 0;
+	for (i = 0; i < 4; i++)
+		*type = (*type << 8) | (unsigned char)(i < len ? ps->word[i] : ' ');
+	return 0;
+}
+
+/* a number of bytes, or of K, M, G or T as lsmac prints them */
+static int ParseSize (Parser *ps, uint64_t *size)
+{
+	char	*end;
+	int		shift = 0;
+
+	if (!isdigit((unsigned char)ps->word[0]))
+	{
+		Fail(ps, "bad size '%s'", ps->word);
+		return -1;
+	}
+
+	errno = 0;
+	*size = strtoull(ps->word, &end, 10);
+	switch (toupper((unsigned char)*end))
+	{
+		case 'K':	shift = 10;	end++;	break;
+		case 'M':	shift = 20;	end++;	break;
+		case 'G':	shift = 30;	end++;	break;
+		case 'T':	shift = 40;	end++;	break;
+	}
+	if (shift && toupper((unsigned char)*end) == 'B')
+		end++;
+	if (*end || errno == ERANGE || (*size << shift) >> shift != *size)
+	{
+		Fail(ps, "bad size '%s'", ps->word);
+		return -1;
+	}
+	*size <<= shift;
+	return 0;
+}
+
+static void Emit (Parser *ps, int code, int cmp, uint16_t mask, uint32_t value, uint64_t size, const char *pattern)
+{
+	FilterOp	*op;
+
+	if (ps->failed)
+		return;
+	if (ps->filter->numOps == FILTER_MAX_OPS)
+	{
+		Fail(ps, "expression is too %s", "long");
+		return;
+	}
+
+	op = &ps->filter->ops[ps->filter->numOps++];
+	op->code = code;
+	op->cmp = cmp;
+	op->mask = mask;
+	op->value = value;
+	op->size = size;
+	op->pattern = NULL;
+	if (pattern && !(op->pattern = strdup(pattern)))
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+}
+
+static void Fail (Parser *ps, const char *format, const char *arg)
+{
+	if (ps->failed)
+		return;
+	ps->failed = 1;
+	snprintf(ps->errBuf, ps->errLen, format, arg);
+}
+
+static int Compare (uint64_t a, int cmp, uint64_t b)
+{
+	switch (cmp)
+	{
+		case CMP_EQ:	return a == b;
+		case CMP_NE:	return a != b;
+		case CMP_LT:	return a < b;
+		case CMP_LE:	return a <= b;
+		case CMP_GT:	return a > b;
+		case CMP_GE:	return a >= b;
+	}
+	return 0;
+}
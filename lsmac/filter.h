@@ -0,0 +1,78 @@
+/*
+    filter.h - --where expressions for lsmac
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    An expression such as
+
+        invisible and label = red and (type = TEXT or name = '*.txt')
+
+    is compiled once into a small postfix program of mask and integer
+    comparisons on the raw Finder flags, type and creator, the size and
+    the name.  Terms are
+
+        invisible customicon locked bundle alias stationery
+        label = none|red|orange|yellow|green|blue|purple|gray|0-7
+        type = XXXX     creator = XXXX
+        size <op> N[K|M|G|T]            (op: = != < <= > >=)
+        name = glob
+
+    joined with and/&&, or/||, not/! and parentheses; = and != go with
+    every field.
+
+    Entries are matched in stages, on whatever is known about them so far,
+    and a term about something not yet known is "maybe".  The caller
+    starts with the name, fetches the Finder info only if the answer is
+    still maybe, and the fork sizes only if it is maybe after that, so an
+    entry the cheap terms reject costs nothing more.
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define		FILTER_NO				0
+#define		FILTER_YES				1
+#define		FILTER_MAYBE			2
+
+/* what is known about an entry, and what an expression asks about */
+#define		FILTER_KNOW_FINDERINFO	0x01
+#define		FILTER_KNOW_SIZE		0x02
+
+#define		FILTER_NO_SIZE			UINT64_MAX		/* folders without -c; every size term is false */
+
+typedef struct FilterFacts
+{
+	int			known;
+	const char	*name;
+	uint16_t	flags;
+	uint32_t	type;
+	uint32_t	creator;
+	uint64_t	size;
+} FilterFacts;
+
+typedef struct Filter Filter;
+
+Filter *FilterCompile (const char *expr, char *errBuf, size_t errLen);
+int     FilterUses (const Filter *filter);
+int     FilterMatch (const Filter *filter, const FilterFacts *facts);
+void    FilterDispose (Filter *filter);
+
+#endif /* FILTER_H */
@@ -0,0 +1,143 @@
+/*
+    finderinfo.c - read Mac OS Finder info from extended attributes
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+
+#include "finderinfo.h"
+
+#ifndef ENOATTR
+#define		ENOATTR		ENODATA
+#endif
+
+#define		MAX_PATH_LENGTH			1024
+#define		MAX_FILENAME_LENGTH		256
+
+static ssize_t ItemGetXattr (int dirFd, const char *dirPath, const char *name, const char *attr, void *buf, size_t size);
+
+/*//////////////////////////////////////
+// Read an attribute of a directory entry
+// without following symlinks.  On Linux we
+// go through /proc/self/fd so the lookup is
+// relative to the open directory and costs a
+// single getxattr; elsewhere, or without /proc,
+// we build the full path.
+/////////////////////////////////////*/
+static ssize_t ItemGetXattr (int dirFd, const char *dirPath, const char *name, const char *attr, void *buf, size_t size)
+{
+	char		path[MAX_PATH_LENGTH + MAX_FILENAME_LENGTH + 32];
+#ifdef __linux__
+	static int	haveProcFd = -1;
+	ssize_t		len;
+
+	if (haveProcFd == -1)
+		haveProcFd = (access("/proc/self/fd", X_OK) == 0);
+
+	if (haveProcFd && dirFd >= 0)
+	{
+		snprintf(path, sizeof(path), "/proc/self/fd/%d/%s", dirFd, name);
+		len = lgetxattr(path, attr, buf, size);
+		if (len != -1 || errno != ENOENT)
+			return len;
+	}
+	snprintf(path, sizeof(path), "%s/%s", dirPath, name);
+	return lgetxattr(path, attr, buf, size);
+#elif defined(__APPLE__)
+	snprintf(path, sizeof(path), "%s/%s", dirPath, name);
+	return getxattr(path, attr, buf, size, 0, XATTR_NOFOLLOW);
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*//////////////////////////////////////
+// Decode a raw big-endian FinderInfo record
+/////////////////////////////////////*/
+void FIDecodeFinderInfo (const unsigned char *raw, FinderInfoRec *info)
+{
+	const unsigned char	*p;
+
+	p = raw + FINDERINFO_TYPE_OFFSET;
+	info->type = ((OSType)p[0] << 24) | ((OSType)p[1] << 16) | ((OSType)p[2] << 8) | p[3];
+
+	p = raw + FINDERINFO_CREATOR_OFFSET;
+	info->creator = ((OSType)p[0] << 24) | ((OSType)p[1] << 16) | ((OSType)p[2] << 8) | p[3];
+
+	p = raw + FINDERINFO_FLAGS_OFFSET;
+	info->flags = (UInt16)((p[0] << 8) | p[1]);
+}
+
+/*//////////////////////////////////////
+// Get the Finder info of an item.  Items
+// without the attribute get an all-zero
+// record, just like HFS+ would give us.
+// Returns 0 on success, -1 and errno on error
+/////////////////////////////////////*/
+int FIGetFinderInfo (int dirFd, const char *dirPath, const char *name, FinderInfoRec *info)
+{
+	unsigned char	raw[FINDERINFO_LENGTH];
+	ssize_t			len;
+
+	memset(info, 0, sizeof(*info));
+
+	len = ItemGetXattr(dirFd, dirPath, name, FINDERINFO_XATTR_NAME, raw, sizeof(raw));
+	if (len == -1)
+	{
+		/* no Finder info, or a filesystem without xattrs */
+		if (errno == ENOATTR || errno == ENOTSUP || errno == ERANGE)
+			return 0;
+		return -1;
+	}
+
+	if (len < FINDERINFO_FLAGS_OFFSET + 2)
+		return 0;
+
+	if (len < FINDERINFO_LENGTH)
+		memset(raw + len, 0, FINDERINFO_LENGTH - len);
+
+	FIDecodeFinderInfo(raw, info);
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Get the logical size of an item's resource
+// fork, which is the size of its attribute
+/////////////////////////////////////*/
+int FIGetResourceForkSize (int dirFd, const char *dirPath, const char *name, UInt64 *size)
+{
+	ssize_t		len;
+
+	*size = 0;
+
+	len = ItemGetXattr(dirFd, dirPath, name, RESOURCEFORK_XATTR_NAME, NULL, 0);
+	if (len == -1)
+	{
+		if (errno == ENOATTR || errno == ENOTSUP)
+			return 0;
+		return -1;
+	}
+
+	*size = (UInt64)len;
+	return 0;
+}
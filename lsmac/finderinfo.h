@@ -0,0 +1,106 @@
+/*
+    finderinfo.h - read Mac OS Finder info from extended attributes
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Volumes mirrored off a Mac (netatalk, Samba with vfs_fruit, rsync -X)
+    keep the 32 byte FinderInfo record in the com.apple.FinderInfo extended
+    attribute and the resource fork in com.apple.ResourceFork.  Linux only
+    allows namespaced attribute names, so there they live under "user.".
+
+    The record is stored big-endian, exactly as in the HFS+ catalog:
+
+        FileInfo                        FolderInfo
+        0   fdType      OSType          0   frRect      Rect
+        4   fdCreator   OSType          8   frFlags     UInt16
+        8   fdFlags     UInt16          10  frLocation  Point
+        10  fdLocation  Point           14  frView      UInt16
+        14  fdFldr      SInt16
+
+    followed by 16 bytes of extended info we don't use.  The flags live
+    at the same offset for files and folders.
+*/
+
+#ifndef FINDERINFO_H
+#define FINDERINFO_H
+
+#include <stdint.h>
+
+#ifdef __APPLE__
+#define		FINDERINFO_XATTR_NAME		"com.apple.FinderInfo"
+#define		RESOURCEFORK_XATTR_NAME		"com.apple.ResourceFork"
+#else
+#define		FINDERINFO_XATTR_NAME		"user.com.apple.FinderInfo"
+#define		RESOURCEFORK_XATTR_NAME		"user.com.apple.ResourceFork"
+#endif
+
+#define		FINDERINFO_LENGTH			32
+
+#define		FINDERINFO_TYPE_OFFSET		0
+#define		FINDERINFO_CREATOR_OFFSET	4
+#define		FINDERINFO_FLAGS_OFFSET		8
+
+/* Carbon types and Finder flags, for hosts without Carbon.framework */
+#ifndef __APPLE__
+
+typedef uint8_t			UInt8;
+typedef uint16_t		UInt16;
+typedef int16_t			SInt16;
+typedef uint32_t		UInt32;
+typedef int32_t			SInt32;
+typedef uint64_t		UInt64;
+typedef int64_t			SInt64;
+typedef uint32_t		OSType;
+typedef SInt16			OSErr;
+typedef SInt32			OSStatus;
+typedef unsigned char	Boolean;
+
+#ifndef true
+#define		true		1
+#define		false		0
+#endif
+
+#define		noErr		0
+#define		ioErr		(-36)
+#define		fnfErr		(-43)
+
+enum {
+	kIsAlias			= 0x8000,
+	kIsInvisible		= 0x4000,
+	kHasBundle			= 0x2000,
+	kNameLocked			= 0x1000,
+	kIsStationery		= 0x0800,
+	kHasCustomIcon		= 0x0400,
+	kColor				= 0x000E
+};
+
+#endif /* __APPLE__ */
+
+/* FinderInfo decoded into host byte order */
+typedef struct FinderInfoRec
+{
+	OSType		type;
+	OSType		creator;
+	UInt16		flags;
+} FinderInfoRec;
+
+int  FIGetFinderInfo (int dirFd, const char *dirPath, const char *name, FinderInfoRec *info);
+int  FIGetResourceForkSize (int dirFd, const char *dirPath, const char *name, UInt64 *size);
+void FIDecodeFinderInfo (const unsigned char *raw, FinderInfoRec *info);
+
+#endif /* FINDERINFO_H */
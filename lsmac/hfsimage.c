@@ -0,0 +1,1953 @@
+/*
+    hfsimage.c - read-only access to HFS+ volume images
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "hfsimage.h"
+#include "../getfcomment/fcomment.h"
+
+#define		SECTOR_SIZE				512
+#define		VOLUME_HEADER_OFFSET	1024
+#define		VOLUME_HEADER_LENGTH	512
+#define		HFS_PLUS_SIGNATURE		0x482B		/* "H+" */
+#define		HFSX_SIGNATURE			0x4858		/* "HX" */
+#define		HFS_SIGNATURE			0x4244		/* "BD", a wrapper around HFS+ */
+#define		APM_SIGNATURE			0x4552		/* "ER" */
+#define		APM_ENTRY_SIGNATURE		0x504D		/* "PM" */
+#define		GPT_SIGNATURE			"EFI PART"
+#define		MAX_PARTITIONS			256
+#define		VOLUME_JOURNALED		0x2000
+
+#define		EXTENTS_FILE_ID			3
+#define		CATALOG_FILE_ID			4
+
+#define		NODE_DESCRIPTOR_LENGTH	14
+#define		LEAF_NODE				-1
+#define		INDEX_NODE				0
+#define		HEADER_NODE				1
+#define		MIN_NODE_SIZE			512
+#define		MAX_NODE_SIZE			32768
+#define		MAX_TREE_DEPTH			16
+#define		BIG_KEYS				0x2
+#define		VARIABLE_INDEX_KEYS		0x4
+#define		BINARY_COMPARE			0xBC
+#define		EXTENT_KEY_LENGTH		10
+#define		CATALOG_KEY_MIN_LENGTH	6
+#define		EXTENT_RECORD_LENGTH	64			/* 8 extents */
+#define		SCAN_PART_LEAVES		64			/* leaf nodes a scan's worker takes at a time */
+
+#define		FOLDER_RECORD			1
+#define		FILE_RECORD				2
+#define		FOLDER_THREAD_RECORD	3
+#define		FILE_THREAD_RECORD		4
+#define		FOLDER_RECORD_LENGTH	88
+#define		FILE_RECORD_LENGTH		248
+#define		THREAD_RECORD_LENGTH	10
+#define		HAS_LINK_CHAIN			0x20
+
+#define		FOUR_CC(a, b, c, d)		(((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+#define		HARD_LINK_TYPE			FOUR_CC('h','l','n','k')
+#define		HARD_LINK_CREATOR		FOUR_CC('h','f','s','+')
+#define		FOLDER_LINK_TYPE		FOUR_CC('f','d','r','p')
+#define		FOLDER_LINK_CREATOR		FOUR_CC('M','A','C','S')
+#define		PRIVATE_FOLDERS_NAME	".HFS+ Private Directory Data\r"
+#define		FILE_TARGET_PREFIX		"iNode"		/* then the number, in the private folders */
+#define		FOLDER_TARGET_PREFIX	"dir_"
+
+/* where file hard links keep their files, four NULs then "HFS+ Private Data" */
+static const unsigned char	gPrivateFilesName[] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 'H', 0, 'F', 0, 'S', 0, '+', 0, ' ', 0, 'P', 0, 'r', 0, 'i',
+	0, 'v', 0, 'a', 0, 't', 0, 'e', 0, ' ', 0, 'D', 0, 'a', 0, 't', 0, 'a'
+};
+
+/* the GUID partition type of HFS+, as it's stored */
+static const unsigned char	gHFSPartitionType[16] =
+{
+	0x00, 0x53, 0x46, 0x48, 0x00, 0x00, 0xAA, 0x11, 0xAA, 0x11, 0x00, 0x30, 0x65, 0x43, 0xEC, 0xAC
+};
+
+/* allocation blocks */
+typedef struct Extent
+{
+	uint32_t		start;
+	uint32_t		count;
+} Extent;
+
+typedef struct Tree
+{
+	Extent			*extents;
+	uint32_t		numExtents;
+	uint32_t		nodeSize;
+	uint32_t		numNodes;
+	uint32_t		root;			/* 0 if empty */
+	uint16_t		depth;
+	uint16_t		maxKeyLength;
+	uint16_t		minKeyLength;
+	int				variableKeys;	/* else index keys are all maxKeyLength */
+} Tree;
+
+struct HFSImage
+{
+	unsigned char		*map;
+	size_t				mapSize;
+	const unsigned char	*volume;
+	size_t				volumeSize;
+	uint32_t			blockSize;
+	uint32_t			attributes;
+	int					caseSensitive;
+	Tree				extents;
+	Tree				catalog;
+	uint32_t			privateFilesID;		/* 0 if there's no such folder */
+	uint32_t			privateFoldersID;
+};
+
+/* a catalog leaf record, where it lies */
+typedef struct Record
+{
+	uint32_t			parentID;
+	const unsigned char	*name;			/* UTF-16BE */
+	uint16_t			nameLength;		/* in characters */
+	const unsigned char	*data;
+	size_t				length;
+} Record;
+
+/* a catalog key to descend to: the names compared as stored */
+typedef struct Key
+{
+	uint32_t			parentID;
+	const unsigned char	*name;			/* UTF-16BE */
+	size_t				nameLength;		/* in bytes */
+} Key;
+
+/* what a catalog folder is searched for */
+typedef struct Match
+{
+	const char			*name;			/* as the shell shows it */
+	const unsigned char	*raw;			/* or as it's stored */
+	size_t				rawLength;
+	int					follow;			/* hard links, to what they share */
+	HFSImageItem		*item;
+	int					found;			/* 2 exactly, 1 but for case */
+	int					err;
+} Match;
+
+/* a folder being listed */
+typedef struct Listing
+{
+	HFSImageCallback	callback;
+	void				*refCon;
+	HFSImageItem		item;
+	int					err;
+} Listing;
+
+/* a thread record, what a catalog ID is called and where */
+typedef struct Thread
+{
+	uint32_t			parentID;
+	unsigned char		name[2 * 255];	/* copied, its node may have been */
+	size_t				nameLength;		/* in bytes */
+	int					found;
+} Thread;
+
+/* HFSImageScan: a folder from its thread record, with the name in the scan's names */
+typedef struct ScanFolderEntry
+{
+	uint32_t			cnid;
+	uint32_t			parentID;
+	size_t				name;
+} ScanFolderEntry;
+
+/* a folder hard link, where the folder it shares can be listed */
+typedef struct ScanLink
+{
+	uint32_t			target;
+	uint32_t			parentID;
+	size_t				name;
+} ScanLink;
+
+/* HFSImageScan: a file or folder that hard links share, where its record is */
+typedef struct ScanTarget
+{
+	uint32_t			number;			/* from its name, iNodeN or dir_N */
+	uint32_t			isFolder;
+	uint32_t			leaf;			/* in the scan's list */
+	uint32_t			index;			/* of the record in that leaf */
+} ScanTarget;
+
+/* what the first pass found in some leaf nodes */
+typedef struct ScanPart
+{
+	ScanFolderEntry		*folders;
+	long				numFolders;
+	long				maxFolders;
+	ScanLink			*links;
+	long				numLinks;
+	long				maxLinks;
+	ScanTarget			*targets;
+	long				numTargets;
+	long				maxTargets;
+	char				*names;
+	size_t				namesLength;
+	size_t				namesSize;
+	size_t				base;			/* of its names, once they're joined */
+} ScanPart;
+
+/* a worker's path, and the folders it's made of */
+typedef struct ScanWorkerState
+{
+	char				*path;
+	size_t				pathSize;
+	const ScanFolderEntry	**chain;
+	long				maxChain;
+} ScanWorkerState;
+
+typedef struct Scan
+{
+	const HFSImage		*image;
+	uint32_t			folderID;
+	const char			*path;
+	HFSImageScanProc	proc;
+	HFSImagePartProc	partProc;
+	void				*refCon;
+	uint32_t			*leaves;		/* in key order */
+	long				numLeaves;
+	ScanPart			*parts;			/* SCAN_PART_LEAVES leaves each */
+	long				numParts;
+	ScanFolderEntry		*folders;		/* by catalog ID, once they're joined */
+	long				numFolders;
+	ScanTarget			*targets;		/* by kind and number, once they're joined */
+	long				numTargets;
+	char				*names;
+	int					pass;
+	pthread_mutex_t		lock;			/* for the rest */
+	long				nextPart;
+	int					stop;
+	int					err;
+} Scan;
+
+typedef int (*KeyCompare) (const unsigned char *key, const void *target);
+typedef int (*RecordCallback) (const HFSImage *image, const Record *record, void *refCon);
+
+static int                  FindVolume (HFSImage *image);
+static int                  TryVolume (HFSImage *image, uint64_t offset, uint64_t size, int inWrapper);
+static int                  ReadVolumeHeader (HFSImage *image);
+static int                  OpenTree (HFSImage *image, Tree *tree, const unsigned char *fork, uint32_t fileID);
+static int                  AddExtents (Tree *tree, const unsigned char *extents, uint32_t *blocks);
+static int                  FindOverflowExtents (const HFSImage *image, uint32_t fileID, uint32_t startBlock, const unsigned char **extents, unsigned char *buf);
+static const unsigned char *GetNode (const HFSImage *image, const Tree *tree, uint32_t number, unsigned char *buf);
+static const unsigned char *GetRecord (const Tree *tree, const unsigned char *node, uint32_t index, size_t *length);
+static int                  GetKeyData (const Tree *tree, const unsigned char *record, size_t length, int isIndex, const unsigned char **data, size_t *dataLength);
+static const unsigned char *FindLeaf (const HFSImage *image, const Tree *tree, KeyCompare compare, const void *target, unsigned char *buf);
+static int                  CompareParent (const unsigned char *key, const void *target);
+static int                  CompareKey (const unsigned char *key, const void *target);
+static int                  CompareExtent (const unsigned char *key, const void *target);
+static int                  ScanFolder (const HFSImage *image, uint32_t parentID, RecordCallback callback, void *refCon);
+static int                  FindRecord (const HFSImage *image, uint32_t parentID, const char *name, Record *record, unsigned char *buf);
+static int                  FindChild (const HFSImage *image, uint32_t parentID, Match *match);
+static int                  MatchRecord (const HFSImage *image, const Record *record, void *refCon);
+static int                  ListRecord (const HFSImage *image, const Record *record, void *refCon);
+static int                  ThreadRecord (const HFSImage *image, const Record *record, void *refCon);
+static int                  GetByID (const HFSImage *image, uint32_t cnid, HFSImageItem *item, int follow);
+static int                  IsHidden (const HFSImage *image, const Record *record);
+static void                 DecodeItem (const HFSImage *image, const Scan *scan, const Record *record, HFSImageItem *item, int follow);
+static int                  GetLinkTarget (const HFSImage *image, const Scan *scan, int isFolder, uint32_t number, HFSImageItem *target);
+static int                  TargetNumber (const Record *record, const char *prefix, uint32_t *number);
+static void                 DecodeName (const unsigned char *name, size_t length, char *out);
+static int                  GatherLeaves (Scan *scan);
+static void                *ScanWorker (void *arg);
+static const unsigned char *GetLeaf (const Scan *scan, long n, unsigned char *buf);
+static int                  GetLeafRecord (const Scan *scan, const unsigned char *node, uint32_t i, Record *record);
+static int                  GatherPart (Scan *scan, long part);
+static int                  AddName (ScanPart *p, const unsigned char *name, size_t length, size_t *offset);
+static int                  JoinFolders (Scan *scan);
+static int                  CompareFolderEntries (const void *a, const void *b);
+static ScanFolderEntry     *FindFolderEntry (const Scan *scan, uint32_t cnid);
+static int                  CompareTargets (const void *a, const void *b);
+static void                 FreePart (ScanPart *p);
+static int                  ListPart (Scan *scan, long part, ScanWorkerState *state);
+static int                  FolderPath (const Scan *scan, uint32_t folderID, ScanWorkerState *state);
+static int                  Stop (Scan *scan);
+static void                *MakeRoom (void *array, long *max, long count, size_t size);
+static uint16_t             Get16 (const unsigned char *p);
+static uint32_t             Get32 (const unsigned char *p);
+static uint64_t             Get64 (const unsigned char *p);
+static uint32_t             GetLittle32 (const unsigned char *p);
+static uint64_t             GetLittle64 (const unsigned char *p);
+static int                  Malformed (void);
+static const unsigned char *BadNode (void);
+
+/*//////////////////////////////////////
+// Map the image at path, a file or a
+// device, and find its HFS+ volume.
+// Returns NULL and errno on error, EINVAL
+// if there's no HFS+ volume or it's
+// malformed
+/////////////////////////////////////*/
+HFSImage *HFSImageOpen (const char *path)
+{
+	HFSImage		*image;
+	struct stat		sb;
+	off_t			size;
+	void			*map;
+	int				fd, err;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &sb) == -1)
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	size = S_ISREG(sb.st_mode) ? sb.st_size : lseek(fd, 0, SEEK_END);
+	if (size < VOLUME_HEADER_OFFSET + VOLUME_HEADER_LENGTH || (uint64_t)size > SIZE_MAX)
+	{
+		close(fd);
+		errno = (size == -1) ? errno : EINVAL;
+		return NULL;
+	}
+
+	map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+	err = errno;
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		errno = err;
+		return NULL;
+	}
+
+	image = calloc(1, sizeof(HFSImage));
+	if (!image)
+	{
+		munmap(map, (size_t)size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	image->map = map;
+	image->mapSize = (size_t)size;
+
+	if (FindVolume(image) == -1 || ReadVolumeHeader(image) == -1)
+	{
+		err = errno;
+		HFSImageClose(image);
+		errno = err;
+		return NULL;
+	}
+	return image;
+}
+
+void HFSImageClose (HFSImage *image)
+{
+	if (!image)
+		return;
+	munmap(image->map, image->mapSize);
+	free(image->extents.extents);
+	free(image->catalog.extents);
+	free(image);
+}
+
+/*//////////////////////////////////////
+// The item at a path from the root of the
+// volume, '/' or "" for the root itself.
+// Returns -1 and errno on error, ENOENT if
+// there's no such item
+/////////////////////////////////////*/
+int HFSImageLookup (HFSImage *image, const char *path, HFSImageItem *item)
+{
+	char		name[HFS_IMAGE_NAME_MAX];
+	size_t		len;
+
+	if (GetByID(image, HFS_IMAGE_ROOT_ID, item, 1) == -1)
+		return -1;
+
+	while (*path)
+	{
+		len = strcspn(path, "/");
+		if (len >= sizeof(name))
+		{
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += len;
+		path += strspn(path, "/");
+
+		if (!len || !strcmp(name, "."))
+			continue;
+		if (!item->isFolder)
+		{
+			errno = ENOTDIR;
+			return -1;
+		}
+		if (!strcmp(name, ".."))
+		{
+			if (item->cnid != HFS_IMAGE_ROOT_ID && GetByID(image, item->parentID, item, 1) == -1)
+				return -1;
+			continue;
+		}
+		if (HFSImageGetItem(image, item->cnid, name, item) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/*//////////////////////////////////////
+// The item called name in the folder with
+// ID parentID.  Returns -1 and errno on
+// error, ENOENT if there's no such item
+/////////////////////////////////////*/
+int HFSImageGetItem (HFSImage *image, uint32_t parentID, const char *name, HFSImageItem *item)
+{
+	Match	match = { 0 };
+
+	match.name = name;
+	match.follow = 1;
+	match.item = item;
+	return FindChild(image, parentID, &match);
+}
+
+/*//////////////////////////////////////
+// The item with catalog ID cnid.  Returns
+// -1 and errno on error, ENOENT if there's
+// no such item
+/////////////////////////////////////*/
+int HFSImageGetByID (HFSImage *image, uint32_t cnid, HFSImageItem *item)
+{
+	return GetByID(image, cnid, item, 1);
+}
+
+/*//////////////////////////////////////
+// Call back with each item of a folder,
+// in catalog order.  Items a Mac hides,
+// the journal and hard links' files,
+// aren't listed.  Returns 0, or -1 and
+// errno if the catalog is malformed
+/////////////////////////////////////*/
+int HFSImageListFolder (HFSImage *image, uint32_t folderID, HFSImageCallback callback, void *refCon)
+{
+	Listing		listing;
+
+	listing.callback = callback;
+	listing.refCon = refCon;
+	listing.err = 0;
+	if (ScanFolder(image, folderID, ListRecord, &listing) == -1)
+		return -1;
+	if (listing.err)
+	{
+		errno = listing.err;
+		return -1;
+	}
+	return 0;
+}
+
+/*//////////////////////////////////////
+// An item as stat would have it on a Mac:
+// st_mtime the content modification date,
+// st_ctime the attribute modification one
+/////////////////////////////////////*/
+void HFSImageStat (const HFSImageItem *item, struct stat *st)
+{
+	memset(st, 0, sizeof(struct stat));
+
+	st->st_ino = item->cnid;
+	st->st_mode = item->fileMode;
+	if (!(st->st_mode & S_IFMT))
+		st->st_mode |= item->isFolder ? S_IFDIR : S_IFREG;
+	if (!(st->st_mode & ~S_IFMT))
+		st->st_mode |= item->isFolder ? 0755 : 0644;
+	st->st_uid = item->ownerID;
+	st->st_gid = item->groupID;
+
+	if (item->isFolder)
+	{
+		st->st_nlink = item->valence + 2;
+		st->st_size = (off_t)(item->valence + 2) * 34;
+	}
+	else
+	{
+		st->st_nlink = item->numLinks;
+		st->st_size = (off_t)item->dataLogical;
+		st->st_blocks = (blkcnt_t)((item->dataPhysical + 511) / 512);
+	}
+	st->st_blksize = 4096;
+
+	st->st_atime = (time_t)item->accessDate - (time_t)HFS_IMAGE_EPOCH_DELTA;
+	st->st_mtime = (time_t)item->contentModDate - (time_t)HFS_IMAGE_EPOCH_DELTA;
+	st->st_ctime = (time_t)item->attributeModDate - (time_t)HFS_IMAGE_EPOCH_DELTA;
+#ifdef __APPLE__
+	st->st_birthtime = (time_t)item->createDate - (time_t)HFS_IMAGE_EPOCH_DELTA;
+#endif
+}
+
+/*//////////////////////////////////////
+// Call back with every item in and under
+// folderID, with the path of its folder
+// made up from path, and with a NULL item
+// after each folder's last.  The leaves
+// are read twice on numThreads threads,
+// for the folders' names and then their
+// items.  Returns 0, or -1 and errno
+/////////////////////////////////////*/
+int HFSImageScan (HFSImage *image, uint32_t folderID, const char *path, int numThreads,
+				  HFSImageScanProc proc, HFSImagePartProc partProc, void *refCon)
+{
+	Scan		scan;
+	pthread_t	*threads;
+	long		i, started;
+	int			pass, err = 0;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.image = image;
+	scan.folderID = folderID;
+	scan.path = path;
+	scan.proc = proc;
+	scan.partProc = partProc;
+	scan.refCon = refCon;
+	pthread_mutex_init(&scan.lock, NULL);
+
+	if (numThreads < 1)
+		numThreads = 1;
+	threads = malloc(numThreads * sizeof(pthread_t));
+	if (!threads || GatherLeaves(&scan) == -1)
+	{
+		err = threads ? errno : ENOMEM;
+		goto done;
+	}
+	scan.numParts = (scan.numLeaves + SCAN_PART_LEAVES - 1) / SCAN_PART_LEAVES;
+	scan.parts = calloc(scan.numParts ? scan.numParts : 1, sizeof(ScanPart));
+	if (!scan.parts)
+	{
+		err = ENOMEM;
+		goto done;
+	}
+
+	/* the folders first, then their items; this thread is a worker too */
+	for (pass = 1; pass <= 2 && !scan.err && !scan.stop; pass++)
+	{
+		scan.pass = pass;
+		scan.nextPart = 0;
+		for (started = 0; started < numThreads - 1 && started < scan.numParts - 1; started++)
+			if (pthread_create(&threads[started], NULL, ScanWorker, &scan) != 0)
+				break;
+		ScanWorker(&scan);
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+
+		if (pass == 1 && !scan.err && JoinFolders(&scan) == -1)
+			scan.err = errno;
+	}
+	err = scan.err;
+
+done:
+	if (scan.parts)
+		for (i = 0; i < scan.numParts; i++)
+			FreePart(&scan.parts[i]);
+	free(scan.parts);
+	free(scan.leaves);
+	free(scan.folders);
+	free(scan.targets);
+	free(scan.names);
+	free(threads);
+	pthread_mutex_destroy(&scan.lock);
+	if (err)
+	{
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Find the volume header: at the start,
+// or in the first HFS partition of an
+// Apple or GUID partition map
+/////////////////////////////////////*/
+static int FindVolume (HFSImage *image)
+{
+	const unsigned char	*map = image->map, *entry;
+	uint64_t			tableOffset, first, last;
+	uint32_t			blockSize, numEntries, entrySize, i, sectorSize;
+
+	if (TryVolume(image, 0, image->mapSize, 0) == 0)
+		return 0;
+
+	/* Apple partition map, an entry a block from block 1 */
+	if (Get16(map) == APM_SIGNATURE)
+	{
+		blockSize = Get16(map + 2);
+		if (blockSize < SECTOR_SIZE)
+			blockSize = SECTOR_SIZE;
+		numEntries = 1;
+		for (i = 1; i <= numEntries && i <= MAX_PARTITIONS; i++)
+		{
+			if ((uint64_t)(i + 1) * blockSize > image->mapSize)
+				break;
+			entry = map + (size_t)i * blockSize;
+			if (Get16(entry) != APM_ENTRY_SIGNATURE)
+				break;
+			numEntries = Get32(entry + 4);
+			if ((!strncmp((const char *)entry + 48, "Apple_HFS", 32) || !strncmp((const char *)entry + 48, "Apple_HFSX", 32))
+				&& TryVolume(image, (uint64_t)Get32(entry + 8) * blockSize, (uint64_t)Get32(entry + 12) * blockSize, 0) == 0)
+				return 0;
+		}
+	}
+
+	/* GUID partition table, in the second sector of whichever size */
+	for (sectorSize = SECTOR_SIZE; sectorSize <= 4096; sectorSize *= 8)
+	{
+		if ((uint64_t)sectorSize + SECTOR_SIZE > image->mapSize || memcmp(map + sectorSize, GPT_SIGNATURE, 8))
+			continue;
+		tableOffset = GetLittle64(map + sectorSize + 72) * sectorSize;
+		numEntries = GetLittle32(map + sectorSize + 80);
+		entrySize = GetLittle32(map + sectorSize + 84);
+		if (entrySize < 128 || numEntries > MAX_PARTITIONS * 4)
+			continue;
+		for (i = 0; i < numEntries; i++)
+		{
+			if (tableOffset > image->mapSize || (uint64_t)(i + 1) * entrySize > image->mapSize - tableOffset)
+				break;
+			entry = map + tableOffset + (size_t)i * entrySize;
+			if (memcmp(entry, gHFSPartitionType, sizeof(gHFSPartitionType)))
+				continue;
+			first = GetLittle64(entry + 32);
+			last = GetLittle64(entry + 40);
+			if (last >= first && TryVolume(image, first * sectorSize, (last - first + 1) * sectorSize, 0) == 0)
+				return 0;
+		}
+	}
+
+	return Malformed();
+}
+
+/*//////////////////////////////////////
+// An HFS+ volume at offset, or an HFS
+// one wrapped around it
+/////////////////////////////////////*/
+static int TryVolume (HFSImage *image, uint64_t offset, uint64_t size, int inWrapper)
+{
+	const unsigned char	*header;
+	uint32_t			signature, allocationBlockSize;
+	uint64_t			embedStart;
+
+	if (offset > image->mapSize || size > image->mapSize - offset || size < VOLUME_HEADER_OFFSET + VOLUME_HEADER_LENGTH)
+		return -1;
+	header = image->map + offset + VOLUME_HEADER_OFFSET;
+	signature = Get16(header);
+
+	if (signature == HFS_PLUS_SIGNATURE || signature == HFSX_SIGNATURE)
+	{
+		image->volume = image->map + offset;
+		image->volumeSize = (size_t)size;
+		return 0;
+	}
+
+	/* the HFS master directory block, with the HFS+ volume as its one file */
+	if (signature == HFS_SIGNATURE && !inWrapper && Get16(header + 0x7C) == HFS_PLUS_SIGNATURE)
+	{
+		allocationBlockSize = Get32(header + 0x14);
+		embedStart = (uint64_t)Get16(header + 0x1C) * SECTOR_SIZE + (uint64_t)Get16(header + 0x7E) * allocationBlockSize;
+		return TryVolume(image, offset + embedStart, (uint64_t)Get16(header + 0x80) * allocationBlockSize, 1);
+	}
+	return -1;
+}
+
+/*//////////////////////////////////////
+// Take the extents and catalog B-trees
+// from the volume header
+/////////////////////////////////////*/
+static int ReadVolumeHeader (HFSImage *image)
+{
+	const unsigned char	*header = image->volume + VOLUME_HEADER_OFFSET;
+	Match				match = { 0 };
+	HFSImageItem		item;
+
+	image->attributes = Get32(header + 4);
+	image->blockSize = Get32(header + 40);
+	if (image->blockSize < SECTOR_SIZE || (image->blockSize & (image->blockSize - 1)))
+		return Malformed();
+
+	if (OpenTree(image, &image->extents, header + 192, EXTENTS_FILE_ID) == -1
+		|| OpenTree(image, &image->catalog, header + 272, CATALOG_FILE_ID) == -1)
+		return -1;
+	if (!image->catalog.root)
+		return Malformed();
+
+	/* where hard links' files and folders are, if anywhere */
+	match.raw = gPrivateFilesName;
+	match.rawLength = sizeof(gPrivateFilesName);
+	match.item = &item;
+	if (FindChild(image, HFS_IMAGE_ROOT_ID, &match) == 0)
+		image->privateFilesID = item.isFolder ? item.cnid : 0;
+	else if (errno != ENOENT)
+		return -1;
+
+	memset(&match, 0, sizeof(match));
+	match.name = PRIVATE_FOLDERS_NAME;
+	match.item = &item;
+	if (FindChild(image, HFS_IMAGE_ROOT_ID, &match) == 0)
+		image->privateFoldersID = item.isFolder ? item.cnid : 0;
+	else if (errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// A B-tree file: its extents, from the
+// fork and the overflow file, and its
+// header record
+/////////////////////////////////////*/
+static int OpenTree (HFSImage *image, Tree *tree, const unsigned char *fork, uint32_t fileID)
+{
+	unsigned char		buf[MAX_NODE_SIZE];
+	const unsigned char	*node, *header, *overflow;
+	uint64_t			logicalSize = Get64(fork), start;
+	uint32_t			totalBlocks = Get32(fork + 12), blocks = 0, totalNodes, attributes;
+
+	tree->minKeyLength = (fileID == EXTENTS_FILE_ID) ? EXTENT_KEY_LENGTH : CATALOG_KEY_MIN_LENGTH;
+	if (AddExtents(tree, fork + 16, &blocks) == -1)
+		return -1;
+	while (blocks < totalBlocks)
+	{
+		if (fileID == EXTENTS_FILE_ID || FindOverflowExtents(image, fileID, blocks, &overflow, buf) == -1)
+			return Malformed();
+		if (AddExtents(tree, overflow, &blocks) == -1)
+			return -1;
+	}
+	if (!tree->numExtents || logicalSize > (uint64_t)blocks * image->blockSize)
+		return Malformed();
+
+	/* the header node, once its size is known */
+	start = (uint64_t)tree->extents[0].start * image->blockSize;
+	if (start > image->volumeSize || image->volumeSize - start < NODE_DESCRIPTOR_LENGTH + 106)
+		return Malformed();
+	header = image->volume + start + NODE_DESCRIPTOR_LENGTH;
+	tree->nodeSize = Get16(header + 18);
+	if (tree->nodeSize < MIN_NODE_SIZE || tree->nodeSize > MAX_NODE_SIZE || (tree->nodeSize & (tree->nodeSize - 1)))
+		return Malformed();
+	tree->numNodes = (uint32_t)(logicalSize / tree->nodeSize);
+	totalNodes = Get32(header + 22);
+	if (totalNodes < tree->numNodes)
+		tree->numNodes = totalNodes;
+
+	if (!(node = GetNode(image, tree, 0, buf)) || (int8_t)node[8] != HEADER_NODE)
+		return Malformed();
+	header = node + NODE_DESCRIPTOR_LENGTH;
+	tree->depth = Get16(header);
+	tree->root = Get32(header + 2);
+	tree->maxKeyLength = Get16(header + 20);
+	attributes = Get32(header + 38);
+	tree->variableKeys = (attributes & VARIABLE_INDEX_KEYS) != 0;
+	if (!(attributes & BIG_KEYS) || tree->depth > MAX_TREE_DEPTH || tree->root >= tree->numNodes
+		|| (tree->root && !tree->depth) || tree->maxKeyLength < tree->minKeyLength)
+		return Malformed();
+
+	if (fileID == CATALOG_FILE_ID)
+		image->caseSensitive = Get16(image->volume + VOLUME_HEADER_OFFSET) == HFSX_SIGNATURE
+								&& header[37] == BINARY_COMPARE;
+	return 0;
+}
+
+/* a record of 8 extents, to the end or the first empty one */
+static int AddExtents (Tree *tree, const unsigned char *extents, uint32_t *blocks)
+{
+	Extent		*grown;
+	uint32_t	count;
+	int			i;
+
+	grown = realloc(tree->extents, (tree->numExtents + 8) * sizeof(Extent));
+	if (!grown)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	tree->extents = grown;
+
+	for (i = 0; i < 8; i++)
+	{
+		count = Get32(extents + 8 * i + 4);
+		if (!count)
+			break;
+		tree->extents[tree->numExtents].start = Get32(extents + 8 * i);
+		tree->extents[tree->numExtents].count = count;
+		tree->numExtents++;
+		*blocks += count;
+	}
+	return i ? 0 : Malformed();
+}
+
+/*//////////////////////////////////////
+// The extents overflow record of a file's
+// data fork that starts at startBlock
+/////////////////////////////////////*/
+static int FindOverflowExtents (const HFSImage *image, uint32_t fileID, uint32_t startBlock,
+								const unsigned char **extents, unsigned char *buf)
+{
+	const unsigned char	*node, *record, *data;
+	size_t				length, dataLength;
+	uint32_t			target[2] = { fileID, startBlock }, i, count;
+
+	if (!image->extents.root || !(node = FindLeaf(image, &image->extents, CompareExtent, target, buf)))
+		return -1;
+
+	count = Get16(node + 10);
+	for (i = 0; i < count; i++)
+	{
+		record = GetRecord(&image->extents, node, i, &length);
+		if (GetKeyData(&image->extents, record, length, 0, &data, &dataLength) == -1)
+			return -1;
+		if (!CompareExtent(record, target) && dataLength >= EXTENT_RECORD_LENGTH)
+		{
+			*extents = data;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// A node by number, checked, in the map
+// or copied into buf when it's split
+// between extents.  Returns NULL and
+// EINVAL if it's malformed
+/////////////////////////////////////*/
+static const unsigned char *GetNode (const HFSImage *image, const Tree *tree, uint32_t number, unsigned char *buf)
+{
+	const unsigned char	*node = NULL;
+	uint64_t			offset = (uint64_t)number * tree->nodeSize, extentBytes, start, n;
+	uint32_t			copied = 0, i, count, recordOffset, last;
+
+	if (number >= tree->numNodes)
+		return BadNode();
+
+	for (i = 0; i < tree->numExtents && !node; i++)
+	{
+		extentBytes = (uint64_t)tree->extents[i].count * image->blockSize;
+		if (offset >= extentBytes)
+		{
+			offset -= extentBytes;
+			continue;
+		}
+		start = (uint64_t)tree->extents[i].start * image->blockSize + offset;
+		n = extentBytes - offset;
+		if (n > tree->nodeSize - copied)
+			n = tree->nodeSize - copied;
+		if (start > image->volumeSize || n > image->volumeSize - start)
+			return BadNode();
+
+		if (!copied && n == tree->nodeSize)
+			node = image->volume + start;
+		else
+		{
+			memcpy(buf + copied, image->volume + start, n);
+			copied += n;
+			offset = 0;
+			if (copied == tree->nodeSize)
+				node = buf;
+		}
+	}
+	if (!node)
+		return BadNode();
+
+	/* record offsets, from the end back, rising to where the free space starts */
+	count = Get16(node + 10);
+	if (NODE_DESCRIPTOR_LENGTH + 2 * ((size_t)count + 1) > tree->nodeSize)
+		return BadNode();
+	last = NODE_DESCRIPTOR_LENGTH;
+	for (i = 0; i <= count; i++)
+	{
+		recordOffset = Get16(node + tree->nodeSize - 2 * (i + 1));
+		if (recordOffset < last || recordOffset > tree->nodeSize - 2 * (count + 1))
+			return BadNode();
+		last = recordOffset;
+	}
+	return node;
+}
+
+/* record index of a checked node, and its length */
+static const unsigned char *GetRecord (const Tree *tree, const unsigned char *node, uint32_t index, size_t *length)
+{
+	uint32_t	offset = Get16(node + tree->nodeSize - 2 * (index + 1));
+
+	*length = Get16(node + tree->nodeSize - 2 * (index + 2)) - offset;
+	return node + offset;
+}
+
+/*//////////////////////////////////////
+// Check a record's key and find what
+// follows it, the data of a leaf record
+// or the child of an index one
+/////////////////////////////////////*/
+static int GetKeyData (const Tree *tree, const unsigned char *record, size_t length, int isIndex,
+					   const unsigned char **data, size_t *dataLength)
+{
+	size_t		keyLength, skip;
+
+	if (length < 2)
+		return Malformed();
+	keyLength = Get16(record);
+	skip = (isIndex && !tree->variableKeys) ? tree->maxKeyLength : keyLength;
+	skip = (2 + skip + 1) & ~(size_t)1;
+	if (keyLength < tree->minKeyLength || keyLength > tree->maxKeyLength || skip > length)
+		return Malformed();
+	if (tree->minKeyLength == CATALOG_KEY_MIN_LENGTH && 8 + 2 * (size_t)Get16(record + 6) > 2 + keyLength)
+		return Malformed();
+
+	*data = record + skip;
+	*dataLength = length - skip;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Descend to the leaf where target is or
+// would be, taking the last child whose
+// key isn't past it, or else the first.
+// Returns NULL and errno on error
+/////////////////////////////////////*/
+static const unsigned char *FindLeaf (const HFSImage *image, const Tree *tree, KeyCompare compare,
+									  const void *target, unsigned char *buf)
+{
+	const unsigned char	*node, *record, *data;
+	size_t				length, dataLength;
+	uint32_t			number = tree->root, child, i, count;
+	int					level;
+
+	for (level = tree->depth; level > 0; level--)
+	{
+		if (!(node = GetNode(image, tree, number, buf)) || node[9] != level)
+			return BadNode();
+		if ((int8_t)node[8] == LEAF_NODE && level == 1)
+			return node;
+		count = Get16(node + 10);
+		if ((int8_t)node[8] != INDEX_NODE || !count)
+			return BadNode();
+
+		child = 0;
+		for (i = 0; i < count; i++)
+		{
+			record = GetRecord(tree, node, i, &length);
+			if (GetKeyData(tree, record, length, 1, &data, &dataLength) == -1 || dataLength < 4)
+				return NULL;
+			if (i && compare(record, target) > 0)
+				break;
+			child = Get32(data);
+		}
+		number = child;
+	}
+	return BadNode();
+}
+
+/* a catalog key against a parent ID and an empty name, before any other */
+static int CompareParent (const unsigned char *key, const void *target)
+{
+	uint32_t	parentID = Get32(key + 2), targetID = *(const uint32_t *)target;
+
+	if (parentID != targetID)
+		return (parentID < targetID) ? -1 : 1;
+	return Get16(key + 6) ? 1 : 0;
+}
+
+/*//////////////////////////////////////
+// A catalog key against a Key, the names
+// compared by code unit.  That's the
+// catalog's order on a binary compare
+// HFSX volume, and in a folder whose
+// names are all alike, as the private
+// folders' are, on any volume
+/////////////////////////////////////*/
+static int CompareKey (const unsigned char *key, const void *target)
+{
+	const Key	*k = target;
+	uint32_t	parentID = Get32(key + 2);
+	size_t		nameLength = 2 * (size_t)Get16(key + 6);
+	int			c;
+
+	if (parentID != k->parentID)
+		return (parentID < k->parentID) ? -1 : 1;
+	c = memcmp(key + 8, k->name, (nameLength < k->nameLength) ? nameLength : k->nameLength);
+	if (c)
+		return c;
+	return (nameLength > k->nameLength) - (nameLength < k->nameLength);
+}
+
+/* an extents key against a file ID and start block, of the data fork */
+static int CompareExtent (const unsigned char *key, const void *target)
+{
+	const uint32_t	*t = target;
+	uint32_t		fileID = Get32(key + 4), startBlock = Get32(key + 8);
+
+	if (fileID != t[0])
+		return (fileID < t[0]) ? -1 : 1;
+	if (key[2])
+		return 1;
+	if (startBlock != t[1])
+		return (startBlock < t[1]) ? -1 : 1;
+	return 0;
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Call back with each catalog record
+// keyed by parentID: its thread record,
+// if it's a folder, then its items in
+// name order.  A non-zero return stops
+/////////////////////////////////////*/
+static int ScanFolder (const HFSImage *image, uint32_t parentID, RecordCallback callback, void *refCon)
+{
+	unsigned char		buf[MAX_NODE_SIZE];
+	const Tree			*tree = &image->catalog;
+	const unsigned char	*node, *recordData;
+	uint32_t			nodesLeft = tree->numNodes, next, i, count;
+	size_t				length;
+	Record				record;
+
+	if (!(node = FindLeaf(image, tree, CompareParent, &parentID, buf)))
+		return -1;
+
+	for (;;)
+	{
+		count = Get16(node + 10);
+		for (i = 0; i < count; i++)
+		{
+			recordData = GetRecord(tree, node, i, &length);
+			if (GetKeyData(tree, recordData, length, 0, &record.data, &record.length) == -1 || record.length < 2)
+				return Malformed();
+			record.parentID = Get32(recordData + 2);
+			if (record.parentID < parentID)
+				continue;
+			if (record.parentID > parentID)
+				return 0;
+			record.nameLength = Get16(recordData + 6);
+			record.name = recordData + 8;
+			if (callback(image, &record, refCon))
+				return 0;
+		}
+
+		/* the items of a folder can go on into the next leaf */
+		if (!(next = Get32(node)))
+			return 0;
+		if (!--nodesLeft || !(node = GetNode(image, tree, next, buf)) || (int8_t)node[8] != LEAF_NODE)
+			return Malformed();
+	}
+}
+
+/*//////////////////////////////////////
+// The record keyed by parentID and an
+// ASCII name, by descending the catalog
+// to its leaf.  See CompareKey for where
+// that finds it.  Returns -1 and errno,
+// ENOENT if there's none
+/////////////////////////////////////*/
+static int FindRecord (const HFSImage *image, uint32_t parentID, const char *name, Record *record, unsigned char *buf)
+{
+	const Tree			*tree = &image->catalog;
+	const unsigned char	*node, *recordData;
+	unsigned char		raw[2 * 32];
+	size_t				length, i;
+	uint32_t			count, n;
+	Key					key;
+
+	for (i = 0; name[i] && i < sizeof(raw) / 2; i++)
+	{
+		raw[2 * i] = 0;
+		raw[2 * i + 1] = (unsigned char)name[i];
+	}
+	key.parentID = parentID;
+	key.name = raw;
+	key.nameLength = 2 * i;
+
+	if (!(node = FindLeaf(image, tree, CompareKey, &key, buf)))
+		return -1;
+	count = Get16(node + 10);
+	for (n = 0; n < count; n++)
+	{
+		recordData = GetRecord(tree, node, n, &length);
+		if (GetKeyData(tree, recordData, length, 0, &record->data, &record->length) == -1 || record->length < 2)
+			return Malformed();
+		if (CompareKey(recordData, &key))
+			continue;
+		record->parentID = parentID;
+		record->nameLength = Get16(recordData + 6);
+		record->name = recordData + 8;
+		return 0;
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+/*//////////////////////////////////////
+// The item of a folder that match names,
+// an exact match before one but for the
+// case of ASCII letters, all strcasecmp
+// folds.  Returns -1 and errno, ENOENT if
+// none
+/////////////////////////////////////*/
+static int FindChild (const HFSImage *image, uint32_t parentID, Match *match)
+{
+	match->found = 0;
+	match->err = 0;
+	if (ScanFolder(image, parentID, MatchRecord, match) == -1)
+		return -1;
+	if (match->err || !match->found)
+	{
+		errno = match->err ? match->err : ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+static int MatchRecord (const HFSImage *image, const Record *record, void *refCon)
+{
+	Match		*match = refCon;
+	char		name[HFS_IMAGE_NAME_MAX];
+	int16_t		type = (int16_t)Get16(record->data);
+
+	if (type != FOLDER_RECORD && type != FILE_RECORD)
+		return 0;
+	if ((size_t)record->length < ((type == FOLDER_RECORD) ? FOLDER_RECORD_LENGTH : FILE_RECORD_LENGTH))
+	{
+		match->err = EINVAL;
+		return 1;
+	}
+
+	if (match->raw)
+	{
+		if (match->rawLength != 2 * (size_t)record->nameLength || memcmp(match->raw, record->name, match->rawLength))
+			return 0;
+		match->found = 2;
+	}
+	else
+	{
+		DecodeName(record->name, 2 * (size_t)record->nameLength, name);
+		if (!strcmp(name, match->name))
+			match->found = 2;
+		else if (!image->caseSensitive && !match->found && !strcasecmp(name, match->name))
+			match->found = 1;
+		else
+			return 0;
+	}
+
+	DecodeItem(image, NULL, record, match->item, match->follow);
+	return match->found == 2;
+}
+
+/* an item for HFSImageListFolder's callback */
+static int ListRecord (const HFSImage *image, const Record *record, void *refCon)
+{
+	Listing		*listing = refCon;
+	int16_t		type = (int16_t)Get16(record->data);
+
+	if (type != FOLDER_RECORD && type != FILE_RECORD)
+		return 0;
+	if ((size_t)record->length < ((type == FOLDER_RECORD) ? FOLDER_RECORD_LENGTH : FILE_RECORD_LENGTH))
+	{
+		listing->err = EINVAL;
+		return 1;
+	}
+	if (IsHidden(image, record))
+		return 0;
+
+	DecodeItem(image, NULL, record, &listing->item, 1);
+	return listing->callback(&listing->item, listing->refCon);
+}
+
+/* a catalog ID's thread record, which comes first of those keyed by it */
+static int ThreadRecord (const HFSImage *image, const Record *record, void *refCon)
+{
+	Thread		*thread = refCon;
+	int16_t		type = (int16_t)Get16(record->data);
+
+	if ((type == FOLDER_THREAD_RECORD || type == FILE_THREAD_RECORD) && !record->nameLength
+		&& record->length >= THREAD_RECORD_LENGTH)
+	{
+		thread->parentID = Get32(record->data + 4);
+		thread->nameLength = 2 * (size_t)Get16(record->data + 8);
+		thread->found = (thread->nameLength <= record->length - THREAD_RECORD_LENGTH
+						 && thread->nameLength <= sizeof(thread->name));
+		if (thread->found)
+			memcpy(thread->name, record->data + THREAD_RECORD_LENGTH, thread->nameLength);
+	}
+	return 1;
+}
+
+/*//////////////////////////////////////
+// An item by catalog ID, from its thread
+// record's parent and name
+/////////////////////////////////////*/
+static int GetByID (const HFSImage *image, uint32_t cnid, HFSImageItem *item, int follow)
+{
+	Thread		thread = { 0 };
+	Match		match = { 0 };
+
+	if (ScanFolder(image, cnid, ThreadRecord, &thread) == -1)
+		return -1;
+	if (!thread.found)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	match.raw = thread.name;
+	match.rawLength = thread.nameLength;
+	match.follow = follow;
+	match.item = item;
+	return FindChild(image, thread.parentID, &match);
+}
+
+/*//////////////////////////////////////
+// What a Mac doesn't show: the folders
+// of hard links' files and folders, and
+// the journal of a journaled volume
+/////////////////////////////////////*/
+static int IsHidden (const HFSImage *image, const Record *record)
+{
+	static const unsigned char	journal[] = { 0, '.', 0, 'j', 0, 'o', 0, 'u', 0, 'r', 0, 'n', 0, 'a', 0, 'l' };
+	static const unsigned char	journalInfo[] = { 0, '_', 0, 'i', 0, 'n', 0, 'f', 0, 'o', 0, '_',
+												  0, 'b', 0, 'l', 0, 'o', 0, 'c', 0, 'k' };
+	size_t						length = 2 * (size_t)record->nameLength;
+
+	if (length >= 2 && !record->name[0] && !record->name[1])
+		return 1;
+	if (record->parentID != HFS_IMAGE_ROOT_ID)
+		return 0;
+	if (image->privateFoldersID && Get32(record->data + 8) == image->privateFoldersID)
+		return 1;
+	if (!(image->attributes & VOLUME_JOURNALED) || length < sizeof(journal) || memcmp(record->name, journal, sizeof(journal)))
+		return 0;
+	return length == sizeof(journal)
+		   || (length == sizeof(journal) + sizeof(journalInfo) && !memcmp(record->name + sizeof(journal), journalInfo, sizeof(journalInfo)));
+}
+
+/*//////////////////////////////////////
+// A folder or file record as an item.  A
+// hard link, if follow, takes everything
+// but its name and place from the file or
+// folder it shares, its ID too as stat's
+// st_ino does.  A scan finds those in its
+// table, anything else by their keys
+/////////////////////////////////////*/
+static void DecodeItem (const HFSImage *image, const Scan *scan, const Record *record, HFSImageItem *item, int follow)
+{
+	const unsigned char	*d = record->data;
+	HFSImageItem		target;
+	uint32_t			special;
+	int					linked = 0;
+
+	item->parentID = record->parentID;
+	item->isFolder = ((int16_t)Get16(d) == FOLDER_RECORD);
+	item->cnid = Get32(d + 8);
+	item->createDate = Get32(d + 12);
+	item->contentModDate = Get32(d + 16);
+	item->attributeModDate = Get32(d + 20);
+	item->accessDate = Get32(d + 24);
+	item->backupDate = Get32(d + 28);
+	item->ownerID = Get32(d + 32);
+	item->groupID = Get32(d + 36);
+	item->fileMode = Get16(d + 42);
+	item->flags = Get16(d + 56);
+	special = Get32(d + 44);
+	DecodeName(record->name, 2 * (size_t)record->nameLength, item->name);
+
+	if (item->isFolder)
+	{
+		item->valence = Get32(d + 4);
+		item->numLinks = 1;
+		item->type = item->creator = 0;
+		item->dataLogical = item->dataPhysical = item->rsrcLogical = item->rsrcPhysical = 0;
+		return;
+	}
+
+	item->valence = 0;
+	item->numLinks = (record->parentID == image->privateFilesID && special) ? special : 1;
+	item->type = Get32(d + 48);
+	item->creator = Get32(d + 52);
+	item->dataLogical = Get64(d + 88);
+	item->dataPhysical = (uint64_t)Get32(d + 88 + 12) * image->blockSize;
+	item->rsrcLogical = Get64(d + 168);
+	item->rsrcPhysical = (uint64_t)Get32(d + 168 + 12) * image->blockSize;
+	if (!follow)
+		return;
+
+	if (item->type == HARD_LINK_TYPE && item->creator == HARD_LINK_CREATOR && image->privateFilesID)
+		linked = (GetLinkTarget(image, scan, 0, special, &target) == 0);
+	else if (item->type == FOLDER_LINK_TYPE && item->creator == FOLDER_LINK_CREATOR
+			 && (Get16(d + 2) & HAS_LINK_CHAIN) && image->privateFoldersID)
+		linked = (GetLinkTarget(image, scan, 1, special, &target) == 0 && target.cnid == special);
+
+	if (linked)
+	{
+		target.parentID = item->parentID;
+		memcpy(target.name, item->name, sizeof(target.name));
+		*item = target;
+	}
+}
+
+/*//////////////////////////////////////
+// The file iNodeN or folder dir_N of a
+// private folder, that hard links with
+// number N share.  Returns -1 if there's
+// no such item or it's not what it should
+// be
+/////////////////////////////////////*/
+static int GetLinkTarget (const HFSImage *image, const Scan *scan, int isFolder, uint32_t number, HFSImageItem *target)
+{
+	unsigned char		buf[MAX_NODE_SIZE];
+	const unsigned char	*node;
+	const ScanTarget	*found;
+	ScanTarget			key;
+	Record				record;
+	char				name[32];
+	int16_t				type;
+
+	if (scan)
+	{
+		key.number = number;
+		key.isFolder = isFolder;
+		found = bsearch(&key, scan->targets, scan->numTargets, sizeof(ScanTarget), CompareTargets);
+		if (!found || !(node = GetLeaf(scan, found->leaf, buf)) || GetLeafRecord(scan, node, found->index, &record) == -1)
+			return -1;
+	}
+	else
+	{
+		snprintf(name, sizeof(name), "%s%u", isFolder ? FOLDER_TARGET_PREFIX : FILE_TARGET_PREFIX, number);
+		if (FindRecord(image, isFolder ? image->privateFoldersID : image->privateFilesID, name, &record, buf) == -1)
+			return -1;
+	}
+
+	type = (int16_t)Get16(record.data);
+	if (type != (isFolder ? FOLDER_RECORD : FILE_RECORD)
+		|| record.length < (isFolder ? FOLDER_RECORD_LENGTH : FILE_RECORD_LENGTH))
+		return -1;
+	DecodeItem(image, NULL, &record, target, 0);
+	return 0;
+}
+
+/* N of a private folder's iNodeN or dir_N, which is ASCII */
+static int TargetNumber (const Record *record, const char *prefix, uint32_t *number)
+{
+	size_t		prefixLength = strlen(prefix), i;
+	uint64_t	n = 0;
+	unsigned	c;
+
+	if (record->nameLength <= prefixLength || record->nameLength > prefixLength + 10)
+		return 0;
+	for (i = 0; i < record->nameLength; i++)
+	{
+		if (record->name[2 * i])
+			return 0;
+		c = record->name[2 * i + 1];
+		if (i < prefixLength)
+		{
+			if (c != (unsigned char)prefix[i])
+				return 0;
+		}
+		else if (c >= '0' && c <= '9')
+			n = 10 * n + (c - '0');
+		else
+			return 0;
+	}
+	if (n > UINT32_MAX)
+		return 0;
+	*number = (uint32_t)n;
+	return 1;
+}
+
+/* UTF-16BE to UTF-8, with the Mac's '/' as the shell's ':' and back */
+static void DecodeName (const unsigned char *name, size_t length, char *out)
+{
+	char	*c;
+
+	FCUTF16ToUTF8(name, length, out, HFS_IMAGE_NAME_MAX);
+	for (c = out; *c; c++)
+	{
+		if (*c == '/')
+			*c = ':';
+		else if (*c == ':')
+			*c = '/';
+	}
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// HFSImageScan: the leaf nodes in key
+// order, the children of the index nodes
+// just above them, read along their level
+/////////////////////////////////////*/
+static int GatherLeaves (Scan *scan)
+{
+	unsigned char		buf[MAX_NODE_SIZE];
+	const Tree			*tree = &scan->image->catalog;
+	const unsigned char	*node, *record, *data;
+	uint32_t			number = tree->root, nodesLeft = tree->numNodes, child, i, count;
+	size_t				length, dataLength;
+	long				maxLeaves = 0;
+	uint32_t			*leaves;
+	int					level;
+
+	if (!number)
+		return 0;
+	if (tree->depth == 1)
+	{
+		if (!(scan->leaves = malloc(sizeof(uint32_t))))
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		scan->leaves[scan->numLeaves++] = number;
+		return 0;
+	}
+
+	/* down the left edge to the level above the leaves */
+	for (level = tree->depth; level > 2; level--)
+	{
+		if (!(node = GetNode(scan->image, tree, number, buf)) || (int8_t)node[8] != INDEX_NODE
+			|| node[9] != level || !Get16(node + 10))
+			return Malformed();
+		record = GetRecord(tree, node, 0, &length);
+		if (GetKeyData(tree, record, length, 1, &data, &dataLength) == -1 || dataLength < 4)
+			return -1;
+		number = Get32(data);
+	}
+
+	while (number)
+	{
+		if (!nodesLeft-- || !(node = GetNode(scan->image, tree, number, buf))
+			|| (int8_t)node[8] != INDEX_NODE || node[9] != 2)
+			return Malformed();
+		count = Get16(node + 10);
+		for (i = 0; i < count; i++)
+		{
+			record = GetRecord(tree, node, i, &length);
+			if (GetKeyData(tree, record, length, 1, &data, &dataLength) == -1 || dataLength < 4)
+				return -1;
+			child = Get32(data);
+			if (child >= tree->numNodes || scan->numLeaves >= tree->numNodes)
+				return Malformed();
+			if (!(leaves = MakeRoom(scan->leaves, &maxLeaves, scan->numLeaves, sizeof(uint32_t))))
+				return -1;
+			scan->leaves = leaves;
+			scan->leaves[scan->numLeaves++] = child;
+		}
+		number = Get32(node);
+	}
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Take parts until there are none left,
+// or a callback or an error stops them
+/////////////////////////////////////*/
+static void *ScanWorker (void *arg)
+{
+	Scan			*scan = arg;
+	ScanWorkerState	state = { NULL, 0, NULL, 0 };
+	long			part;
+	int				rc;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&scan->lock);
+		part = (scan->err || scan->stop) ? scan->numParts : scan->nextPart++;
+		pthread_mutex_unlock(&scan->lock);
+		if (part >= scan->numParts)
+			break;
+
+		rc = (scan->pass == 1) ? GatherPart(scan, part) : ListPart(scan, part, &state);
+		if (rc == -1)
+		{
+			pthread_mutex_lock(&scan->lock);
+			if (!scan->err)
+				scan->err = errno;
+			pthread_mutex_unlock(&scan->lock);
+		}
+		if (scan->pass == 2 && scan->partProc)
+			scan->partProc(part, scan->refCon);
+	}
+
+	free(state.path);
+	free(state.chain);
+	return NULL;
+}
+
+/* a leaf from the list, checked */
+static const unsigned char *GetLeaf (const Scan *scan, long n, unsigned char *buf)
+{
+	const unsigned char	*node = GetNode(scan->image, &scan->image->catalog, scan->leaves[n], buf);
+
+	if (node && ((int8_t)node[8] != LEAF_NODE || node[9] != 1))
+		return BadNode();
+	return node;
+}
+
+/* a record of a leaf, with its key taken apart */
+static int GetLeafRecord (const Scan *scan, const unsigned char *node, uint32_t i, Record *record)
+{
+	const unsigned char	*recordData;
+	size_t				length;
+
+	recordData = GetRecord(&scan->image->catalog, node, i, &length);
+	if (GetKeyData(&scan->image->catalog, recordData, length, 0, &record->data, &record->length) == -1
+		|| record->length < 2)
+		return Malformed();
+	record->parentID = Get32(recordData + 2);
+	record->nameLength = Get16(recordData + 6);
+	record->name = recordData + 8;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// The first pass over a part: the folders'
+// thread records, what each folder is
+// called and where, the folder hard
+// links that can stand in for those, and
+// where the items hard links share are
+/////////////////////////////////////*/
+static int GatherPart (Scan *scan, long part)
+{
+	unsigned char		buf[MAX_NODE_SIZE];
+	ScanPart			*p = &scan->parts[part];
+	const unsigned char	*node, *d;
+	const HFSImage		*image = scan->image;
+	ScanFolderEntry		*folders;
+	ScanLink			*links;
+	ScanTarget			*targets;
+	Record				record;
+	long				n, end = (part + 1) * SCAN_PART_LEAVES;
+	uint32_t			i, count, number;
+	size_t				nameLength;
+	int16_t				type;
+
+	if (end > scan->numLeaves)
+		end = scan->numLeaves;
+	for (n = part * SCAN_PART_LEAVES; n < end; n++)
+	{
+		if (!(node = GetLeaf(scan, n, buf)))
+			return -1;
+		count = Get16(node + 10);
+		for (i = 0; i < count; i++)
+		{
+			if (GetLeafRecord(scan, node, i, &record) == -1)
+				return -1;
+			d = record.data;
+			type = (int16_t)Get16(d);
+
+			if (type == FOLDER_THREAD_RECORD && !record.nameLength && record.length >= THREAD_RECORD_LENGTH)
+			{
+				nameLength = 2 * (size_t)Get16(d + 8);
+				if (nameLength > record.length - THREAD_RECORD_LENGTH || nameLength > 2 * 255)
+					return Malformed();
+				if (!(folders = MakeRoom(p->folders, &p->maxFolders, p->numFolders, sizeof(ScanFolderEntry))))
+					return -1;
+				p->folders = folders;
+				folders[p->numFolders].cnid = record.parentID;
+				folders[p->numFolders].parentID = Get32(d + 4);
+				if (AddName(p, d + THREAD_RECORD_LENGTH, nameLength, &folders[p->numFolders].name) == -1)
+					return -1;
+				p->numFolders++;
+			}
+			else if (type == FILE_RECORD && record.length >= FILE_RECORD_LENGTH
+					 && Get32(d + 48) == FOLDER_LINK_TYPE && Get32(d + 52) == FOLDER_LINK_CREATOR
+					 && (Get16(d + 2) & HAS_LINK_CHAIN) && scan->image->privateFoldersID
+					 && !IsHidden(scan->image, &record))
+			{
+				if (!(links = MakeRoom(p->links, &p->maxLinks, p->numLinks, sizeof(ScanLink))))
+					return -1;
+				p->links = links;
+				links[p->numLinks].target = Get32(d + 44);
+				links[p->numLinks].parentID = record.parentID;
+				if (AddName(p, record.name, 2 * (size_t)record.nameLength, &links[p->numLinks].name) == -1)
+					return -1;
+				p->numLinks++;
+			}
+			else if ((type == FILE_RECORD && image->privateFilesID && record.parentID == image->privateFilesID
+					  && TargetNumber(&record, FILE_TARGET_PREFIX, &number))
+					 || (type == FOLDER_RECORD && image->privateFoldersID && record.parentID == image->privateFoldersID
+						 && TargetNumber(&record, FOLDER_TARGET_PREFIX, &number)))
+			{
+				if (!(targets = MakeRoom(p->targets, &p->maxTargets, p->numTargets, sizeof(ScanTarget))))
+					return -1;
+				p->targets = targets;
+				targets[p->numTargets].number = number;
+				targets[p->numTargets].isFolder = (type == FOLDER_RECORD);
+				targets[p->numTargets].leaf = (uint32_t)n;
+				targets[p->numTargets].index = i;
+				p->numTargets++;
+			}
+		}
+	}
+	return 0;
+}
+
+/* a name as the shell shows it, kept with the part's others */
+static int AddName (ScanPart *p, const unsigned char *name, size_t length, size_t *offset)
+{
+	char		decoded[HFS_IMAGE_NAME_MAX];
+	size_t		len, size;
+	char		*names;
+
+	DecodeName(name, length, decoded);
+	len = strlen(decoded) + 1;
+	if (p->namesLength + len > p->namesSize)
+	{
+		size = p->namesSize ? 2 * p->namesSize : 4096;
+		while (size < p->namesLength + len)
+			size *= 2;
+		if (!(names = realloc(p->names, size)))
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		p->names = names;
+		p->namesSize = size;
+	}
+	*offset = p->namesLength;
+	memcpy(p->names + p->namesLength, decoded, len);
+	p->namesLength += len;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Join the parts' folders into one table
+// by catalog ID, which is the order their
+// thread records came in.  A folder with
+// hard links is put where its first link
+// is, so it's listed once, there.  The
+// items hard links share go into another,
+// by kind and number
+/////////////////////////////////////*/
+static int JoinFolders (Scan *scan)
+{
+	const HFSImage	*image = scan->image;
+	ScanPart		*p;
+	ScanFolderEntry	*entry;
+	size_t			namesLength = 0, base;
+	long			numFolders = 0, numTargets = 0, i, j;
+	int				sorted = 1;
+
+	for (i = 0; i < scan->numParts; i++)
+	{
+		numFolders += scan->parts[i].numFolders;
+		numTargets += scan->parts[i].numTargets;
+		namesLength += scan->parts[i].namesLength;
+	}
+	scan->folders = malloc((numFolders ? numFolders : 1) * sizeof(ScanFolderEntry));
+	scan->targets = malloc((numTargets ? numTargets : 1) * sizeof(ScanTarget));
+	scan->names = malloc(namesLength ? namesLength : 1);
+	if (!scan->folders || !scan->targets || !scan->names)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0, base = 0; i < scan->numParts; i++)
+	{
+		p = &scan->parts[i];
+		if (p->namesLength)
+			memcpy(scan->names + base, p->names, p->namesLength);
+		for (j = 0; j < p->numFolders; j++)
+		{
+			entry = &scan->folders[scan->numFolders++];
+			*entry = p->folders[j];
+			entry->name += base;
+			if (scan->numFolders > 1 && entry->cnid < entry[-1].cnid)
+				sorted = 0;
+		}
+		if (p->numTargets)
+			memcpy(scan->targets + scan->numTargets, p->targets, p->numTargets * sizeof(ScanTarget));
+		scan->numTargets += p->numTargets;
+		p->base = base;
+		base += p->namesLength;
+	}
+	if (!sorted)
+		qsort(scan->folders, scan->numFolders, sizeof(ScanFolderEntry), CompareFolderEntries);
+
+	/* in name order, iNode10 before iNode9 */
+	qsort(scan->targets, scan->numTargets, sizeof(ScanTarget), CompareTargets);
+
+	for (i = 0; i < scan->numParts; i++)
+	{
+		p = &scan->parts[i];
+		for (j = 0; j < p->numLinks; j++)
+		{
+			entry = FindFolderEntry(scan, p->links[j].target);
+			if (entry && entry->parentID == image->privateFoldersID)
+			{
+				entry->parentID = p->links[j].parentID;
+				entry->name = p->base + p->links[j].name;
+			}
+		}
+		FreePart(p);
+	}
+	return 0;
+}
+
+static int CompareFolderEntries (const void *a, const void *b)
+{
+	uint32_t	x = ((const ScanFolderEntry *)a)->cnid, y = ((const ScanFolderEntry *)b)->cnid;
+
+	return (x > y) - (x < y);
+}
+
+static ScanFolderEntry *FindFolderEntry (const Scan *scan, uint32_t cnid)
+{
+	ScanFolderEntry	key;
+
+	key.cnid = cnid;
+	return bsearch(&key, scan->folders, scan->numFolders, sizeof(ScanFolderEntry), CompareFolderEntries);
+}
+
+static int CompareTargets (const void *a, const void *b)
+{
+	const ScanTarget	*x = a, *y = b;
+
+	if (x->isFolder != y->isFolder)
+		return (x->isFolder > y->isFolder) - (x->isFolder < y->isFolder);
+	return (x->number > y->number) - (x->number < y->number);
+}
+
+static void FreePart (ScanPart *p)
+{
+	free(p->folders);
+	free(p->links);
+	free(p->targets);
+	free(p->names);
+	p->folders = NULL;
+	p->links = NULL;
+	p->targets = NULL;
+	p->names = NULL;
+}
+
+/*//////////////////////////////////////
+// The second pass over a part: the items
+// of each folder whose records start in
+// it, which can run on into the parts
+// after.  Those a part starts in the
+// middle of are the part's before
+/////////////////////////////////////*/
+static int ListPart (Scan *scan, long part, ScanWorkerState *state)
+{
+	unsigned char		buf[MAX_NODE_SIZE];
+	const unsigned char	*node;
+	HFSImageItem		item;
+	Record				record;
+	long				n = part * SCAN_PART_LEAVES, end = n + SCAN_PART_LEAVES;
+	uint32_t			skipID = 0, folderID = 0, i, count;
+	int					skipping = 0, inFolder = 0, listed = 0;
+	int16_t				type;
+
+	/* the records of the last folder of the part before */
+	if (n > 0)
+	{
+		if (!(node = GetLeaf(scan, n - 1, buf)) || !(count = Get16(node + 10)))
+			return Malformed();
+		if (GetLeafRecord(scan, node, count - 1, &record) == -1)
+			return -1;
+		skipID = record.parentID;
+		skipping = 1;
+	}
+
+	for (; n < scan->numLeaves; n++)
+	{
+		if (!(node = GetLeaf(scan, n, buf)))
+			return -1;
+		count = Get16(node + 10);
+		for (i = 0; i < count; i++)
+		{
+			if (GetLeafRecord(scan, node, i, &record) == -1)
+				return -1;
+			if (skipping && record.parentID == skipID)
+				continue;
+			skipping = 0;
+
+			if (!inFolder || record.parentID != folderID)
+			{
+				if (listed && scan->proc(state->path, folderID, NULL, scan->refCon))
+					return Stop(scan);
+				if (n >= end)
+					return 0;
+				inFolder = 1;
+				folderID = record.parentID;
+
+				/* a file's thread record is all there is under its ID */
+				if ((int16_t)Get16(record.data) == FILE_THREAD_RECORD)
+					listed = 0;
+				else if ((listed = FolderPath(scan, folderID, state)) == -1)
+					return -1;
+			}
+			if (!listed)
+				continue;
+
+			type = (int16_t)Get16(record.data);
+			if (type != FOLDER_RECORD && type != FILE_RECORD)
+				continue;
+			if ((size_t)record.length < ((type == FOLDER_RECORD) ? FOLDER_RECORD_LENGTH : FILE_RECORD_LENGTH))
+				return Malformed();
+			if (IsHidden(scan->image, &record))
+				continue;
+			DecodeItem(scan->image, scan, &record, &item, 1);
+			if (scan->proc(state->path, folderID, &item, scan->refCon))
+				return Stop(scan);
+		}
+	}
+	if (listed && scan->proc(state->path, folderID, NULL, scan->refCon))
+		return Stop(scan);
+	return 0;
+}
+
+/*//////////////////////////////////////
+// The path of a folder, made up in state
+// from the table's names up to the folder
+// being scanned.  Returns 1, 0 if the
+// folder isn't in it or is hidden, or the
+// ID isn't a folder's at all, or -1 and
+// ENOMEM
+/////////////////////////////////////*/
+static int FolderPath (const Scan *scan, uint32_t folderID, ScanWorkerState *state)
+{
+	const HFSImage			*image = scan->image;
+	const ScanFolderEntry	*entry, **chain;
+	const char				*name;
+	size_t					pathLength = strlen(scan->path), length, size;
+	long					depth = 0, i;
+	char					*path;
+	uint32_t				id;
+
+	for (id = folderID; id != scan->folderID; id = entry->parentID)
+	{
+		if (depth > scan->numFolders || id == image->privateFilesID || id == image->privateFoldersID
+			|| !(entry = FindFolderEntry(scan, id)) || !scan->names[entry->name])
+			return 0;
+		if (!(chain = MakeRoom(state->chain, &state->maxChain, depth, sizeof(*chain))))
+			return -1;
+		state->chain = chain;
+		chain[depth++] = entry;
+	}
+
+	length = pathLength;
+	for (i = 0; i < depth; i++)
+		length += strlen(scan->names + state->chain[i]->name) + 1;
+	if (length + 1 > state->pathSize)
+	{
+		size = length + 1 + 256;
+		if (!(path = realloc(state->path, size)))
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		state->path = path;
+		state->pathSize = size;
+	}
+
+	memcpy(state->path, scan->path, pathLength);
+	while (depth--)
+	{
+		name = scan->names + state->chain[depth]->name;
+		if (!pathLength || state->path[pathLength - 1] != '/')
+			state->path[pathLength++] = '/';
+		length = strlen(name);
+		memcpy(state->path + pathLength, name, length);
+		pathLength += length;
+	}
+	state->path[pathLength] = '\0';
+	return 1;
+}
+
+/* a callback asked for the scan to stop */
+static int Stop (Scan *scan)
+{
+	pthread_mutex_lock(&scan->lock);
+	scan->stop = 1;
+	pthread_mutex_unlock(&scan->lock);
+	return 0;
+}
+
+/* room for one more in a growing array, or NULL and ENOMEM */
+static void *MakeRoom (void *array, long *max, long count, size_t size)
+{
+	long	n;
+
+	if (count < *max)
+		return array;
+	n = *max ? 2 * *max : 256;
+	if (!(array = realloc(array, n * size)))
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	*max = n;
+	return array;
+}
+
+#pragma mark -
+
+static uint16_t Get16 (const unsigned char *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t Get32 (const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t Get64 (const unsigned char *p)
+{
+	return ((uint64_t)Get32(p) << 32) | Get32(p + 4);
+}
+
+static uint32_t GetLittle32 (const unsigned char *p)
+{
+	return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static uint64_t GetLittle64 (const unsigned char *p)
+{
+	return ((uint64_t)GetLittle32(p + 4) << 32) | GetLittle32(p);
+}
+
+static int Malformed (void)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static const unsigned char *BadNode (void)
+{
+	errno = EINVAL;
+	return NULL;
+}
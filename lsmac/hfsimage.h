@@ -0,0 +1,117 @@
+/*
+    hfsimage.h - read-only access to HFS+ volume images
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    An HFS+ (or HFSX) volume, in a raw image file or device, read
+    without mounting it, as TN1150 lays it out.  HFSImageOpen maps the
+    whole image and finds the volume: at the start, inside an HFS
+    wrapper, or as the first HFS partition of an Apple or GUID
+    partition map.  From the volume header it takes the catalog file's
+    extents, and any it has in the extents overflow file.
+
+    The catalog is a B-tree keyed by parent folder ID and name, so a
+    folder's items are one run of leaf records.  Everything here finds
+    that run by parent ID alone, descending the index to where an
+    empty name would go, and walks the leaves from there; names are
+    compared only within a folder, as UTF-8, so no case-folding table
+    is needed.  On a case-insensitive volume a name that differs only in
+    the case of ASCII letters still matches, but that is all the folding
+    there is: other letters must match exactly, and so must the form of
+    the name.  Names on HFS+ are decomposed Unicode, so a precomposed
+    name doesn't find them.  They keep '/' where the Mac shows ':', and
+    come back the way the Mac's shell shows them.
+
+    Items have what FSGetCatalogInfo answers: Finder info, dates,
+    folder valences, fork sizes and BSD permissions.  A file hard link
+    is followed to the file it shares.  Nothing is written or cached
+    and nodes are read into the caller's stack when they're split
+    between extents, so an image can be read by any number of threads.
+
+    HFSImageScan lists a whole tree without going folder by folder.
+    Every record is in the leaf nodes, and the index nodes just above
+    them list those in key order, so the list is split into parts of
+    64 leaves and the threads take a part at a time.  A first
+    pass keeps the folder thread records, each folder's parent and
+    name, in a table sorted by catalog ID; a second decodes the items
+    and makes up each folder's path from the table once.  A folder's
+    items can run on past the end of a part, and are listed whole by
+    the part they start in, so the callback sees each folder on one
+    thread, in name order; parts are done in any order, and
+    HFSImagePartProc says when, for a caller that prints them in order.
+    A folder with hard links is listed once, where its first link is.
+*/
+
+#ifndef HFSIMAGE_H
+#define HFSIMAGE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define		HFS_IMAGE_NAME_MAX		768			/* 255 UTF-16 characters as UTF-8, and the NUL */
+#define		HFS_IMAGE_ROOT_ID		2
+#define		HFS_IMAGE_EPOCH_DELTA	2082844800U	/* 1904 to 1970, in seconds */
+
+typedef struct HFSImage HFSImage;
+
+/* a file or folder, with numbers in host byte order */
+typedef struct HFSImageItem
+{
+	uint32_t	cnid;
+	uint32_t	parentID;
+	int			isFolder;
+	uint32_t	valence;			/* folders only */
+	uint32_t	numLinks;			/* files, more than 1 for a hard link */
+	uint32_t	createDate;			/* seconds since 1904, UTC */
+	uint32_t	contentModDate;
+	uint32_t	attributeModDate;
+	uint32_t	accessDate;
+	uint32_t	backupDate;
+	uint32_t	ownerID;
+	uint32_t	groupID;
+	uint16_t	fileMode;			/* 0 if never set */
+	uint32_t	type;				/* 0 for folders */
+	uint32_t	creator;
+	uint16_t	flags;				/* Finder flags */
+	uint64_t	dataLogical;
+	uint64_t	dataPhysical;
+	uint64_t	rsrcLogical;
+	uint64_t	rsrcPhysical;
+	char		name[HFS_IMAGE_NAME_MAX];
+} HFSImageItem;
+
+/* called for each item of a folder; returning non-zero stops there */
+typedef int (*HFSImageCallback) (const HFSImageItem *item, void *refCon);
+
+/* HFSImageScan's, on any of its threads, with a NULL item once a folder is done */
+typedef int  (*HFSImageScanProc) (const char *dirPath, uint32_t folderID, const HFSImageItem *item, void *refCon);
+/* and on the same thread once it has done a part; they're numbered in catalog order */
+typedef void (*HFSImagePartProc) (long part, void *refCon);
+
+HFSImage *HFSImageOpen (const char *path);
+void      HFSImageClose (HFSImage *image);
+int       HFSImageLookup (HFSImage *image, const char *path, HFSImageItem *item);
+int       HFSImageGetItem (HFSImage *image, uint32_t parentID, const char *name, HFSImageItem *item);
+int       HFSImageGetByID (HFSImage *image, uint32_t cnid, HFSImageItem *item);
+int       HFSImageListFolder (HFSImage *image, uint32_t folderID, HFSImageCallback callback, void *refCon);
+void      HFSImageStat (const HFSImageItem *item, struct stat *st);
+int       HFSImageScan (HFSImage *image, uint32_t folderID, const char *path, int numThreads,
+                        HFSImageScanProc proc, HFSImagePartProc partProc, void *refCon);
+
+#endif /* HFSIMAGE_H */
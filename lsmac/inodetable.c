@@ -0,0 +1,365 @@
+/*
+    inodetable.c - thread safe hash table keyed by (device, inode)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <pthread.h>
+
+#include "inodetable.h"
+
+#define		NUM_STRIPES			64
+#define		INITIAL_SLOTS		256		/* per stripe, power of two */
+#define		SET_INITIAL_SLOTS	64		/* power of two */
+
+/* a slot: ino, dev, then the value; ino 0 marks a free slot */
+#define		SLOT_KEY_SIZE		(2 * sizeof(uint64_t))
+
+typedef struct Stripe
+{
+	pthread_mutex_t		lock;
+	unsigned char		*slots;
+	size_t				numSlots;
+	size_t				used;
+	int					haveZero;		/* inode 0 can't live in a slot */
+	uint64_t			zeroDev;
+} Stripe;
+
+struct InodeTable
+{
+	size_t		valueSize;
+	size_t		slotSize;
+	Stripe		stripes[NUM_STRIPES];
+};
+
+/* any key can go in a set, zero included */
+typedef struct SetSlot
+{
+	uint64_t	dev;
+	uint64_t	ino;
+	int			used;
+} SetSlot;
+
+struct InodeSet
+{
+	SetSlot		*slots;
+	size_t		numSlots;
+	size_t		used;
+};
+
+static uint64_t	HashKey (uint64_t dev, uint64_t ino);
+static unsigned char *FindSlot (InodeTable *table, Stripe *stripe, uint64_t hash, uint64_t dev, uint64_t ino);
+static void		GrowStripe (InodeTable *table, Stripe *stripe);
+static SetSlot *FindSetSlot (InodeSet *set, uint64_t dev, uint64_t ino);
+static void		GrowSet (InodeSet *set);
+static void	   *AllocOrDie (void *p);
+
+/*//////////////////////////////////////
+// Create a table whose entries carry
+// valueSize bytes each (0 for a set)
+/////////////////////////////////////*/
+InodeTable *InodeTableCreate (size_t valueSize)
+{
+	InodeTable	*table;
+	int			i;
+
+	table = calloc(1, sizeof(InodeTable));
+	if (!table)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+
+	table->valueSize = valueSize;
+	table->slotSize = (SLOT_KEY_SIZE + valueSize + 7) & ~(size_t)7;
+
+	for (i = 0; i < NUM_STRIPES; i++)
+		pthread_mutex_init(&table->stripes[i].lock, NULL);
+
+	return table;
+}
+
+void InodeTableDispose (InodeTable *table)
+{
+	int		i;
+
+	if (!table)
+		return;
+
+	for (i = 0; i < NUM_STRIPES; i++)
+	{
+		pthread_mutex_destroy(&table->stripes[i].lock);
+		free(table->stripes[i].slots);
+	}
+	free(table);
+}
+
+/*//////////////////////////////////////
+// Add a key, storing value if given.
+// Returns 1 if the key is new, 0 if it
+// was already there (value is then
+// left alone)
+/////////////////////////////////////*/
+int InodeTableInsert (InodeTable *table, uint64_t dev, uint64_t ino, const void *value)
+{
+	uint64_t		hash = HashKey(dev, ino);
+	Stripe			*stripe = &table->stripes[hash >> 58];
+	unsigned char	*slot;
+	int				isNew = 0;
+
+	pthread_mutex_lock(&stripe->lock);
+
+	if (ino == 0)
+	{
+		/* not a real inode number, but don't lose it */
+		if (!stripe->haveZero)
+		{
+			stripe->haveZero = 1;
+			stripe->zeroDev = dev;
+			isNew = 1;
+		}
+		pthread_mutex_unlock(&stripe->lock);
+		return isNew;
+	}
+
+	if ((stripe->used + 1) * 4 > stripe->numSlots * 3)
+		GrowStripe(table, stripe);
+
+	slot = FindSlot(table, stripe, hash, dev, ino);
+	if (((uint64_t *)slot)[0] == 0)
+	{
+		((uint64_t *)slot)[0] = ino;
+		((uint64_t *)slot)[1] = dev;
+		if (value && table->valueSize)
+			memcpy(slot + SLOT_KEY_SIZE, value, table->valueSize);
+		stripe->used++;
+		isNew = 1;
+	}
+
+	pthread_mutex_unlock(&stripe->lock);
+	return isNew;
+}
+
+/*//////////////////////////////////////
+// Look a key up, copying out its value
+// Returns 1 if found
+/////////////////////////////////////*/
+int InodeTableLookup (InodeTable *table, uint64_t dev, uint64_t ino, void *value)
+{
+	uint64_t		hash = HashKey(dev, ino);
+	Stripe			*stripe = &table->stripes[hash >> 58];
+	unsigned char	*slot;
+	int				found = 0;
+
+	if (ino == 0)
+		return 0;
+
+	pthread_mutex_lock(&stripe->lock);
+	if (stripe->numSlots)
+	{
+		slot = FindSlot(table, stripe, hash, dev, ino);
+		if (((uint64_t *)slot)[0] != 0)
+		{
+			if (value && table->valueSize)
+				memcpy(value, slot + SLOT_KEY_SIZE, table->valueSize);
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock(&stripe->lock);
+
+	return found;
+}
+
+/*//////////////////////////////////////
+// Call proc for every entry, in no
+// particular order.  Not to be used
+// while other threads are inserting.
+/////////////////////////////////////*/
+void InodeTableApply (InodeTable *table, InodeTableProc proc, void *refCon)
+{
+	Stripe			*stripe;
+	unsigned char	*slot;
+	size_t			i;
+	int				s;
+
+	for (s = 0; s < NUM_STRIPES; s++)
+	{
+		stripe = &table->stripes[s];
+		if (stripe->haveZero)
+			proc(stripe->zeroDev, 0, NULL, refCon);
+		for (i = 0; i < stripe->numSlots; i++)
+		{
+			slot = stripe->slots + i * table->slotSize;
+			if (((uint64_t *)slot)[0] != 0)
+				proc(((uint64_t *)slot)[1], ((uint64_t *)slot)[0], slot + SLOT_KEY_SIZE, refCon);
+		}
+	}
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// An empty set, for one thread only; any
+// pair of 64 bit numbers can be a key
+/////////////////////////////////////*/
+InodeSet *InodeSetCreate (void)
+{
+	InodeSet	*set = AllocOrDie(calloc(1, sizeof(InodeSet)));
+
+	set->numSlots = SET_INITIAL_SLOTS;
+	set->slots = AllocOrDie(calloc(set->numSlots, sizeof(SetSlot)));
+	return set;
+}
+
+void InodeSetDispose (InodeSet *set)
+{
+	if (!set)
+		return;
+	free(set->slots);
+	free(set);
+}
+
+/*//////////////////////////////////////
+// Add a key.  Returns 1 if it is new, 0
+// if it was already there
+/////////////////////////////////////*/
+int InodeSetInsert (InodeSet *set, uint64_t dev, uint64_t ino)
+{
+	SetSlot		*slot;
+
+	if ((set->used + 1) * 4 > set->numSlots * 3)
+		GrowSet(set);
+
+	slot = FindSetSlot(set, dev, ino);
+	if (slot->used)
+		return 0;
+
+	slot->dev = dev;
+	slot->ino = ino;
+	slot->used = 1;
+	set->used++;
+	return 1;
+}
+
+#pragma mark -
+
+/* 64 bit mix (splitmix64 finalizer) */
+static uint64_t HashKey (uint64_t dev, uint64_t ino)
+{
+	uint64_t	x = ino ^ (dev * 0x9E3779B97F4A7C15ULL);
+
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* the slot holding the key, or the free slot where it would go */
+static unsigned char *FindSlot (InodeTable *table, Stripe *stripe, uint64_t hash, uint64_t dev, uint64_t ino)
+{
+	size_t			mask = stripe->numSlots - 1;
+	size_t			i = (size_t)hash & mask;
+	unsigned char	*slot;
+
+	for (;;)
+	{
+		slot = stripe->slots + i * table->slotSize;
+		if (((uint64_t *)slot)[0] == 0)
+			return slot;
+		if (((uint64_t *)slot)[0] == ino && ((uint64_t *)slot)[1] == dev)
+			return slot;
+		i = (i + 1) & mask;
+	}
+}
+
+static void GrowStripe (InodeTable *table, Stripe *stripe)
+{
+	unsigned char	*oldSlots = stripe->slots;
+	size_t			oldNum = stripe->numSlots;
+	unsigned char	*src;
+	unsigned char	*dst;
+	size_t			i;
+
+	stripe->numSlots = oldNum ? oldNum * 2 : INITIAL_SLOTS;
+	stripe->slots = calloc(stripe->numSlots, table->slotSize);
+	if (!stripe->slots)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+
+	for (i = 0; i < oldNum; i++)
+	{
+		src = oldSlots + i * table->slotSize;
+		if (((uint64_t *)src)[0] == 0)
+			continue;
+		dst = FindSlot(table, stripe, HashKey(((uint64_t *)src)[1], ((uint64_t *)src)[0]),
+					   ((uint64_t *)src)[1], ((uint64_t *)src)[0]);
+		memcpy(dst, src, table->slotSize);
+	}
+
+	free(oldSlots);
+}
+
+/* the slot holding the key, or the free slot where it would go */
+static SetSlot *FindSetSlot (InodeSet *set, uint64_t dev, uint64_t ino)
+{
+	size_t		mask = set->numSlots - 1;
+	size_t		i = (size_t)HashKey(dev, ino) & mask;
+	SetSlot		*slot;
+
+	for (;;)
+	{
+		slot = &set->slots[i];
+		if (!slot->used)
+			return slot;
+		if (slot->ino == ino && slot->dev == dev)
+			return slot;
+		i = (i + 1) & mask;
+	}
+}
+
+static void GrowSet (InodeSet *set)
+{
+	SetSlot		*oldSlots = set->slots;
+	size_t		oldNum = set->numSlots;
+	size_t		i;
+
+	set->numSlots = oldNum * 2;
+	set->slots = AllocOrDie(calloc(set->numSlots, sizeof(SetSlot)));
+
+	for (i = 0; i < oldNum; i++)
+		if (oldSlots[i].used)
+			*FindSetSlot(set, oldSlots[i].dev, oldSlots[i].ino) = oldSlots[i];
+
+	free(oldSlots);
+}
+
+static void *AllocOrDie (void *p)
+{
+	if (!p)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	return p;
+}
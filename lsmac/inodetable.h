@@ -0,0 +1,54 @@
+/*
+    inodetable.h - thread safe hash table keyed by (device, inode)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Open addressing, split into independently locked stripes so the
+    walker threads rarely wait on each other.  Each slot is the key plus
+    a fixed size value; with a value size of 0 it is simply a set, which
+    is what we use to count hard links only once.
+
+    An InodeSet is the small, unlocked kind for one thread's use, such as
+    the hard links in the one directory being listed.  It starts out at a
+    couple of kilobytes and grows with what is put in it.
+*/
+
+#ifndef INODETABLE_H
+#define INODETABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct InodeTable InodeTable;
+
+typedef void (*InodeTableProc) (uint64_t dev, uint64_t ino, void *value, void *refCon);
+
+InodeTable *InodeTableCreate (size_t valueSize);
+void        InodeTableDispose (InodeTable *table);
+
+int  InodeTableInsert (InodeTable *table, uint64_t dev, uint64_t ino, const void *value);
+int  InodeTableLookup (InodeTable *table, uint64_t dev, uint64_t ino, void *value);
+void InodeTableApply (InodeTable *table, InodeTableProc proc, void *refCon);
+
+typedef struct InodeSet InodeSet;
+
+InodeSet   *InodeSetCreate (void);
+void        InodeSetDispose (InodeSet *set);
+int         InodeSetInsert (InodeSet *set, uint64_t dev, uint64_t ino);
+
+#endif /* INODETABLE_H */
@@ -29,6 +29,52 @@
 
 /*  CHANGES
 
+	0.7	-	* Builds without Carbon: Finder info and resource fork sizes are read from
+			  the com.apple.FinderInfo and com.apple.ResourceFork extended attributes,
+			  relative to the open directory, so mirrored Mac volumes can be listed on Linux
+			* Directories are read in large batches (getdents64 on Linux) and entries
+			  stat'ed relative to the directory fd; full paths are only built when needed
+			* -R option: list subdirectories recursively, scanned in parallel by a pool of
+			  work-stealing threads (-j); output stays in order unless -U is given
+			* -c option: folder sizes, added up bottom-up over the whole hierarchy in
+			  parallel, per fork; a hard linked file is counted once in each folder
+			  that holds any of its links
+			* -I option: keep Finder info and fork sizes in an index file keyed by device
+			  and inode, so later runs only go back to the file system for items whose
+			  ctime or size has changed
+			* --watch option: after the listing, follow the directories with inotify and
+			  print the lines of entries that change, once per burst of events
+			* Folders with more than 9999 items show their real count; off the Mac the
+			  count is a bare getdents pass, and folders the -c walk has already read
+			  aren't read again.  A folder whose items can't be counted is still listed
+			* --format=ndjson and --format=binary: machine readable output, one JSON object
+			  per entry or blocks of fixed width columns with a string heap, formatted
+			  into one large buffer per thread
+			* The text listing goes through the same buffers: no printf per line and no
+			  static size strings; the walker hands finished directories to writev
+			* --columns option: choose the columns; Finder info, fork sizes, alias targets
+			  and item counts are only fetched for the columns shown
+			* --where option: list only entries matching an expression on flags, label,
+			  type, creator, size and name, tested before anything more is fetched
+			* --top and --by options: the largest files (and folders, with -c) of a whole
+			  tree, kept in a small heap per thread instead of sorting a full listing
+			* --summary option: file counts and bytes of a whole tree by label, type,
+			  creator and Finder flag, in one pass; a hard link's bytes count once
+			* The total line counts hard links and extents shared between files (clones,
+			  where FIEMAP tells) once, and adds up physical sizes with -l
+			* --stats option: calls and time per phase (readdir, stat, Finder info, fork
+			  sizes, aliases, output...) from per-thread counters, as a table or JSON
+			* --trace option: Chrome trace-event spans per directory, meta-data read,
+			  output write and walker wait, from per-thread ring buffers
+			* --holes option: data and holes of sparse files, from SEEK_DATA/SEEK_HOLE
+			  or FIEMAP, probed only when the blocks fall short of the logical size
+			* --image option: list folders of an HFS+ disk image or device, read
+			  straight from its catalog B-tree without mounting it, so Finder info,
+			  fork sizes and item counts come out the same on any system
+			* --image with -R, --top or --summary reads the whole catalog at once,
+			  its leaf nodes split between the threads, and makes up each
+			  folder's path from a table of the folders' thread records
+
 	0.6	-	* Now lists symlinks without error, thanks to Jean-Luc Dubois
 			* All errors go to stderr
 			* Exit values are constants from sysexits.h
@@ -73,11 +119,9 @@
     
         * Incorporate Ingmar J. Stein's improvements to lsmac, which should fix the following problems
         
-            * Bug - errors may occur when listing folders containing more than 9999 files.
             * Bug - Does not display size correctly for files larger than 4GB or so. 64bit int problem.
             * Bug - When a directory parameter ends with a "/", the pathnames reported by the -p option have two slashes at the end
         
-        * Implement calculation of folder sizes - recursively scan through hierarchy and add up total size
         * There is other Mac file meta-data not available via FSpGetFInfo() which should also be listed
         * -x option: list file suffixes in a seperate column, kind of like the DOS dir command
         * List total size/number of all files listed on top, akin to ls
@@ -89,62 +133,228 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
-#include <Carbon/Carbon.h>
+#include <fcntl.h>
 #include <sysexits.h>
 #include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include <Carbon/Carbon.h>
+#else
+#include "finderinfo.h"
+#endif
+
+#include "scan.h"
+#include "walk.h"
+#include "inodetable.h"
+#include "mdindex.h"
+#include "watch.h"
+#include "output.h"
+#include "filter.h"
+#include "rank.h"
+#include "tally.h"
+#include "stats.h"
+#include "trace.h"
+#include "hfsimage.h"
+
+#define		MAX_PATH_LENGTH		1024
+#define		MAX_FILENAME_LENGTH	256
+
+/*
+    Everything the backends need to get at an item again.
+    On Mac OS X we go through the File Manager with an FSRef,
+    elsewhere Finder info comes from extended attributes,
+    looked up relative to the directory the item lives in.
+    With --image the catalog record has it all, and there's
+    no directory to look in.
+*/
+typedef struct ItemRef
+{
+#ifdef __APPLE__
+	FSRef		fsRef;
+#endif
+	const HFSImageItem	*imageItem;	/* or NULL */
+	int			dirFd;
+	const char	*dirPath;
+	char		*name;
+	char		*path;		/* built on demand by ItemPath() */
+	struct stat	st;
+	char		pathBuf[MAX_PATH_LENGTH + MAX_FILENAME_LENGTH + 1];
+} ItemRef;
+
+/* Sizes of both forks of a file, or totals for a folder */
+typedef struct ForkSizes
+{
+	UInt64		dataLogical;
+	UInt64		dataPhysical;
+	UInt64		rsrcLogical;
+	UInt64		rsrcPhysical;
+} ForkSizes;
+
+#ifdef __APPLE__
+/* Finder info in host byte order, as the xattr backend decodes it */
+typedef struct FinderInfoRec
+{
+	OSType		type;
+	OSType		creator;
+	UInt16		flags;
+} FinderInfoRec;
+#endif
+
+/* -c: a file with more than one link, and what it added to the sizes */
+typedef struct LinkedFile
+{
+	uint64_t	dev;
+	uint64_t	ino;
+	ForkSizes	sizes;
+} LinkedFile;
+
+/* -c: one folder's WalkNode data.  Its own files are kept apart from
+   node->sum, which its subfolders add into as they finish. */
+typedef struct FolderSizing
+{
+	ForkSizes	own;			// the files in the folder itself, every link
+	LinkedFile	*ownLinks;		// of those, the ones with more than one link
+	long		numOwnLinks;
+	long		maxOwnLinks;
+	InodeSet	*seen;			// links counted anywhere below, walk locked
+	LinkedFile	*links;
+	long		numLinks;
+	long		maxLinks;
+} FolderSizing;
+
+/* --image: the items of a catalog folder, copied as they're listed */
+typedef struct ImageFolder
+{
+	HFSImageItem	*items;
+	long			numItems;
+	long			maxItems;
+} ImageFolder;
+
+/* what --image -R captured of a part of the catalog */
+typedef struct ImageOutput
+{
+	char			*out;
+	size_t			outLen;
+	int				done;
+} ImageOutput;
+
+/* what --top keeps of an entry that made it into the ranking */
+typedef struct RankedItem
+{
+	ForkSizes		sizes;
+	FinderInfoRec	finderInfo;
+	int				kind;			// ROW_FILE, ROW_FOLDER or ROW_SYMLINK
+	char			path[1];
+} RankedItem;
 
 /*///////Prototypes///////////////////*/
 
 static void PrintVersion (void);
 static void PrintHelp (void);
 
-static void ListDirectoryContents (char *arg);
-static void ListItem (char *path, char *name);
-static void ListFile (char *name, char *path, FSRef fileRef);
-static void ListFolder (char *name, char *path, FSRef fileRef);
-
-static char* GetNumFilesString (long numFiles);
-static long GetNumFilesInFolder (FSRef *fileRef);
+static int  ListDirectoryContents (char *arg);
+static void OutputFolderTotal (UInt64 size);
+static int  ListImageArgument (char *arg, int showHeader);
+static int  ListImageFolder (const char *path, uint32_t folderID);
+static int  ListImageTree (const char *path, uint32_t folderID);
+static int  ListImageScanItem (const char *dirPath, uint32_t folderID, const HFSImageItem *catItem, void *refCon);
+static int  IsDotPath (const char *path);
+static void ImagePartDone (long part, void *refCon);
+static int  AddImageItem (const HFSImageItem *catItem, void *refCon);
+static void ListImageItem (const char *dirPath, const HFSImageItem *catItem);
+static void ListDirectoryNode (WalkNode *node);
+static void CalculateFolderSizes (char *path);
+static void SizeDirectoryNode (WalkNode *node);
+static void AddUpFolderSizes (WalkNode *node);
+static void AddLinks (WalkNode *node, const LinkedFile *links, long numLinks);
+static void AppendLink (LinkedFile **list, long *num, long *max, const LinkedFile *link);
+static void ListChanges (const char *dirPath, char **names, int numNames);
+static void GatherDirectoryNode (WalkNode *node);
+static void PrintRanking (void);
+static void PrintSummary (void);
+static int  ParseSummary (char *str);
+static int  CompareRankedItems (const void *a, const void *b);
+static void ListItem (int dirFd, const char *dirPath, char *name);
+static char* ItemPath (ItemRef *item);
+static OSErr ItemMakeRef (ItemRef *item);
+static int  IsDotOrDotDot (const char *name);
+static void ListFile (ItemRef *item);
+static void ListFolder (ItemRef *item);
+static int  ItemMatches (ItemRef *item, FinderInfoRec *finderInfo, int *haveFinderInfo, ForkSizes *sizes, int *haveSizes);
+static void RankItem (ItemRef *item, FinderInfoRec *finderInfo, int haveFinderInfo, const ForkSizes *sizes);
+static void SummarizeItem (ItemRef *item, FinderInfoRec *finderInfo, int haveFinderInfo, const ForkSizes *sizes);
+static void AddToFolderTotal (ItemRef *item, UInt64 size);
+static void CountSharedExtent (uint64_t physical, uint64_t length, void *refCon);
+static void OutputFileRow (ItemRef *item, const FinderInfoRec *finderInfo, const ForkSizes *sizes, char *aliasTarget,
+                           const ScanRange *ranges, long numRanges);
+static long GetDataRanges (ItemRef *item, ScanRange **ranges);
+static void OutputRanges (const ScanRange *ranges, long numRanges);
+static void OutputFolderRow (ItemRef *item, long valence, const FinderInfoRec *dInfo);
+
+static void OutputNumFiles (long numFiles);
+static int  ParseColumns (char *str);
+static int  PlanAttributes (void);
+static long GetNumFilesInFolder (ItemRef *item);
 
 static short GetForkParameterFromString (char *str);
 
-// static char* GetSizeString (long size);
-static char* GetSizeString (UInt64 size);   // up to 99 TBytes
-// static char* GetHumanSizeString (long size);
-static char* GetHumanSizeString (UInt64 size);
 
-static OSErr GetForkSizes (const FSRef *fileRef,  UInt64 *totalLogicalForkSize, UInt64 *totalPhysicalForkSize, short fork);
+static OSErr GetEachForkSize (const ItemRef *item, ForkSizes *sizes, short fork);
+static OSErr FetchForkSizes (const ItemRef *item, ForkSizes *sizes, short fork);
 
 static void OSTypeToStr(OSType aType, char *aStr);
-static int UnixIsFolder (char *path);
-static void HFSUniPStrToCString (HFSUniStr255 *uniStr, char *cstr);
+static int UnixIsFolder (ItemRef *item);
 
 static char* GetPathOfAliasSource (char *path);
-static OSStatus FSMakePath(FSRef fileRef, UInt8 *path, UInt32 maxPathSize);
-static OSErr GetDInfo(const FSRef *ref, DInfo *dInfo);
+static OSErr GetFinderInfo(const ItemRef *item, FinderInfoRec *finderInfo);
+static OSErr FetchFinderInfo(const ItemRef *item, FinderInfoRec *finderInfo);
+static OSErr GetIndexedInfo(const ItemRef *item, MDIndexEntry *entry);
 static short GetLabelNumber (SInt16 flags);
 
+#ifdef __APPLE__
+static void HFSUniPStrToCString (HFSUniStr255 *uniStr, char *cstr);
+static OSStatus FSMakePath(FSRef fileRef, UInt8 *path, UInt32 maxPathSize);
 static OSErr MyFSPathMakeRef( const unsigned char *path, FSRef *ref );  // path to the link itself
 static OSErr ConvertCStringToHFSUniStr(const char* cStr, HFSUniStr255 *uniStr);
+#endif
+
+/* the total of the files in the folder being listed as text */
+typedef struct FolderTotal
+{
+	UInt64		size;
+	InodeSet	*links;			// files with more than one link already counted
+	InodeSet	*extents;		// shared extents already counted, by device and offset
+} FolderTotal;
 
-static UInt64 totalFolderSize;     // total size of files in folder
+/* a file's extents shared with others, as FIEMAP reports them */
+typedef struct SharedExtents
+{
+	InodeSet	*seen;		// the folder's, keyed by device and physical offset
+	uint64_t	dev;
+	UInt64		shared;		// bytes of the file's shared extents
+	UInt64		counted;	// of those, bytes not counted for other files yet
+} SharedExtents;
+
+static __thread FolderTotal *folderTotal;
+static __thread dev_t       noHolesDev = (dev_t)-1;		// a device SEEK_HOLE and FIEMAP don't work on
+static __thread dev_t       noExtentsDev = (dev_t)-1;	// a device FIEMAP doesn't work on
 
 /*///////Definitions///////////////////*/
 
 #define		PROGRAM_STRING  	"lsmac"
-#define		VERSION_STRING		"0.5"
+#define		VERSION_STRING		"0.7"
 #define		AUTHOR_STRING 		"Sveinbjorn Thordarson <sveinbt@hi.is>"
 
 /* Text for /usr/bin/what */
 /*@unused@*/ static const char rcsid[] = "@(#)" PROGRAM_STRING " " VERSION_STRING
     " $Id: lsmac.c,v 1.5 2004/12/19 22:59:06 carstenklapp Exp $";
 
-#define         USAGE_STRING            "lsmac [-LvhFsboaplQ] [-f fork] directory ..."
+#define         USAGE_STRING            "lsmac [-LvhFsboaplQRUcW] [-f fork] [-j threads] [-I index] [--watch] [--format fmt] [--columns list] [--where expr] [--top n] [--by measure] [--summary groups] [--stats[=json]] [--trace file] [--holes] [--image file] directory ..."
 
-#define		MAX_PATH_LENGTH		1024
-#define		MAX_FILENAME_LENGTH	256
-
-#define		OPT_STRING		"Lvhf:FsboaplQ"
+#define		OPT_STRING		"Lvhf:FsboaplQRUj:cI:W"
 
 #define		DISPLAY_FORK_BOTH	0
 #define		DISPLAY_FORK_DATA	1
@@ -169,8 +379,101 @@ static int		useBytesForSize = false;
 static int		physicalSize = false;
 static int		forkToDisplay = DISPLAY_FORK_BOTH;
 static int		useQuotes = false;
-static int      printLabelName = false;
 static int		foldersOnly = false;
+static int		recursive = false;
+static int		orderedOutput = WALK_ORDERED;
+static int		numThreads = 0;
+static int		calcFolderSizes = false;
+static char		*indexPath = NULL;
+static int		useIndex = false;
+static int		watchMode = false;
+static int		outputFormat = OUTPUT_TEXT;
+static int		showHoles = false;
+static char		*imagePath = NULL;
+static HFSImage	*image = NULL;		// --image
+static int		exitStatus = EX_OK;	// EX_IOERR once an item couldn't be read
+
+/* --image -R: the parts of the catalog listed, printed in order */
+static ImageOutput		*imageParts;
+static long				imageMaxParts;
+static long				imageNextPart;
+static int				imageBlankLine;
+static size_t			imageRootLength;
+static pthread_mutex_t	imagePartLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* and the folder each thread is listing */
+static __thread uint32_t	imageFolderID;
+static __thread int			imageFolderShown;
+static __thread FolderTotal	imageTotal;
+static __thread int			imageCapturing;
+static __thread uint64_t	imagePartStart;
+
+#define		OPT_FORMAT		256			// long options only
+#define		OPT_COLUMNS		257
+#define		OPT_WHERE		258
+#define		OPT_TOP			259
+#define		OPT_BY			260
+#define		OPT_SUMMARY		261
+#define		OPT_STATS		262
+#define		OPT_TRACE		263
+#define		OPT_HOLES		264
+#define		OPT_IMAGE		265
+
+/* what --top ranks by */
+#define		TOP_BY_LOGICAL	0
+#define		TOP_BY_PHYSICAL	1
+#define		TOP_BY_RSRC		2
+
+/* --summary groups, the tally group of each and its bit */
+#define		GROUP_LABEL		0
+#define		GROUP_TYPE		1
+#define		GROUP_CREATOR	2
+#define		GROUP_FLAGS		3
+#define		NUM_GROUPS		4
+
+/* columns besides the name, for --columns */
+#define		COL_FLAGS		0x01
+#define		COL_TYPE		0x02
+#define		COL_CREATOR		0x04
+#define		COL_LABEL		0x08
+#define		COL_SIZE		0x10
+#define		COL_ITEMS		0x20
+#define		COL_DEFAULT		(COL_FLAGS | COL_TYPE | COL_CREATOR | COL_SIZE | COL_ITEMS)
+
+/* attribute groups an entry may need besides its stat info, worked out
+   once from the columns by PlanAttributes() */
+#define		ATTR_FINDERINFO	0x01
+#define		ATTR_DATASIZE	0x02
+#define		ATTR_RSRCSIZE	0x04
+#define		ATTR_ALIAS		0x08
+#define		ATTR_VALENCE	0x10
+
+static int		columns = COL_DEFAULT;
+static int		attrPlan;
+static Filter	*filter = NULL;		// --where
+static long		topCount = 0;		// --top
+static int		topBy = TOP_BY_LOGICAL;
+static int		summaryGroups = 0;	// --summary, bits (1 << GROUP_)
+
+static struct option	longOptions[] =
+{
+	{ "watch",	no_argument,		NULL,	'W' },
+	{ "format",	required_argument,	NULL,	OPT_FORMAT },
+	{ "columns",	required_argument,	NULL,	OPT_COLUMNS },
+	{ "where",	required_argument,	NULL,	OPT_WHERE },
+	{ "top",	required_argument,	NULL,	OPT_TOP },
+	{ "by",		required_argument,	NULL,	OPT_BY },
+	{ "summary",	required_argument,	NULL,	OPT_SUMMARY },
+	{ "stats",	optional_argument,	NULL,	OPT_STATS },
+	{ "trace",	required_argument,	NULL,	OPT_TRACE },
+	{ "holes",	no_argument,		NULL,	OPT_HOLES },
+	{ "image",	required_argument,	NULL,	OPT_IMAGE },
+	{ NULL,		0,				NULL,	0 }
+};
+
+static InodeTable	*folderSizes;		// ForkSizes of every folder, by device and inode
+static InodeTable	*folderValences;	// number of items in folders we've read anyway
+static InodeTable	*summaryLinks;		// --summary, hard linked files whose bytes are counted
 
 static char             labelNames[8][8] = { "None   ", "Red  ", "Orange ", "Yellow ", "Green  ", "Blue   ", "Purple ", "Gray   " };
 
@@ -188,10 +491,23 @@ static char             labelNames[8][8] = { "None   ", "Red  ", "Orange ", "Yel
     p - print full file path
     l - when printing size, print physical size, not logical size
     L - print label name
+    R - list subdirectories recursively
+    U - with -R, print each directory as soon as it is done instead of in order
+    c - calculate folder sizes
     
     [-f fork] - select which fork to print size of
+    [-j threads] - number of threads scanning directories with -R
+    [-I index] - file in which to keep meta-data between runs
+    W, --watch - keep watching the directories and print entries that change
+    [--format fmt] - text (the default), ndjson or binary
+    [--columns list] - flags,type,creator,label,size,items or some of them
+    [--where expr] - only list entries for which expr is true, see filter.h
+    [--top n] - list the n largest files under the directories instead
+    [--by measure] - logical (the default), physical or rsrc size, for --top
+    [--summary groups] - totals by label,type,creator,flags or some of them instead
+    --holes - list the data and holes of sparse files
+    [--image file] - list folders of the HFS+ volume in an image file or device
     
-    c - calculate folder sizes 				** NOT IMPLEMENTED YET **
     i - calculate number of files within folders 	** NOT IMPLEMENTED YET **
 
 */
@@ -202,13 +518,14 @@ static char             labelNames[8][8] = { "None   ", "Red  ", "Orange ", "Yel
 int main (int argc, char *argv[]) 
 {
     int			i;
-    int			rc;
     int			optch;
+    int			flagColumns = 0;	// added by -L whether --columns comes before or after
     static char		optstring[] = OPT_STRING;
     char                buf[MAX_PATH_LENGTH];
     char                *cwd;
+    char                errStr[256];
 
-    while ( (optch = getopt(argc, argv, optstring)) != -1)
+    while ( (optch = getopt_long(argc, argv, optstring, longOptions, NULL)) != -1)
     {
         switch(optch)
         {
@@ -242,13 +559,102 @@ int main (int argc, char *argv[])
                 physicalSize = true;
                 break;
             case 'L':
-                printLabelName = true;
+                flagColumns |= COL_LABEL;
                 break;
             case 'Q':
                 useQuotes = true;
                 break;
+            case 'R':
+                recursive = true;
+                break;
+            case 'c':
+                calcFolderSizes = true;
+                break;
+            case 'U':
+                orderedOutput = WALK_INTERLEAVED;
+                break;
+            case OPT_COLUMNS:
+                columns = ParseColumns(optarg);
+                break;
+            case OPT_WHERE:
+                filter = FilterCompile(optarg, errStr, sizeof(errStr));
+                if (!filter)
+                {
+                    fprintf(stderr, "Bad --where expression: %s\n", errStr);
+                    return EX_USAGE;
+                }
+                break;
+            case OPT_TOP:
+                topCount = atol(optarg);
+                if (topCount <= 0)
+                {
+                    fprintf(stderr, "Illegal number for --top: %s\n", optarg);
+                    return EX_USAGE;
+                }
+                break;
+            case OPT_BY:
+                if (!strcmp(optarg, "logical"))
+                    topBy = TOP_BY_LOGICAL;
+                else if (!strcmp(optarg, "physical"))
+                    topBy = TOP_BY_PHYSICAL;
+                else if (!strcmp(optarg, "rsrc"))
+                    topBy = TOP_BY_RSRC;
+                else
+                {
+                    fprintf(stderr, "Illegal parameter: %s\nYou must specify one of the following: logical, physical, rsrc\n", optarg);
+                    return EX_USAGE;
+                }
+                break;
+            case OPT_SUMMARY:
+                summaryGroups = ParseSummary(optarg);
+                break;
+            case OPT_STATS:
+                if (!optarg || !strcmp(optarg, "text"))
+                    StatsInit(STATS_TEXT);
+                else if (!strcmp(optarg, "json"))
+                    StatsInit(STATS_JSON);
+                else
+                {
+                    fprintf(stderr, "Illegal parameter: %s\nYou must specify one of the following: text, json\n", optarg);
+                    return EX_USAGE;
+                }
+                break;
+            case OPT_TRACE:
+                if (TraceOpen(optarg) == -1)
+                {
+                    perror(optarg);
+                    return EX_CANTCREAT;
+                }
+                break;
+            case OPT_HOLES:
+                showHoles = true;
+                break;
+            case OPT_IMAGE:
+                imagePath = optarg;
+                break;
+            case OPT_FORMAT:
+                outputFormat = OutputParseFormat(optarg);
+                if (outputFormat == -1)
+                {
+                    fprintf(stderr, "Unknown format: %s\nYou must specify one of the following: text, ndjson, binary\n", optarg);
+                    return EX_USAGE;
+                }
+                break;
+            case 'W':
+                watchMode = true;
+                break;
+            case 'I':
+                indexPath = optarg;
+                break;
+            case 'j':
+                numThreads = atoi(optarg);
+                if (numThreads < 1)
+                {
+                    fprintf(stderr, "Illegal number of threads: %s\n", optarg);
+                    return EX_USAGE;
+                }
+                break;
             default: /* '?' */
-                rc = 1;
                 PrintHelp();
                 return EX_USAGE;
         }
@@ -257,19 +663,143 @@ int main (int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if(argc) 
+	if (!numThreads)
+		numThreads = WalkDefaultThreads();
+
+	if (summaryGroups && outputFormat == OUTPUT_BINARY)
+	{
+		fprintf(stderr, "--summary can only be printed as text or ndjson\n");
+		return EX_USAGE;
+	}
+	if (showHoles && outputFormat == OUTPUT_BINARY)
+	{
+		fprintf(stderr, "--holes can only be printed as text or ndjson\n");
+		return EX_USAGE;
+	}
+	if ((topCount || summaryGroups) && watchMode)
+	{
+		fprintf(stderr, "--top and --summary can't be used with --watch\n");
+		return EX_USAGE;
+	}
+	if (imagePath && (calcFolderSizes || indexPath || watchMode || showHoles))
+	{
+		fprintf(stderr, "--image can't be used with -c, -I, --watch or --holes\n");
+		return EX_USAGE;
+	}
+	if (summaryGroups)
+	{
+		recursive = true;
+		summaryLinks = InodeTableCreate(0);
+	}
+
+	if (topCount)
+	{
+		/* ranking by resource fork is ranking what -f rsrc shows */
+		if (topBy == TOP_BY_RSRC)
+		{
+			forkToDisplay = DISPLAY_FORK_RSRC;
+			topBy = TOP_BY_LOGICAL;
+		}
+		recursive = true;
+		RankInit(topCount, CompareRankedItems);
+	}
+
+	/* the index is only a cache, we can do without it */
+	if (indexPath)
+	{
+		if (MDIndexOpen(indexPath) == -1)
+			perror(indexPath);
+		else
+			useIndex = true;
+	}
+
+	columns |= flagColumns;
+	attrPlan = PlanAttributes();
+
+	/* whatever is buffered goes out, however we exit, and then --stats and --trace */
+	OutputInit(outputFormat);
+	atexit(TraceWrite);
+	atexit(StatsPrint);
+	atexit(OutputFlush);
+
+	if (watchMode && WatchInit(recursive) == -1)
+	{
+		perror("--watch");
+		return EX_UNAVAILABLE;
+	}
+
+	if (imagePath)
+	{
+		image = HFSImageOpen(imagePath);
+		if (!image)
+		{
+			fprintf(stderr, "%s: %s\n", imagePath, (errno == EINVAL) ? "No HFS+ volume, or a damaged one" : strerror(errno));
+			return EX_NOINPUT;
+		}
+
+		/* the arguments are paths on the volume, its root by default */
+		for (i = 0; i < argc || (!argc && !i); i++)
+		{
+			if (!(topCount || summaryGroups) && outputFormat == OUTPUT_TEXT && i > 0)
+				OutputChar('\n');
+			if (ListImageArgument(argc ? argv[i] : "/", argc > 1) == -1)
+				exit(EX_USAGE);
+		}
+		if (summaryGroups)
+			PrintSummary();
+		if (topCount)
+			PrintRanking();
+		HFSImageClose(image);
+	}
+	else if (topCount || summaryGroups)
+	{
+		/* every file under every argument goes into the one report */
+		for (i = 0; i < argc; i++)
+		{
+			if (calcFolderSizes)
+				CalculateFolderSizes(argv[i]);
+			WalkTree(argv[i], numThreads, WALK_INTERLEAVED, GatherDirectoryNode, NULL);
+		}
+		if (!argc && (cwd = getcwd(buf, sizeof(buf))))
+		{
+			if (calcFolderSizes)
+				CalculateFolderSizes(cwd);
+			WalkTree(cwd, numThreads, WALK_INTERLEAVED, GatherDirectoryNode, NULL);
+		}
+		if (summaryGroups)
+			PrintSummary();
+		if (topCount)
+			PrintRanking();
+	}
+	else if(argc) 
 	{
 		for(i=0; i<argc; i++) 
 		{
-			if( argc > 1 ) 
+			if (recursive)
+			{
+				/* every directory gets its own header */
+				if( i > 0 && outputFormat == OUTPUT_TEXT )
+					OutputChar('\n');
+				OutputFlush();
+				fflush(stdout);
+				if (calcFolderSizes)
+					CalculateFolderSizes(argv[i]);
+				WalkTree(argv[i], numThreads, orderedOutput, ListDirectoryNode, NULL);
+				continue;
+			}
+			if( argc > 1 && outputFormat == OUTPUT_TEXT )
 			{
 				if( i > 0 ) 
 				{
-					printf("\n");
+					OutputChar('\n');
 				}
-				printf("%s:\n", argv[i]);
+				OutputString(argv[i]);
+				OutputBytes(":\n", 2);
 			}
-			ListDirectoryContents( argv[i] );
+			if (calcFolderSizes)
+				CalculateFolderSizes(argv[i]);
+			if (ListDirectoryContents( argv[i] ) == -1)
+				exit(EX_USAGE);
 		}
 	} 
 	else 
@@ -282,10 +812,39 @@ int main (int argc, char *argv[])
 			fprintf(stderr, "Error getting working directory.\n");
 			return(EX_IOERR);
 		}
-		ListDirectoryContents( cwd );
+		if (calcFolderSizes)
+			CalculateFolderSizes(cwd);
+		if (recursive)
+		{
+			OutputFlush();
+			fflush(stdout);
+			WalkTree(cwd, numThreads, orderedOutput, ListDirectoryNode, NULL);
+		}
+		else if (ListDirectoryContents( cwd ) == -1)
+			exit(EX_USAGE);
+	}
+
+	if (useIndex)
+	{
+		if (MDIndexSave() == -1)
+			perror(indexPath);
+		MDIndexClose();
 	}
 
-    return(EX_OK);
+	if (watchMode)
+	{
+		/* a changed entry is printed on its own, so show where it is */
+		printFullPath = true;
+		OutputFlush();
+		fflush(stdout);
+		if (WatchRun(ListChanges) == -1)
+		{
+			perror("--watch");
+			return EX_IOERR;
+		}
+	}
+
+    return(exitStatus);
 }
 
 #pragma mark -
@@ -309,18 +868,318 @@ static void PrintHelp (void)
     printf("usage: %s\n", USAGE_STRING);
 }
 
+/*//////////////////////////////////////
+// Parse the --columns list
+/////////////////////////////////////*/
+
+static int ParseColumns (char *str)
+{
+    static const struct { const char *name; int column; } names[] =
+    {
+        { "flags", COL_FLAGS }, { "type", COL_TYPE }, { "creator", COL_CREATOR },
+        { "label", COL_LABEL }, { "size", COL_SIZE }, { "items", COL_ITEMS }
+    };
+    int		cols = 0;
+    char	*name;
+    int		i;
+
+    for (name = strtok(str, ","); name; name = strtok(NULL, ","))
+    {
+        for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+            if (!strcmp(name, names[i].name))
+                break;
+        if (i == (int)(sizeof(names) / sizeof(names[0])))
+        {
+            fprintf(stderr, "Unknown column: %s\nYou must specify some of the following: flags, type, creator, label, size, items\n", name);
+            exit(EX_USAGE);
+        }
+        cols |= names[i].column;
+    }
+    return cols;
+}
+
+/*//////////////////////////////////////
+// Work out what we have to fetch for each
+// entry, beyond the stat info we always
+// need to tell folders from files
+/////////////////////////////////////*/
+
+static int PlanAttributes (void)
+{
+    int		plan = 0;
+
+    if (columns & (COL_FLAGS | COL_TYPE | COL_CREATOR | COL_LABEL))
+        plan |= ATTR_FINDERINFO;
+
+#ifdef __APPLE__
+    /* alias targets come with the name, but it takes the
+       Finder flags to know an alias when we see one */
+    if (plan & ATTR_FINDERINFO)
+        plan |= ATTR_ALIAS;
+#endif
+
+    if (columns & COL_SIZE)
+    {
+        if (forkToDisplay != DISPLAY_FORK_RSRC)
+            plan |= ATTR_DATASIZE;
+        if (forkToDisplay != DISPLAY_FORK_DATA)
+            plan |= ATTR_RSRCSIZE;
+    }
+
+    if (columns & COL_ITEMS)
+        plan |= ATTR_VALENCE;
+
+    /* --summary adds up Finder info and sizes */
+    if (summaryGroups)
+        plan |= ATTR_FINDERINFO;
+
+    /* both rank or add up by size and list no folder item counts */
+    if (topCount || summaryGroups)
+    {
+        if (forkToDisplay != DISPLAY_FORK_RSRC)
+            plan |= ATTR_DATASIZE;
+        if (forkToDisplay != DISPLAY_FORK_DATA)
+            plan |= ATTR_RSRCSIZE;
+        plan &= ~ATTR_VALENCE;
+    }
+
+    return plan;
+}
+
 #pragma mark -
 
+/*//////////////////////////////////////
+// List one directory of a recursive walk.
+// Runs on a worker thread; the listing is
+// captured in the node and printed by walk.c
+/////////////////////////////////////*/
+
+static void ListDirectoryNode (WalkNode *node)
+{
+	OutputBeginCapture();
+
+	/* machine readable rows have their directory in them, no header */
+	if (outputFormat == OUTPUT_TEXT)
+	{
+		if (node->depth > 0)
+			OutputChar('\n');
+		OutputString(node->path);
+		OutputBytes(":\n", 2);
+	}
+
+	ListDirectoryContents(node->path);
+
+	OutputEndCapture(&node->out, &node->outLen);
+}
+
+/*//////////////////////////////////////
+// Size every folder below path before we
+// list anything.  Directories are scanned
+// in parallel and each folder's totals are
+// added into its parent once all of its
+// subfolders are done.
+/////////////////////////////////////*/
+
+static void CalculateFolderSizes (char *path)
+{
+	if (!folderSizes)
+		folderSizes = InodeTableCreate(sizeof(ForkSizes));
+	if (!folderValences)
+		folderValences = InodeTableCreate(sizeof(long));
+
+	WalkTree(path, numThreads, WALK_INTERLEAVED, SizeDirectoryNode, AddUpFolderSizes);
+}
+
+/*//////////////////////////////////////
+// Add up the forks of the files in one
+// folder and queue its subfolders
+/////////////////////////////////////*/
+
+static void SizeDirectoryNode (WalkNode *node)
+{
+	DirScan			scan;
+	ScanEntry		entry;
+	ItemRef			item;
+	ForkSizes		sizes;
+	FolderSizing	*sizing;
+	LinkedFile		link;
+	OSErr			err;
+	long			valence = 0;
+	int				rc;
+
+	/* before any subfolder is queued, they add their links into it */
+	sizing = calloc(1, sizeof(FolderSizing));
+	if (!sizing)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	node->data = sizing;
+
+	if (ScanOpenDir(&scan, AT_FDCWD, node->path) == -1)
+	{
+		perror(node->path);
+		return;
+	}
+
+	item.imageItem = NULL;
+	item.dirFd = scan.fd;
+	item.dirPath = node->path;
+
+	while ( (rc = ScanNextEntry(&scan, &entry)) == 1 )
+	{
+		if (IsDotOrDotDot(entry.name))
+			continue;
+		valence++;
+		StatsItem();
+
+		item.name = (char *)entry.name;
+		item.path = NULL;
+
+		if (ScanStatAt(scan.fd, entry.name, &item.st) == -1)
+		{
+			perror(ItemPath(&item));
+			continue;
+		}
+
+		if (S_ISDIR(item.st.st_mode))
+		{
+			WalkAddChild(entry.name, item.st.st_dev, item.st.st_ino);
+			continue;
+		}
+
+		/* the data fork alone comes with the stat info */
+		err = (forkToDisplay != DISPLAY_FORK_DATA || useIndex) ? ItemMakeRef(&item) : noErr;
+		if (err == noErr)
+			err = GetEachForkSize(&item, &sizes, forkToDisplay);
+		if (err != noErr)
+		{
+			fprintf(stderr, "GetForkSizes(): Error %d getting size of file forks of %s\n", err, ItemPath(&item));
+			continue;
+		}
+
+		sizing->own.dataLogical += sizes.dataLogical;
+		sizing->own.dataPhysical += sizes.dataPhysical;
+		sizing->own.rsrcLogical += sizes.rsrcLogical;
+		sizing->own.rsrcPhysical += sizes.rsrcPhysical;
+
+		/* whether the other links are counted too depends on where they are */
+		if (item.st.st_nlink > 1)
+		{
+			link.dev = item.st.st_dev;
+			link.ino = item.st.st_ino;
+			link.sizes = sizes;
+			AppendLink(&sizing->ownLinks, &sizing->numOwnLinks, &sizing->maxOwnLinks, &link);
+		}
+	}
+
+	if (rc == -1)
+		perror(node->path);
+	else
+		InodeTableInsert(folderValences, node->dev, node->ino, &valence);
+
+	ScanCloseDir(&scan);
+}
+
+/*//////////////////////////////////////
+// A folder and everything below it is
+// done: remember its totals and pass
+// them up.  Called with the walk locked.
+//
+// A hard linked file counts once in each
+// folder holding any of its links, which
+// doesn't depend on which thread got to
+// which link first.
+/////////////////////////////////////*/
+
+static void AddUpFolderSizes (WalkNode *node)
+{
+	FolderSizing	*sizing = node->data;
+	ForkSizes		sizes;
+	int				i;
+
+	node->sum[0] += sizing->own.dataLogical;
+	node->sum[1] += sizing->own.dataPhysical;
+	node->sum[2] += sizing->own.rsrcLogical;
+	node->sum[3] += sizing->own.rsrcPhysical;
+	AddLinks(node, sizing->ownLinks, sizing->numOwnLinks);
+
+	sizes.dataLogical = node->sum[0];
+	sizes.dataPhysical = node->sum[1];
+	sizes.rsrcLogical = node->sum[2];
+	sizes.rsrcPhysical = node->sum[3];
+	InodeTableInsert(folderSizes, node->dev, node->ino, &sizes);
+
+	if (node->parent)
+	{
+		for (i = 0; i < WALK_NUM_SUMS; i++)
+			node->parent->sum[i] += node->sum[i];
+		AddLinks(node->parent, sizing->links, sizing->numLinks);
+	}
+
+	InodeSetDispose(sizing->seen);
+	free(sizing->ownLinks);
+	free(sizing->links);
+	free(sizing);
+	node->data = NULL;
+}
+
+/*//////////////////////////////////////
+// Links added into a folder's totals:
+// keep the first of each file and take
+// the others back out of node->sum
+/////////////////////////////////////*/
+
+static void AddLinks (WalkNode *node, const LinkedFile *links, long numLinks)
+{
+	FolderSizing	*sizing = node->data;
+	long			i;
+
+	for (i = 0; i < numLinks; i++)
+	{
+		if (!sizing->seen)
+			sizing->seen = InodeSetCreate();
+		if (InodeSetInsert(sizing->seen, links[i].dev, links[i].ino))
+		{
+			AppendLink(&sizing->links, &sizing->numLinks, &sizing->maxLinks, &links[i]);
+			continue;
+		}
+		node->sum[0] -= links[i].sizes.dataLogical;
+		node->sum[1] -= links[i].sizes.dataPhysical;
+		node->sum[2] -= links[i].sizes.rsrcLogical;
+		node->sum[3] -= links[i].sizes.rsrcPhysical;
+	}
+}
+
+static void AppendLink (LinkedFile **list, long *num, long *max, const LinkedFile *link)
+{
+	LinkedFile	*grown;
+
+	if (*num == *max)
+	{
+		*max = *max ? 2 * *max : 16;
+		grown = realloc(*list, *max * sizeof(LinkedFile));
+		if (!grown)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(EX_OSERR);
+		}
+		*list = grown;
+	}
+	(*list)[(*num)++] = *link;
+}
+
 /*//////////////////////////////////////
 // Iterate through directory and list its items
+// Returns -1 if the directory can't be read
 /////////////////////////////////////*/
 
-static void ListDirectoryContents(char *pathPtr)
+static int ListDirectoryContents(char *pathPtr)
 {
-	char			path[MAX_PATH_LENGTH + MAX_FILENAME_LENGTH + 1];
-	DIR				*directory;
-	struct dirent 	*dentry;
-	char			*sizeStrTot;      // total of files in folder others folders excluded
+	DirScan			scan;
+	ScanEntry		entry;
+	FolderTotal		total;
+	int				rc;
 
 	if (!pathPtr[0]) 
 	{
@@ -328,332 +1187,1476 @@ static void ListDirectoryContents(char *pathPtr)
 		exit(EX_USAGE);
 	}
 
+    /* watch before reading, so no change slips in between */
+    if (watchMode && WatchAddDirectory(pathPtr) == -1)
+        perror(pathPtr);
+
     /* open directory */
-    directory = opendir(pathPtr);
+    rc = ScanOpenDir(&scan, AT_FDCWD, pathPtr);
 
     /* if it's invalid, we return with an error */
-    if (!directory) 
+    if (rc == -1) 
     {
         perror(pathPtr);
-        exit(EX_USAGE);
+        return -1;
     }
-    
-    errno = 0;
 
-    /* iterate through the specified directory's contents */
-	while( (dentry = readdir(directory)) ) 
-        {
-		/* create the file's full path */
-		strcpy(path, pathPtr);
-		strcat(path, "/");
-		strcat(path, (char *)&dentry->d_name);
+    if (outputFormat != OUTPUT_TEXT)
+    {
+        OutputBeginDirectory(pathPtr);
+        while( (rc = ScanNextEntry(&scan, &entry)) == 1 )
+            ListItem(scan.fd, pathPtr, (char *)entry.name);
+        OutputEndDirectory();
+
+        if (rc == -1)
+            perror("readdir(3)");
+        ScanCloseDir(&scan);
+        return 0;
+    }
 
-		ListItem(path, (char *)&dentry->d_name);
+    memset(&total, 0, sizeof(total));
+    folderTotal = &total;
 
-		errno = 0;
+    /* iterate through the specified directory's contents; items are
+       looked up relative to the open directory, not by path */
+	while( (rc = ScanNextEntry(&scan, &entry)) == 1 ) 
+        {
+		ListItem(scan.fd, pathPtr, (char *)entry.name);
 	}
 
+    folderTotal = NULL;
+    InodeSetDispose(total.links);
+    InodeSetDispose(total.extents);
+
 	// report total of all files in folder other folders size are not included
-	
-	sizeStrTot = useBytesForSize ? GetSizeString(totalFolderSize) : GetHumanSizeString(totalFolderSize);
-	
-	printf("                  %s\n","----------------------------------------------" );
-	printf("                   %s %s\n", sizeStrTot, "Total Size of Files in Folder" );
+	OutputFolderTotal(total.size);
 
 
 	/* report errors and close dir */
-	if (errno != 0) 
+	if (rc == -1) 
 		perror("readdir(3)");
 
-	if (closedir(directory) == -1) 
-		perror("closedir(3)");
+	ScanCloseDir(&scan);
+	return 0;
+}
+
+
+/*//////////////////////////////////////
+// The line under a text listing with the
+// total size of the files in the folder
+/////////////////////////////////////*/
+
+static void OutputFolderTotal (UInt64 size)
+{
+	if (!(columns & COL_SIZE))
+		return;
+	OutputString("                  ----------------------------------------------\n");
+	OutputString("                   ");
+	OutputSize(size, useBytesForSize, false);
+	OutputString(" Total Size of Files in Folder\n");
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// --image: list the folder at a path on
+// the volume, and with -R everything in
+// it.  Returns -1 if there's no folder
+/////////////////////////////////////*/
+
+static int ListImageArgument (char *arg, int showHeader)
+{
+	HFSImageItem	catItem;
+
+	if (HFSImageLookup(image, arg, &catItem) == -1 || (!catItem.isFolder && (errno = ENOTDIR)))
+	{
+		fprintf(stderr, "%s: %s\n", arg, strerror(errno));
+		return -1;
+	}
+	if (recursive || topCount || summaryGroups)
+		return ListImageTree(arg, catItem.cnid);
+
+	if (showHeader && outputFormat == OUTPUT_TEXT)
+	{
+		OutputString(arg);
+		OutputBytes(":\n", 2);
+	}
+	return ListImageFolder(arg, catItem.cnid);
+}
+
+/*//////////////////////////////////////
+// --image: list a folder from the catalog
+// as ListDirectoryContents would list it
+// from its directory
+/////////////////////////////////////*/
+
+static int ListImageFolder (const char *path, uint32_t folderID)
+{
+	ImageFolder		folder = { NULL, 0, 0 };
+	FolderTotal		total;
+	uint64_t		start;
+	int				rc;
+	long			i;
+
+	start = StatsBegin();
+	rc = HFSImageListFolder(image, folderID, AddImageItem, &folder);
+	StatsEnd(STATS_READDIR, start);
+	if (rc == -1)
+	{
+		perror(path);
+		free(folder.items);
+		return -1;
+	}
+
+	if (outputFormat != OUTPUT_TEXT)
+	{
+		OutputBeginDirectory(path);
+		for (i = 0; i < folder.numItems; i++)
+			ListImageItem(path, &folder.items[i]);
+		OutputEndDirectory();
+	}
+	else
+	{
+		memset(&total, 0, sizeof(total));
+		folderTotal = &total;
+		for (i = 0; i < folder.numItems; i++)
+			ListImageItem(path, &folder.items[i]);
+		folderTotal = NULL;
+		InodeSetDispose(total.links);
+		OutputFolderTotal(total.size);
+	}
+
+	free(folder.items);
+	return 0;
+}
+
+/*//////////////////////////////////////
+// --image -R, --top and --summary: list
+// every folder under one, or offer their
+// items to the report, from a scan of the
+// whole catalog on all the threads.  Each
+// part of the scan is captured as it's
+// listed and printed in catalog order,
+// so folders come in the order they were
+// made rather than depth first
+/////////////////////////////////////*/
+
+static int ListImageTree (const char *path, uint32_t folderID)
+{
+	int		gather = (topCount || summaryGroups);
+	int		rc;
+
+	imageRootLength = strlen(path);
+	imageNextPart = 0;
+	imageBlankLine = false;
+
+	rc = HFSImageScan(image, folderID, path, numThreads, ListImageScanItem, gather ? NULL : ImagePartDone, NULL);
+	imageFolderID = 0;
+	folderTotal = NULL;
+	free(imageParts);
+	imageParts = NULL;
+	imageMaxParts = 0;
+	if (rc == -1)
+	{
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* HFSImageScan's callback: starts a folder at its first item, or ends it */
+static int ListImageScanItem (const char *dirPath, uint32_t folderID, const HFSImageItem *catItem, void *refCon)
+{
+	int		gather = (topCount || summaryGroups);
+
+	if (folderID != imageFolderID)
+	{
+		imageFolderID = folderID;
+		imageFolderShown = (displayAll || !IsDotPath(dirPath + imageRootLength));
+		if (imageFolderShown && !gather)
+		{
+			if (!imageCapturing)
+			{
+				imagePartStart = StatsBegin();
+				OutputBeginCapture();
+				imageCapturing = true;
+			}
+			if (outputFormat != OUTPUT_TEXT)
+				OutputBeginDirectory(dirPath);
+			else
+			{
+				OutputChar('\n');
+				OutputString(dirPath);
+				OutputBytes(":\n", 2);
+				memset(&imageTotal, 0, sizeof(imageTotal));
+				folderTotal = &imageTotal;
+			}
+		}
+	}
+
+	if (catItem)
+	{
+		if (imageFolderShown)
+			ListImageItem(dirPath, catItem);
+		return 0;
+	}
+
+	if (imageFolderShown && !gather)
+	{
+		if (outputFormat != OUTPUT_TEXT)
+			OutputEndDirectory();
+		else
+		{
+			folderTotal = NULL;
+			InodeSetDispose(imageTotal.links);
+			OutputFolderTotal(imageTotal.size);
+		}
+	}
+	imageFolderID = 0;
+	return 0;
+}
+
+/* whether a folder of a path past the argument's is a dot folder */
+static int IsDotPath (const char *path)
+{
+	if (*path == '/')
+		path++;
+	while (*path)
+	{
+		if (*path == '.')
+			return true;
+		if (!(path = strchr(path, '/')))
+			return false;
+		path++;
+	}
+	return false;
+}
+
+/*//////////////////////////////////////
+// HFSImageScan's part callback: keep what
+// this thread captured of the part, and
+// print every part that's next in order.
+// The first folder printed doesn't need
+// the blank line before its header
+/////////////////////////////////////*/
+
+static void ImagePartDone (long part, void *refCon)
+{
+	ImageOutput		captured = { NULL, 0, true };
+	ImageOutput		*parts, *next;
+	long			n;
+
+	if (imageCapturing)
+	{
+		OutputEndCapture(&captured.out, &captured.outLen);
+		imageCapturing = false;
+		TraceEnd("catalog", NULL, imagePartStart);
+	}
+
+	pthread_mutex_lock(&imagePartLock);
+	if (part >= imageMaxParts)
+	{
+		n = imageMaxParts ? 2 * imageMaxParts : 256;
+		while (n <= part)
+			n *= 2;
+		parts = realloc(imageParts, n * sizeof(ImageOutput));
+		if (!parts)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(EX_OSERR);
+		}
+		memset(parts + imageMaxParts, 0, (n - imageMaxParts) * sizeof(ImageOutput));
+		imageParts = parts;
+		imageMaxParts = n;
+	}
+	imageParts[part] = captured;
+
+	while (imageNextPart < imageMaxParts && imageParts[imageNextPart].done)
+	{
+		next = &imageParts[imageNextPart++];
+		if (next->outLen && !imageBlankLine && outputFormat == OUTPUT_TEXT)
+			OutputBytes(next->out + 1, next->outLen - 1);
+		else if (next->outLen)
+			OutputBytes(next->out, next->outLen);
+		imageBlankLine = imageBlankLine || next->outLen;
+		free(next->out);
+		next->out = NULL;
+	}
+	OutputFlush();
+	pthread_mutex_unlock(&imagePartLock);
+}
+
+/* HFSImageListFolder's callback, keeping each item */
+static int AddImageItem (const HFSImageItem *catItem, void *refCon)
+{
+	ImageFolder		*folder = refCon;
+	HFSImageItem	*items;
+
+	if (folder->numItems == folder->maxItems)
+	{
+		folder->maxItems = folder->maxItems ? 2 * folder->maxItems : 64;
+		items = realloc(folder->items, folder->maxItems * sizeof(HFSImageItem));
+		if (!items)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(EX_OSERR);
+		}
+		folder->items = items;
+	}
+	folder->items[folder->numItems++] = *catItem;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// --image: ListItem for a catalog item,
+// its stat info made up from the record
+/////////////////////////////////////*/
+
+static void ListImageItem (const char *dirPath, const HFSImageItem *catItem)
+{
+    ItemRef		item;
+
+    if (catItem->name[0] == '.' && !displayAll)
+        return;
+
+    StatsItem();
+
+    item.imageItem = catItem;
+    item.dirFd = -1;
+    item.dirPath = dirPath;
+    item.name = (char *)catItem->name;
+    item.path = NULL;
+    HFSImageStat(catItem, &item.st);
+
+    if (catItem->isFolder)
+    {
+        if (!omitFolders)
+            ListFolder(&item);
+    }
+    else if (!foldersOnly)
+        ListFile(&item);
 }
 
+#pragma mark -
+
+/*//////////////////////////////////////
+// --watch: print the lines of the entries
+// that changed in a directory, or of all
+// its entries if names is NULL.  Entries
+// that are gone get a line saying so.
+/////////////////////////////////////*/
+
+static void ListChanges (const char *dirPath, char **names, int numNames)
+{
+	DirScan		scan;
+	ScanEntry	entry;
+	ItemRef		item;
+	int			i;
+
+	ListRow		row;
+	FilterFacts	facts;
+
+	if (ScanOpenDir(&scan, AT_FDCWD, dirPath) == -1)
+	{
+		perror(dirPath);
+		return;
+	}
+
+	if (outputFormat != OUTPUT_TEXT)
+		OutputBeginDirectory(dirPath);
+
+	if (!names)
+	{
+		while (ScanNextEntry(&scan, &entry) == 1)
+			ListItem(scan.fd, dirPath, (char *)entry.name);
+	}
+	else for (i = 0; i < numNames; i++)
+	{
+		item.imageItem = NULL;
+		item.dirPath = dirPath;
+		item.name = names[i];
+		item.path = NULL;
+		if (ScanStatAt(scan.fd, names[i], &item.st) == -1 && errno == ENOENT)
+		{
+			if (names[i][0] == '.' && !displayAll)
+				continue;
+
+			/* all there is left to go by is the name */
+			facts.known = 0;
+			facts.name = names[i];
+			if (filter && FilterMatch(filter, &facts) == FILTER_NO)
+				continue;
+			if (outputFormat != OUTPUT_TEXT)
+			{
+				memset(&row, 0, sizeof(row));
+				row.name = names[i];
+				row.kind = ROW_DELETED;
+				row.items = -1;
+				row.dataLogical = row.dataPhysical = row.rsrcLogical = row.rsrcPhysical = OUTPUT_UNKNOWN_SIZE;
+				OutputRow(&row);
+			}
+			else
+			{
+				if (useQuotes)
+					OutputChar('"');
+				OutputString(ItemPath(&item));
+				OutputString(useQuotes ? "\" (deleted)\n" : " (deleted)\n");
+			}
+			continue;
+		}
+		ListItem(scan.fd, dirPath, names[i]);
+	}
+
+	ScanCloseDir(&scan);
+	if (outputFormat != OUTPUT_TEXT)
+		OutputEndDirectory();
+	OutputFlush();
+}
+
+
+/*//////////////////////////////////////
+// --top and --summary: offer everything in
+// a directory to the report; the walk goes
+// on into its subdirectories
+/////////////////////////////////////*/
+
+static void GatherDirectoryNode (WalkNode *node)
+{
+	DirScan			scan;
+	ScanEntry		entry;
+	int				rc;
+
+	if (ScanOpenDir(&scan, AT_FDCWD, node->path) == -1)
+	{
+		perror(node->path);
+		return;
+	}
+
+	while ((rc = ScanNextEntry(&scan, &entry)) == 1)
+		if (!IsDotOrDotDot(entry.name))
+			ListItem(scan.fd, node->path, (char *)entry.name);
+
+	if (rc == -1)
+		perror(node->path);
+	ScanCloseDir(&scan);
+}
+
+/*//////////////////////////////////////
+// Hand an entry to the ranking.  Its path
+// and Finder info are only put together
+// if its size gets it in
+/////////////////////////////////////*/
+
+static void RankItem (ItemRef *item, FinderInfoRec *finderInfo, int haveFinderInfo, const ForkSizes *sizes)
+{
+    RankedItem		*ranked;
+    UInt64		key;
+    char		*path;
+
+    if (topBy == TOP_BY_PHYSICAL)
+        key = sizes->dataPhysical + sizes->rsrcPhysical;
+    else
+        key = sizes->dataLogical + sizes->rsrcLogical;
+
+    if (!RankWants(key))
+        return;
+
+    if ((attrPlan & ATTR_FINDERINFO) && !haveFinderInfo && GetFinderInfo(item, finderInfo) != noErr)
+        memset(finderInfo, 0, sizeof(*finderInfo));
+
+    path = ItemPath(item);
+    ranked = malloc(sizeof(RankedItem) + strlen(path));
+    if (!ranked)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EX_OSERR);
+    }
+    ranked->sizes = *sizes;
+    ranked->finderInfo = *finderInfo;
+    ranked->kind = S_ISDIR(item->st.st_mode) ? ROW_FOLDER : S_ISLNK(item->st.st_mode) ? ROW_SYMLINK : ROW_FILE;
+    strcpy(ranked->path, path);
+
+    RankAdd(key, ranked);
+}
+
+/* equal sizes go by path, so the list is the same every time */
+static int CompareRankedItems (const void *a, const void *b)
+{
+    return strcmp(((const RankedItem *)b)->path, ((const RankedItem *)a)->path);
+}
+
+/*//////////////////////////////////////
+// --top: print the ranking, largest first,
+// one line per entry with its full path
+/////////////////////////////////////*/
+
+static void PrintRanking (void)
+{
+    RankEntry		*entries;
+    RankedItem		*ranked;
+    ListRow		row;
+    char		fileType[5];
+    char		creatorType[5];
+    char		fflagstr[7];
+    char		quote = useQuotes ? '"' : ' ';
+    long		count;
+    long		i;
+
+    count = RankCollect(&entries);
+
+    if (outputFormat != OUTPUT_TEXT)
+        OutputBeginDirectory(NULL);
+
+    for (i = 0; i < count; i++)
+    {
+        ranked = entries[i].data;
+
+        if (outputFormat != OUTPUT_TEXT)
+        {
+            memset(&row, 0, sizeof(row));
+            row.name = ranked->path;
+            row.kind = ranked->kind;
+            row.haveFinderInfo = (attrPlan & ATTR_FINDERINFO) != 0;
+            row.flags = ranked->finderInfo.flags;
+            row.type = ranked->finderInfo.type;
+            row.creator = ranked->finderInfo.creator;
+            row.label = GetLabelNumber(ranked->finderInfo.flags);
+            row.items = -1;
+            row.dataLogical = ranked->sizes.dataLogical;
+            row.dataPhysical = ranked->sizes.dataPhysical;
+            row.rsrcLogical = ranked->sizes.rsrcLogical;
+            row.rsrcPhysical = ranked->sizes.rsrcPhysical;
+            OutputRow(&row);
+            free(ranked);
+            continue;
+        }
+
+        /* the columns line up with those of a file in the listing */
+        if (columns & COL_LABEL)
+        {
+            OutputString((char *)&labelNames[GetLabelNumber(ranked->finderInfo.flags)]);
+            OutputChar(' ');
+        }
+        if (columns & COL_FLAGS)
+        {
+            fflagstr[0] = (ranked->finderInfo.flags & kIsInvisible) ? 'I' : '-';
+            fflagstr[1] = (ranked->finderInfo.flags & kHasCustomIcon) ? 'C' : '-';
+            fflagstr[2] = (ranked->finderInfo.flags & kNameLocked) ? 'L' : '-';
+            fflagstr[3] = (ranked->finderInfo.flags & kHasBundle) ? 'B' : '-';
+            fflagstr[4] = (ranked->finderInfo.flags & kIsAlias) ? 'A' : '-';
+            fflagstr[5] = (ranked->finderInfo.flags & kIsStationery) ? 'S' : '-';
+            fflagstr[6] = '\0';
+            OutputString(fflagstr);
+            OutputBytes("  ", 2);
+        }
+        if (columns & COL_TYPE)
+        {
+            OSTypeToStr(ranked->finderInfo.type, fileType);
+            OutputPadded(ranked->kind == ROW_FOLDER ? "" : fileType, 4);
+            OutputChar(' ');
+        }
+        if (columns & COL_CREATOR)
+        {
+            OSTypeToStr(ranked->finderInfo.creator, creatorType);
+            OutputPadded(ranked->kind == ROW_FOLDER ? "" : creatorType, 4);
+            OutputBytes("  ", 2);
+        }
+        OutputSize(entries[i].key, useBytesForSize, false);
+        OutputChar(' ');
+        OutputChar(quote);
+        OutputString(ranked->path);
+        if (ranked->kind == ROW_FOLDER)
+            OutputChar('/');
+        OutputChar(quote);
+        OutputChar('\n');
+
+        free(ranked);
+    }
+
+    if (outputFormat != OUTPUT_TEXT)
+        OutputEndDirectory();
+    free(entries);
+}
+
+/*//////////////////////////////////////
+// --summary: add a file into the totals
+// of every group asked for
+/////////////////////////////////////*/
+
+static void SummarizeItem (ItemRef *item, FinderInfoRec *finderInfo, int haveFinderInfo, const ForkSizes *sizes)
+{
+    static const UInt16	flags[] = { kIsInvisible, kHasCustomIcon, kNameLocked, kHasBundle, kIsAlias, kIsStationery };
+    UInt64		bytes;
+    int			hasFlags = false;
+    int			i;
+
+    if (!haveFinderInfo && GetFinderInfo(item, finderInfo) != noErr)
+        memset(finderInfo, 0, sizeof(*finderInfo));
+
+    bytes = physicalSize ? sizes->dataPhysical + sizes->rsrcPhysical : sizes->dataLogical + sizes->rsrcLogical;
+
+    /* every link counts as a file, but only the first one met brings its bytes */
+    if (item->st.st_nlink > 1 && !InodeTableInsert(summaryLinks, item->st.st_dev, item->st.st_ino, NULL))
+        bytes = 0;
+
+    if (summaryGroups & (1 << GROUP_LABEL))
+        TallyAdd(GROUP_LABEL, GetLabelNumber(finderInfo->flags), bytes);
+    if (summaryGroups & (1 << GROUP_TYPE))
+        TallyAdd(GROUP_TYPE, finderInfo->type, bytes);
+    if (summaryGroups & (1 << GROUP_CREATOR))
+        TallyAdd(GROUP_CREATOR, finderInfo->creator, bytes);
+
+    /* a file counts under each flag it has, or under none */
+    if (summaryGroups & (1 << GROUP_FLAGS))
+    {
+        for (i = 0; i < (int)(sizeof(flags) / sizeof(flags[0])); i++)
+        {
+            if (finderInfo->flags & flags[i])
+            {
+                TallyAdd(GROUP_FLAGS, flags[i], bytes);
+                hasFlags = true;
+            }
+        }
+        if (!hasFlags)
+            TallyAdd(GROUP_FLAGS, 0, bytes);
+    }
+}
+
+/*//////////////////////////////////////
+// --summary: a small table per group,
+// most bytes first
+/////////////////////////////////////*/
+
+static void PrintSummary (void)
+{
+    static const char	*groupNames[NUM_GROUPS] = { "label", "type", "creator", "flags" };
+    static const char	*groupTitles[NUM_GROUPS] = { "Label", "Type", "Creator", "Flag" };
+    static const char	*labels[8] = { "None", "Red", "Orange", "Yellow", "Green", "Blue", "Purple", "Gray" };
+    TallyEntry		*entries;
+    const char		*key;
+    char		keyStr[5];
+    long		count;
+    long		i;
+    size_t		n;
+    int			group;
+    int			first = true;
+
+    for (group = 0; group < NUM_GROUPS; group++)
+    {
+        if (!(summaryGroups & (1 << group)))
+            continue;
+
+        count = TallyCollect(group, &entries);
+
+        if (outputFormat == OUTPUT_TEXT)
+        {
+            if (!first)
+                OutputChar('\n');
+            OutputString(groupTitles[group]);
+            for (n = strlen(groupTitles[group]); n < 12; n++)
+                OutputChar(' ');
+            OutputString("     Files  ");
+            OutputString(useBytesForSize ? "             Size\n" : "        Size\n");
+        }
+        first = false;
+
+        for (i = 0; i < count; i++)
+        {
+            switch (group)
+            {
+                case GROUP_LABEL:
+                    key = labels[entries[i].key & 7];
+                    break;
+                case GROUP_FLAGS:
+                    key = (entries[i].key == kIsInvisible) ? "Invisible" :
+                          (entries[i].key == kHasCustomIcon) ? "Custom icon" :
+                          (entries[i].key == kNameLocked) ? "Locked" :
+                          (entries[i].key == kHasBundle) ? "Bundle" :
+                          (entries[i].key == kIsAlias) ? "Alias" :
+                          (entries[i].key == kIsStationery) ? "Stationery" : "(none)";
+                    break;
+                default:
+                    OSTypeToStr(entries[i].key, keyStr);
+                    key = entries[i].key ? keyStr : "(none)";
+                    break;
+            }
+
+            if (outputFormat != OUTPUT_TEXT)
+            {
+                OutputTally(groupNames[group], entries[i].key || group == GROUP_LABEL ? key : "", entries[i].count, entries[i].bytes);
+                continue;
+            }
+
+            /* keys are left aligned */
+            OutputString(key);
+            for (n = strlen(key); n < 12; n++)
+                OutputChar(' ');
+            OutputNumber(entries[i].count, 10);
+            OutputBytes("  ", 2);
+            OutputSize(entries[i].bytes, useBytesForSize, false);
+            OutputChar('\n');
+        }
+
+        free(entries);
+    }
+}
+
+/*//////////////////////////////////////
+// Parse the --summary list
+/////////////////////////////////////*/
+
+static int ParseSummary (char *str)
+{
+    static const char	*names[NUM_GROUPS] = { "label", "type", "creator", "flags" };
+    int		groups = 0;
+    char	*name;
+    int		i;
+
+    for (name = strtok(str, ","); name; name = strtok(NULL, ","))
+    {
+        for (i = 0; i < NUM_GROUPS; i++)
+            if (!strcmp(name, names[i]))
+                break;
+        if (i == NUM_GROUPS)
+        {
+            fprintf(stderr, "Unknown group: %s\nYou must specify some of the following: label, type, creator, flags\n", name);
+            exit(EX_USAGE);
+        }
+        groups |= 1 << i;
+    }
+    return groups;
+}
 
 /*//////////////////////////////////////
 // List some item in directory
 /////////////////////////////////////*/
 
-static void ListItem (char *path, char *name)
+static void ListItem (int dirFd, const char *dirPath, char *name)
 {
-    FSRef		fileRef;
-    OSErr		err = noErr;
+    ItemRef		item;
     short		isFldr;
 
     /* unless the -a paramter is passed, we don't list hidden .* files */
     if (name[0] == '.' && !displayAll) 
             return;
 
-	/* Get file ref to the file or folder pointed to by the path */
-    err = FSPathMakeRef((unsigned char *)path, &fileRef, NULL);
+    StatsItem();
+
+    item.imageItem = NULL;
+    item.dirFd = dirFd;
+    item.dirPath = dirPath;
+    item.name = name;
+    item.path = NULL;
 
-    if (err != noErr) 
-    {
-        if (err != VOL_NOT_FOUND)   // suppress error with files or folders like /.vol or /dev
-		fprintf(stderr, "FSPathMakeRef(): Error %d returned when getting file reference from %s\n", err, path);
-        return;
-    }
-    
     /* Check if we're dealing with a folder */
-    isFldr = UnixIsFolder(path);
+    isFldr = UnixIsFolder(&item);
 	// printf("isFldr : %d  %s\n", isFldr, path);
 	
     if (isFldr == -1)/* an error occurred in stat */
     {
-            perror(path);
+            perror(ItemPath(&item));
             return;
     }
-    
-    /*  if (isFldr)   // it's a folder
+
+#ifdef __APPLE__
+    /* Get file ref to the file or folder pointed to by the path, unless
+       it isn't listed or nothing we list needs the File Manager; data
+       fork sizes come with the stat info */
+    if ((isFldr == 1 ? !omitFolders : !foldersOnly) &&
+        ((attrPlan & (ATTR_FINDERINFO | ATTR_RSRCSIZE | ATTR_VALENCE)) || (useIndex && attrPlan) ||
+         (filter && FilterUses(filter))))
     {
-        if (!omitFolders)
-            ListFolder(name, path, fileRef);
+        err = ItemMakeRef(&item);
+        if (err != noErr) 
+        {
+            if (err != VOL_NOT_FOUND)   // suppress error with files or folders like /.vol or /dev
+            fprintf(stderr, "FSPathMakeRef(): Error %d returned when getting file reference from %s\n", err, ItemPath(&item));
+            return;
+        }
     }
-    else // regular file
-    {
-        if (!foldersOnly) 
-            ListFile(name, path, fileRef);
-    } */
+#endif
 	
 	if (!isFldr)   // it's a regular file
 		{
 			if (!foldersOnly)
-				ListFile(name, path, fileRef);
+				ListFile(&item);
 		}
 	 else
 		{
 			if (isFldr == IS_SYMLINK)
 				{
 				if (!foldersOnly)
-					{
-					err = MyFSPathMakeRef ((unsigned char *)path, &fileRef);
-					ListFile(name, path, fileRef);
-					}
+					ListFile(&item);
 				}
 			else
 			{
 			if (!omitFolders)
-				ListFolder(name, path, fileRef);
+				ListFolder(&item);
+
+			/* queue subdirectories, but not . and .. */
+			if (recursive && S_ISDIR(item.st.st_mode) && !IsDotOrDotDot(name))
+				WalkAddChild(name, item.st.st_dev, item.st.st_ino);
 			}
 		}
 }
 
 
+/*//////////////////////////////////////
+// Full path of an item, only put together
+// when something actually needs it
+/////////////////////////////////////*/
+
+static char* ItemPath (ItemRef *item)
+{
+    if (!item->path)
+    {
+        size_t	len = strlen(item->dirPath);
+
+        /* don't double the slash of "dir/" arguments */
+        if (len && item->dirPath[len - 1] == '/')
+            snprintf(item->pathBuf, sizeof(item->pathBuf), "%s%s", item->dirPath, item->name);
+        else
+            snprintf(item->pathBuf, sizeof(item->pathBuf), "%s/%s", item->dirPath, item->name);
+        item->path = item->pathBuf;
+    }
+    return item->path;
+}
+
+
+/*//////////////////////////////////////
+// Get the backend's handle on an item
+// whose stat info is already filled in
+/////////////////////////////////////*/
+
+static OSErr ItemMakeRef (ItemRef *item)
+{
+#ifdef __APPLE__
+    uint64_t	start = StatsBegin();
+    OSErr	err;
+
+    if (S_ISLNK(item->st.st_mode))
+        err = MyFSPathMakeRef((unsigned char *)ItemPath(item), &item->fsRef);
+    else
+        err = FSPathMakeRef((unsigned char *)ItemPath(item), &item->fsRef, NULL);
+    StatsEnd(STATS_MAKEREF, start);
+    return err;
+#else
+    return noErr;
+#endif
+}
+
+static int IsDotOrDotDot (const char *name)
+{
+    return (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])));
+}
+
+
 /*//////////////////////////////////////
 // Print directory item info for a file
 /////////////////////////////////////*/
 
-static void ListFile(char *name, char *path, FSRef fileRef)
+static void ListFile(ItemRef *item)
 {
-    /* File manager structures */
-    FInfo 		finderInfo;
+    FinderInfoRec	finderInfo;
+    ForkSizes		sizes;
+    int			haveFinderInfo = false;
+    int			haveSizes = false;
 
     char		fileType[5];
     char		creatorType[5];
-    char		*sizeStr;
     char		quote;
     char		fflagstr[7];
     char		*fileName;
     char		*aliasSrcPath;
+    ScanRange		*ranges;
+    long		numRanges;
     
     UInt64		totalPhysicalSize;
     UInt64		totalLogicalSize;
-    // long		size;
 	UInt64		size;
 	
     short               labelNum;
     OSErr		err = noErr;
+    uint64_t		start;
 
-    /* retrieve filespec from file ref */
-    FSCatalogInfo cinfo;
-    err = FSGetCatalogInfo (&fileRef, kFSCatInfoFinderInfo, &cinfo, NULL, NULL, NULL);
-    if (err != noErr) 
+    memset(&finderInfo, 0, sizeof(finderInfo));
+
+    /* with --where, weed the file out before fetching anything else */
+    if (filter && !ItemMatches(item, &finderInfo, &haveFinderInfo, &sizes, &haveSizes))
+        return;
+
+    /* --top and --summary: rank or add up the file instead of listing it */
+    if (topCount || summaryGroups)
+    {
+        if (!haveSizes && (err = GetEachForkSize(item, &sizes, forkToDisplay)) != noErr)
+        {
+            fprintf(stderr, "GetForkSizes(): Error %d getting size of file forks of %s\n", err, ItemPath(item));
+            exitStatus = EX_IOERR;
+            return;
+        }
+        if (summaryGroups)
+        {
+            SummarizeItem(item, &finderInfo, haveFinderInfo, &sizes);
+            haveFinderInfo = true;
+        }
+        if (topCount)
+            RankItem(item, &finderInfo, haveFinderInfo, &sizes);
+        return;
+    }
+
+    /*
+     * get the finder info, if any column wants it, and the fork
+     * sizes; a file we can't read them of, unreadable or gone
+     * since the folder was read, is still listed, as ls would
+     */
+    if ((attrPlan & ATTR_FINDERINFO) && !haveFinderInfo)
+    {
+        err = GetFinderInfo(item, &finderInfo);
+        if (err != noErr) 
+        {
+            fprintf(stderr, "GetFinderInfo(): Error %d getting finder info of %s\n", err, ItemPath(item));
+            memset(&finderInfo, 0, sizeof(finderInfo));
+            exitStatus = EX_IOERR;
+        }
+    }
+
+    if ((attrPlan & (ATTR_DATASIZE | ATTR_RSRCSIZE)) && !haveSizes)
+    {
+        err = GetEachForkSize(item, &sizes, forkToDisplay);
+        if (err != noErr) 
+        {
+            fprintf(stderr, "GetForkSizes(): Error %d getting size of file forks of %s\n", err, ItemPath(item));
+            exitStatus = EX_IOERR;
+        }
+        else
+            haveSizes = true;
+    }
+
+    /* and where it points, if it's an alias */
+    aliasSrcPath = NULL;
+    if ((attrPlan & ATTR_ALIAS) && (finderInfo.flags & kIsAlias) && !item->imageItem)
+    {
+        start = StatsBegin();
+        aliasSrcPath = GetPathOfAliasSource(ItemPath(item));
+        StatsEnd(STATS_ALIAS, start);
+    }
+
+    /* and, with --holes, where a sparse file's data is */
+    ranges = NULL;
+    numRanges = 0;
+    if (showHoles)
+        numRanges = GetDataRanges(item, &ranges);
+
+    if (outputFormat != OUTPUT_TEXT)
     {
-        fprintf(stderr, "FSGetCatalogInfo(): Error %d getting finder info from file reference", err);
-        exit(EX_IOERR);
+        start = StatsBegin();
+        OutputFileRow(item, &finderInfo, ((attrPlan & (ATTR_DATASIZE | ATTR_RSRCSIZE)) && haveSizes) ? &sizes : NULL,
+                      aliasSrcPath, ranges, numRanges);
+        StatsEnd(STATS_FORMAT, start);
+        free(ranges);
+        return;
+    }
+
+	/* ///// File Sizes ////// */
+    size = 0;
+    if ((columns & COL_SIZE) && haveSizes)
+    {
+    totalLogicalSize = sizes.dataLogical + sizes.rsrcLogical;
+    totalPhysicalSize = sizes.dataPhysical + sizes.rsrcPhysical;
+
+    size = physicalSize ? totalPhysicalSize : totalLogicalSize;
+
+    // update the total with the current file
+    if (folderTotal)
+        AddToFolderTotal(item, size);
     }
 
-    /* get the finder info */
-    finderInfo = *(FInfo*)cinfo.finderInfo;
+    start = StatsBegin();
 
     /* ///// Finder flags////// */
     
 	/* Is Invisible */
-	fflagstr[0] = (finderInfo.fdFlags & kIsInvisible) ? 'I' : '-';
+	fflagstr[0] = (finderInfo.flags & kIsInvisible) ? 'I' : '-';
 
 	/* Has Custom Icon */
-	fflagstr[1] = (finderInfo.fdFlags & kHasCustomIcon) ? 'C' : '-';
+	fflagstr[1] = (finderInfo.flags & kHasCustomIcon) ? 'C' : '-';
 
 	/* Is Locked */
-        fflagstr[2] = (finderInfo.fdFlags & kNameLocked) ? 'L' : '-';
+        fflagstr[2] = (finderInfo.flags & kNameLocked) ? 'L' : '-';
 
 	/* Has Bundle Bit Set */
-	fflagstr[3] = (finderInfo.fdFlags & kHasBundle) ? 'B' : '-';
+	fflagstr[3] = (finderInfo.flags & kHasBundle) ? 'B' : '-';
 
 	/* Is Alias */
-        fflagstr[4] = (finderInfo.fdFlags & kIsAlias) ? 'A' : '-';
+        fflagstr[4] = (finderInfo.flags & kIsAlias) ? 'A' : '-';
 
 	/* Is Stationery */
-	fflagstr[5] = (finderInfo.fdFlags & kIsStationery) ? 'S' : '-';
+	fflagstr[5] = (finderInfo.flags & kIsStationery) ? 'S' : '-';
 
 	fflagstr[6] = '\0';    
 
     /* ///// File/Creator types ///// */
 
 	/* get file type string */
-	OSTypeToStr(finderInfo.fdType, fileType);
+	OSTypeToStr(finderInfo.type, fileType);
 
 	/* get creator type string */
-	OSTypeToStr(finderInfo.fdCreator, creatorType);
-
-	/* ///// File Sizes ////// */
-    err = GetForkSizes(&fileRef,  &totalLogicalSize, &totalPhysicalSize, forkToDisplay);
-    if (err != noErr) 
-    {
-        fprintf(stderr, "GetForkSizes(): Error %d getting size of file forks\n", err);
-        exit(EX_IOERR);
-    }
-
-    /*////////////////////////////
-    // This needs to be fixed in the future
-    // The size of files larger than 4GB is not displayed correctly due
-    // due the use of a long int to store file size
-    ////////////////////////////*/
-    size = physicalSize ? totalPhysicalSize : totalLogicalSize;
-
-    size = totalLogicalSize;
-	
-	totalFolderSize += size;   // update the total with the current file
-	
-    sizeStr = useBytesForSize ? GetSizeString(size) : GetHumanSizeString(size);
+	OSTypeToStr(finderInfo.creator, creatorType);
 
     /* if the -Q option is specified */
     quote = useQuotes ? '"' : ' ';
 
     /* if the -p option is specified */
-    fileName = printFullPath ? path : name;
+    fileName = printFullPath ? ItemPath(item) : item->name;
     
     
     // Print label
-    if (printLabelName)
+    if (columns & COL_LABEL)
     {
-            labelNum = GetLabelNumber(finderInfo.fdFlags);
-            printf("%s ", (char *)&labelNames[labelNum]);
+            labelNum = GetLabelNumber(finderInfo.flags);
+            OutputString((char *)&labelNames[labelNum]);
+            OutputChar(' ');
     }
-    /* /////// Print output for this directory item //////// */
-    if (finderInfo.fdFlags & kIsAlias)
+    /* /////// Print output for this directory item, the columns asked for //////// */
+    if (columns & COL_FLAGS)
     {
-        aliasSrcPath = GetPathOfAliasSource(path);
-        printf("%s  %4s %4s  %s %c%s%c-->%c%s%c\n", fflagstr, fileType, creatorType, sizeStr, quote, fileName, quote, quote, aliasSrcPath, quote);
+        OutputString(fflagstr);
+        OutputBytes("  ", 2);
+    }
+    if (columns & COL_TYPE)
+    {
+        OutputPadded(fileType, 4);
+        OutputChar(' ');
+    }
+    if (columns & COL_CREATOR)
+    {
+        OutputPadded(creatorType, 4);
+        OutputBytes("  ", 2);
+    }
+    if (columns & COL_SIZE)
+    {
+        if (haveSizes)
+            OutputSize(size, useBytesForSize, false);
+        else
+            OutputString(useBytesForSize ? "              -  " : "        -   ");
+        OutputChar(' ');
+    }
+    OutputChar(quote);
+    OutputString(fileName);
+    OutputChar(quote);
+    if (aliasSrcPath)
+    {
+        OutputString("-->");
+        OutputChar(quote);
+        OutputString(aliasSrcPath);
+        OutputChar(quote);
+    }
+    OutputChar('\n');
+    if (ranges)
+    {
+        OutputRanges(ranges, numRanges);
+        free(ranges);
+    }
+    StatsEnd(STATS_FORMAT, start);
+}
+
+/*//////////////////////////////////////
+// Add a file into the folder's total line.
+// A file with several links in the folder
+// counts once, and with -l so does each
+// extent it shares with other files in it.
+/////////////////////////////////////*/
+
+static void AddToFolderTotal (ItemRef *item, UInt64 size)
+{
+    SharedExtents	extents;
+    uint64_t		start;
+    int			rc;
+
+    if (item->st.st_nlink > 1 && !S_ISDIR(item->st.st_mode))
+    {
+        if (!folderTotal->links)
+            folderTotal->links = InodeSetCreate();
+        if (!InodeSetInsert(folderTotal->links, item->st.st_dev, item->st.st_ino))
+            return;
+    }
+
+    /* clones share the data fork's blocks, which only the physical size shows */
+    if (physicalSize && forkToDisplay != DISPLAY_FORK_RSRC && S_ISREG(item->st.st_mode) &&
+        item->st.st_blocks > 0 && item->st.st_dev != noExtentsDev && !item->imageItem)
+    {
+        if (!folderTotal->extents)
+            folderTotal->extents = InodeSetCreate();
+        extents.seen = folderTotal->extents;
+        extents.dev = item->st.st_dev;
+        extents.shared = 0;
+        extents.counted = 0;
+        start = StatsBegin();
+        rc = ScanSharedExtents(item->dirFd, item->name, CountSharedExtent, &extents);
+        StatsEnd(STATS_EXTENTS, start);
+        if (rc == 0)
+        {
+            if (extents.shared > size)
+                extents.shared = size;
+            size = size - extents.shared + extents.counted;
+        }
+        else if (errno == EOPNOTSUPP)
+            noExtentsDev = item->st.st_dev;
+    }
+
+    folderTotal->size += size;
+}
+
+static void CountSharedExtent (uint64_t physical, uint64_t length, void *refCon)
+{
+    SharedExtents	*extents = refCon;
+
+    extents->shared += length;
+    if (InodeSetInsert(extents->seen, extents->dev, physical))
+        extents->counted += length;
+}
+
+/*//////////////////////////////////////
+// --holes: the data and holes of a file's
+// data fork, or 0 if it has no holes.
+// Only a file with fewer blocks than its
+// size can have any, so no other file is
+// opened.  The list is the caller's to free
+/////////////////////////////////////*/
+static long GetDataRanges (ItemRef *item, ScanRange **ranges)
+{
+    uint64_t	start;
+    long	n, i;
+
+    *ranges = NULL;
+    if (!S_ISREG(item->st.st_mode) || forkToDisplay == DISPLAY_FORK_RSRC ||
+        (uint64_t)item->st.st_blocks * 512 >= (uint64_t)item->st.st_size || item->st.st_dev == noHolesDev)
+        return 0;
+
+    start = StatsBegin();
+    n = ScanFileRanges(item->dirFd, item->name, item->st.st_size, ranges);
+    StatsEnd(STATS_EXTENTS, start);
+    if (n == -1)
+    {
+        if (errno == EOPNOTSUPP)
+            noHolesDev = item->st.st_dev;
+        else
+            fprintf(stderr, "%s: %s\n", ItemPath(item), strerror(errno));
+        *ranges = NULL;
+        return 0;
+    }
+
+    /* compressed or inline data can be short of blocks without holes */
+    for (i = 0; i < n; i++)
+        if ((*ranges)[i].isHole)
+            return n;
+    free(*ranges);
+    *ranges = NULL;
+    return 0;
+}
+
+/* one indented line per range, under the file's */
+static void OutputRanges (const ScanRange *ranges, long numRanges)
+{
+    long	i;
+
+    for (i = 0; i < numRanges; i++)
+    {
+        OutputString(ranges[i].isHole ? "        hole " : "        data ");
+        OutputSize(ranges[i].length, useBytesForSize, false);
+        OutputString(" at ");
+        OutputNumber((int64_t)ranges[i].offset, 0);
+        OutputChar('\n');
     }
-    else
-        printf("%s  %4s %4s  %s %c%s%c\n", fflagstr, fileType, creatorType, sizeStr, quote, fileName, quote);
 }
 
 /*//////////////////////////////////////
 // Print directory item info for a folder
 /////////////////////////////////////*/
-static void ListFolder (char *name, char *path, FSRef fileRef)
+static void ListFolder (ItemRef *item)
 {
     char	quote;
     long	valence;
-    char	*numFilesStr;
     char	*fileName;
     char        fflagstr[7];
     short       labelNum;
-    const char	*sizeStr;
     const char	*humanSizeStr = "     -   ";
     const char	*byteSizeStr  = "           -  ";
-    DInfo       dInfo;//directory information
+    FinderInfoRec	dInfo;//directory information
+    ForkSizes	sizes;
+    UInt64	size;
+    int		haveSize = false;
+    int		haveFinderInfo = false;
+    uint64_t	start;
+
+    memset(&dInfo, 0, sizeof(dInfo));
+
+    /* with --where, weed the folder out first */
+    if (filter && !ItemMatches(item, &dInfo, &haveFinderInfo, &sizes, &haveSize))
+        return;
+
+    /* --top: only folders sized with -c are ranked; --summary counts files */
+    if (topCount || summaryGroups)
+    {
+        if (!topCount)
+            return;
+        if (haveSize || (calcFolderSizes && InodeTableLookup(folderSizes, item->st.st_dev, item->st.st_ino, &sizes)))
+            RankItem(item, &dInfo, haveFinderInfo, &sizes);
+        return;
+    }
 
     /*
-	 * Retrieve number of files within folder from the 
-         * FSCatalog record
+	 * Retrieve number of files within folder; a folder we
+	 * can't look into is still listed, just without a count
     */
-    valence = GetNumFilesInFolder(&fileRef);
-    if (valence == -1)/* error */
+    valence = -1;
+    if (attrPlan & ATTR_VALENCE)
     {
-        fprintf(stderr, "%s: Error getting number of files in folder\n", name);
-        return;
+        valence = GetNumFilesInFolder(item);
+        if (valence == -1)/* error */
+            fprintf(stderr, "%s: Error getting number of files in folder\n", item->name);
     }
 
-    /* generate a suitable-length string from this number */
-    numFilesStr = GetNumFilesString(valence);
-    if (!numFilesStr) 
+    if ((attrPlan & ATTR_FINDERINFO) && !haveFinderInfo && GetFinderInfo(item, &dInfo) != noErr)
+        memset(&dInfo, 0, sizeof(dInfo));
+
+    start = StatsBegin();
+
+    if (outputFormat != OUTPUT_TEXT)
     {
-        fprintf(stderr, "%s: Error getting number of files in folder\n", name);
+        OutputFolderRow(item, valence, &dInfo);
+        StatsEnd(STATS_FORMAT, start);
         return;
     }
-    
+
     /* modify according to the options specified */
-	fileName = printFullPath ? path : name;
+	fileName = printFullPath ? ItemPath(item) : item->name;
 
-	sizeStr = useBytesForSize ? byteSizeStr : humanSizeStr;
+	/* with -c, the total of everything inside */
+	if (calcFolderSizes && InodeTableLookup(folderSizes, item->st.st_dev, item->st.st_ino, &sizes))
+	{
+		size = physicalSize ? sizes.dataPhysical + sizes.rsrcPhysical : sizes.dataLogical + sizes.rsrcLogical;
+		haveSize = true;
+	}
 
 	quote = useQuotes ? '"' : ' ';
 
-        GetDInfo(&fileRef, &dInfo);
-
-                
         /* Is Invisible */
-	fflagstr[0] = (dInfo.frFlags & kIsInvisible) ? 'I' : '-';
+	fflagstr[0] = (dInfo.flags & kIsInvisible) ? 'I' : '-';
 
 	/* Has Custom Icon */
-	fflagstr[1] = (dInfo.frFlags & kHasCustomIcon) ? 'C' : '-';
+	fflagstr[1] = (dInfo.flags & kHasCustomIcon) ? 'C' : '-';
 
 	/* Is Locked */
-        fflagstr[2] = (dInfo.frFlags & kNameLocked) ? 'L' : '-';
+        fflagstr[2] = (dInfo.flags & kNameLocked) ? 'L' : '-';
 
 	/* Has Bundle Bit Set */
-	fflagstr[3] = (dInfo.frFlags & kHasBundle) ? 'B' : '-';
+	fflagstr[3] = (dInfo.flags & kHasBundle) ? 'B' : '-';
 
 	/* Is Alias */
-        fflagstr[4] = (dInfo.frFlags & kIsAlias) ? 'A' : '-';
+        fflagstr[4] = (dInfo.flags & kIsAlias) ? 'A' : '-';
 
 	/* Is Stationery */
-	fflagstr[5] = (dInfo.frFlags & kIsStationery) ? 'S' : '-';
+	fflagstr[5] = (dInfo.flags & kIsStationery) ? 'S' : '-';
 
 	fflagstr[6] = '\0';
 
         
         
         // get label
-        if (printLabelName)
+        if (columns & COL_LABEL)
         {
-            labelNum = GetLabelNumber(dInfo.frFlags);
-            printf("%s ", (char *)&labelNames[labelNum]);
+            labelNum = GetLabelNumber(dInfo.flags);
+            OutputString((char *)&labelNames[labelNum]);
+            OutputChar(' ');
         }
         
-        //print out line
-	printf("%s %s     %s %c%s/%c\n", fflagstr, numFilesStr, sizeStr, quote, fileName, quote);
+        //print out line; the folder size column is three characters narrower than the file one
+	if (columns & COL_FLAGS)
+	{
+		OutputString(fflagstr);
+		OutputChar(' ');
+	}
+	if (columns & COL_ITEMS)
+	{
+		OutputNumFiles(valence);
+		OutputString("     ");
+	}
+	if (columns & COL_SIZE)
+	{
+		if (haveSize)
+			OutputSize(size, useBytesForSize, true);
+		else
+			OutputString(useBytesForSize ? byteSizeStr : humanSizeStr);
+		OutputChar(' ');
+	}
+	OutputChar(quote);
+	OutputString(fileName);
+	OutputChar('/');
+	OutputChar(quote);
+	OutputChar('\n');
+	StatsEnd(STATS_FORMAT, start);
         
         return;
     
 }
 
+/*//////////////////////////////////////
+// --where: test an entry, fetching its
+// Finder info and then its sizes only
+// while the answer still depends on them.
+// What was fetched is handed back, so it
+// needn't be fetched again for listing.
+/////////////////////////////////////*/
+static int ItemMatches (ItemRef *item, FinderInfoRec *finderInfo, int *haveFinderInfo, ForkSizes *sizes, int *haveSizes)
+{
+    FilterFacts		facts;
+    int			match;
+
+    facts.known = 0;
+    facts.name = item->name;
+
+    if (S_ISDIR(item->st.st_mode))
+    {
+        /* a folder's size is its -c total, or it has none */
+        facts.known |= FILTER_KNOW_SIZE;
+        facts.size = FILTER_NO_SIZE;
+        if (calcFolderSizes && InodeTableLookup(folderSizes, item->st.st_dev, item->st.st_ino, sizes))
+            *haveSizes = true;
+    }
+    else if (forkToDisplay == DISPLAY_FORK_DATA)
+    {
+        /* the data fork alone is in the stat info */
+        memset(sizes, 0, sizeof(*sizes));
+        sizes->dataLogical = item->st.st_size;
+        sizes->dataPhysical = (UInt64)item->st.st_blocks * 512;
+        *haveSizes = true;
+    }
+
+    if (*haveSizes)
+    {
+        facts.known |= FILTER_KNOW_SIZE;
+        facts.size = physicalSize ? sizes->dataPhysical + sizes->rsrcPhysical : sizes->dataLogical + sizes->rsrcLogical;
+    }
+
+    match = FilterMatch(filter, &facts);
+
+    if (match == FILTER_MAYBE && (FilterUses(filter) & FILTER_KNOW_FINDERINFO))
+    {
+        /* an entry we can't read the Finder info of has none */
+        if (GetFinderInfo(item, finderInfo) == noErr)
+            *haveFinderInfo = true;
+        else
+            memset(finderInfo, 0, sizeof(*finderInfo));
+        facts.known |= FILTER_KNOW_FINDERINFO;
+        facts.flags = finderInfo->flags;
+        facts.type = finderInfo->type;
+        facts.creator = finderInfo->creator;
+        match = FilterMatch(filter, &facts);
+    }
+
+    if (match == FILTER_MAYBE)
+    {
+        facts.known |= FILTER_KNOW_SIZE;
+        facts.size = FILTER_NO_SIZE;
+        if (GetEachForkSize(item, sizes, forkToDisplay) == noErr)
+        {
+            *haveSizes = true;
+            facts.size = physicalSize ? sizes->dataPhysical + sizes->rsrcPhysical : sizes->dataLogical + sizes->rsrcLogical;
+        }
+        match = FilterMatch(filter, &facts);
+    }
+
+    return match == FILTER_YES;
+}
+
+/*//////////////////////////////////////
+// --format: hand a file's meta-data to the
+// output module as it is, every fork size
+// separately and no text formatting
+/////////////////////////////////////*/
+static void OutputFileRow (ItemRef *item, const FinderInfoRec *finderInfo, const ForkSizes *sizes, char *aliasTarget,
+                           const ScanRange *ranges, long numRanges)
+{
+    ListRow		row;
+
+    row.name = item->name;
+    row.aliasTarget = aliasTarget;
+    row.ranges = ranges;
+    row.numRanges = numRanges;
+    row.kind = S_ISLNK(item->st.st_mode) ? ROW_SYMLINK : ROW_FILE;
+    row.haveFinderInfo = (attrPlan & ATTR_FINDERINFO) != 0;
+    row.flags = finderInfo->flags;
+    row.type = finderInfo->type;
+    row.creator = finderInfo->creator;
+    row.label = GetLabelNumber(finderInfo->flags);
+    row.items = -1;
+
+    if (sizes)
+    {
+        row.dataLogical = sizes->dataLogical;
+        row.dataPhysical = sizes->dataPhysical;
+        row.rsrcLogical = sizes->rsrcLogical;
+        row.rsrcPhysical = sizes->rsrcPhysical;
+    }
+    else
+        row.dataLogical = row.dataPhysical = row.rsrcLogical = row.rsrcPhysical = OUTPUT_UNKNOWN_SIZE;
+
+    OutputRow(&row);
+}
+
+/*//////////////////////////////////////
+// --format: same for a folder; sizes are
+// only known with -c
+/////////////////////////////////////*/
+static void OutputFolderRow (ItemRef *item, long valence, const FinderInfoRec *dInfo)
+{
+    ListRow		row;
+    ForkSizes		sizes;
+
+    row.name = item->name;
+    row.aliasTarget = NULL;
+    row.ranges = NULL;
+    row.numRanges = 0;
+    row.kind = ROW_FOLDER;
+    row.haveFinderInfo = (attrPlan & ATTR_FINDERINFO) != 0;
+    row.flags = dInfo->flags;
+    row.type = dInfo->type;
+    row.creator = dInfo->creator;
+    row.label = GetLabelNumber(dInfo->flags);
+    row.items = valence;
+
+    if ((columns & COL_SIZE) && calcFolderSizes && InodeTableLookup(folderSizes, item->st.st_dev, item->st.st_ino, &sizes))
+    {
+        row.dataLogical = sizes.dataLogical;
+        row.dataPhysical = sizes.dataPhysical;
+        row.rsrcLogical = sizes.rsrcLogical;
+        row.rsrcPhysical = sizes.rsrcPhysical;
+    }
+    else
+        row.dataLogical = row.dataPhysical = row.rsrcLogical = row.rsrcPhysical = OUTPUT_UNKNOWN_SIZE;
+
+    OutputRow(&row);
+}
+
 #pragma mark -
 
 /*//////////////////////////////////////
-// Generate a string for number of files within a folder
+// Print the number of files within a folder
 /////////////////////////////////////*/
 
-static char* GetNumFilesString (long numFiles)
+static void OutputNumFiles (long numFiles)
 {
-    static char	numFilesStr[11];
-    
-    /* there can't be less than 0 files in a folder...duh */
+    /* there can't be less than 0 files in a folder, so we couldn't count them */
     if (numFiles < 0)
-        return NULL;
-    
-    /* we list a maximum of 9999 files within folder
-       this needs to be fixed at some point */
-    if (numFiles > 9999)
-        numFiles = 9999;
+    {
+        OutputString("   ? items");
+        return;
+    }
     
-    /* create a string that contains just the number */
-    sprintf(numFilesStr, "%4d items", (int)numFiles);
-
-    return numFilesStr;
+    /* past 9999 the column just gets wider */
+    OutputNumber(numFiles, 4);
+    OutputString(" items");
 }
 
 
@@ -661,19 +2664,38 @@ static char* GetNumFilesString (long numFiles)
 // Get the number of files contained within
 // the folder pointed to by an FSRef
 /////////////////////////////////////*/
-static long GetNumFilesInFolder (FSRef *fileRef)
+static long GetNumFilesInFolder (ItemRef *item)
 {
+#ifdef __APPLE__
     OSErr		err;
     FSCatalogInfo	catInfo;
+    uint64_t		start;
+#endif
+    long		valence;
+
+    /* the -c walk has read the folder already */
+    if (folderValences && InodeTableLookup(folderValences, item->st.st_dev, item->st.st_ino, &valence))
+        return valence;
+
+    /* an image's catalog keeps count, as the Mac's does */
+    if (item->imageItem)
+        return item->imageItem->valence;
+
+#ifdef __APPLE__
     
     /* access the FSCatalog record to get the number of files */
-    err = FSGetCatalogInfo(fileRef, kFSCatInfoValence, &catInfo, NULL, NULL, NULL);
+    start = StatsBegin();
+    err = FSGetCatalogInfo(&item->fsRef, kFSCatInfoValence, &catInfo, NULL, NULL, NULL);
+    StatsEnd(STATS_READDIR, start);
 
     if (err)
         return(-1);
 
     return (catInfo.valence);
-
+#else
+    /* no catalog to ask, so count the entries ourselves */
+    return ScanCountEntries(item->dirFd, item->name);
+#endif
 }
 
 /*//////////////////////////////////////
@@ -713,58 +2735,48 @@ short GetForkParameterFromString (char *str)
 }
 
 
-/*//////////////////////////////////////
-// Generate file size string in bytes
-/////////////////////////////////////*/
+/*//////////////////////////////////////////
+// Logical and physical size of each fork,
+// leaving out the fork we don't display
+//////////////////////////////////////////*/
 
-// static char* GetSizeString (long size)
-static char* GetSizeString (UInt64 size)
+static OSErr GetEachForkSize (const ItemRef *item, ForkSizes *sizes, short fork)
 {
-    // static char	sizeStr[15];
-	static char	sizeStr[17];
-	
-    // sprintf(sizeStr, "%12d B", (int)size);
-    sprintf(sizeStr, "%15llu B",size );
-    return sizeStr;
-}
+    MDIndexEntry	entry;
+    OSErr		err;
+    uint64_t		start;
 
-/*//////////////////////////////////////
-// Generate file size string in human readable format
-/////////////////////////////////////*/
+    if (!useIndex)
+    {
+        start = StatsBegin();
+        err = FetchForkSizes(item, sizes, fork);
+        StatsEnd(STATS_FORKSIZES, start);
+        return err;
+    }
 
-static char* GetHumanSizeString (UInt64 size)
-{
-    static char	humanSizeStr[13];
+    err = GetIndexedInfo(item, &entry);
+    if (err != noErr)
+        return err;
 
-    if (size < 1024) 
-    {
-                /* bytes */
-        sprintf(humanSizeStr, "   %6d  B", (int)size);
-    } 
-    else if (size < 1048576) {
-            /* kbytes */
-        sprintf(humanSizeStr, "   %6.1f KB", size / 1024.0);
-    } 
-    else if (size < 1073741824) 
+    memset(sizes, 0, sizeof(*sizes));
+    if (fork != DISPLAY_FORK_RSRC)
     {
-            /* megabytes */
-        sprintf(humanSizeStr, "   %6.1f MB", size / 1048576.0);
-    } 
-    else 
+        sizes->dataLogical = entry.size;
+        sizes->dataPhysical = entry.dataPhysical;
+    }
+    if (fork != DISPLAY_FORK_DATA)
     {
-		/* gigabytes */
-		sprintf(humanSizeStr, "   %6.1f GB", size / 1073741824.0);
+        sizes->rsrcLogical = entry.rsrcLogical;
+        sizes->rsrcPhysical = entry.rsrcPhysical;
     }
-
-    return (humanSizeStr);
+    return noErr;
 }
 
-
 /*//////////////////////////////////////////
-// Function to get size of file forks
+// Fork sizes, from the file system
 //////////////////////////////////////////*/
 
-static OSErr GetForkSizes (const FSRef *fileRef,  UInt64 *totalLogicalForkSize, UInt64 *totalPhysicalForkSize, short fork)  
+static OSErr FetchForkSizes (const ItemRef *item, ForkSizes *sizes, short fork)
 {
     /*
         the fork paramater can be one of three possible values
@@ -775,45 +2787,50 @@ static OSErr GetForkSizes (const FSRef *fileRef,  UInt64 *totalLogicalForkSize,
 
     */
 
+    /* an image's catalog record has both forks */
+    if (item->imageItem)
+    {
+        memset(sizes, 0, sizeof(*sizes));
+        if (fork != DISPLAY_FORK_RSRC)
+        {
+            sizes->dataLogical = item->imageItem->dataLogical;
+            sizes->dataPhysical = item->imageItem->dataPhysical;
+        }
+        if (fork != DISPLAY_FORK_DATA)
+        {
+            sizes->rsrcLogical = item->imageItem->rsrcLogical;
+            sizes->rsrcPhysical = item->imageItem->rsrcPhysical;
+        }
+        return noErr;
+    }
+
+#ifdef __APPLE__
+    const FSRef		*fileRef = &item->fsRef;
     OSErr   		err;
     CatPositionRec 	forkIterator;
     
     SInt64   		forkLogicalSize = (SInt64)NULL;
-    SInt64   		*forkLogicalSizePtr;
     UInt64   		forkPhysicalSize = (UInt64)NULL;
-    UInt64   		*forkPhysicalSizePtr;
 
     HFSUniStr255	forkName;
     char		forkStr[255];
 
-    /* if logical fork size is needed */
-    if (totalLogicalForkSize) 
-    {
-        *totalLogicalForkSize = 0;
-        forkLogicalSizePtr = &forkLogicalSize;
-    } 
-    else 
-    {
-        forkLogicalSizePtr = NULL;
-    }
-    
-    /* if physical fork size is needed */
-    if (totalPhysicalForkSize) 
-    {
-        *totalPhysicalForkSize = 0;
-        forkPhysicalSizePtr = &forkPhysicalSize;
-    } 
-    else 
+    memset(sizes, 0, sizeof(*sizes));
+
+    /* the data fork alone is in the stat info, no need for the File Manager */
+    if (fork == DISPLAY_FORK_DATA)
     {
-        forkPhysicalSizePtr = NULL;
+        sizes->dataLogical = item->st.st_size;
+        sizes->dataPhysical = (UInt64)item->st.st_blocks * 512;
+        return noErr;
     }
     
-    /* Iterate through the file's forks and get their combined size */
+    /* Iterate through the file's forks and get their sizes */
     forkIterator.initialize = 0;
 
     do 
     {
-        err = FSIterateForks(fileRef, &forkIterator, &forkName, forkLogicalSizePtr, forkPhysicalSizePtr);
+        err = FSIterateForks(fileRef, &forkIterator, &forkName, &forkLogicalSize, &forkPhysicalSize);
         if (noErr == err) 
         {
             HFSUniPStrToCString(&forkName, (char *)&forkStr);
@@ -824,28 +2841,16 @@ static OSErr GetForkSizes (const FSRef *fileRef,  UInt64 *totalLogicalForkSize,
                 /* if we're not just displaying the data fork */
                 if (fork != DISPLAY_FORK_DATA) 
                 {
-                    if (totalLogicalForkSize) 
-                    {
-                        *totalLogicalForkSize += forkLogicalSize;
-                    }
-                    if (totalPhysicalForkSize) 
-                    {
-                        *totalPhysicalForkSize += forkPhysicalSize;
-                    }
+                    sizes->rsrcLogical += forkLogicalSize;
+                    sizes->rsrcPhysical += forkPhysicalSize;
                 }
             }
             else/* must be the data fork, then */
             {
                 if (fork != DISPLAY_FORK_RSRC) 
                 {
-                    if (totalLogicalForkSize) 
-                    {
-                        *totalLogicalForkSize += forkLogicalSize;
-                    }
-                    if (totalPhysicalForkSize) 
-                    {
-                        *totalPhysicalForkSize += forkPhysicalSize;
-                    }
+                    sizes->dataLogical += forkLogicalSize;
+                    sizes->dataPhysical += forkPhysicalSize;
                 }
             }
         }
@@ -863,6 +2868,29 @@ static OSErr GetForkSizes (const FSRef *fileRef,  UInt64 *totalLogicalForkSize,
     }
     
     return(err);
+#else
+    UInt64		rsrcSize;
+
+    memset(sizes, 0, sizeof(*sizes));
+
+    /* data fork is the file itself */
+    if (fork != DISPLAY_FORK_RSRC)
+    {
+        sizes->dataLogical = item->st.st_size;
+        sizes->dataPhysical = (UInt64)item->st.st_blocks * 512;
+    }
+
+    /* resource fork is an extended attribute */
+    if (fork != DISPLAY_FORK_DATA)
+    {
+        if (FIGetResourceForkSize(item->dirFd, item->dirPath, item->name, &rsrcSize) == -1)
+            return ioErr;
+        sizes->rsrcLogical = rsrcSize;
+        sizes->rsrcPhysical = rsrcSize;
+    }
+
+    return noErr;
+#endif
 }
 
 
@@ -890,18 +2918,20 @@ void OSTypeToStr(OSType aType, char *aStr)
 // This is faster than the File-Manager based
 // function above
 /////////////////////////////////////*/
-static int UnixIsFolder (char *path)
+static int UnixIsFolder (ItemRef *item)
 {
     struct stat filestat;
     short err;
     short i;      // file type 0 = regular 1 = folder
 	
     // err = stat(path, &filestat);
-	err = lstat(path, &filestat);   // use lstat for symlinks
+	err = ScanStatAt(item->dirFd, item->name, &item->st);   // doesn't follow symlinks
 	
 	if (err == -1)
         return err;
 
+	filestat = item->st;
+
     // return (S_ISREG(filestat.st_mode) != 1);
 	
 	i = (S_ISREG(filestat.st_mode) != 1);	// only 0 for regular files
@@ -921,6 +2951,8 @@ static int UnixIsFolder (char *path)
 	 }
 }
 
+#ifdef __APPLE__
+
 /**************************************************************************************/
 
   /* Due to a bug in the X File Manager, 2489632,			*/
@@ -1013,6 +3045,8 @@ static void HFSUniPStrToCString (HFSUniStr255 *uniStr, char *cstr)
     CFStringGetCString(cfStr, cstr, 255, kCFStringEncodingUTF8);
 }
 
+#endif
+
 
 /*//////////////////////////////////////
 // On being passed the path to a Mac OS alias,
@@ -1021,8 +3055,9 @@ static void HFSUniPStrToCString (HFSUniStr255 *uniStr, char *cstr)
 /////////////////////////////////////*/
 static char* GetPathOfAliasSource (char *path)
 {
+#ifdef __APPLE__
     OSErr	err = noErr;
-    static char	srcPath[2000];
+    static __thread char	srcPath[2000];
     FSRef	fileRef;
     Boolean	isAlias, isFolder;
 
@@ -1063,9 +3098,14 @@ static char* GetPathOfAliasSource (char *path)
     }
     
     return ((char *)&srcPath);
+#else
+    /* resolving aliases needs the Alias Manager */
+    return NULL;
+#endif
 }
 
 
+#ifdef __APPLE__
 /*//////////////////////////////////////
 // Creates POSIX path string from FSRef
 /////////////////////////////////////*/
@@ -1077,23 +3117,110 @@ static OSStatus FSMakePath(FSRef fileRef, UInt8 *path, UInt32 maxPathSize)
 
     return ( result );
 }
+#endif
+
+/*//////////////////////////////////////
+// Returns type, creator and Finder flags
+// of a file or folder.  The flags are at
+// the same offset in FInfo and DInfo.
+/////////////////////////////////////*/
+static OSErr GetFinderInfo(const ItemRef *item, FinderInfoRec *finderInfo)
+{
+	MDIndexEntry	entry;
+	OSErr			err;
+
+	if (!useIndex)
+		return FetchFinderInfo(item, finderInfo);
+
+	err = GetIndexedInfo(item, &entry);
+	if (err == noErr)
+	{
+		finderInfo->type = entry.type;
+		finderInfo->creator = entry.creator;
+		finderInfo->flags = entry.flags;
+	}
+	return err;
+}
 
 /*//////////////////////////////////////
-// Returns directory info structure of 
-// file spec
+// Finder info, from the file system
 /////////////////////////////////////*/
-static OSErr GetDInfo(const FSRef *ref, DInfo *dInfo)
+static OSErr FetchFinderInfo(const ItemRef *item, FinderInfoRec *finderInfo)
 {
 	OSErr		err = noErr;
+	uint64_t	start = StatsBegin();
+
+	if (item->imageItem)
+	{
+		finderInfo->type = item->imageItem->type;
+		finderInfo->creator = item->imageItem->creator;
+		finderInfo->flags = item->imageItem->flags;
+		StatsEnd(STATS_FINDERINFO, start);
+		return noErr;
+	}
 	
+#ifdef __APPLE__
     FSCatalogInfo cinfo;
-    err = FSGetCatalogInfo(ref, kFSCatInfoFinderInfo, &cinfo, NULL, NULL, NULL);
+    err = FSGetCatalogInfo(&item->fsRef, kFSCatInfoFinderInfo, &cinfo, NULL, NULL, NULL);
     if (err == noErr) {
-        *dInfo = *(DInfo*)cinfo.finderInfo;
+        finderInfo->type = ((FInfo*)cinfo.finderInfo)->fdType;
+        finderInfo->creator = ((FInfo*)cinfo.finderInfo)->fdCreator;
+        finderInfo->flags = ((FInfo*)cinfo.finderInfo)->fdFlags;
     }
+#else
+    if (FIGetFinderInfo(item->dirFd, item->dirPath, item->name, finderInfo) == -1)
+        err = ioErr;
+#endif
+	StatsEnd(STATS_FINDERINFO, start);
 	return err;
 }
 
+/*//////////////////////////////////////
+// Everything the index keeps about an
+// item: what was recorded if the item's
+// ctime and size haven't changed since,
+// otherwise read now and recorded.
+/////////////////////////////////////*/
+static OSErr GetIndexedInfo(const ItemRef *item, MDIndexEntry *entry)
+{
+	FinderInfoRec	finderInfo;
+	ForkSizes		sizes;
+	OSErr			err;
+	uint64_t		start;
+	int				found;
+
+	start = StatsBegin();
+	found = MDIndexLookup(&item->st, entry);
+	StatsEnd(STATS_INDEX, start);
+	if (found)
+		return noErr;
+
+	memset(entry, 0, sizeof(*entry));
+
+	err = FetchFinderInfo(item, &finderInfo);
+	if (err != noErr)
+		return err;
+	entry->type = finderInfo.type;
+	entry->creator = finderInfo.creator;
+	entry->flags = finderInfo.flags;
+
+	/* folders have no forks */
+	if (!S_ISDIR(item->st.st_mode))
+	{
+		start = StatsBegin();
+		err = FetchForkSizes(item, &sizes, DISPLAY_FORK_BOTH);
+		StatsEnd(STATS_FORKSIZES, start);
+		if (err != noErr)
+			return err;
+		entry->dataPhysical = sizes.dataPhysical;
+		entry->rsrcLogical = sizes.rsrcLogical;
+		entry->rsrcPhysical = sizes.rsrcPhysical;
+	}
+
+	MDIndexStore(&item->st, entry);
+	return noErr;
+}
+
 /*//////////////////////////////////////
 // Checks bits 1-3 of fdFlags and frFlags
 // values in FInfo and DInfo structs
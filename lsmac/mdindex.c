@@ -0,0 +1,339 @@
+/*
+    mdindex.c - persistent index of Mac meta-data, keyed by (device, inode)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sysexits.h>
+#include <sys/mman.h>
+
+#include "mdindex.h"
+#include "inodetable.h"
+
+#define		MDINDEX_MAGIC		"LSMI"
+#define		MDINDEX_VERSION		1
+
+typedef struct MDIndexHeader
+{
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	entrySize;		/* catches files from a different build */
+	uint32_t	reserved;
+	uint64_t	count;
+} MDIndexHeader;
+
+/* an array of entries being collected for saving */
+typedef struct EntryList
+{
+	MDIndexEntry	*items;
+	size_t			count;
+	size_t			capacity;
+} EntryList;
+
+static void   GetCTime (const struct stat *st, int64_t *sec, int64_t *nsec);
+static int    CompareEntries (const void *a, const void *b);
+static void   CountEntry (uint64_t dev, uint64_t ino, void *value, void *refCon);
+static void   CollectEntry (uint64_t dev, uint64_t ino, void *value, void *refCon);
+static int    WriteAll (int fd, const void *buf, size_t len);
+
+static char					*gPath;
+static void					*gMap;			/* the index file, mapped */
+static size_t				gMapLen;
+static const MDIndexEntry	*gEntries;		/* sorted entries within the map */
+static size_t				gNumEntries;
+static InodeTable			*gRecorded;		/* entries recorded this run */
+
+/*//////////////////////////////////////
+// Map the index at path.  A missing file
+// is an empty index, to be created when
+// we save.  A file we don't understand is
+// ignored and will be overwritten.
+// Returns 0 on success, -1 and errno on error
+/////////////////////////////////////*/
+int MDIndexOpen (const char *path)
+{
+	MDIndexHeader	*header;
+	struct stat		st;
+	int				fd;
+
+	gPath = strdup(path);
+	gRecorded = InodeTableCreate(sizeof(MDIndexEntry));
+	if (!gPath)
+		return -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return (errno == ENOENT) ? 0 : -1;
+
+	if (fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size < (off_t)sizeof(MDIndexHeader))
+	{
+		close(fd);
+		return 0;
+	}
+
+	gMapLen = st.st_size;
+	gMap = mmap(NULL, gMapLen, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (gMap == MAP_FAILED)
+	{
+		gMap = NULL;
+		return -1;
+	}
+
+	header = gMap;
+	if (memcmp(header->magic, MDINDEX_MAGIC, 4) != 0 ||
+		header->version != MDINDEX_VERSION ||
+		header->entrySize != sizeof(MDIndexEntry) ||
+		header->count > (gMapLen - sizeof(MDIndexHeader)) / sizeof(MDIndexEntry))
+	{
+		munmap(gMap, gMapLen);
+		gMap = NULL;
+		return 0;
+	}
+
+	gEntries = (const MDIndexEntry *)((char *)gMap + sizeof(MDIndexHeader));
+	gNumEntries = header->count;
+
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Find an item's entry, if it is still
+// valid.  Safe to call from any thread.
+// Returns 1 if found
+/////////////////////////////////////*/
+int MDIndexLookup (const struct stat *st, MDIndexEntry *entry)
+{
+	const MDIndexEntry	*e = NULL;
+	int64_t				sec, nsec;
+	size_t				lo, hi, mid;
+
+	if (!gRecorded)
+		return 0;
+
+	if (InodeTableLookup(gRecorded, st->st_dev, st->st_ino, entry))
+		e = entry;
+	else
+	{
+		lo = 0;
+		hi = gNumEntries;
+		while (lo < hi)
+		{
+			mid = lo + (hi - lo) / 2;
+			if (gEntries[mid].dev < (uint64_t)st->st_dev ||
+				(gEntries[mid].dev == (uint64_t)st->st_dev && gEntries[mid].ino < (uint64_t)st->st_ino))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < gNumEntries && gEntries[lo].dev == (uint64_t)st->st_dev && gEntries[lo].ino == (uint64_t)st->st_ino)
+			e = &gEntries[lo];
+	}
+
+	if (!e)
+		return 0;
+
+	GetCTime(st, &sec, &nsec);
+	if (e->ctimeSec != sec || e->ctimeNsec != nsec || e->size != (uint64_t)st->st_size)
+		return 0;
+
+	if (e != entry)
+		*entry = *e;
+	return 1;
+}
+
+/*//////////////////////////////////////
+// Record the meta-data just read for an
+// item.  Fills in the key and validators
+// from st.  Safe to call from any thread.
+/////////////////////////////////////*/
+void MDIndexStore (const struct stat *st, MDIndexEntry *entry)
+{
+	if (!gRecorded || st->st_ino == 0)
+		return;
+
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	GetCTime(st, &entry->ctimeSec, &entry->ctimeNsec);
+	entry->size = st->st_size;
+	memset(entry->pad, 0, sizeof(entry->pad));
+
+	InodeTableInsert(gRecorded, entry->dev, entry->ino, entry);
+}
+
+/*//////////////////////////////////////
+// Write the mapped entries merged with
+// the recorded ones to a temporary file
+// and rename it over the index, so other
+// lsmac processes never see half of it.
+// Returns 0 on success, -1 and errno on error
+/////////////////////////////////////*/
+int MDIndexSave (void)
+{
+	EntryList		recorded = { NULL, 0, 0 };
+	MDIndexHeader	header;
+	MDIndexEntry	*merged;
+	char			*tmpPath;
+	size_t			i = 0, j = 0, n = 0;
+	int				fd, rc = -1;
+
+	if (!gRecorded)
+		return 0;
+
+	InodeTableApply(gRecorded, CountEntry, &recorded.capacity);
+
+	/* nothing changed, nothing to write */
+	if (recorded.capacity == 0)
+		return 0;
+
+	recorded.items = malloc(recorded.capacity * sizeof(MDIndexEntry));
+	merged = malloc((gNumEntries + recorded.capacity) * sizeof(MDIndexEntry));
+	tmpPath = malloc(strlen(gPath) + 32);
+	if (!recorded.items || !merged || !tmpPath)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	InodeTableApply(gRecorded, CollectEntry, &recorded);
+	qsort(recorded.items, recorded.count, sizeof(MDIndexEntry), CompareEntries);
+
+	/* both are sorted; a recorded entry replaces a mapped one */
+	while (i < gNumEntries || j < recorded.count)
+	{
+		if (j == recorded.count || (i < gNumEntries && CompareEntries(&gEntries[i], &recorded.items[j]) < 0))
+			merged[n++] = gEntries[i++];
+		else
+		{
+			if (i < gNumEntries && CompareEntries(&gEntries[i], &recorded.items[j]) == 0)
+				i++;
+			merged[n++] = recorded.items[j++];
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MDINDEX_MAGIC, 4);
+	header.version = MDINDEX_VERSION;
+	header.entrySize = sizeof(MDIndexEntry);
+	header.count = n;
+
+	sprintf(tmpPath, "%s.%ld", gPath, (long)getpid());
+	fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		goto done;
+
+	if (WriteAll(fd, &header, sizeof(header)) == -1 ||
+		WriteAll(fd, merged, n * sizeof(MDIndexEntry)) == -1 ||
+		close(fd) == -1 ||
+		rename(tmpPath, gPath) == -1)
+	{
+		int err = errno;
+		unlink(tmpPath);
+		errno = err;
+		goto done;
+	}
+	rc = 0;
+
+done:
+	free(recorded.items);
+	free(merged);
+	free(tmpPath);
+	return rc;
+}
+
+void MDIndexClose (void)
+{
+	if (gMap)
+		munmap(gMap, gMapLen);
+	gMap = NULL;
+	gEntries = NULL;
+	gNumEntries = 0;
+
+	InodeTableDispose(gRecorded);
+	gRecorded = NULL;
+	free(gPath);
+	gPath = NULL;
+}
+
+#pragma mark -
+
+static void GetCTime (const struct stat *st, int64_t *sec, int64_t *nsec)
+{
+#ifdef __APPLE__
+	*sec = st->st_ctimespec.tv_sec;
+	*nsec = st->st_ctimespec.tv_nsec;
+#else
+	*sec = st->st_ctim.tv_sec;
+	*nsec = st->st_ctim.tv_nsec;
+#endif
+}
+
+static int CompareEntries (const void *a, const void *b)
+{
+	const MDIndexEntry	*x = a;
+	const MDIndexEntry	*y = b;
+
+	if (x->dev != y->dev)
+		return (x->dev < y->dev) ? -1 : 1;
+	if (x->ino != y->ino)
+		return (x->ino < y->ino) ? -1 : 1;
+	return 0;
+}
+
+static void CountEntry (uint64_t dev, uint64_t ino, void *value, void *refCon)
+{
+	if (value)
+		(*(size_t *)refCon)++;
+}
+
+static void CollectEntry (uint64_t dev, uint64_t ino, void *value, void *refCon)
+{
+	EntryList	*list = refCon;
+
+	if (value && list->count < list->capacity)
+		list->items[list->count++] = *(MDIndexEntry *)value;
+}
+
+static int WriteAll (int fd, const void *buf, size_t len)
+{
+	const char	*p = buf;
+	ssize_t		n;
+
+	while (len)
+	{
+		n = write(fd, p, len);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+    mdindex.h - persistent index of Mac meta-data, keyed by (device, inode)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    The index file is a header followed by fixed size entries sorted by
+    (device, inode).  It is mapped read only and searched in place, so
+    looking an item up costs no system calls at all.  An entry is only
+    trusted if the item's ctime and size are still what they were when
+    it was recorded; changing an extended attribute updates the ctime.
+
+    Entries recorded during a run go into an in-memory table and are
+    merged with the mapped ones when the index is saved.  Entries for
+    items we didn't visit are kept, so listing part of a tree doesn't
+    throw away what is known about the rest of it.
+
+    The file is in host byte order; it is a cache, not an exchange format.
+*/
+
+#ifndef MDINDEX_H
+#define MDINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+typedef struct MDIndexEntry
+{
+	uint64_t	dev;
+	uint64_t	ino;
+	int64_t		ctimeSec;
+	int64_t		ctimeNsec;
+	uint64_t	size;			/* also the logical size of the data fork */
+	uint64_t	dataPhysical;
+	uint64_t	rsrcLogical;
+	uint64_t	rsrcPhysical;
+	uint32_t	type;
+	uint32_t	creator;
+	uint16_t	flags;
+	uint16_t	pad[3];
+} MDIndexEntry;
+
+int  MDIndexOpen (const char *path);
+int  MDIndexLookup (const struct stat *st, MDIndexEntry *entry);
+void MDIndexStore (const struct stat *st, MDIndexEntry *entry);
+int  MDIndexSave (void);
+void MDIndexClose (void);
+
+#endif /* MDINDEX_H */
@@ -0,0 +1,683 @@
+/*
+    output.c - machine readable output for lsmac
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sysexits.h>
+
+#include "output.h"
+#include "scan.h"
+#include "stats.h"
+
+#define		OUTPUT_VERSION		1
+#define		BYTE_ORDER_MARK		0x01020304
+
+/* the columns of the binary block being filled */
+typedef struct Block
+{
+	uint32_t	numRows;
+	uint32_t	maxRows;
+	uint64_t	*dataLogical;
+	uint64_t	*dataPhysical;
+	uint64_t	*rsrcLogical;
+	uint64_t	*rsrcPhysical;
+	int64_t		*items;
+	uint32_t	*type;
+	uint32_t	*creator;
+	uint32_t	*nameOffset;
+	uint32_t	*aliasOffset;
+	uint16_t	*flags;
+	uint8_t		*kind;
+	uint8_t		*label;
+	char		*heap;
+	size_t		heapLen;
+	size_t		heapCap;
+} Block;
+
+/* one per thread */
+typedef struct OutState
+{
+	char		*buf;
+	size_t		len;
+	size_t		cap;
+	int			capturing;		/* keep everything for the walker */
+	const char	*dirPath;
+	Block		block;
+} OutState;
+
+static OutState  *GetState (void);
+static void       Reserve (OutState *out, size_t n);
+static void       Append (OutState *out, const void *p, size_t n);
+static void       AppendString (OutState *out, const char *s);
+static void       AppendU64 (OutState *out, uint64_t n);
+static void       AppendI64 (OutState *out, int64_t n);
+static void       AppendPadded (OutState *out, const char *s, size_t len, int width);
+static void       AppendTenths (OutState *out, uint64_t size, int shift, int width);
+static void       AppendJSONString (OutState *out, const char *s, size_t len);
+static void       AppendOSType (OutState *out, uint32_t type);
+static void       NDJSONRow (OutState *out, const ListRow *row);
+static void       BlockStart (OutState *out);
+static void       BlockAddRow (OutState *out, const ListRow *row);
+static uint32_t   BlockAddString (Block *block, const char *s);
+static void       BlockEmit (OutState *out);
+static void      *ReallocOrDie (void *p, size_t size);
+
+static int					gFormat = OUTPUT_TEXT;
+static __thread OutState	*tOut;
+
+static const char	*kindNames[] = { "file", "folder", "symlink", "deleted" };
+
+/*//////////////////////////////////////
+// Format name for --format, -1 if we
+// don't know it
+/////////////////////////////////////*/
+int OutputParseFormat (const char *str)
+{
+	if (!strcmp(str, "text"))
+		return OUTPUT_TEXT;
+	if (!strcmp(str, "ndjson"))
+		return OUTPUT_NDJSON;
+	if (!strcmp(str, "binary"))
+		return OUTPUT_BINARY;
+	return -1;
+}
+
+/*//////////////////////////////////////
+// Choose the format, before any output
+/////////////////////////////////////*/
+void OutputInit (int format)
+{
+	OutState	*out;
+	uint32_t	header[3];
+
+	gFormat = format;
+	if (format != OUTPUT_BINARY)
+		return;
+
+	out = GetState();
+	Append(out, "LSMB", 4);
+	header[0] = OUTPUT_VERSION;
+	header[1] = BYTE_ORDER_MARK;
+	header[2] = 0;
+	Append(out, header, sizeof(header));
+}
+
+/*//////////////////////////////////////
+// Rows that follow are entries of dirPath,
+// which must stay valid until the matching
+// OutputEndDirectory
+/////////////////////////////////////*/
+void OutputBeginDirectory (const char *dirPath)
+{
+	OutState	*out = GetState();
+
+	out->dirPath = dirPath;
+	if (gFormat == OUTPUT_BINARY)
+		BlockStart(out);
+}
+
+void OutputRow (const ListRow *row)
+{
+	OutState	*out = GetState();
+
+	if (gFormat == OUTPUT_NDJSON)
+		NDJSONRow(out, row);
+	else if (gFormat == OUTPUT_BINARY)
+	{
+		/* rows without a directory, such as --top's, share one block */
+		if (!out->block.numRows && !out->block.heapLen)
+			BlockStart(out);
+		BlockAddRow(out, row);
+		if (out->block.numRows == OUTPUT_BLOCK_ROWS || out->block.heapLen >= OUTPUT_BLOCK_HEAP)
+		{
+			BlockEmit(out);
+			BlockStart(out);
+		}
+	}
+}
+
+void OutputEndDirectory (void)
+{
+	OutState	*out = GetState();
+
+	if (gFormat == OUTPUT_BINARY && out->block.numRows)
+		BlockEmit(out);
+	out->block.numRows = 0;
+	out->block.heapLen = 0;
+	out->dirPath = NULL;
+}
+
+/*//////////////////////////////////////
+// Collect this thread's output instead of
+// writing it, until OutputEndCapture hands
+// it over (to be freed by the caller)
+/////////////////////////////////////*/
+void OutputBeginCapture (void)
+{
+	OutState	*out = GetState();
+
+	OutputFlush();
+	out->capturing = 1;
+}
+
+void OutputEndCapture (char **out, size_t *outLen)
+{
+	OutState	*state = GetState();
+
+	*out = state->buf;
+	*outLen = state->len;
+	state->buf = NULL;
+	state->len = 0;
+	state->cap = 0;
+	state->capturing = 0;
+}
+
+/*//////////////////////////////////////
+// Write out what this thread has buffered.
+// stdio's buffer goes first, so anything
+// printed that way stays in order.
+/////////////////////////////////////*/
+void OutputFlush (void)
+{
+	OutState	*out = GetState();
+	const char	*p = out->buf;
+	size_t		len = out->len;
+	ssize_t		n;
+	uint64_t	start;
+
+	if (out->capturing || !len)
+		return;
+
+	fflush(stdout);
+	start = StatsBegin();
+	while (len)
+	{
+		n = write(STDOUT_FILENO, p, len);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("write(2)");
+			exit(EX_IOERR);
+		}
+		p += n;
+		len -= n;
+	}
+	StatsEnd(STATS_WRITE, start);
+	out->len = 0;
+}
+
+/*//////////////////////////////////////
+// --summary in ndjson: one total of a
+// group; text is laid out by lsmac.c
+/////////////////////////////////////*/
+void OutputTally (const char *group, const char *key, uint64_t count, uint64_t bytes)
+{
+	OutState	*out = GetState();
+
+	AppendString(out, "{\"group\":");
+	AppendJSONString(out, group, strlen(group));
+	AppendString(out, ",\"key\":");
+	AppendJSONString(out, key, strlen(key));
+	AppendString(out, ",\"count\":");
+	AppendU64(out, count);
+	AppendString(out, ",\"bytes\":");
+	AppendU64(out, bytes);
+	Append(out, "}\n", 2);
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Text output, for lsmac's own columns
+/////////////////////////////////////*/
+void OutputBytes (const char *p, size_t n)
+{
+	Append(GetState(), p, n);
+}
+
+void OutputString (const char *s)
+{
+	Append(GetState(), s, strlen(s));
+}
+
+void OutputChar (char c)
+{
+	OutState	*out = GetState();
+
+	Reserve(out, 1);
+	out->buf[out->len++] = c;
+}
+
+/* like %*s */
+void OutputPadded (const char *s, int width)
+{
+	AppendPadded(GetState(), s, strlen(s), width);
+}
+
+/* like %*lld */
+void OutputNumber (int64_t n, int width)
+{
+	char		digits[24];
+	uint64_t	u = (n < 0) ? (uint64_t)0 - (uint64_t)n : (uint64_t)n;
+	int			i = sizeof(digits);
+
+	do
+	{
+		digits[--i] = '0' + (u % 10);
+		u /= 10;
+	} while (u);
+	if (n < 0)
+		digits[--i] = '-';
+
+	AppendPadded(GetState(), digits + i, sizeof(digits) - i, width);
+}
+
+/*//////////////////////////////////////
+// The size column: "%15llu B" in bytes,
+// otherwise B, KB, MB or GB with one
+// decimal, KB being 2^10 bytes.  narrow
+// leaves out the leading blanks, as the
+// folder lines do.
+/////////////////////////////////////*/
+void OutputSize (uint64_t size, int inBytes, int narrow)
+{
+	OutState	*out = GetState();
+	int			pad = narrow ? 0 : OUTPUT_SIZE_NARROW;
+
+	if (inBytes)
+	{
+		OutputNumber((int64_t)size, 15 - (narrow ? OUTPUT_SIZE_NARROW : 0));
+		Append(out, " B", 2);
+		return;
+	}
+
+	Append(out, "   ", pad);
+	if (size < 1024)
+	{
+		OutputNumber((int64_t)size, 6);
+		Append(out, "  B", 3);
+	}
+	else if (size < 1048576)
+	{
+		AppendTenths(out, size, 10, 6);
+		Append(out, " KB", 3);
+	}
+	else if (size < 1073741824)
+	{
+		AppendTenths(out, size, 20, 6);
+		Append(out, " MB", 3);
+	}
+	else
+	{
+		AppendTenths(out, size, 30, 6);
+		Append(out, " GB", 3);
+	}
+}
+
+#pragma mark -
+
+static OutState *GetState (void)
+{
+	if (!tOut)
+	{
+		tOut = ReallocOrDie(NULL, sizeof(OutState));
+		memset(tOut, 0, sizeof(OutState));
+	}
+	return tOut;
+}
+
+/* room for n more bytes, writing out first if we're full */
+static void Reserve (OutState *out, size_t n)
+{
+	if (!out->capturing && out->len && out->len + n > OUTPUT_BUFFER_SIZE)
+		OutputFlush();
+
+	if (out->len + n > out->cap)
+	{
+		/* a captured directory is usually small */
+		if (!out->cap)
+			out->cap = out->capturing ? OUTPUT_CAPTURE_SIZE : OUTPUT_BUFFER_SIZE;
+		while (out->len + n > out->cap)
+			out->cap *= 2;
+		out->buf = ReallocOrDie(out->buf, out->cap);
+	}
+}
+
+static void Append (OutState *out, const void *p, size_t n)
+{
+	Reserve(out, n);
+	memcpy(out->buf + out->len, p, n);
+	out->len += n;
+}
+
+static void AppendString (OutState *out, const char *s)
+{
+	Append(out, s, strlen(s));
+}
+
+static void AppendU64 (OutState *out, uint64_t n)
+{
+	char	digits[20];
+	int		i = sizeof(digits);
+
+	do
+	{
+		digits[--i] = '0' + (n % 10);
+		n /= 10;
+	} while (n);
+
+	Append(out, digits + i, sizeof(digits) - i);
+}
+
+static void AppendI64 (OutState *out, int64_t n)
+{
+	if (n < 0)
+	{
+		Append(out, "-", 1);
+		AppendU64(out, (uint64_t)0 - (uint64_t)n);
+	}
+	else
+		AppendU64(out, (uint64_t)n);
+}
+
+static void AppendPadded (OutState *out, const char *s, size_t len, int width)
+{
+	while (width-- > (int)len)
+	{
+		Reserve(out, 1);
+		out->buf[out->len++] = ' ';
+	}
+	Append(out, s, len);
+}
+
+/*
+    size / 2^shift like "%*.1f" would print it.  The division is exact
+    in binary, so printf's round half to even is easy to match.
+*/
+static void AppendTenths (OutState *out, uint64_t size, int shift, int width)
+{
+	uint64_t	unit = (uint64_t)1 << shift;
+	uint64_t	whole = size >> shift;
+	uint64_t	rest = (size & (unit - 1)) * 10;
+	uint64_t	tenths = rest >> shift;
+	uint64_t	rem = rest & (unit - 1);
+	char		digits[24];
+	int			i = sizeof(digits);
+
+	if (rem > unit / 2 || (rem == unit / 2 && (tenths & 1)))
+	{
+		if (++tenths == 10)
+		{
+			tenths = 0;
+			whole++;
+		}
+	}
+
+	digits[--i] = '0' + (char)tenths;
+	digits[--i] = '.';
+	do
+	{
+		digits[--i] = '0' + (whole % 10);
+		whole /= 10;
+	} while (whole);
+
+	AppendPadded(out, digits + i, sizeof(digits) - i, width);
+}
+
+/* quoted, with what JSON can't take as is escaped */
+static void AppendJSONString (OutState *out, const char *s, size_t len)
+{
+	static const char	hex[] = "0123456789abcdef";
+	unsigned char		c;
+	char				*p;
+	size_t				i;
+
+	/* worst case every byte becomes \u00XX */
+	Reserve(out, len * 6 + 2);
+	p = out->buf + out->len;
+
+	*p++ = '"';
+	for (i = 0; i < len; i++)
+	{
+		c = (unsigned char)s[i];
+		if (c == '"' || c == '\\')
+		{
+			*p++ = '\\';
+			*p++ = c;
+		}
+		else if (c < 0x20)
+		{
+			*p++ = '\\';
+			*p++ = 'u';
+			*p++ = '0';
+			*p++ = '0';
+			*p++ = hex[c >> 4];
+			*p++ = hex[c & 0xF];
+		}
+		else
+			*p++ = c;
+	}
+	*p++ = '"';
+
+	out->len = p - out->buf;
+}
+
+/* the four characters of an OSType, or "" if it's not set */
+static void AppendOSType (OutState *out, uint32_t type)
+{
+	char	str[4];
+
+	str[0] = (char)(type >> 24);
+	str[1] = (char)(type >> 16);
+	str[2] = (char)(type >> 8);
+	str[3] = (char)type;
+	AppendJSONString(out, str, type ? 4 : 0);
+}
+
+static void NDJSONRow (OutState *out, const ListRow *row)
+{
+	long	i;
+
+	Append(out, "{", 1);
+	if (out->dirPath)
+	{
+		AppendString(out, "\"dir\":");
+		AppendJSONString(out, out->dirPath, strlen(out->dirPath));
+		Append(out, ",", 1);
+	}
+	AppendString(out, "\"name\":");
+	AppendJSONString(out, row->name, strlen(row->name));
+	AppendString(out, ",\"kind\":\"");
+	AppendString(out, kindNames[row->kind]);
+	Append(out, "\"", 1);
+
+	if (row->kind == ROW_DELETED)
+	{
+		Append(out, "}\n", 2);
+		return;
+	}
+
+	if (row->haveFinderInfo)
+	{
+		AppendString(out, ",\"flags\":");
+		AppendU64(out, row->flags);
+		AppendString(out, ",\"type\":");
+		AppendOSType(out, row->type);
+		AppendString(out, ",\"creator\":");
+		AppendOSType(out, row->creator);
+		AppendString(out, ",\"label\":");
+		AppendI64(out, row->label);
+	}
+
+	if (row->kind == ROW_FOLDER && row->items >= 0)
+	{
+		AppendString(out, ",\"items\":");
+		AppendI64(out, row->items);
+	}
+	if (row->dataLogical != OUTPUT_UNKNOWN_SIZE)
+	{
+		AppendString(out, ",\"dataLogical\":");
+		AppendU64(out, row->dataLogical);
+		AppendString(out, ",\"dataPhysical\":");
+		AppendU64(out, row->dataPhysical);
+		AppendString(out, ",\"rsrcLogical\":");
+		AppendU64(out, row->rsrcLogical);
+		AppendString(out, ",\"rsrcPhysical\":");
+		AppendU64(out, row->rsrcPhysical);
+	}
+	if (row->aliasTarget)
+	{
+		AppendString(out, ",\"aliasTarget\":");
+		AppendJSONString(out, row->aliasTarget, strlen(row->aliasTarget));
+	}
+	if (row->ranges)
+	{
+		AppendString(out, ",\"ranges\":[");
+		for (i = 0; i < row->numRanges; i++)
+		{
+			AppendString(out, i ? ",{\"offset\":" : "{\"offset\":");
+			AppendU64(out, row->ranges[i].offset);
+			AppendString(out, ",\"length\":");
+			AppendU64(out, row->ranges[i].length);
+			AppendString(out, row->ranges[i].isHole ? ",\"hole\":true}" : ",\"hole\":false}");
+		}
+		Append(out, "]", 1);
+	}
+
+	Append(out, "}\n", 2);
+}
+
+#pragma mark -
+
+/* an empty block whose heap starts with the directory */
+static void BlockStart (OutState *out)
+{
+	out->block.numRows = 0;
+	out->block.heapLen = 0;
+	BlockAddString(&out->block, out->dirPath ? out->dirPath : "");
+}
+
+static void BlockAddRow (OutState *out, const ListRow *row)
+{
+	Block		*b = &out->block;
+	uint32_t	i;
+
+	if (b->numRows == b->maxRows)
+	{
+		b->maxRows = b->maxRows ? b->maxRows * 2 : 1024;
+		b->dataLogical = ReallocOrDie(b->dataLogical, b->maxRows * sizeof(uint64_t));
+		b->dataPhysical = ReallocOrDie(b->dataPhysical, b->maxRows * sizeof(uint64_t));
+		b->rsrcLogical = ReallocOrDie(b->rsrcLogical, b->maxRows * sizeof(uint64_t));
+		b->rsrcPhysical = ReallocOrDie(b->rsrcPhysical, b->maxRows * sizeof(uint64_t));
+		b->items = ReallocOrDie(b->items, b->maxRows * sizeof(int64_t));
+		b->type = ReallocOrDie(b->type, b->maxRows * sizeof(uint32_t));
+		b->creator = ReallocOrDie(b->creator, b->maxRows * sizeof(uint32_t));
+		b->nameOffset = ReallocOrDie(b->nameOffset, b->maxRows * sizeof(uint32_t));
+		b->aliasOffset = ReallocOrDie(b->aliasOffset, b->maxRows * sizeof(uint32_t));
+		b->flags = ReallocOrDie(b->flags, b->maxRows * sizeof(uint16_t));
+		b->kind = ReallocOrDie(b->kind, b->maxRows);
+		b->label = ReallocOrDie(b->label, b->maxRows);
+	}
+
+	i = b->numRows++;
+	b->dataLogical[i] = row->dataLogical;
+	b->dataPhysical[i] = row->dataPhysical;
+	b->rsrcLogical[i] = row->rsrcLogical;
+	b->rsrcPhysical[i] = row->rsrcPhysical;
+	b->items[i] = (row->kind == ROW_FOLDER) ? row->items : -1;
+	b->type[i] = row->type;
+	b->creator[i] = row->creator;
+	b->nameOffset[i] = BlockAddString(b, row->name);
+	b->aliasOffset[i] = row->aliasTarget ? BlockAddString(b, row->aliasTarget) : OUTPUT_NO_ALIAS;
+	b->flags[i] = row->flags;
+	b->kind[i] = (uint8_t)row->kind;
+	b->label[i] = (uint8_t)row->label;
+}
+
+static uint32_t BlockAddString (Block *block, const char *s)
+{
+	size_t		len = strlen(s) + 1;
+	uint32_t	offset = (uint32_t)block->heapLen;
+
+	if (block->heapLen + len > block->heapCap)
+	{
+		block->heapCap = block->heapCap ? block->heapCap : 64 * 1024;
+		while (block->heapLen + len > block->heapCap)
+			block->heapCap *= 2;
+		block->heap = ReallocOrDie(block->heap, block->heapCap);
+	}
+	memcpy(block->heap + block->heapLen, s, len);
+	block->heapLen += len;
+	return offset;
+}
+
+/* the block header, the columns one after another, then the heap */
+static void BlockEmit (OutState *out)
+{
+	static const char	zeros[8] = { 0 };
+	Block				*b = &out->block;
+	uint32_t			header[3];
+	size_t				n = b->numRows;
+	size_t				columnBytes;
+	size_t				heapBytes;
+
+	columnBytes = n * (5 * sizeof(uint64_t) + 4 * sizeof(uint32_t) + sizeof(uint16_t) + 2);
+	heapBytes = (b->heapLen + 7) & ~(size_t)7;
+
+	header[0] = (uint32_t)n;
+	header[1] = (uint32_t)heapBytes;
+	header[2] = 0;
+
+	Reserve(out, 16 + columnBytes + 8 + heapBytes);
+	Append(out, "ROWS", 4);
+	Append(out, header, sizeof(header));
+	Append(out, b->dataLogical, n * sizeof(uint64_t));
+	Append(out, b->dataPhysical, n * sizeof(uint64_t));
+	Append(out, b->rsrcLogical, n * sizeof(uint64_t));
+	Append(out, b->rsrcPhysical, n * sizeof(uint64_t));
+	Append(out, b->items, n * sizeof(int64_t));
+	Append(out, b->type, n * sizeof(uint32_t));
+	Append(out, b->creator, n * sizeof(uint32_t));
+	Append(out, b->nameOffset, n * sizeof(uint32_t));
+	Append(out, b->aliasOffset, n * sizeof(uint32_t));
+	Append(out, b->flags, n * sizeof(uint16_t));
+	Append(out, b->kind, n);
+	Append(out, b->label, n);
+	Append(out, zeros, ((columnBytes + 7) & ~(size_t)7) - columnBytes);
+	Append(out, b->heap, b->heapLen);
+	Append(out, zeros, heapBytes - b->heapLen);
+
+	b->numRows = 0;
+	b->heapLen = 0;
+}
+
+static void *ReallocOrDie (void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (!p)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	return p;
+}
@@ -0,0 +1,132 @@
+/*
+    output.h - machine readable output for lsmac
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Everything lsmac lists goes through here.  Rows are formatted into a
+    large per thread buffer and written out with write(2) when it fills
+    up, or handed to the walker as a whole directory's output.  There is
+    no stdio and no allocation per row, and numbers and sizes are
+    formatted by hand rather than by printf.
+
+    text: lsmac.c lays out the columns itself with the Output* calls
+    below; OutputSize gives the size column the way "%15llu B" and
+    "   %6.1f KB" used to.
+
+    ndjson: one JSON object per entry, e.g.
+
+        {"dir":"/Volumes/Archive","name":"Read Me","kind":"file","flags":256,
+         "type":"TEXT","creator":"ttxt","label":0,"dataLogical":1003,
+         "dataPhysical":4096,"rsrcLogical":0,"rsrcPhysical":0}
+
+    --summary prints one object per total instead, e.g.
+
+        {"group":"type","key":"TEXT","count":1204,"bytes":50331648}
+
+    Folders have "items" and only have sizes with -c.  Whatever --columns
+    left out is left out here too, rather than fetched.  Names are bytes
+    as the file system has them; control characters, quotes and
+    backslashes are escaped.
+
+    binary: a stream header, then blocks of at most OUTPUT_BLOCK_ROWS
+    entries from one directory.  All integers are in the byte order of
+    the machine that wrote them, which the byteOrder field tells.
+
+        stream header   "LSMB", uint32 version, uint32 byteOrder (0x01020304), uint32 0
+        block header    "ROWS", uint32 numRows, uint32 heapSize, uint32 0
+        columns         uint64 dataLogical[n], dataPhysical[n], rsrcLogical[n], rsrcPhysical[n]
+                        int64  items[n]
+                        uint32 type[n], creator[n], nameOffset[n], aliasOffset[n]
+                        uint16 flags[n]
+                        uint8  kind[n], label[n]
+                        zero padding to a multiple of 8
+        heap            heapSize bytes of NUL terminated strings, padded to a multiple
+                        of 8; the directory's path is at offset 0
+
+    Unknown sizes are OUTPUT_UNKNOWN_SIZE, unknown item counts are -1 (and
+    always -1 for files), Finder info that wasn't fetched is zero, an
+    aliasOffset of OUTPUT_NO_ALIAS means no alias target.  kind is one of
+    the ROW_ constants below; a ROW_DELETED row has only its name, with
+    every size and count unknown.
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define		OUTPUT_TEXT				0
+#define		OUTPUT_NDJSON			1
+#define		OUTPUT_BINARY			2
+
+#define		OUTPUT_BUFFER_SIZE		(1024 * 1024)	/* written out when this full */
+#define		OUTPUT_CAPTURE_SIZE		(16 * 1024)		/* to start with, per directory */
+#define		OUTPUT_BLOCK_ROWS		65536
+#define		OUTPUT_BLOCK_HEAP		(4 * 1024 * 1024)
+
+#define		OUTPUT_UNKNOWN_SIZE		UINT64_MAX
+#define		OUTPUT_NO_ALIAS			UINT32_MAX
+
+#define		OUTPUT_SIZE_WIDTH		12		/* human readable, 17 in bytes */
+#define		OUTPUT_SIZE_NARROW		3		/* folder columns leave out this much */
+
+#define		ROW_FILE				0
+#define		ROW_FOLDER				1
+#define		ROW_SYMLINK				2
+#define		ROW_DELETED				3		/* --watch: the entry is gone */
+
+struct ScanRange;
+
+typedef struct ListRow
+{
+	const char	*name;
+	const char	*aliasTarget;	/* NULL unless a resolved alias */
+	const struct ScanRange	*ranges;	/* --holes: data and holes, NULL unless sparse */
+	long		numRanges;
+	int			kind;
+	int			haveFinderInfo;	/* flags, type, creator and label are set */
+	uint16_t	flags;
+	uint32_t	type;
+	uint32_t	creator;
+	int			label;
+	int64_t		items;
+	uint64_t	dataLogical;
+	uint64_t	dataPhysical;
+	uint64_t	rsrcLogical;
+	uint64_t	rsrcPhysical;
+} ListRow;
+
+int  OutputParseFormat (const char *str);
+void OutputInit (int format);
+void OutputBeginDirectory (const char *dirPath);
+void OutputRow (const ListRow *row);
+void OutputEndDirectory (void);
+void OutputBeginCapture (void);
+void OutputEndCapture (char **out, size_t *outLen);
+void OutputFlush (void);
+void OutputTally (const char *group, const char *key, uint64_t count, uint64_t bytes);
+
+void OutputBytes (const char *p, size_t n);
+void OutputString (const char *s);
+void OutputChar (char c);
+void OutputPadded (const char *s, int width);
+void OutputNumber (int64_t n, int width);
+void OutputSize (uint64_t size, int inBytes, int narrow);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,213 @@
+/*
+    rank.c - keep the N largest of a stream of entries
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <pthread.h>
+
+#include "rank.h"
+
+/* one per thread that added something */
+typedef struct RankHeap
+{
+	RankEntry			*entries;		/* entries[0] ranks lowest */
+	long				count;
+	struct RankHeap		*next;
+} RankHeap;
+
+static int    Above (const RankEntry *a, const RankEntry *b);
+static void   SiftDown (RankHeap *heap, long i);
+static void   SiftUp (RankHeap *heap, long i);
+static int    CompareDescending (const void *a, const void *b);
+static void  *AllocOrDie (void *p);
+
+static long					gMax;
+static RankCompareProc		gCompare;
+
+static pthread_mutex_t		gLock = PTHREAD_MUTEX_INITIALIZER;
+static RankHeap				*gHeaps;		/* every thread's */
+static __thread RankHeap	*tHeap;
+
+/*//////////////////////////////////////
+// Keep the n highest ranking entries
+/////////////////////////////////////*/
+void RankInit (long n, RankCompareProc compare)
+{
+	gMax = n;
+	gCompare = compare;
+}
+
+/*//////////////////////////////////////
+// Would an entry with this key get into
+// this thread's heap?  Lets the caller
+// skip putting together its data
+/////////////////////////////////////*/
+int RankWants (uint64_t key)
+{
+	RankHeap	*heap = tHeap;
+
+	if (gMax <= 0)
+		return 0;
+	return !heap || heap->count < gMax || key >= heap->entries[0].key;
+}
+
+/*//////////////////////////////////////
+// Offer an entry to this thread's heap,
+// which keeps data or frees it
+/////////////////////////////////////*/
+void RankAdd (uint64_t key, void *data)
+{
+	RankHeap	*heap = tHeap;
+	RankEntry	entry;
+
+	if (!heap)
+	{
+		heap = AllocOrDie(calloc(1, sizeof(RankHeap)));
+		heap->entries = AllocOrDie(malloc(gMax * sizeof(RankEntry)));
+		pthread_mutex_lock(&gLock);
+		heap->next = gHeaps;
+		gHeaps = heap;
+		pthread_mutex_unlock(&gLock);
+		tHeap = heap;
+	}
+
+	entry.key = key;
+	entry.data = data;
+
+	if (heap->count < gMax)
+	{
+		heap->entries[heap->count] = entry;
+		SiftUp(heap, heap->count++);
+	}
+	else if (Above(&entry, &heap->entries[0]))
+	{
+		free(heap->entries[0].data);
+		heap->entries[0] = entry;
+		SiftDown(heap, 0);
+	}
+	else
+		free(data);
+}
+
+/*//////////////////////////////////////
+// Merge the heaps once nothing is added
+// any more.  Hands back the highest
+// ranking entries, highest first, to be
+// freed by the caller; returns how many
+/////////////////////////////////////*/
+long RankCollect (RankEntry **entries)
+{
+	RankEntry	*all;
+	RankHeap	*heap, *next;
+	long		count = 0;
+	long		i;
+
+	for (heap = gHeaps; heap; heap = heap->next)
+		count += heap->count;
+
+	all = AllocOrDie(malloc((count + 1) * sizeof(RankEntry)));
+	count = 0;
+	for (heap = gHeaps; heap; heap = next)
+	{
+		next = heap->next;
+		for (i = 0; i < heap->count; i++)
+			all[count++] = heap->entries[i];
+		free(heap->entries);
+		free(heap);
+	}
+	gHeaps = NULL;
+	tHeap = NULL;
+
+	qsort(all, count, sizeof(RankEntry), CompareDescending);
+	for (i = gMax; i < count; i++)
+		free(all[i].data);
+
+	*entries = all;
+	return (count < gMax) ? count : gMax;
+}
+
+#pragma mark -
+
+static int Above (const RankEntry *a, const RankEntry *b)
+{
+	if (a->key != b->key)
+		return a->key > b->key;
+	return gCompare(a->data, b->data) > 0;
+}
+
+static void SiftDown (RankHeap *heap, long i)
+{
+	RankEntry	*e = heap->entries;
+	RankEntry	tmp;
+	long		lowest, child;
+
+	for (;;)
+	{
+		lowest = i;
+		child = 2 * i + 1;
+		if (child < heap->count && Above(&e[lowest], &e[child]))
+			lowest = child;
+		if (child + 1 < heap->count && Above(&e[lowest], &e[child + 1]))
+			lowest = child + 1;
+		if (lowest == i)
+			return;
+		tmp = e[i];
+		e[i] = e[lowest];
+		e[lowest] = tmp;
+		i = lowest;
+	}
+}
+
+static void SiftUp (RankHeap *heap, long i)
+{
+	RankEntry	*e = heap->entries;
+	RankEntry	tmp;
+	long		parent;
+
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (!Above(&e[parent], &e[i]))
+			return;
+		tmp = e[i];
+		e[i] = e[parent];
+		e[parent] = tmp;
+		i = parent;
+	}
+}
+
+static int CompareDescending (const void *a, const void *b)
+{
+	if (Above(a, b))
+		return -1;
+	if (Above(b, a))
+		return 1;
+	return 0;
+}
+
+static void *AllocOrDie (void *p)
+{
+	if (!p)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	return p;
+}
@@ -0,0 +1,51 @@
+/*
+    rank.h - keep the N largest of a stream of entries
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Each thread keeps a min-heap of at most N entries, so adding one is
+    a comparison with the smallest kept so far and, if it gets in, a
+    sift down; nothing is locked.  RankCollect merges the heaps once all
+    the threads are done.  Memory is N entries per thread, however many
+    are offered.
+
+    An entry is a key and a block of caller data, which the heap owns
+    once added.  Equal keys are ordered with the caller's compare proc,
+    so that which of them make the cut doesn't depend on thread timing.
+*/
+
+#ifndef RANK_H
+#define RANK_H
+
+#include <stdint.h>
+
+typedef struct RankEntry
+{
+	uint64_t	key;
+	void		*data;		/* malloc'd */
+} RankEntry;
+
+/* > 0 if a ranks above b */
+typedef int (*RankCompareProc) (const void *a, const void *b);
+
+void RankInit (long n, RankCompareProc compare);
+int  RankWants (uint64_t key);
+void RankAdd (uint64_t key, void *data);
+long RankCollect (RankEntry **entries);
+
+#endif /* RANK_H */
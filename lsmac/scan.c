@@ -0,0 +1,521 @@
+/*
+    scan.c - batched, directory-relative directory scanning
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include "scan.h"
+#include "stats.h"
+
+#ifdef __linux__
+/* the kernel's record, glibc doesn't export it */
+struct linux_dirent64
+{
+	uint64_t		d_ino;
+	int64_t			d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char			d_name[];
+};
+#endif
+
+static int  StatAt (int dirFd, const char *name, struct stat *st);
+static long SeekRanges (int fd, uint64_t size, ScanRange *ranges);
+#ifdef __linux__
+static long FiemapRanges (int fd, uint64_t size, ScanRange *ranges);
+#endif
+static long AddRange (ScanRange *ranges, long n, uint64_t offset, uint64_t end, int isHole, uint64_t size);
+static int  RangesFull (const ScanRange *ranges, long n, uint64_t size);
+
+/*//////////////////////////////////////
+// Open a directory relative to atFd
+// (AT_FDCWD for plain paths)
+// Returns 0 on success, -1 and errno on error
+/////////////////////////////////////*/
+int ScanOpenDir (DirScan *scan, int atFd, const char *path)
+{
+	scan->fd = openat(atFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (scan->fd == -1)
+		return -1;
+
+#ifdef __linux__
+	scan->buf = malloc(SCAN_BUFFER_SIZE);
+	if (!scan->buf)
+	{
+		close(scan->fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	scan->bufPos = 0;
+	scan->bufLen = 0;
+#else
+	scan->dir = fdopendir(scan->fd);
+	if (!scan->dir)
+	{
+		close(scan->fd);
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Get the next entry of the directory,
+// refilling the buffer when it runs dry
+// Returns 1 for an entry, 0 at the end,
+// -1 and errno on error
+/////////////////////////////////////*/
+int ScanNextEntry (DirScan *scan, ScanEntry *entry)
+{
+#ifdef __linux__
+	struct linux_dirent64	*d;
+	long					n;
+	uint64_t				start;
+
+	if (scan->bufPos >= scan->bufLen)
+	{
+		start = StatsBegin();
+		n = syscall(SYS_getdents64, scan->fd, scan->buf, SCAN_BUFFER_SIZE);
+		StatsEnd(STATS_READDIR, start);
+		if (n <= 0)
+			return (int)n;
+
+		scan->bufLen = n;
+		scan->bufPos = 0;
+	}
+
+	d = (struct linux_dirent64 *)(scan->buf + scan->bufPos);
+	scan->bufPos += d->d_reclen;
+
+	entry->name = d->d_name;
+	entry->ino = d->d_ino;
+	entry->type = d->d_type;
+	return 1;
+#else
+	struct dirent	*d;
+	uint64_t		start;
+
+	errno = 0;
+	start = StatsBegin();
+	d = readdir(scan->dir);
+	StatsEnd(STATS_READDIR, start);
+	if (!d)
+		return errno ? -1 : 0;
+
+	entry->name = d->d_name;
+	entry->ino = d->d_ino;
+#ifdef DT_UNKNOWN
+	entry->type = d->d_type;
+#else
+	entry->type = 0;
+#endif
+	return 1;
+#endif
+}
+
+/*//////////////////////////////////////
+// Close directory and release its buffer
+/////////////////////////////////////*/
+void ScanCloseDir (DirScan *scan)
+{
+#ifdef __linux__
+	free(scan->buf);
+	scan->buf = NULL;
+	if (close(scan->fd) == -1)
+		perror("close(2)");
+#else
+	if (closedir(scan->dir) == -1)
+		perror("closedir(3)");
+#endif
+	scan->fd = -1;
+}
+
+/*//////////////////////////////////////
+// Count the entries of a directory, not
+// counting . and .., without stat'ing any
+// of them.  On Linux this is a bare
+// getdents64 loop over a buffer on the
+// stack, so it costs no allocation either.
+// Returns the count, -1 and errno on error
+/////////////////////////////////////*/
+long ScanCountEntries (int atFd, const char *path)
+{
+#ifdef __linux__
+	char					buf[SCAN_COUNT_BUFFER_SIZE] __attribute__((aligned(8)));
+	struct linux_dirent64	*d;
+	long					count = 0;
+	long					n, pos;
+	int						fd, err;
+	uint64_t				start;
+
+	fd = openat(atFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	start = StatsBegin();
+	while ( (n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0 )
+	{
+		for (pos = 0; pos < n; pos += d->d_reclen)
+		{
+			d = (struct linux_dirent64 *)(buf + pos);
+			if (d->d_name[0] == '.' && (!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2])))
+				continue;
+			count++;
+		}
+	}
+	StatsEnd(STATS_READDIR, start);
+
+	err = errno;
+	close(fd);
+	if (n == -1)
+	{
+		errno = err;
+		return -1;
+	}
+	return count;
+#else
+	DirScan		scan;
+	ScanEntry	entry;
+	long		count = 0;
+	int			rc;
+
+	if (ScanOpenDir(&scan, atFd, path) == -1)
+		return -1;
+
+	while ( (rc = ScanNextEntry(&scan, &entry)) == 1 )
+	{
+		if (entry.name[0] == '.' && (!entry.name[1] || (entry.name[1] == '.' && !entry.name[2])))
+			continue;
+		count++;
+	}
+
+	ScanCloseDir(&scan);
+	return (rc == -1) ? -1 : count;
+#endif
+}
+
+/*//////////////////////////////////////
+// Stat a directory entry without following
+// symlinks.  statx only asks for the fields
+// we use, which saves work on network
+// filesystems.
+/////////////////////////////////////*/
+int ScanStatAt (int dirFd, const char *name, struct stat *st)
+{
+	uint64_t	start = StatsBegin();
+	int			rc;
+
+	rc = StatAt(dirFd, name, st);
+	StatsEnd(STATS_STAT, start);
+	return rc;
+}
+
+/*//////////////////////////////////////
+// Call proc for every extent of a regular
+// file that is shared with other files.
+// Returns 0 on success, -1 and errno on
+// error, EOPNOTSUPP if the file system
+// can't tell
+/////////////////////////////////////*/
+int ScanSharedExtents (int dirFd, const char *name, ScanExtentProc proc, void *refCon)
+{
+#if defined(__linux__) && defined(FS_IOC_FIEMAP)
+	union
+	{
+		struct fiemap	map;
+		char			space[sizeof(struct fiemap) + SCAN_EXTENT_BATCH * sizeof(struct fiemap_extent)];
+	}						buf;
+	struct fiemap			*map = &buf.map;
+	struct fiemap_extent	*ext;
+	uint64_t				start = 0;
+	unsigned				i;
+	int						fd, err;
+	int						last = 0;
+
+	fd = openat(dirFd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	while (!last)
+	{
+		memset(map, 0, sizeof(struct fiemap));
+		map->fm_start = start;
+		map->fm_length = FIEMAP_MAX_OFFSET - start;
+		map->fm_extent_count = SCAN_EXTENT_BATCH;
+
+		if (ioctl(fd, FS_IOC_FIEMAP, map) == -1)
+		{
+			err = (errno == ENOTTY) ? EOPNOTSUPP : errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		if (map->fm_mapped_extents == 0)
+			break;
+
+		for (i = 0; i < map->fm_mapped_extents; i++)
+		{
+			ext = &map->fm_extents[i];
+			if ((ext->fe_flags & FIEMAP_EXTENT_SHARED) && !(ext->fe_flags & FIEMAP_EXTENT_UNKNOWN))
+				proc(ext->fe_physical, ext->fe_length, refCon);
+			if (ext->fe_flags & FIEMAP_EXTENT_LAST)
+				last = 1;
+		}
+		start = ext->fe_logical + ext->fe_length;
+	}
+
+	close(fd);
+	return 0;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+/*//////////////////////////////////////
+// The data and holes of a regular file
+// of the given size, in order, in a list
+// to be freed by the caller.  Returns the
+// number of ranges, -1 and errno on error,
+// EOPNOTSUPP if the file system can't tell
+/////////////////////////////////////*/
+long ScanFileRanges (int dirFd, const char *name, uint64_t size, ScanRange **ranges)
+{
+	ScanRange	*list;
+	long		n;
+	int			fd, err;
+
+	fd = openat(dirFd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	list = malloc(SCAN_MAX_RANGES * sizeof(ScanRange));
+	if (!list)
+	{
+		close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	n = SeekRanges(fd, size, list);
+#ifdef __linux__
+	if (n == -1 && errno == EOPNOTSUPP)
+		n = FiemapRanges(fd, size, list);
+#endif
+
+	err = errno;
+	close(fd);
+	if (n == -1)
+	{
+		free(list);
+		errno = err;
+		return -1;
+	}
+	*ranges = list;
+	return n;
+}
+
+#pragma mark -
+
+/* ScanFileRanges with SEEK_DATA and SEEK_HOLE */
+static long SeekRanges (int fd, uint64_t size, ScanRange *ranges)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	off_t	data, hole;
+	off_t	pos = 0;
+	long	n = 0;
+
+	while ((uint64_t)pos < size)
+	{
+		data = lseek(fd, pos, SEEK_DATA);
+		if (data == -1)
+		{
+			/* nothing but hole from here on */
+			if (errno == ENXIO)
+				return AddRange(ranges, n, pos, size, 1, size);
+			if (errno == EINVAL && pos == 0)
+				errno = EOPNOTSUPP;
+			return -1;
+		}
+		if (data > pos)
+			n = AddRange(ranges, n, pos, data, 1, size);
+		if (RangesFull(ranges, n, size))
+			return n;
+
+		hole = lseek(fd, data, SEEK_HOLE);
+		if (hole == -1)
+			return -1;
+		n = AddRange(ranges, n, data, hole, 0, size);
+		if (RangesFull(ranges, n, size))
+			return n;
+		pos = hole;
+	}
+	return n;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+#ifdef __linux__
+/* ScanFileRanges with FIEMAP: the extents are the data */
+static long FiemapRanges (int fd, uint64_t size, ScanRange *ranges)
+{
+#ifdef FS_IOC_FIEMAP
+	union
+	{
+		struct fiemap	map;
+		char			space[sizeof(struct fiemap) + SCAN_EXTENT_BATCH * sizeof(struct fiemap_extent)];
+	}						buf;
+	struct fiemap			*map = &buf.map;
+	struct fiemap_extent	*ext = NULL;
+	uint64_t				pos = 0;
+	unsigned				i;
+	long					n = 0;
+	int						last = 0;
+
+	while (!last && pos < size)
+	{
+		memset(map, 0, sizeof(struct fiemap));
+		map->fm_start = pos;
+		map->fm_length = FIEMAP_MAX_OFFSET - pos;
+		map->fm_extent_count = SCAN_EXTENT_BATCH;
+
+		if (ioctl(fd, FS_IOC_FIEMAP, map) == -1)
+		{
+			if (errno == ENOTTY)
+				errno = EOPNOTSUPP;
+			return -1;
+		}
+		if (map->fm_mapped_extents == 0)
+			break;
+
+		for (i = 0; i < map->fm_mapped_extents; i++)
+		{
+			ext = &map->fm_extents[i];
+			if (ext->fe_logical > pos)
+				n = AddRange(ranges, n, pos, ext->fe_logical, 1, size);
+			n = AddRange(ranges, n, ext->fe_logical, ext->fe_logical + ext->fe_length, 0, size);
+			if (RangesFull(ranges, n, size))
+				return n;
+			pos = ext->fe_logical + ext->fe_length;
+			if (ext->fe_flags & FIEMAP_EXTENT_LAST)
+				last = 1;
+		}
+	}
+	if (pos < size)
+		n = AddRange(ranges, n, pos, size, 1, size);
+	return n;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+#endif
+
+/*//////////////////////////////////////
+// Append offset..end, clipped to the file
+// size and merged with the range before
+// if it's of the same kind.  A list that
+// is full has its last range stretched to
+// the end of the file instead, as data.
+// Returns the new number of ranges
+/////////////////////////////////////*/
+static long AddRange (ScanRange *ranges, long n, uint64_t offset, uint64_t end, int isHole, uint64_t size)
+{
+	if (end > size)
+		end = size;
+	if (end <= offset)
+		return n;
+
+	if (n && ranges[n - 1].isHole == isHole && ranges[n - 1].offset + ranges[n - 1].length == offset)
+	{
+		ranges[n - 1].length = end - ranges[n - 1].offset;
+		return n;
+	}
+	if (n == SCAN_MAX_RANGES)
+	{
+		ranges[n - 1].length = size - ranges[n - 1].offset;
+		ranges[n - 1].isHole = 0;
+		return n;
+	}
+
+	ranges[n].offset = offset;
+	ranges[n].length = end - offset;
+	ranges[n].isHole = isHole;
+	return n + 1;
+}
+
+/* full, with the last range stretched to the end: there's no more to add */
+static int RangesFull (const ScanRange *ranges, long n, uint64_t size)
+{
+	return n == SCAN_MAX_RANGES && ranges[n - 1].offset + ranges[n - 1].length == size;
+}
+
+/* ScanStatAt, untimed */
+static int StatAt (int dirFd, const char *name, struct stat *st)
+{
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+	struct statx	stx;
+
+	if (statx(dirFd, name, AT_SYMLINK_NOFOLLOW,
+			  STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_BLOCKS | STATX_CTIME | STATX_MTIME,
+			  &stx) == -1)
+	{
+		/* kernels before 4.11 */
+		if (errno == ENOSYS)
+			return fstatat(dirFd, name, st, AT_SYMLINK_NOFOLLOW);
+		return -1;
+	}
+
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	st->st_ino = stx.stx_ino;
+	st->st_mode = stx.stx_mode;
+	st->st_nlink = stx.stx_nlink;
+	st->st_uid = stx.stx_uid;
+	st->st_gid = stx.stx_gid;
+	st->st_size = stx.stx_size;
+	st->st_blocks = stx.stx_blocks;
+	st->st_blksize = stx.stx_blksize;
+	st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+	st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+	return 0;
+#else
+	return fstatat(dirFd, name, st, AT_SYMLINK_NOFOLLOW);
+#endif
+}
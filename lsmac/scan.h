@@ -0,0 +1,89 @@
+/*
+    scan.h - batched, directory-relative directory scanning
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    On Linux a directory is read with getdents64 into one large buffer,
+    so a directory of a million entries costs a few dozen system calls,
+    and entries are stat'ed with statx relative to the directory fd.
+    Elsewhere we fall back on fdopendir/readdir and fstatat.
+
+    Extents a file shares with other files come from the FIEMAP ioctl,
+    which btrfs, XFS, ext4 and others support; elsewhere, or on file
+    systems that don't, ScanSharedExtents fails with EOPNOTSUPP.
+
+    The data and holes of a sparse file come from lseek SEEK_DATA and
+    SEEK_HOLE, which Linux, Mac OS X 10.8 and later and the BSDs have;
+    on Linux file systems without them we try FIEMAP, whose gaps are
+    the holes.
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define		SCAN_BUFFER_SIZE		(256 * 1024)
+#define		SCAN_COUNT_BUFFER_SIZE	(32 * 1024)		/* on the stack */
+#define		SCAN_EXTENT_BATCH		64				/* extents per FIEMAP call */
+#define		SCAN_MAX_RANGES			4096			/* past this, the rest is one range */
+
+typedef struct DirScan
+{
+	int			fd;
+#ifdef __linux__
+	char		*buf;
+	long		bufPos;
+	long		bufLen;
+#else
+	DIR			*dir;
+#endif
+} DirScan;
+
+typedef struct ScanEntry
+{
+	const char		*name;		/* valid until the next ScanNextEntry */
+	uint64_t		ino;
+	unsigned char	type;		/* DT_* constant, DT_UNKNOWN if the fs won't say */
+} ScanEntry;
+
+/* a stretch of a file, written or not */
+typedef struct ScanRange
+{
+	uint64_t		offset;
+	uint64_t		length;
+	int				isHole;
+} ScanRange;
+
+int  ScanOpenDir (DirScan *scan, int atFd, const char *path);
+int  ScanNextEntry (DirScan *scan, ScanEntry *entry);
+void ScanCloseDir (DirScan *scan);
+long ScanCountEntries (int atFd, const char *path);
+
+int  ScanStatAt (int dirFd, const char *name, struct stat *st);
+
+/* called for each extent of a file that it shares with others (reflinks, clones) */
+typedef void (*ScanExtentProc) (uint64_t physical, uint64_t length, void *refCon);
+
+int  ScanSharedExtents (int dirFd, const char *name, ScanExtentProc proc, void *refCon);
+long ScanFileRanges (int dirFd, const char *name, uint64_t size, ScanRange **ranges);
+
+#endif /* SCAN_H */
@@ -0,0 +1,201 @@
+/*
+    stats.c - per-phase counters and timers, for lsmac --stats
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "stats.h"
+#include "trace.h"
+
+/* one per thread that recorded something */
+typedef struct Counters
+{
+	uint64_t			calls[STATS_NUM_PHASES];
+	uint64_t			nanos[STATS_NUM_PHASES];
+	uint64_t			items;
+	struct Counters		*next;
+} Counters;
+
+static Counters  *GetCounters (void);
+
+static const char	*gPhaseNames[STATS_NUM_PHASES] =
+{
+	"readdir", "stat", "makeref", "finderinfo", "forksizes",
+	"index", "extents", "alias", "format", "write"
+};
+
+#define		TRACE_SPAN		1			/* a span each */
+#define		TRACE_SUM		2			/* done for every file, summed per directory */
+
+/* the phases slow enough to be worth tracing */
+static const char	gPhaseTraced[STATS_NUM_PHASES] =
+{
+	0, 0, TRACE_SUM, TRACE_SUM, TRACE_SUM,
+	0, TRACE_SUM, TRACE_SUM, 0, TRACE_SPAN
+};
+
+int							gStatsMode = STATS_OFF;
+static uint64_t				gStart;
+
+static pthread_mutex_t		gLock = PTHREAD_MUTEX_INITIALIZER;
+static Counters				*gCounters;		/* every thread's */
+static __thread Counters	*tCounters;
+
+/*//////////////////////////////////////
+// Start counting, STATS_TEXT or STATS_JSON,
+// or reading the clock for STATS_TRACE
+/////////////////////////////////////*/
+void StatsInit (int mode)
+{
+	if (!gStatsMode)
+		gStart = StatsNow();
+	gStatsMode |= mode;
+}
+
+/*//////////////////////////////////////
+// Monotonic clock, in nanoseconds
+/////////////////////////////////////*/
+uint64_t StatsNow (void)
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t	timebase;
+
+	if (!timebase.denom)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*//////////////////////////////////////
+// One call of a phase, begun at start;
+// use StatsEnd, which checks it's on
+/////////////////////////////////////*/
+void StatsAdd (int phase, uint64_t start)
+{
+	Counters	*counters;
+
+	if (gTracing && gPhaseTraced[phase] == TRACE_SPAN)
+		TraceSpan(gPhaseNames[phase], NULL, start);
+	else if (gTracing && gPhaseTraced[phase] == TRACE_SUM)
+		TraceSum(gPhaseNames[phase], start);
+	if (!(gStatsMode & (STATS_TEXT | STATS_JSON)))
+		return;
+
+	counters = GetCounters();
+	counters->calls[phase]++;
+	counters->nanos[phase] += StatsNow() - start;
+}
+
+/* one more entry looked at; use StatsItem */
+void StatsAddItem (void)
+{
+	if (gStatsMode & (STATS_TEXT | STATS_JSON))
+		GetCounters()->items++;
+}
+
+/*//////////////////////////////////////
+// Add up every thread's counters and
+// print them on stderr, as a table or a
+// line of JSON.  Meant for atexit, once
+// the threads are done.
+/////////////////////////////////////*/
+void StatsPrint (void)
+{
+	Counters	total = { { 0 } };
+	Counters	*counters;
+	double		wall;
+	long		threads = 0;
+	int			i;
+
+	if (!(gStatsMode & (STATS_TEXT | STATS_JSON)))
+		return;
+	wall = (StatsNow() - gStart) / 1e9;
+
+	pthread_mutex_lock(&gLock);
+	for (counters = gCounters; counters; counters = counters->next)
+	{
+		for (i = 0; i < STATS_NUM_PHASES; i++)
+		{
+			total.calls[i] += counters->calls[i];
+			total.nanos[i] += counters->nanos[i];
+		}
+		total.items += counters->items;
+		threads++;
+	}
+	pthread_mutex_unlock(&gLock);
+
+	if (gStatsMode & STATS_JSON)
+	{
+		fprintf(stderr, "{\"items\":%llu,\"seconds\":%.6f,\"threads\":%ld,\"phases\":{",
+				(unsigned long long)total.items, wall, threads);
+		for (i = 0; i < STATS_NUM_PHASES; i++)
+			fprintf(stderr, "%s\"%s\":{\"calls\":%llu,\"seconds\":%.6f}", i ? "," : "",
+					gPhaseNames[i], (unsigned long long)total.calls[i], total.nanos[i] / 1e9);
+		fprintf(stderr, "}}\n");
+		return;
+	}
+
+	fprintf(stderr, "%llu items in %.3f s, %ld threads; phase times are summed over the threads\n",
+			(unsigned long long)total.items, wall, threads);
+	fprintf(stderr, "%-12s %10s %10s %10s %10s\n", "phase", "calls", "seconds", "us/call", "us/item");
+	for (i = 0; i < STATS_NUM_PHASES; i++)
+	{
+		if (!total.calls[i])
+			continue;
+		fprintf(stderr, "%-12s %10llu %10.3f %10.2f %10.2f\n", gPhaseNames[i],
+				(unsigned long long)total.calls[i], total.nanos[i] / 1e9,
+				total.nanos[i] / 1e3 / total.calls[i],
+				total.items ? total.nanos[i] / 1e3 / total.items : 0.0);
+	}
+}
+
+#pragma mark -
+
+/* this thread's, registered the first time */
+static Counters *GetCounters (void)
+{
+	Counters	*counters = tCounters;
+
+	if (counters)
+		return counters;
+
+	counters = calloc(1, sizeof(Counters));
+	if (!counters)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	pthread_mutex_lock(&gLock);
+	counters->next = gCounters;
+	gCounters = counters;
+	pthread_mutex_unlock(&gLock);
+	return tCounters = counters;
+}
@@ -0,0 +1,70 @@
+/*
+    stats.h - per-phase counters and timers, for lsmac --stats
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Each phase of listing an entry (reading the directory, stat, Finder
+    info, fork sizes, ...) is bracketed with StatsBegin and StatsEnd,
+    which count the calls and add up the monotonic clock time in a table
+    of the calling thread's own, so nothing is shared or locked.
+
+    Off, which is the default, StatsBegin and StatsEnd are a test of one
+    global each and the clock is never read, so they stay compiled in.
+    Times are summed over all the threads.  Phases don't nest, except
+    that making up rows takes in writing them out whenever the output
+    buffer fills.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+enum
+{
+	STATS_READDIR,			/* refilling the directory buffer, getdents64 or readdir */
+	STATS_STAT,				/* statx, fstatat, or hfsdata's catalog lookup */
+	STATS_MAKEREF,			/* path to FSRef, on the Mac */
+	STATS_FINDERINFO,		/* the File Manager or the FinderInfo xattr */
+	STATS_FORKSIZES,		/* the File Manager or the ResourceFork xattr */
+	STATS_INDEX,			/* looking entries up in the -I index */
+	STATS_EXTENTS,			/* FIEMAP, for shared extents in the folder total */
+	STATS_ALIAS,			/* resolving alias files */
+	STATS_FORMAT,			/* making up the rows */
+	STATS_WRITE,			/* writing them out */
+	STATS_NUM_PHASES
+};
+
+#define		STATS_OFF		0
+#define		STATS_TEXT		1			/* --stats */
+#define		STATS_JSON		2			/* --stats=json */
+#define		STATS_TRACE		4			/* --trace, which takes the same clock readings */
+
+extern int	gStatsMode;
+
+#define		StatsBegin()				(gStatsMode ? StatsNow() : 0)
+#define		StatsEnd(phase, start)		do { if (gStatsMode) StatsAdd((phase), (start)); } while (0)
+#define		StatsItem()					do { if (gStatsMode) StatsAddItem(); } while (0)
+
+void     StatsInit (int mode);
+uint64_t StatsNow (void);
+void     StatsAdd (int phase, uint64_t start);
+void     StatsAddItem (void);
+void     StatsPrint (void);
+
+#endif /* STATS_H */
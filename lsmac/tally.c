@@ -0,0 +1,204 @@
+/*
+    tally.c - counts and byte totals by key, for lsmac --summary
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <pthread.h>
+
+#include "tally.h"
+
+#define		INITIAL_SLOTS		64		/* a power of two */
+
+typedef struct Slot
+{
+	TallyEntry	entry;
+	int			used;
+} Slot;
+
+/* one thread's table for one group */
+typedef struct Table
+{
+	Slot			*slots;
+	uint32_t		numSlots;
+	uint32_t		numUsed;
+	struct Table	*next;			/* the group's tables, from every thread */
+} Table;
+
+static Table  *NewTable (int group);
+static Slot   *FindSlot (Table *table, uint32_t key);
+static void    Grow (Table *table);
+static int     CompareEntries (const void *a, const void *b);
+static void   *AllocOrDie (void *p);
+
+static pthread_mutex_t		gLock = PTHREAD_MUTEX_INITIALIZER;
+static Table				*gTables[TALLY_MAX_GROUPS];
+static __thread Table		*tTables[TALLY_MAX_GROUPS];
+
+/*//////////////////////////////////////
+// Count one more entry of bytes bytes
+// under key in group
+/////////////////////////////////////*/
+void TallyAdd (int group, uint32_t key, uint64_t bytes)
+{
+	Table	*table = tTables[group];
+	Slot	*slot;
+
+	if (!table)
+		table = tTables[group] = NewTable(group);
+
+	slot = FindSlot(table, key);
+	if (!slot->used)
+	{
+		if ((table->numUsed + 1) * 4 > table->numSlots * 3)
+		{
+			Grow(table);
+			slot = FindSlot(table, key);
+		}
+		slot->used = 1;
+		slot->entry.key = key;
+		table->numUsed++;
+	}
+	slot->entry.count++;
+	slot->entry.bytes += bytes;
+}
+
+/*//////////////////////////////////////
+// Merge every thread's table for group,
+// once nothing is added any more.  Hands
+// back the totals, most bytes first, to be
+// freed by the caller; returns how many
+/////////////////////////////////////*/
+long TallyCollect (int group, TallyEntry **entries)
+{
+	Table		*merged, *table, *next;
+	Slot		*slot;
+	TallyEntry	*all;
+	long		count = 0;
+	uint32_t	i;
+
+	merged = NewTable(-1);
+	for (table = gTables[group]; table; table = next)
+	{
+		next = table->next;
+		for (i = 0; i < table->numSlots; i++)
+		{
+			if (!table->slots[i].used)
+				continue;
+			slot = FindSlot(merged, table->slots[i].entry.key);
+			if (!slot->used)
+			{
+				if ((merged->numUsed + 1) * 4 > merged->numSlots * 3)
+				{
+					Grow(merged);
+					slot = FindSlot(merged, table->slots[i].entry.key);
+				}
+				slot->used = 1;
+				slot->entry.key = table->slots[i].entry.key;
+				merged->numUsed++;
+			}
+			slot->entry.count += table->slots[i].entry.count;
+			slot->entry.bytes += table->slots[i].entry.bytes;
+		}
+		free(table->slots);
+		free(table);
+	}
+	gTables[group] = NULL;
+	tTables[group] = NULL;
+
+	all = AllocOrDie(malloc((merged->numUsed + 1) * sizeof(TallyEntry)));
+	for (i = 0; i < merged->numSlots; i++)
+		if (merged->slots[i].used)
+			all[count++] = merged->slots[i].entry;
+	free(merged->slots);
+	free(merged);
+
+	qsort(all, count, sizeof(TallyEntry), CompareEntries);
+	*entries = all;
+	return count;
+}
+
+#pragma mark -
+
+/* group -1 is a table of no thread's, for merging */
+static Table *NewTable (int group)
+{
+	Table	*table = AllocOrDie(calloc(1, sizeof(Table)));
+
+	table->numSlots = INITIAL_SLOTS;
+	table->slots = AllocOrDie(calloc(table->numSlots, sizeof(Slot)));
+
+	if (group >= 0)
+	{
+		pthread_mutex_lock(&gLock);
+		table->next = gTables[group];
+		gTables[group] = table;
+		pthread_mutex_unlock(&gLock);
+	}
+	return table;
+}
+
+/* the key's slot, or the empty one it would go in; OSTypes are
+   mostly letters, so mix the bytes before masking */
+static Slot *FindSlot (Table *table, uint32_t key)
+{
+	uint32_t	mask = table->numSlots - 1;
+	uint32_t	i = (key * 2654435761u) >> 7;
+
+	for (i &= mask; table->slots[i].used; i = (i + 1) & mask)
+		if (table->slots[i].entry.key == key)
+			break;
+	return &table->slots[i];
+}
+
+static void Grow (Table *table)
+{
+	Slot		*old = table->slots;
+	uint32_t	oldNumSlots = table->numSlots;
+	uint32_t	i;
+
+	table->numSlots *= 2;
+	table->slots = AllocOrDie(calloc(table->numSlots, sizeof(Slot)));
+	for (i = 0; i < oldNumSlots; i++)
+		if (old[i].used)
+			*FindSlot(table, old[i].entry.key) = old[i];
+	free(old);
+}
+
+static int CompareEntries (const void *a, const void *b)
+{
+	const TallyEntry	*x = a;
+	const TallyEntry	*y = b;
+
+	if (x->bytes != y->bytes)
+		return (x->bytes > y->bytes) ? -1 : 1;
+	if (x->count != y->count)
+		return (x->count > y->count) ? -1 : 1;
+	return (x->key < y->key) ? -1 : (x->key > y->key);
+}
+
+static void *AllocOrDie (void *p)
+{
+	if (!p)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	return p;
+}
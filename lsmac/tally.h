@@ -0,0 +1,45 @@
+/*
+    tally.h - counts and byte totals by key, for lsmac --summary
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Each thread adds into its own small open addressed tables, one per
+    group (label, type, ...), keyed by a 32 bit value such as an OSType,
+    so adding takes no locks.  TallyCollect merges a group's tables once
+    the threads are done.  Memory goes with the number of distinct keys,
+    not the number of entries.
+*/
+
+#ifndef TALLY_H
+#define TALLY_H
+
+#include <stdint.h>
+
+#define		TALLY_MAX_GROUPS		8
+
+typedef struct TallyEntry
+{
+	uint32_t	key;
+	uint64_t	count;
+	uint64_t	bytes;
+} TallyEntry;
+
+void TallyAdd (int group, uint32_t key, uint64_t bytes);
+long TallyCollect (int group, TallyEntry **entries);
+
+#endif /* TALLY_H */
@@ -0,0 +1,310 @@
+/*
+    trace.c - Chrome trace-event spans, for lsmac --trace
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sysexits.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "stats.h"
+
+#define		INITIAL_SPANS		1024
+#define		MAX_SUMS			8			/* kinds of call summed at once */
+
+typedef struct Span
+{
+	const char		*name;			/* static */
+	char			*path;			/* malloc'd, or NULL */
+	char			*args;			/* malloc'd JSON object, or NULL */
+	uint64_t		start;
+	uint64_t		end;
+} Span;
+
+/* calls summed since the thread's last span */
+typedef struct Sum
+{
+	const char		*name;			/* static */
+	uint64_t		calls;
+	uint64_t		nanos;
+} Sum;
+
+/* one per thread that recorded something */
+typedef struct Ring
+{
+	Span			*spans;
+	long			numSpans;		/* room for */
+	uint64_t		numAdded;		/* ever; past numSpans, the oldest are gone */
+	Sum				sums[MAX_SUMS];
+	int				numSums;
+	uint64_t		sumStart;		/* of the first of them */
+	int				tid;
+	int				isMain;
+	struct Ring		*next;
+} Ring;
+
+static Ring  *GetRing (void);
+static void   AddSpan (Ring *ring, const char *name, const char *path, uint64_t start, uint64_t end, char *args);
+static void   FlushSums (Ring *ring);
+static void   WriteJSONString (FILE *f, const char *s);
+static void  *AllocOrDie (void *p);
+
+int							gTracing = 0;
+static FILE					*gFile;
+static char					*gPath;
+static uint64_t				gOrigin;
+static pthread_t			gMainThread;
+
+static pthread_mutex_t		gLock = PTHREAD_MUTEX_INITIALIZER;
+static Ring					*gRings;		/* every thread's */
+static int					gNumRings;
+static __thread Ring		*tRing;
+
+/*//////////////////////////////////////
+// Start tracing into the file at path,
+// created now so a bad path shows up
+// before the run rather than after it.
+// Returns -1 and errno on error
+/////////////////////////////////////*/
+int TraceOpen (const char *path)
+{
+	if (!(gFile = fopen(path, "w")))
+		return -1;
+	gPath = strdup(path);
+	gMainThread = pthread_self();
+	StatsInit(STATS_TRACE);
+	gOrigin = StatsNow();
+	gTracing = 1;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Record a span from start until now.
+// path, if any, is copied and names the
+// span, with name as its category; use
+// TraceEnd, which checks we're tracing
+/////////////////////////////////////*/
+void TraceSpan (const char *name, const char *path, uint64_t start)
+{
+	Ring	*ring = GetRing();
+
+	FlushSums(ring);
+	AddSpan(ring, name, path, start, StatsNow(), NULL);
+}
+
+/*//////////////////////////////////////
+// Add a call from start until now to the
+// thread's sum for name.  Calls made for
+// every file are summed this way rather
+// than given a span each, and the sums go
+// out as one span before the thread's
+// next one, the end of its directory
+/////////////////////////////////////*/
+void TraceSum (const char *name, uint64_t start)
+{
+	Ring		*ring = GetRing();
+	uint64_t	now = StatsNow();
+	int			i;
+
+	for (i = 0; i < ring->numSums && ring->sums[i].name != name; i++)
+		;
+	if (i == MAX_SUMS)
+	{
+		AddSpan(ring, name, NULL, start, now, NULL);
+		return;
+	}
+	if (i == ring->numSums)
+	{
+		if (!ring->numSums)
+			ring->sumStart = start;
+		ring->sums[i].name = name;
+		ring->sums[i].calls = 0;
+		ring->sums[i].nanos = 0;
+		ring->numSums++;
+	}
+	ring->sums[i].calls++;
+	ring->sums[i].nanos += now - start;
+}
+
+/*//////////////////////////////////////
+// Write out every thread's spans and
+// close the file
+/////////////////////////////////////*/
+void TraceWrite (void)
+{
+	Ring		*ring;
+	Span		*span;
+	long		i, n;
+	int			pid = (int)getpid();
+
+	if (!gTracing)
+		return;
+	gTracing = 0;
+
+	fprintf(gFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(gFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"lsmac\"}}", pid);
+
+	pthread_mutex_lock(&gLock);
+	for (ring = gRings; ring; ring = ring->next)
+	{
+		FlushSums(ring);
+		fprintf(gFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"",
+				pid, ring->tid);
+		if (ring->isMain)
+			fprintf(gFile, "main");
+		else
+			fprintf(gFile, "thread %d", ring->tid);
+		if (ring->numAdded > (uint64_t)ring->numSpans)
+			fprintf(gFile, ", %llu oldest spans dropped",
+					(unsigned long long)(ring->numAdded - ring->numSpans));
+		fprintf(gFile, "\"}}");
+
+		n = (ring->numAdded < (uint64_t)ring->numSpans) ? (long)ring->numAdded : ring->numSpans;
+		for (i = 0; i < n; i++)
+		{
+			span = &ring->spans[i];
+			fprintf(gFile, ",\n{\"name\":");
+			WriteJSONString(gFile, span->path ? span->path : span->name);
+			fprintf(gFile, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+					span->name, (span->start - gOrigin) / 1e3, (span->end - span->start) / 1e3,
+					pid, ring->tid);
+			if (span->args)
+				fprintf(gFile, ",\"args\":%s", span->args);
+			putc('}', gFile);
+		}
+	}
+	pthread_mutex_unlock(&gLock);
+
+	fprintf(gFile, "\n]}\n");
+	if (fclose(gFile) == EOF)
+		perror(gPath);
+	gFile = NULL;
+}
+
+#pragma mark -
+
+/* a span into the ring, args handed over */
+static void AddSpan (Ring *ring, const char *name, const char *path, uint64_t start, uint64_t end, char *args)
+{
+	Span	*span;
+
+	if (ring->numAdded == (uint64_t)ring->numSpans && ring->numSpans < TRACE_MAX_SPANS)
+	{
+		ring->numSpans *= 2;
+		ring->spans = AllocOrDie(realloc(ring->spans, ring->numSpans * sizeof(Span)));
+	}
+
+	span = &ring->spans[ring->numAdded++ % ring->numSpans];
+	if (ring->numAdded > (uint64_t)ring->numSpans)
+	{
+		/* overwriting the oldest */
+		free(span->path);
+		free(span->args);
+	}
+
+	span->name = name;
+	span->path = path ? AllocOrDie(strdup(path)) : NULL;
+	span->args = args;
+	span->start = start;
+	span->end = end;
+}
+
+/*//////////////////////////////////////
+// The calls summed since the last span,
+// as a "files" span from the first of
+// them as long as they took together,
+// with each kind's calls and time in its
+// args
+/////////////////////////////////////*/
+static void FlushSums (Ring *ring)
+{
+	char		args[MAX_SUMS * 64 + 2];
+	uint64_t	nanos = 0;
+	size_t		len = 0;
+	int			i;
+
+	if (!ring->numSums)
+		return;
+
+	args[len++] = '{';
+	for (i = 0; i < ring->numSums; i++)
+	{
+		len += snprintf(args + len, sizeof(args) - len, "%s\"%s\":{\"calls\":%llu,\"ms\":%.3f}",
+						i ? "," : "", ring->sums[i].name, (unsigned long long)ring->sums[i].calls,
+						ring->sums[i].nanos / 1e6);
+		nanos += ring->sums[i].nanos;
+	}
+	snprintf(args + len, sizeof(args) - len, "}");
+
+	ring->numSums = 0;
+	AddSpan(ring, "files", NULL, ring->sumStart, ring->sumStart + nanos, AllocOrDie(strdup(args)));
+}
+
+/* this thread's, registered the first time */
+static Ring *GetRing (void)
+{
+	Ring	*ring = tRing;
+
+	if (ring)
+		return ring;
+
+	ring = AllocOrDie(calloc(1, sizeof(Ring)));
+	ring->numSpans = INITIAL_SPANS;
+	ring->spans = AllocOrDie(malloc(ring->numSpans * sizeof(Span)));
+	ring->isMain = pthread_equal(pthread_self(), gMainThread);
+
+	pthread_mutex_lock(&gLock);
+	ring->tid = ++gNumRings;
+	ring->next = gRings;
+	gRings = ring;
+	pthread_mutex_unlock(&gLock);
+	return tRing = ring;
+}
+
+static void WriteJSONString (FILE *f, const char *s)
+{
+	unsigned char	c;
+
+	putc('"', f);
+	for (; (c = *s); s++)
+	{
+		if (c == '"' || c == '\\')
+		{
+			putc('\\', f);
+			putc(c, f);
+		}
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			putc(c, f);
+	}
+	putc('"', f);
+}
+
+static void *AllocOrDie (void *p)
+{
+	if (!p)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	return p;
+}
@@ -0,0 +1,54 @@
+/*
+    trace.h - Chrome trace-event spans, for lsmac --trace
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    A span is a name, an optional path and its start and end on the
+    StatsNow clock.  Each thread records its spans in a ring buffer of
+    its own, which grows up to TRACE_MAX_SPANS and then overwrites the
+    oldest, so recording takes no locks and memory stays bounded however
+    long the run.  TraceWrite puts every thread's spans in the file as
+    trace-event JSON, which chrome://tracing and Perfetto open; meant
+    for atexit, once the threads are done.
+
+    The phases stats.c times are traced through StatsEnd as well, so
+    TraceEnd is only needed for spans that aren't phases, such as a
+    directory or a wait.  The phases done for every file, Finder info,
+    fork sizes and the like, aren't given a span each, which would fill
+    the ring with them: TraceSum adds them up, and the thread's next span
+    is preceded by a single "files" span with the calls and time of each
+    in its args.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define		TRACE_MAX_SPANS		(1 << 20)		/* per thread */
+
+extern int	gTracing;
+
+#define		TraceEnd(name, path, start)		do { if (gTracing) TraceSpan((name), (path), (start)); } while (0)
+
+int  TraceOpen (const char *path);
+void TraceSpan (const char *name, const char *path, uint64_t start);
+void TraceSum (const char *name, uint64_t start);
+void TraceWrite (void);
+
+#endif /* TRACE_H */
@@ -0,0 +1,520 @@
+/*
+    walk.c - parallel directory tree walker with work stealing
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sysexits.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "walk.h"
+#include "stats.h"
+#include "trace.h"
+
+#define		MAX_WORKERS			256
+#define		IDLE_WAIT_USEC		2000
+#define		OUT_BATCH_BUFFERS	256					/* directories per writev */
+#define		OUT_BATCH_BYTES		(1024 * 1024)
+
+/* a worker's own tasks, bottom for the owner, top for thieves */
+typedef struct WorkDeque
+{
+	pthread_mutex_t		lock;
+	WalkNode			**items;
+	long				head;
+	long				tail;
+	long				capacity;
+} WorkDeque;
+
+static void       PushTask (WorkDeque *deque, WalkNode *node);
+static WalkNode  *PopTask (WorkDeque *deque);
+static WalkNode  *StealTask (WorkDeque *deque);
+static WalkNode  *FindTask (int self);
+static void      *WorkerMain (void *arg);
+static void       FinishTask (WalkNode *node);
+static void       CompleteNode (WalkNode *node);
+static void       PrintInOrder (WalkNode *node);
+static void       QueueOutput (WalkNode *node);
+static void       WriteQueued (void);
+static void      *AllocOrDie (size_t size);
+
+static WorkDeque		*gDeques;
+static int				gNumWorkers;
+static int				gOrdered;
+static WalkProc			gProc;
+static WalkProc			gReduce;
+
+static pthread_mutex_t	gLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	gWorkCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	gDoneCond = PTHREAD_COND_INITIALIZER;
+static long				gPending;		/* tasks queued or running */
+
+static pthread_mutex_t	gOutLock = PTHREAD_MUTEX_INITIALIZER;
+static struct iovec		gOutIov[OUT_BATCH_BUFFERS];	/* finished output not yet written */
+static char				*gOutBufs[OUT_BATCH_BUFFERS];	/* the same, to free when it is */
+static int				gOutNumIov;
+static size_t			gOutBytes;
+
+static __thread int			tWorker = -1;
+static __thread WalkNode	*tCurrent;
+
+/*//////////////////////////////////////
+// Number of threads to use if not told
+/////////////////////////////////////*/
+int WalkDefaultThreads (void)
+{
+	long	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n < 1)
+		n = 1;
+	if (n > MAX_WORKERS)
+		n = MAX_WORKERS;
+	return (int)n;
+}
+
+/*//////////////////////////////////////
+// Walk the tree under rootPath, calling
+// proc once for every directory and, when
+// not ordered, reduce bottom up.
+// Returns -1 if rootPath can't be stat'ed
+/////////////////////////////////////*/
+int WalkTree (const char *rootPath, int numThreads, int ordered, WalkProc proc, WalkProc reduce)
+{
+	pthread_t	threads[MAX_WORKERS];
+	WalkNode	*root;
+	struct stat	st;
+	int			i;
+
+	if (stat(rootPath, &st) == -1)
+	{
+		perror(rootPath);
+		return -1;
+	}
+
+	if (numThreads < 1)
+		numThreads = 1;
+	if (numThreads > MAX_WORKERS)
+		numThreads = MAX_WORKERS;
+
+	gNumWorkers = numThreads;
+	gOrdered = ordered;
+	gProc = proc;
+	gReduce = ordered ? NULL : reduce;
+	gPending = 1;
+
+	gDeques = AllocOrDie(sizeof(WorkDeque) * numThreads);
+	memset(gDeques, 0, sizeof(WorkDeque) * numThreads);
+	for (i = 0; i < numThreads; i++)
+		pthread_mutex_init(&gDeques[i].lock, NULL);
+
+	root = AllocOrDie(sizeof(WalkNode));
+	memset(root, 0, sizeof(WalkNode));
+	root->path = strdup(rootPath);
+	root->dev = st.st_dev;
+	root->ino = st.st_ino;
+	root->pending = 1;
+	PushTask(&gDeques[0], root);
+
+	for (i = 0; i < numThreads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, WorkerMain, (void *)(long)i) != 0)
+		{
+			perror("pthread_create(3)");
+			exit(EX_OSERR);
+		}
+	}
+
+	/* the caller's thread prints while the workers scan */
+	if (ordered)
+	{
+		PrintInOrder(root);
+		WriteQueued();
+	}
+
+	for (i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+
+	/* what's left of the unordered output */
+	if (!ordered)
+		WriteQueued();
+
+	for (i = 0; i < numThreads; i++)
+	{
+		pthread_mutex_destroy(&gDeques[i].lock);
+		free(gDeques[i].items);
+	}
+	free(gDeques);
+	gDeques = NULL;
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Queue a subdirectory of the directory
+// the calling worker is processing
+/////////////////////////////////////*/
+WalkNode *WalkAddChild (const char *name, uint64_t dev, uint64_t ino)
+{
+	WalkNode	*parent = tCurrent;
+	WalkNode	*node;
+	size_t		len;
+
+	if (!parent || tWorker < 0)
+		return NULL;
+
+	node = AllocOrDie(sizeof(WalkNode));
+	memset(node, 0, sizeof(WalkNode));
+
+	len = strlen(parent->path);
+	node->path = AllocOrDie(len + strlen(name) + 2);
+	if (len && parent->path[len - 1] == '/')
+		sprintf(node->path, "%s%s", parent->path, name);
+	else
+		sprintf(node->path, "%s/%s", parent->path, name);
+	node->dev = dev;
+	node->ino = ino;
+	node->depth = parent->depth + 1;
+	node->pending = 1;
+	node->parent = parent;
+
+	/* the printer needs the list of subdirectories */
+	if (gOrdered)
+	{
+		if (parent->lastChild)
+			parent->lastChild->nextSibling = node;
+		else
+			parent->firstChild = node;
+		parent->lastChild = node;
+	}
+
+	pthread_mutex_lock(&gLock);
+	gPending++;
+	parent->pending++;
+	pthread_mutex_unlock(&gLock);
+
+	PushTask(&gDeques[tWorker], node);
+	pthread_cond_signal(&gWorkCond);
+
+	return node;
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Worker thread: run own tasks, steal
+// when out, stop when nothing is pending
+/////////////////////////////////////*/
+static void *WorkerMain (void *arg)
+{
+	int					self = (int)(long)arg;
+	WalkNode			*node;
+	struct timeval		now;
+	struct timespec		until;
+	uint64_t			start;
+
+	tWorker = self;
+
+	for (;;)
+	{
+		node = FindTask(self);
+		if (node)
+		{
+			tCurrent = node;
+			start = StatsBegin();
+			gProc(node);
+			TraceEnd("directory", node->path, start);
+			tCurrent = NULL;
+			FinishTask(node);
+			continue;
+		}
+
+		/* nothing to steal; sleep unless the walk is over */
+		pthread_mutex_lock(&gLock);
+		if (gPending == 0)
+		{
+			pthread_mutex_unlock(&gLock);
+			break;
+		}
+		gettimeofday(&now, NULL);
+		until.tv_sec = now.tv_sec;
+		until.tv_nsec = (now.tv_usec + IDLE_WAIT_USEC) * 1000L;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		start = StatsBegin();
+		pthread_cond_timedwait(&gWorkCond, &gLock, &until);
+		pthread_mutex_unlock(&gLock);
+		TraceEnd("idle", NULL, start);
+	}
+
+	return NULL;
+}
+
+/*//////////////////////////////////////
+// Own deque first, then try every other
+// worker, starting with our neighbour
+/////////////////////////////////////*/
+static WalkNode *FindTask (int self)
+{
+	WalkNode	*node;
+	int			i;
+
+	node = PopTask(&gDeques[self]);
+	if (node)
+		return node;
+
+	for (i = 1; i < gNumWorkers; i++)
+	{
+		node = StealTask(&gDeques[(self + i) % gNumWorkers]);
+		if (node)
+			return node;
+	}
+	return NULL;
+}
+
+/*//////////////////////////////////////
+// Hand a scanned directory's output on
+/////////////////////////////////////*/
+static void FinishTask (WalkNode *node)
+{
+	if (!gOrdered)
+	{
+		/* whole directories at a time, never mixed; written once enough pile up */
+		pthread_mutex_lock(&gOutLock);
+		QueueOutput(node);
+		pthread_mutex_unlock(&gOutLock);
+	}
+
+	pthread_mutex_lock(&gLock);
+	if (gOrdered)
+	{
+		node->done = 1;
+		pthread_cond_broadcast(&gDoneCond);
+	}
+	else
+		CompleteNode(node);
+	gPending--;
+	if (gPending == 0)
+		pthread_cond_broadcast(&gWorkCond);
+	pthread_mutex_unlock(&gLock);
+}
+
+/*//////////////////////////////////////
+// One less thing outstanding for a node;
+// when nothing is left, reduce it into its
+// parent and let it go.  gLock is held.
+/////////////////////////////////////*/
+static void CompleteNode (WalkNode *node)
+{
+	WalkNode	*parent;
+
+	while (node && --node->pending == 0)
+	{
+		parent = node->parent;
+		if (gReduce)
+			gReduce(node);
+		free(node->path);
+		free(node);
+		node = parent;
+	}
+}
+
+/*//////////////////////////////////////
+// Print a directory and then its
+// subdirectories, waiting for each
+// to be scanned.  Frees the nodes.
+/////////////////////////////////////*/
+static void PrintInOrder (WalkNode *node)
+{
+	WalkNode	*child;
+	WalkNode	*next;
+	uint64_t	start;
+
+	pthread_mutex_lock(&gLock);
+	if (!node->done)
+	{
+		/* don't sit on what we have while we wait */
+		pthread_mutex_unlock(&gLock);
+		WriteQueued();
+		start = StatsBegin();
+		pthread_mutex_lock(&gLock);
+		while (!node->done)
+			pthread_cond_wait(&gDoneCond, &gLock);
+		pthread_mutex_unlock(&gLock);
+		TraceEnd("wait", node->path, start);
+	}
+	else
+		pthread_mutex_unlock(&gLock);
+
+	QueueOutput(node);
+
+	for (child = node->firstChild; child; child = next)
+	{
+		next = child->nextSibling;
+		PrintInOrder(child);
+	}
+
+	free(node->path);
+	free(node);
+}
+
+/*//////////////////////////////////////
+// Take over a directory's output, writing
+// out what has piled up once there is
+// enough of it.  Only one thread at a time.
+/////////////////////////////////////*/
+static void QueueOutput (WalkNode *node)
+{
+	if (!node->outLen)
+	{
+		free(node->out);
+		node->out = NULL;
+		return;
+	}
+
+	if (gOutNumIov == OUT_BATCH_BUFFERS)
+		WriteQueued();
+
+	gOutBufs[gOutNumIov] = node->out;
+	gOutIov[gOutNumIov].iov_base = node->out;
+	gOutIov[gOutNumIov].iov_len = node->outLen;
+	gOutNumIov++;
+	gOutBytes += node->outLen;
+	node->out = NULL;
+	node->outLen = 0;
+
+	if (gOutBytes >= OUT_BATCH_BYTES)
+		WriteQueued();
+}
+
+/* one writev for all of it, picking up after short writes */
+static void WriteQueued (void)
+{
+	struct iovec	*iov = gOutIov;
+	int				numIov = gOutNumIov;
+	ssize_t			n;
+	int				i;
+	uint64_t		start = StatsBegin();
+
+	while (numIov)
+	{
+		n = writev(STDOUT_FILENO, iov, numIov);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("writev(2)");
+			exit(EX_IOERR);
+		}
+		while (numIov && (size_t)n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			numIov--;
+		}
+		if (numIov)
+		{
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	StatsEnd(STATS_WRITE, start);
+
+	for (i = 0; i < gOutNumIov; i++)
+		free(gOutBufs[i]);
+	gOutNumIov = 0;
+	gOutBytes = 0;
+}
+
+#pragma mark -
+
+static void PushTask (WorkDeque *deque, WalkNode *node)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->tail == deque->capacity)
+	{
+		/* slide down over stolen slots before growing */
+		if (deque->head > 0)
+		{
+			memmove(deque->items, deque->items + deque->head, (deque->tail - deque->head) * sizeof(WalkNode *));
+			deque->tail -= deque->head;
+			deque->head = 0;
+		}
+		if (deque->tail == deque->capacity)
+		{
+			deque->capacity = deque->capacity ? deque->capacity * 2 : 64;
+			deque->items = realloc(deque->items, deque->capacity * sizeof(WalkNode *));
+			if (!deque->items)
+			{
+				fprintf(stderr, "Out of memory\n");
+				exit(EX_OSERR);
+			}
+		}
+	}
+	deque->items[deque->tail++] = node;
+
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static WalkNode *PopTask (WorkDeque *deque)
+{
+	WalkNode	*node = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail > deque->head)
+		node = deque->items[--deque->tail];
+	if (deque->tail == deque->head)
+		deque->head = deque->tail = 0;
+	pthread_mutex_unlock(&deque->lock);
+
+	return node;
+}
+
+static WalkNode *StealTask (WorkDeque *deque)
+{
+	WalkNode	*node = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail > deque->head)
+		node = deque->items[deque->head++];
+	if (deque->tail == deque->head)
+		deque->head = deque->tail = 0;
+	pthread_mutex_unlock(&deque->lock);
+
+	return node;
+}
+
+static void *AllocOrDie (size_t size)
+{
+	void	*p = malloc(size);
+
+	if (!p)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	return p;
+}
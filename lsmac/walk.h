@@ -0,0 +1,78 @@
+/*
+    walk.h - parallel directory tree walker with work stealing
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Every directory is a task.  Each worker thread keeps its own deque of
+    tasks: subdirectories found while scanning are pushed on the bottom and
+    popped from there again (depth first, good locality), while idle workers
+    steal from the top of somebody else's deque (big subtrees near the root).
+
+    A task's output is captured in its node.  In ordered mode the calling
+    thread prints the nodes in the same depth first order a single threaded
+    walk would have used; otherwise each directory is queued whole as soon
+    as it is done.  Finished directories are gathered up and written
+    to the standard output with writev, a batch at a time.
+
+    Unordered walks can also reduce bottom up: once a directory and all
+    of its subdirectories are done, the reduce proc is called for it (with
+    the walker's lock held, so it may add into node->parent->sum freely),
+    and then for its parent if that was the last one outstanding.  A
+    subdirectory can be reduced while its parent is still being scanned,
+    so the proc keeps its own results in node->data until the reduce
+    rather than adding them into node->sum.
+*/
+
+#ifndef WALK_H
+#define WALK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define		WALK_NUM_SUMS		4
+
+typedef struct WalkNode
+{
+	struct WalkNode		*parent;
+	struct WalkNode		*firstChild;	/* subdirectories, in scan order */
+	struct WalkNode		*lastChild;
+	struct WalkNode		*nextSibling;
+	char				*path;
+	uint64_t			dev;
+	uint64_t			ino;
+	int					depth;
+	int					done;
+	long				pending;		/* itself plus unfinished subdirectories */
+
+	uint64_t			sum[WALK_NUM_SUMS];	/* reduction totals, meaning is up to the caller */
+	void				*data;			/* the caller's, from the proc to the reduce */
+
+	char				*out;			/* output captured for this directory */
+	size_t				outLen;
+} WalkNode;
+
+typedef void (*WalkProc) (WalkNode *node);
+
+#define		WALK_ORDERED		1
+#define		WALK_INTERLEAVED	0
+
+int       WalkTree (const char *rootPath, int numThreads, int ordered, WalkProc proc, WalkProc reduce);
+WalkNode *WalkAddChild (const char *name, uint64_t dev, uint64_t ino);
+int       WalkDefaultThreads (void);
+
+#endif /* WALK_H */
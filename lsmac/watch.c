@@ -0,0 +1,429 @@
+/*
+    watch.c - follow changes to listed directories
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE		/* ppoll */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sysexits.h>
+#include <pthread.h>
+
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+
+#include "scan.h"
+
+#define		WATCH_MASK			(IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+								 IN_CLOSE_WRITE | IN_ONLYDIR)
+#define		EVENT_BUFFER_SIZE	(64 * 1024)
+
+/* an entry that changed during the current burst */
+typedef struct Change
+{
+	int			wd;
+	char		*name;
+} Change;
+
+static int		ReadEvents (int timeout);
+static void		AddChange (int wd, const char *name);
+static void		AddTree (const char *path);
+static void		Flush (WatchProc proc);
+static int		CompareChanges (const void *a, const void *b);
+static char	   *JoinPath (const char *dirPath, const char *name);
+static long		ElapsedMsec (const struct timespec *since);
+static void		Stop (int sig);
+static void    *AllocOrDie (void *p);
+
+static int				gFd = -1;
+static int				gRecursive;
+static int				gOverflow;
+
+static pthread_mutex_t	gLock = PTHREAD_MUTEX_INITIALIZER;	/* directories get added by walker threads */
+static char				**gPaths;		/* by watch descriptor */
+static int				gNumPaths;
+
+static Change			*gChanges;
+static long				gNumChanges;
+static long				gMaxChanges;
+
+static volatile sig_atomic_t	gStop;
+static sigset_t			gWaitMask;		/* SIGINT and SIGTERM are only taken while waiting */
+
+/*//////////////////////////////////////
+// Set up; with recursive, directories
+// created under a watched one are
+// watched too.
+// Returns 0 on success, -1 and errno on error
+/////////////////////////////////////*/
+int WatchInit (int recursive)
+{
+	gRecursive = recursive;
+	gFd = inotify_init1(IN_CLOEXEC);
+	return (gFd == -1) ? -1 : 0;
+}
+
+/*//////////////////////////////////////
+// Watch the entries of a directory.  Do
+// it before listing the directory, so that
+// nothing falls between the two.
+// Returns 0 on success, -1 and errno on error
+/////////////////////////////////////*/
+int WatchAddDirectory (const char *path)
+{
+	int		wd;
+	int		i;
+
+	pthread_mutex_lock(&gLock);
+
+	wd = inotify_add_watch(gFd, path, WATCH_MASK);
+	if (wd == -1)
+	{
+		pthread_mutex_unlock(&gLock);
+		return -1;
+	}
+
+	if (wd >= gNumPaths)
+	{
+		gPaths = AllocOrDie(realloc(gPaths, (wd + 64) * sizeof(char *)));
+		for (i = gNumPaths; i < wd + 64; i++)
+			gPaths[i] = NULL;
+		gNumPaths = wd + 64;
+	}
+
+	/* the same directory again gets the same descriptor */
+	free(gPaths[wd]);
+	gPaths[wd] = AllocOrDie(strdup(path));
+
+	pthread_mutex_unlock(&gLock);
+	return 0;
+}
+
+/*//////////////////////////////////////
+// Wait for changes and report them,
+// a burst at a time, until SIGINT or
+// SIGTERM, so that the atexit handlers
+// still get to run.  Returns 0 then, or
+// -1 if reading the events fails
+/////////////////////////////////////*/
+int WatchRun (WatchProc proc)
+{
+	struct sigaction	action;
+	sigset_t			stopSignals;
+	struct timespec		start;
+	long				elapsed;
+	int					rc;
+
+	sigemptyset(&stopSignals);
+	sigaddset(&stopSignals, SIGINT);
+	sigaddset(&stopSignals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stopSignals, &gWaitMask);
+	sigdelset(&gWaitMask, SIGINT);
+	sigdelset(&gWaitMask, SIGTERM);
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = Stop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	for (;;)
+	{
+		rc = ReadEvents(-1);
+		if (rc == -1)
+			return -1;
+		if (gStop)
+			return 0;
+
+		/* soak up the rest of the burst */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (;;)
+		{
+			elapsed = ElapsedMsec(&start);
+			if (elapsed >= WATCH_MAX_DELAY_MSEC)
+				break;
+			rc = ReadEvents(elapsed + WATCH_SETTLE_MSEC > WATCH_MAX_DELAY_MSEC ?
+							WATCH_MAX_DELAY_MSEC - elapsed : WATCH_SETTLE_MSEC);
+			if (rc == -1)
+				return -1;
+			if (rc == 0 || gStop)
+				break;
+		}
+
+		Flush(proc);
+		if (gStop)
+			return 0;
+	}
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// Wait up to timeout milliseconds (-1 for
+// ever) and take in whatever events there
+// are.  Returns 1 if there were some, 0 on
+// timeout or once we're to stop, -1 on
+// error
+/////////////////////////////////////*/
+static int ReadEvents (int timeout)
+{
+	static char					buf[EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event	*ev;
+	struct pollfd				pfd;
+	struct timespec				ts;
+	char						*path;
+	const char					*dirPath;
+	ssize_t						len;
+	char						*p;
+	int							rc;
+
+	pfd.fd = gFd;
+	pfd.events = POLLIN;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000L;
+	do
+		rc = gStop ? 0 : ppoll(&pfd, 1, (timeout < 0) ? NULL : &ts, &gWaitMask);
+	while (rc == -1 && errno == EINTR);
+	if (rc <= 0)
+		return rc;
+
+	len = read(gFd, buf, sizeof(buf));
+	if (len == -1)
+		return (errno == EINTR || errno == EAGAIN) ? 1 : -1;
+
+	for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+	{
+		ev = (const struct inotify_event *)p;
+
+		if (ev->mask & IN_Q_OVERFLOW)
+		{
+			gOverflow = 1;
+			continue;
+		}
+
+		pthread_mutex_lock(&gLock);
+		dirPath = (ev->wd >= 0 && ev->wd < gNumPaths) ? gPaths[ev->wd] : NULL;
+		if (ev->mask & IN_IGNORED)
+		{
+			/* the directory is gone, its parent reports that */
+			if (dirPath)
+			{
+				free(gPaths[ev->wd]);
+				gPaths[ev->wd] = NULL;
+			}
+			dirPath = NULL;
+		}
+		pthread_mutex_unlock(&gLock);
+
+		/* events about the directory itself are reported by its parent */
+		if (!dirPath || !ev->len)
+			continue;
+
+		AddChange(ev->wd, ev->name);
+
+		if (gRecursive && (ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+		{
+			path = JoinPath(dirPath, ev->name);
+			AddTree(path);
+			free(path);
+		}
+	}
+
+	return 1;
+}
+
+static void AddChange (int wd, const char *name)
+{
+	if (gNumChanges == gMaxChanges)
+	{
+		gMaxChanges = gMaxChanges ? gMaxChanges * 2 : 256;
+		gChanges = AllocOrDie(realloc(gChanges, gMaxChanges * sizeof(Change)));
+	}
+	gChanges[gNumChanges].wd = wd;
+	gChanges[gNumChanges].name = AllocOrDie(strdup(name));
+	gNumChanges++;
+}
+
+/*//////////////////////////////////////
+// Watch a directory that just turned up,
+// and everything below it
+/////////////////////////////////////*/
+static void AddTree (const char *path)
+{
+	DirScan		scan;
+	ScanEntry	entry;
+	struct stat	st;
+	char		*subPath;
+	int			isDir;
+
+	if (WatchAddDirectory(path) == -1)
+		return;
+
+	if (ScanOpenDir(&scan, AT_FDCWD, path) == -1)
+		return;
+
+	while (ScanNextEntry(&scan, &entry) == 1)
+	{
+		if (entry.name[0] == '.' && (!entry.name[1] || (entry.name[1] == '.' && !entry.name[2])))
+			continue;
+
+		if (entry.type == DT_UNKNOWN)
+			isDir = (ScanStatAt(scan.fd, entry.name, &st) == 0 && S_ISDIR(st.st_mode));
+		else
+			isDir = (entry.type == DT_DIR);
+		if (!isDir)
+			continue;
+
+		subPath = JoinPath(path, entry.name);
+		AddTree(subPath);
+		free(subPath);
+	}
+
+	ScanCloseDir(&scan);
+}
+
+/*//////////////////////////////////////
+// Hand the burst over: each changed entry
+// once, a directory at a time
+/////////////////////////////////////*/
+static void Flush (WatchProc proc)
+{
+	char	**names;
+	int		numNames;
+	long	i, j;
+	int		wd;
+
+	if (gOverflow)
+	{
+		/* events were lost, so look at everything again */
+		for (wd = 0; wd < gNumPaths; wd++)
+			if (gPaths[wd])
+				proc(gPaths[wd], NULL, 0);
+		gOverflow = 0;
+		for (i = 0; i < gNumChanges; i++)
+			free(gChanges[i].name);
+		gNumChanges = 0;
+		return;
+	}
+
+	qsort(gChanges, gNumChanges, sizeof(Change), CompareChanges);
+
+	names = AllocOrDie(malloc((gNumChanges + 1) * sizeof(char *)));
+
+	for (i = 0; i < gNumChanges; i = j)
+	{
+		wd = gChanges[i].wd;
+		numNames = 0;
+		for (j = i; j < gNumChanges && gChanges[j].wd == wd; j++)
+		{
+			/* one line per entry, however many events it had */
+			if (numNames && !strcmp(names[numNames - 1], gChanges[j].name))
+				continue;
+			names[numNames++] = gChanges[j].name;
+		}
+		if (wd < gNumPaths && gPaths[wd])
+			proc(gPaths[wd], names, numNames);
+	}
+
+	for (i = 0; i < gNumChanges; i++)
+		free(gChanges[i].name);
+	gNumChanges = 0;
+	free(names);
+}
+
+static int CompareChanges (const void *a, const void *b)
+{
+	const Change	*x = a;
+	const Change	*y = b;
+
+	if (x->wd != y->wd)
+		return (x->wd < y->wd) ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+static char *JoinPath (const char *dirPath, const char *name)
+{
+	size_t	len = strlen(dirPath);
+	char	*path = AllocOrDie(malloc(len + strlen(name) + 2));
+
+	if (len && dirPath[len - 1] == '/')
+		sprintf(path, "%s%s", dirPath, name);
+	else
+		sprintf(path, "%s/%s", dirPath, name);
+	return path;
+}
+
+static long ElapsedMsec (const struct timespec *since)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+/* SIGINT or SIGTERM: finish the burst and return */
+static void Stop (int sig)
+{
+	gStop = 1;
+}
+
+static void *AllocOrDie (void *p)
+{
+	if (!p)
+	{
+		fprintf(stderr, "Out of memory\n");
+		exit(EX_OSERR);
+	}
+	return p;
+}
+
+#else /* !__linux__ */
+
+/* no inotify here */
+
+int WatchInit (int recursive)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int WatchAddDirectory (const char *path)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int WatchRun (WatchProc proc)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+    watch.h - follow changes to listed directories
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/*
+    Directories are watched with inotify.  IN_ATTRIB covers extended
+    attribute changes, so labels, Finder flags and types show up as well
+    as new, written, renamed and deleted entries.
+
+    Events are not handed on one by one.  After the first event of a
+    burst we keep reading until the directories have been quiet for a
+    little while (or a limit is reached), then report each changed entry
+    once, grouped by directory.  If the kernel's event queue overflowed,
+    every watched directory is reported whole.
+*/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#define		WATCH_SETTLE_MSEC		50		/* quiet time that ends a burst */
+#define		WATCH_MAX_DELAY_MSEC	500		/* longest we sit on an event */
+
+/* names is NULL when the whole directory should be looked at again;
+   entries that were deleted are reported too */
+typedef void (*WatchProc) (const char *dirPath, char **names, int numNames);
+
+int  WatchInit (int recursive);
+int  WatchAddDirectory (const char *path);
+int  WatchRun (WatchProc proc);
+
+#endif /* WATCH_H */
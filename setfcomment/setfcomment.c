@@ -21,6 +21,10 @@
     
 /*  CHANGES
     
+	0.3 - Mac OS X comments written straight to the kMDItemFinderComment extended
+	      attribute, so the Finder needn't be running, and on other systems too;
+	      -F sends the Finder an Apple Event as before.  Comments up to 16K.
+	      --stdin sets "path<TAB>comment" lines from stdin with a thread per processor
 	0.2 - New "Silent Mode" flag, exit values from sysexit.h, errors go to stderr
     0.1 - First release of setfcomment
 
@@ -40,40 +44,65 @@
     h - help - usage
     c [str] - comment string passed as parameter
     n - don't set MacOS 9 comment
+    F - set the comment by Apple Event to the Finder instead of the extended attribute
+    --stdin - read "path<TAB>comment" lines from stdin
     
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#ifdef __APPLE__
 #include <Carbon/Carbon.h>
+#endif
 #include <string.h>
 #include <sysexits.h>
 
+#include "../getfcomment/fcomment.h"
+
 ///////////////  Definitions    //////////////
 
-#define		MAX_COMMENT_LENGTH	200
+#define		MAX_COMMENT_LENGTH	200		// what the Finder takes, -F
+#define		BATCH_WINDOW		4096	// lines read ahead of the workers, --stdin
+#define		OPT_STDIN			256		// long options only
 #define		PROGRAM_STRING  	"setfcomment"
-#define		VERSION_STRING		"0.2"
+#define		VERSION_STRING		"0.3"
 #define		AUTHOR_STRING 		"Sveinbjorn Thordarson"
 
 
+#ifdef __APPLE__
 // Some MoreAppleEvents voodoo
 #define MoreAssert(x) (true)
 #define MoreAssertQ(x)
+#else
+#define		true		1
+#define		false		0
+#endif
 
 
 /////////////// Prototypes  /////////////////
 
     // my stuff
 
-    static char *GetCommentParameter (char *arg);
-    static void SetFileComment (char *path, char *comment);
-    static OSErr OSX_SetComment (FSRef *fileRef, FSSpec *fileSpec, char *comment);
-    static OSErr OS9_SetComment (FSSpec *fileSpec, char *comment, bool *unsupported);
+    static int CheckComment (char *comment);
+    static size_t MaxCommentLength (void);
+    static int SetFileComment (char *path, char *comment);
+    static int SetXattrComment (char *path, char *comment);
+    static int RunBatch (void);
+    static void *BatchWorker (void *arg);
+    static char *Unescape (char *s);
     static void PrintVersion (void);
     static void PrintHelp (void);
+
+#ifdef __APPLE__
+    static int SetCarbonComment (char *path, char *comment);
+    static OSErr OSX_SetComment (FSRef *fileRef, FSSpec *fileSpec, char *comment);
+    static OSErr OS9_SetComment (FSSpec *fileSpec, char *comment, bool *unsupported);
     
     // the stuff I ripped from MoreAppleEvents sample code
 
@@ -85,25 +114,56 @@
     pascal OSErr MoreAEGetHandlerError(const AppleEvent* pAEReply);
     pascal void MoreAEDisposeDesc(AEDesc* desc);
     pascal void MoreAENullDesc(AEDesc* desc);
+#endif
     
     
 /////////////// Globals  /////////////////
 
+#ifdef __APPLE__
 static const OSType 	gFinderSignature 	= 'MACS';
 static short			setOS9comment 		= 1;
+static short			askFinder			= 0;
+#else
+static short			setOS9comment 		= 0;
+static short			askFinder			= 0;
+#endif
 static short			silentMode			= 0;
 
+static struct option	longOptions[] =
+{
+	{ "stdin",	no_argument,	NULL,	OPT_STDIN },
+	{ NULL,		0,				NULL,	0 }
+};
+
+/* --stdin: a window of lines read ahead, each set by whichever worker
+   takes it; the order they're set in doesn't matter */
+static char				*batch[BATCH_WINDOW];
+static unsigned long	batchRead, batchWork;		// lines read, taken by a worker
+static int				batchEOF = false;
+static int				batchStatus = EX_OK;
+static pthread_mutex_t	batchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	batchWorkCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	batchRoomCond = PTHREAD_COND_INITIALIZER;
+
 int main (int argc, const char * argv[]) 
 {
-    int			rc;
     int			optch;
-    static char	optstring[] = "vhsnc:";
+    int			useStdin = false;
+    int			status = EX_OK;
+#ifdef __APPLE__
+    static char	optstring[] = "vhsnFc:";
+#else
+    static char	optstring[] = "vhsc:";
+#endif
     char		*comment = NULL;
 
-    while ( (optch = getopt(argc, (char * const *)argv, optstring)) != -1)
+    while ( (optch = getopt_long(argc, (char * const *)argv, optstring, longOptions, NULL)) != -1)
     {
         switch(optch)
         {
+            case OPT_STDIN:
+                useStdin = true;
+                break;
             case 'v':
                 PrintVersion();
                 return EX_OK;
@@ -116,13 +176,17 @@ int main (int argc, const char * argv[])
 				silentMode = 1;
 				break;
             case 'c':
-                comment = GetCommentParameter(optarg);
+                comment = optarg;
                 break;
+#ifdef __APPLE__
             case 'n':
                 setOS9comment = 0;
                 break;
+            case 'F':
+                askFinder = 1;
+                break;
+#endif
             default: // '?'
-                rc = 1;
                 PrintHelp();
                 return EX_USAGE;
         }
@@ -131,17 +195,35 @@ int main (int argc, const char * argv[])
     setOS9comment = 0;
 #endif
     
+    // comments and paths on stdin, or the one comment for the files passed as arguments
+    if (useStdin)
+    {
+        if (comment != NULL || optind != argc)
+        {
+            fprintf(stderr, "Invalid usage: --stdin takes neither -c nor files.\n");
+            return EX_USAGE;
+        }
+        return RunBatch();
+    }
+
     if (comment == NULL)
     {
         fprintf(stderr, "Invalid usage: You must specify the comment to set using the -c option.\n");
         return(EX_USAGE);
     }
+    if (CheckComment(comment) == -1)
+    {
+        fprintf(stderr, "Invalid parameter: %s\n", comment);
+        fprintf(stderr, "Max comment length is %lu characters\n", (unsigned long)MaxCommentLength());
+        exit(EX_DATAERR);
+    }
 
     //all remaining arguments should be files
     for (; optind < argc; ++optind)
-        SetFileComment((char *)argv[optind], comment);
+        if (SetFileComment((char *)argv[optind], comment) == -1)
+            status = EX_IOERR;
 
-    return EX_OK;
+    return status;
 }
 
 
@@ -151,28 +233,240 @@ int main (int argc, const char * argv[])
 #pragma mark -
 
 ///////////////////////////////////////////////////////////////////
-// Check out the string passed as parameter with the -c option
-// Make sure it's within reasonable bounds etc.
+// Make sure the comment is within reasonable bounds.  Returns -1
+// if it's too long; the caller says so.
 ///////////////////////////////////////////////////////////////////
-static char *GetCommentParameter (char *arg)
+static int CheckComment (char *comment)
 {
-    static char 	comment[200];
-    
-    if (strlen(arg) > MAX_COMMENT_LENGTH)
+    return (strlen(comment) > MaxCommentLength()) ? -1 : 0;
+}
+
+// the Finder takes a Pascal string, the extended attribute takes more
+static size_t MaxCommentLength (void)
+{
+    return askFinder ? MAX_COMMENT_LENGTH : FC_MAX_COMMENT;
+}
+
+///////////////////////////////////////////////////////////////////
+// Set the file Finder comment, by extended attribute unless the
+// Finder or the Desktop Database must be asked.  Returns -1 if it
+// couldn't be set.
+///////////////////////////////////////////////////////////////////
+static int SetFileComment (char *path, char *comment)
+{
+#ifdef __APPLE__
+    if (askFinder || setOS9comment)
+        return SetCarbonComment(path, comment);
+#endif
+    return SetXattrComment(path, comment);
+}
+
+/*//////////////////////////////////////
+// Write the comment into the file's
+// kMDItemFinderComment attribute, where
+// Spotlight and getfcomment read it.  An
+// empty comment removes the attribute
+/////////////////////////////////////*/
+static int SetXattrComment (char *path, char *comment)
+{
+    int		fd;
+    int		err;
+
+    // O_NONBLOCK, so a FIFO doesn't wait for a writer
+    fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd == -1)
     {
-        fprintf(stderr, "Invalid parameter: %s\n", arg);
-        fprintf(stderr, "Max comment length is 200 characters\n");
-        exit(EX_DATAERR);
+        perror(path);
+        return -1;
+    }
+    if (FCSetComment(fd, comment) == -1)
+    {
+        err = errno;
+        close(fd);
+        if (err == EINVAL)
+            fprintf(stderr, "%s: Comment isn't valid UTF-8\n", path);
+        else
+            fprintf(stderr, "%s: %s\n", path, strerror(err));
+        return -1;
     }
-    strcpy((char *)&comment, arg);
-    return((char *)&comment);
+    close(fd);
+
+    if (!silentMode)
+        printf("Finder Comment set for %s\n", path);
+    return 0;
+}
+
+#pragma mark -
+
+/*//////////////////////////////////////
+// --stdin: read "path<TAB>comment" lines
+// from stdin and hand them to a thread
+// per processor to set.  Returns the exit
+// status, EX_DATAERR if any line was bad,
+// else EX_IOERR if any comment wasn't set
+/////////////////////////////////////*/
+static int RunBatch (void)
+{
+	pthread_t	*threads;
+	long		numThreads, i;
+	char		*buf = NULL;
+	char		*line;
+	size_t		bufSize = 0;
+	ssize_t		len;
+
+	numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads < 1)
+		numThreads = 1;
+	
+	// the Finder and the Desktop Database take one at a time
+	if (askFinder || setOS9comment)
+		numThreads = 1;
+
+	threads = malloc(numThreads * sizeof(pthread_t));
+	if (!threads)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return EX_OSERR;
+	}
+	for (i = 0; i < numThreads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, BatchWorker, NULL) != 0)
+		{
+			fprintf(stderr, "pthread_create(): Error creating worker thread\n");
+			exit(EX_OSERR);
+		}
+	}
+
+	while ((len = getline(&buf, &bufSize, stdin)) != -1)
+	{
+		if (len && buf[len - 1] == '\n')
+			buf[--len] = '\0';
+		if (!len)
+			continue;
+		line = strdup(buf);
+		if (!line)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(EX_OSERR);
+		}
+
+		pthread_mutex_lock(&batchLock);
+		while (batchRead - batchWork == BATCH_WINDOW)
+			pthread_cond_wait(&batchRoomCond, &batchLock);
+		batch[batchRead++ % BATCH_WINDOW] = line;
+		pthread_cond_signal(&batchWorkCond);
+		pthread_mutex_unlock(&batchLock);
+	}
+	if (ferror(stdin))
+	{
+		perror("stdin");
+		batchStatus = EX_IOERR;
+	}
+
+	pthread_mutex_lock(&batchLock);
+	batchEOF = true;
+	pthread_cond_broadcast(&batchWorkCond);
+	pthread_mutex_unlock(&batchLock);
+
+	for (i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(buf);
+
+	if (fflush(stdout) == EOF)
+	{
+		perror("stdout");
+		return EX_IOERR;
+	}
+	return batchStatus;
+}
+
+/*//////////////////////////////////////
+// Set the comment of each line taken from
+// the window, until stdin runs dry
+/////////////////////////////////////*/
+static void *BatchWorker (void *arg)
+{
+	char	*line, *comment;
+	int		status;
+
+	pthread_mutex_lock(&batchLock);
+	for (;;)
+	{
+		while (batchWork == batchRead && !batchEOF)
+			pthread_cond_wait(&batchWorkCond, &batchLock);
+		if (batchWork == batchRead)
+			break;
+		line = batch[batchWork++ % BATCH_WINDOW];
+		pthread_cond_signal(&batchRoomCond);
+		pthread_mutex_unlock(&batchLock);
+
+		// the path runs up to the first tab, so the comment may hold more
+		status = EX_OK;
+		comment = strchr(line, '\t');
+		if (!comment)
+		{
+			fprintf(stderr, "%s: No tab between path and comment\n", line);
+			status = EX_DATAERR;
+		}
+		else
+		{
+			*comment++ = '\0';
+			Unescape(comment);
+			if (CheckComment(comment) == -1)
+			{
+				fprintf(stderr, "%s: Comment too long, max is %lu characters\n", line, (unsigned long)MaxCommentLength());
+				status = EX_DATAERR;
+			}
+			else if (SetFileComment(line, comment) == -1)
+				status = EX_IOERR;
+		}
+		free(line);
+
+		pthread_mutex_lock(&batchLock);
+		if (status == EX_DATAERR || (status != EX_OK && batchStatus == EX_OK))
+			batchStatus = status;
+	}
+	pthread_mutex_unlock(&batchLock);
+	return NULL;
+}
+
+/*//////////////////////////////////////
+// Turn \n, \t and \\ in a comment into a
+// newline, tab and backslash, in place,
+// since a line can't hold the first two
+/////////////////////////////////////*/
+static char *Unescape (char *s)
+{
+	char	*in, *out;
+
+	for (in = out = s; *in; in++)
+	{
+		if (*in == '\\' && (in[1] == 'n' || in[1] == 't' || in[1] == '\\'))
+		{
+			in++;
+			*out++ = (*in == 'n') ? '\n' : (*in == 't') ? '\t' : '\\';
+		}
+		else
+			*out++ = *in;
+	}
+	*out = '\0';
+	return s;
 }
 
+
+
+
+#ifdef __APPLE__
+
+#pragma mark -
+
 ///////////////////////////////////////////////////////////////////
 // Make sure file exists and we have privileges.  Then set the 
-// file Finder comment.
+// file Finder comment, by Apple Event with -F, and the MacOS 9
+// one if asked.
 ///////////////////////////////////////////////////////////////////
-static void SetFileComment (char *path, char *comment)
+static int SetCarbonComment (char *path, char *comment)
 {
     OSErr	err = noErr;
     FSRef	fileRef;
@@ -184,7 +478,7 @@ static void SetFileComment (char *path, char *comment)
             if (access(path, R_OK|W_OK|F_OK) == -1)
             {
 				perror(path);
-                return;
+                return -1;
             }
             
             //get file reference from path
@@ -192,7 +486,7 @@ static void SetFileComment (char *path, char *comment)
             if (err != noErr)
             {
 				fprintf(stderr, "FSPathMakeRef: Error %d for file %s\n", err, path);
-                return;
+                return -1;
             }
         
             //retrieve filespec from file ref
@@ -200,7 +494,7 @@ static void SetFileComment (char *path, char *comment)
             if (err != noErr)
             {
 				fprintf(stderr, "FSGetCatalogInfo(): Error %d getting file spec for %s\n", err, path);
-                return;
+                return -1;
             }
     
     
@@ -208,20 +502,28 @@ static void SetFileComment (char *path, char *comment)
     
     
             //being by setting MacOS X Finder Comment
-            err = OSX_SetComment (&fileRef, &fileSpec, comment);
-            if (err != noErr)
+            if (!askFinder)
             {
-                fprintf(stderr, "OSX_SetComment(): Error %d setting Finder comment for %s\n", err, path);
-                return;
+                if (SetXattrComment(path, comment) == -1)
+                    return -1;
+            }
+            else
+            {
+                err = OSX_SetComment (&fileRef, &fileSpec, comment);
+                if (err != noErr)
+                {
+                    fprintf(stderr, "OSX_SetComment(): Error %d setting Finder comment for %s\n", err, path);
+                    return -1;
+                }
+                else if (!silentMode)
+                {
+                    printf("Finder Comment set for %s\n", path);
+                }
             }
-            else if (!silentMode)
-			{
-                printf("Finder Comment set for %s\n", path);
-			}
 			
             //check if we're setting OS9 comment.  If not, we bail out here
             if (!setOS9comment)
-                return;
+                return 0;
     
             //set MacOS 9 Comment
             bool unsupported = 0;
@@ -230,18 +532,16 @@ static void SetFileComment (char *path, char *comment)
                 if (err != noErr)
                 {
                     fprintf(stderr, "OS9_SetComment(): Error %d setting MacOS 9 comment for %s\n", err, path);
-                    return;
+                    return -1;
                 }
                 else if (!silentMode)
     			{
                     printf("MacOS 9 Comment set for %s\n", path);
     			}
     		}
+            return 0;
 }
 
-
-
-
 #pragma mark -
 
 
@@ -312,6 +612,9 @@ static OSErr OS9_SetComment (FSSpec *fileSpec, char *comment, bool *unsupported)
 
 
 
+#endif /* __APPLE__ */
+
+
 #pragma mark -
 
 ////////////////////////////////////////
@@ -329,7 +632,13 @@ static void PrintVersion (void)
 
 static void PrintHelp (void)
 {
-    printf("usage: %s [-vhn] [-c comment] [file ...]\n", PROGRAM_STRING);
+#ifdef __APPLE__
+    printf("usage: %s [-vhnsF] [-c comment] [file ...]\n", PROGRAM_STRING);
+    printf("   or: %s [-nsF] --stdin < lines of path<TAB>comment\n", PROGRAM_STRING);
+#else
+    printf("usage: %s [-vhs] [-c comment] [file ...]\n", PROGRAM_STRING);
+    printf("   or: %s [-s] --stdin < lines of path<TAB>comment\n", PROGRAM_STRING);
+#endif
 }
 
 
@@ -344,6 +653,8 @@ static void PrintHelp (void)
 
 
 
+#ifdef __APPLE__
+
 #pragma mark -
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////// The stuff I ripped from MoreAppleEvents sample code //////////////////////
@@ -680,4 +991,5 @@ pascal OSErr MoreAESendEventReturnData(
 
 
 
-*/
\ No newline at end of file
+*/
+#endif /* __APPLE__ */